@@ -143,6 +143,15 @@ typedef struct {
   FILE *outFile_st;
   int auto_lpi_naming;  /* Enable automatic .lpi file naming */
   int force_serial;     /* Force serial processing even for large files */
+  int private_tables;   /* Parallel workers aggregate privately, merge at end */
+  size_t memory_limit;  /* Address table budget in bytes, 0 for no limit */
+  char *temp_dir;       /* Where spill runs go, NULL for $TMPDIR or /tmp */
+  int binary_index;     /* Write the mapped binary index format */
+  int key_order;        /* Text index in address order with a .lpx key directory */
+  int compress_index;   /* -k records compressed in blocks, one gzip member each */
+  char *index_filename; /* Index being written with -w, NULL for stdout */
+  char *catalog_filename; /* Address catalog to update or search, NULL for none */
+  char *merge_filename; /* Index the -M merge writes, NULL when indexing logs */
 } Config_t;
 
 #endif /* end of COMMON_H */
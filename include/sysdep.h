@@ -63,6 +63,10 @@
 # include <memory.h>
 #endif
 
+#ifdef HAVE_MALLOC_H
+# include <malloc.h>
+#endif
+
 #ifdef HAVE_NDIR_H
 # include <ndir.h>
 #endif
@@ -0,0 +1,89 @@
+/*****
+ *
+ * Description: Memory Budget Accounting Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "budget.h"
+#include <string.h>
+
+static budget_t budget;
+
+static const char *budget_names[BUDGET_SUBSYSTEMS] = {
+  "chunks", "tables", "postings", "output", "spilled"
+};
+
+/* Reset the counters and set the limit every subsystem draws from */
+void budget_init(size_t limit) {
+  memset(&budget, 0, sizeof(budget));
+  budget.limit = limit;
+}
+
+size_t budget_limit(void) {
+  return budget.limit;
+}
+
+/* Charge or release bytes against a subsystem */
+void budget_add(int subsystem, int64_t delta) {
+  size_t now = __atomic_add_fetch(&budget.used[subsystem], (size_t)delta, __ATOMIC_RELAXED);
+  size_t peak = __atomic_load_n(&budget.peak[subsystem], __ATOMIC_RELAXED);
+
+  while (now > peak &&
+         !__atomic_compare_exchange_n(&budget.peak[subsystem], &peak, now, TRUE,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+/*
+ * Owners that can only measure their total (tables, slabs) report it
+ * here, only the change since their last report is charged.
+ */
+void budget_publish(int subsystem, size_t *reported, size_t now) {
+  if (now != *reported) {
+    budget_add(subsystem, (int64_t)now - (int64_t)*reported);
+    *reported = now;
+  }
+}
+
+size_t budget_used(int subsystem) {
+  return __atomic_load_n(&budget.used[subsystem], __ATOMIC_RELAXED);
+}
+
+/* One line breakdown, current (peak) MB per subsystem */
+void budget_report(FILE *fp) {
+  size_t total = 0;
+  int i;
+
+  fprintf(fp, "Memory:");
+  for (i = 0; i < BUDGET_SUBSYSTEMS; i++) {
+    size_t used = budget_used(i);
+    size_t peak = __atomic_load_n(&budget.peak[i], __ATOMIC_RELAXED);
+
+    if (i != BUDGET_SPILLED)
+      total += used;
+    fprintf(fp, " %s %zu MB (peak %zu)%s", budget_names[i], used >> 20, peak >> 20,
+            (i < BUDGET_SUBSYSTEMS - 1) ? "," : "");
+  }
+  if (budget.limit)
+    fprintf(fp, ", in memory %zu of %zu MB\n", total >> 20, budget.limit >> 20);
+  else
+    fprintf(fp, ", in memory %zu MB\n", total >> 20);
+}
+
+/*
+ * A spilled table frees its memory in pieces the allocator keeps for
+ * itself, hand them back so the process shrinks with the budget.
+ */
+void budget_trim(void) {
+#ifdef HAVE_MALLOC_TRIM
+  malloc_trim(0);
+#endif
+}
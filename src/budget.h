@@ -0,0 +1,61 @@
+/*****
+ *
+ * Description: Memory Budget Accounting Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Budget configuration */
+#define BUDGET_CHUNK_SHARE 4          /* Chunk pipeline gets 1/4 of the budget */
+#define BUDGET_OUTPUT_SHARE 4         /* Sorting the output in chunks gets 1/4 of the budget */
+
+/* Subsystems that draw from the budget */
+enum budget_subsystem {
+  BUDGET_CHUNKS,                /* Chunk buffers queued or being scanned */
+  BUDGET_TABLES,                /* Address tables, keys and metadata */
+  BUDGET_POSTINGS,              /* Posting lists and blocks */
+  BUDGET_OUTPUT,                /* Sorting, merging and filtering while the index is written */
+  BUDGET_SPILLED,               /* Bytes written to spill runs, on disk */
+  BUDGET_SUBSYSTEMS
+};
+
+/* Process-wide accounting, every counter is updated atomically */
+typedef struct budget_s {
+  size_t limit;                 /* Bytes, 0 for no limit */
+  size_t used[BUDGET_SUBSYSTEMS];
+  size_t peak[BUDGET_SUBSYSTEMS];
+} budget_t;
+
+/* Function prototypes */
+void budget_init(size_t limit);
+size_t budget_limit(void);
+void budget_add(int subsystem, int64_t delta);
+void budget_publish(int subsystem, size_t *reported, size_t now);
+size_t budget_used(int subsystem);
+void budget_report(FILE *fp);
+void budget_trim(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BUDGET_H */
@@ -0,0 +1,80 @@
+/*****
+ *
+ * Description: Address Catalog Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "catalog.h"
+#include "mem.h"
+#include <stdlib.h>
+#include <string.h>
+
+/****
+ *
+ * map a catalog and list its files
+ *
+ ****/
+
+catalog_t *catalog_open(const char *path) {
+  const lpi2_section_t *section;
+  const char *p, *end;
+  catalog_t *catalog;
+  size_t i;
+
+  if ((catalog = (catalog_t *)XMALLOC(sizeof(catalog_t))) == NULL)
+    return NULL;
+  XMEMSET(catalog, 0, sizeof(catalog_t));
+
+  if ((catalog->index = lpi2_open(path)) == NULL) {
+    XFREE(catalog);
+    return NULL;
+  }
+  if (!(catalog->index->flags & LPI2_FLAG_CATALOG) ||
+      (section = lpi2_find_section(catalog->index, LPI2_SECTION_FILES)) == NULL) {
+    fprintf(stderr, "ERR - [%s] is not a catalog\n", path);
+    catalog_close(catalog);
+    return NULL;
+  }
+
+  p = (const char *)catalog->index->map + section->offset;
+  end = p + section->length;
+  if (section->length > 0 && end[-1] != '\0') {
+    fprintf(stderr, "ERR - Catalog [%s] has a corrupt file list\n", path);
+    catalog_close(catalog);
+    return NULL;
+  }
+  for (i = 0; i < section->length; i++) {
+    if (p[i] == '\0')
+      catalog->file_count++;
+  }
+
+  if (catalog->file_count > 0) {
+    if ((catalog->files = (const char **)XMALLOC(sizeof(char *) * catalog->file_count)) == NULL) {
+      catalog_close(catalog);
+      return NULL;
+    }
+    for (i = 0; p < end; i++) {
+      catalog->files[i] = p;
+      p += strlen(p) + 1;
+    }
+  }
+
+  return catalog;
+}
+
+void catalog_close(catalog_t *catalog) {
+  if (catalog == NULL)
+    return;
+  if (catalog->files != NULL)
+    XFREE(catalog->files);
+  lpi2_close(catalog->index);
+  XFREE(catalog);
+}
@@ -0,0 +1,52 @@
+/*****
+ *
+ * Description: Address Catalog Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "../include/common.h"
+#include "lpi2.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A catalog maps each address to the log files it was seen in.  It is
+ * a binary index flagged LPI2_FLAG_CATALOG whose postings hold (file
+ * id, count) pairs where an index holds (line, field), file ids one
+ * based and ascending, so it is searched with the same code.  The
+ * files section holds the absolute path of each log file, NUL
+ * terminated, in id order.
+ */
+
+/* A catalog mapped for searching */
+typedef struct catalog_s {
+  lpi2_index_t *index;
+  const char **files;           /* Path of file id n at n - 1 */
+  size_t file_count;
+} catalog_t;
+
+/* Function prototypes */
+catalog_t *catalog_open(const char *path);
+void catalog_close(catalog_t *catalog);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CATALOG_H */
@@ -0,0 +1,465 @@
+/*****
+ *
+ * Description: Address Catalog Builder Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "catalog_build.h"
+#include "lpi2_build.h"
+#include "mem.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define CATALOG_READ_BUFFER 65536
+
+/* A file's postings while a key is merged */
+typedef struct catalog_pair_s {
+  uint64_t file;
+  uint64_t count;
+} catalog_pair_t;
+
+catalog_builder_t *catalog_builder_create(const char *path) {
+  catalog_builder_t *cb;
+
+  if ((cb = (catalog_builder_t *)XMALLOC(sizeof(catalog_builder_t))) == NULL)
+    return NULL;
+  XMEMSET(cb, 0, sizeof(catalog_builder_t));
+  if ((cb->path = XSTRDUP(path)) == NULL) {
+    XFREE(cb);
+    return NULL;
+  }
+
+  return cb;
+}
+
+/****
+ *
+ * note one key of the file being added
+ *
+ ****/
+
+static int add_entry(catalog_builder_t *cb, const char *text, size_t len, uint64_t count) {
+  catalog_entry_t *entry;
+
+  /* Too long for a key, and never an address */
+  if (len == 0 || len > LPI2_MAX_TEXT)
+    return TRUE;
+
+  if (cb->count == cb->capacity) {
+    size_t capacity = (cb->capacity == 0) ? 4096 : cb->capacity * 2;
+    catalog_entry_t *grown;
+
+    if ((grown = (catalog_entry_t *)XREALLOC(cb->entries, sizeof(catalog_entry_t) * capacity)) == NULL) {
+      fprintf(stderr, "ERR - Unable to grow catalog batch\n");
+      return FAILED;
+    }
+    cb->entries = grown;
+    cb->capacity = capacity;
+  }
+  if (!out_reserve(&cb->names, len))
+    return FAILED;
+
+  entry = &cb->entries[cb->count++];
+  lpi2_key_init(&entry->key, text, len);
+  entry->key.text = (uint32_t)cb->names.len;
+  entry->text = NULL;
+  entry->file = (uint32_t)cb->file_count;
+  entry->count = count;
+  memcpy(cb->names.data + cb->names.len, text, len);
+  cb->names.len += len;
+
+  return TRUE;
+}
+
+/****
+ *
+ * read the keys and counts back from a text index
+ *
+ * Only the start of each record is wanted, the locations are skipped
+ * a buffer at a time.
+ *
+ ****/
+
+static int read_text_index(catalog_builder_t *cb, const char *index_path) {
+  char key[LPI2_MAX_TEXT + 2];
+  char *buf, *p, *end, *nl;
+  size_t key_len = 0, got;
+  uint64_t count = 0;
+  int field = 0, ret = TRUE, n;
+  gzFile fp;
+
+  /* A -z index is read through zlib, which passes plain text through */
+  if ((fp = gzopen(index_path, "rb")) == NULL) {
+    fprintf(stderr, "ERR - Unable to open index [%s] %d (%s)\n", index_path, errno, strerror(errno));
+    return FAILED;
+  }
+  if ((buf = (char *)XMALLOC(CATALOG_READ_BUFFER)) == NULL) {
+    gzclose(fp);
+    return FAILED;
+  }
+
+  /* field is 0 in the key, 1 in the count and 2 in the locations */
+  while (ret == TRUE && (n = gzread(fp, buf, CATALOG_READ_BUFFER)) > 0) {
+    got = (size_t)n;
+    for (p = buf, end = buf + got; p < end && ret == TRUE;) {
+      if (field == 2) {
+        if ((nl = memchr(p, '\n', end - p)) == NULL)
+          break;
+        p = nl + 1;
+        field = 0;
+        key_len = 0;
+        count = 0;
+      } else if (*p == ',' || *p == '\n') {
+        if (field == 1) {
+          ret = add_entry(cb, key, key_len, count);
+          field = (*p == '\n') ? 0 : 2;
+          key_len = 0;
+          count = 0;
+        } else
+          field = (*p == '\n') ? 0 : 1;
+        p++;
+      } else if (field == 0) {
+        if (key_len < sizeof(key))
+          key[key_len++] = *p;
+        p++;
+      } else {
+        count = count * 10 + (uint64_t)(*p++ - '0');
+      }
+    }
+  }
+  if (n < 0) {
+    fprintf(stderr, "ERR - Unable to read index [%s]\n", index_path);
+    ret = FAILED;
+  }
+
+  XFREE(buf);
+  gzclose(fp);
+  return ret;
+}
+
+static int read_binary_index(catalog_builder_t *cb, const char *index_path) {
+  const lpi2_key_t *key;
+  const char *text;
+  char text_buf[LPI2_TEXT_BUF];
+  lpi2_index_t *index;
+  uint64_t i;
+  int ret = TRUE;
+
+  if ((index = lpi2_open(index_path)) == NULL)
+    return FAILED;
+  if (index->flags & LPI2_FLAG_CATALOG) {
+    fprintf(stderr, "ERR - [%s] is a catalog, not an index\n", index_path);
+    lpi2_close(index);
+    return FAILED;
+  }
+
+  for (i = 0; i < index->key_count && ret == TRUE; i++) {
+    key = &index->keys[i];
+    if ((text = lpi2_key_text(index, key, text_buf)) == NULL) {
+      fprintf(stderr, "ERR - Index is corrupt [%s]\n", index_path);
+      ret = FAILED;
+    } else
+      ret = add_entry(cb, text, key->text_len, key->count);
+  }
+
+  lpi2_close(index);
+  return ret;
+}
+
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static int compare_catalog_entries(const void *a, const void *b) {
+  const catalog_entry_t *entry_a = (const catalog_entry_t *)a;
+  const catalog_entry_t *entry_b = (const catalog_entry_t *)b;
+  int ret;
+
+  if ((ret = lpi2_key_compare(&entry_a->key, entry_a->text, &entry_b->key, entry_b->text)) != 0)
+    return ret;
+  return (entry_a->file > entry_b->file) - (entry_a->file < entry_b->file);
+}
+
+static int add_pair(catalog_pair_t **pairs, size_t *count, size_t *capacity, uint64_t file, uint64_t n) {
+  if (*count == *capacity) {
+    size_t grow = (*capacity == 0) ? 1024 : *capacity * 2;
+    catalog_pair_t *grown;
+
+    if ((grown = (catalog_pair_t *)XREALLOC(*pairs, sizeof(catalog_pair_t) * grow)) == NULL)
+      return FAILED;
+    *pairs = grown;
+    *capacity = grow;
+  }
+  (*pairs)[*count].file = file;
+  (*pairs)[*count].count = n;
+  (*count)++;
+  return TRUE;
+}
+
+/****
+ *
+ * merge the batch into the catalog
+ *
+ * The old catalog's keys are already in key order and the batch is
+ * sorted to match, so one pass over both writes every key.  Old files
+ * keep their order and the batch follows them, so renumbered file ids
+ * still ascend in each key's postings.
+ *
+ ****/
+
+static int catalog_flush(catalog_builder_t *cb) {
+  char tmp_path[PATH_MAX];
+  catalog_t *old = NULL;
+  char **sorted = NULL;
+  uint64_t *remap = NULL, next = 0, i = 0, file, n;
+  lpi2_builder_t *b = NULL;
+  lpi2_postings_t postings;
+  out_buffer_t buf, files;
+  catalog_pair_t *pairs = NULL;
+  size_t pair_count, pair_capacity = 0, j = 0, k;
+  const lpi2_key_t *key;
+  const char *text;
+  char text_buf[LPI2_TEXT_BUF];
+  lpi2_cursor_t cursor;
+  writer_t *writer = NULL;
+  struct stat st;
+  FILE *fp = NULL;
+  int cmp, ret = TRUE;
+
+  if (cb->file_count == 0)
+    return TRUE;
+
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cb->path) >= (int)sizeof(tmp_path)) {
+    fprintf(stderr, "ERR - Catalog path too long [%s]\n", cb->path);
+    return FAILED;
+  }
+  if (stat(cb->path, &st) == 0 && (old = catalog_open(cb->path)) == NULL)
+    return FAILED;
+
+  fprintf(stderr, "Updating catalog [%s] with %zu files\n", cb->path, cb->file_count);
+
+  XMEMSET(&buf, 0, sizeof(buf));
+  XMEMSET(&files, 0, sizeof(files));
+
+  /* Old files that were indexed again are dropped, the rest keep their order */
+  if (old != NULL && old->file_count > 0) {
+    if ((remap = (uint64_t *)XMALLOC(sizeof(uint64_t) * old->file_count)) == NULL ||
+        (sorted = (char **)XMALLOC(sizeof(char *) * cb->file_count)) == NULL)
+      ret = FAILED;
+    else {
+      memcpy(sorted, cb->files, sizeof(char *) * cb->file_count);
+      qsort(sorted, cb->file_count, sizeof(char *), compare_paths);
+    }
+    for (k = 0; k < old->file_count && ret == TRUE; k++) {
+      if (bsearch(&old->files[k], sorted, cb->file_count, sizeof(char *), compare_paths) != NULL)
+        remap[k] = 0;
+      else {
+        remap[k] = ++next;
+        if (!out_reserve(&files, strlen(old->files[k]) + 1))
+          ret = FAILED;
+        else {
+          memcpy(files.data + files.len, old->files[k], strlen(old->files[k]) + 1);
+          files.len += strlen(old->files[k]) + 1;
+        }
+      }
+    }
+  }
+  for (k = 0; k < cb->file_count && ret == TRUE; k++) {
+    if (!out_reserve(&files, strlen(cb->files[k]) + 1))
+      ret = FAILED;
+    else {
+      memcpy(files.data + files.len, cb->files[k], strlen(cb->files[k]) + 1);
+      files.len += strlen(cb->files[k]) + 1;
+    }
+  }
+
+  /* The batch follows the old files, entries name a file by its place in it */
+  for (k = 0; k < cb->count; k++)
+    cb->entries[k].text = cb->names.data + cb->entries[k].key.text;
+  qsort(cb->entries, cb->count, sizeof(catalog_entry_t), compare_catalog_entries);
+
+  if (ret == TRUE && (fp = fopen(tmp_path, "w")) == NULL) {
+    fprintf(stderr, "ERR - Unable to open catalog [%s] %d (%s)\n", tmp_path, errno, strerror(errno));
+    ret = FAILED;
+  }
+  if (ret == TRUE && ((writer = writer_create(fp, FALSE)) == NULL ||
+                      (b = lpi2_builder_create(writer, LPI2_FLAG_CATALOG)) == NULL))
+    ret = FAILED;
+
+  while (ret == TRUE && ((old != NULL && i < old->index->key_count) || j < cb->count)) {
+    pair_count = 0;
+    key = NULL;
+    text = NULL;
+
+    if (old == NULL || i == old->index->key_count)
+      cmp = 1;
+    else if (j == cb->count)
+      cmp = -1;
+    else {
+      if ((text = lpi2_key_text(old->index, &old->index->keys[i], text_buf)) == NULL) {
+        fprintf(stderr, "ERR - Catalog is corrupt [%s]\n", cb->path);
+        ret = FAILED;
+        break;
+      }
+      cmp = lpi2_key_compare(&old->index->keys[i], text, &cb->entries[j].key, cb->entries[j].text);
+    }
+
+    if (cmp <= 0) {
+      key = &old->index->keys[i++];
+      if ((text = lpi2_key_text(old->index, key, text_buf)) == NULL || lpi2_cursor_init(old->index, key, &cursor) != TRUE) {
+        fprintf(stderr, "ERR - Catalog is corrupt [%s]\n", cb->path);
+        ret = FAILED;
+        break;
+      }
+      while (ret == TRUE && lpi2_cursor_next(&cursor, &file, &n) == TRUE) {
+        if (file == 0 || file > old->file_count) {
+          fprintf(stderr, "ERR - Catalog is corrupt [%s]\n", cb->path);
+          ret = FAILED;
+        } else if (remap[file - 1] != 0)
+          ret = add_pair(&pairs, &pair_count, &pair_capacity, remap[file - 1], n);
+      }
+    }
+    if (cmp >= 0) {
+      if (key == NULL) {
+        key = &cb->entries[j].key;
+        text = cb->entries[j].text;
+      }
+      do {
+        ret = add_pair(&pairs, &pair_count, &pair_capacity, next + 1 + cb->entries[j].file, cb->entries[j].count);
+        j++;
+      } while (ret == TRUE && j < cb->count &&
+               lpi2_key_compare(&cb->entries[j - 1].key, cb->entries[j - 1].text,
+                                &cb->entries[j].key, cb->entries[j].text) == 0);
+    }
+
+    if (ret != TRUE || pair_count == 0)
+      continue;
+    buf.len = 0;
+    ret = lpi2_postings_begin(&postings, &buf, pair_count);
+    for (k = 0; k < pair_count && ret == TRUE; k++)
+      ret = lpi2_postings_add(&postings, pairs[k].file, pairs[k].count);
+    if (ret == TRUE && (ret = lpi2_postings_end(&postings)) == TRUE)
+      ret = lpi2_builder_add(b, text, key->text_len, pair_count, buf.data, buf.len);
+  }
+
+  if (ret == TRUE)
+    ret = lpi2_builder_section(b, LPI2_SECTION_FILES, files.data, files.len);
+  if (ret == TRUE)
+    ret = lpi2_builder_finish(b);
+  lpi2_builder_destroy(b);
+  if (writer != NULL && writer_close(writer) != TRUE)
+    ret = FAILED;
+  if (fp != NULL && fclose(fp) != 0)
+    ret = FAILED;
+  catalog_close(old);
+
+  if (ret == TRUE && rename(tmp_path, cb->path) != 0) {
+    fprintf(stderr, "ERR - Unable to replace catalog [%s] %d (%s)\n", cb->path, errno, strerror(errno));
+    ret = FAILED;
+  }
+  if (ret != TRUE) {
+    fprintf(stderr, "ERR - Unable to write catalog [%s]\n", cb->path);
+    unlink(tmp_path);
+  }
+
+  if (remap != NULL)
+    XFREE(remap);
+  if (sorted != NULL)
+    XFREE(sorted);
+  if (pairs != NULL)
+    XFREE(pairs);
+  if (buf.data != NULL)
+    XFREE(buf.data);
+  if (files.data != NULL)
+    XFREE(files.data);
+
+  /* Start the next batch */
+  for (k = 0; k < cb->file_count; k++)
+    XFREE(cb->files[k]);
+  cb->file_count = 0;
+  cb->count = 0;
+  cb->names.len = 0;
+
+  return ret;
+}
+
+/****
+ *
+ * add a log file whose index has just been written
+ *
+ ****/
+
+int catalog_builder_add(catalog_builder_t *cb, const char *log_path) {
+  char index_path[PATH_MAX], real[PATH_MAX];
+  size_t k, start = cb->count;
+  int ret;
+
+  if (snprintf(index_path, sizeof(index_path), "%s.lpi", log_path) >= (int)sizeof(index_path) ||
+      realpath(log_path, real) == NULL) {
+    fprintf(stderr, "ERR - Unable to add [%s] to the catalog\n", log_path);
+    return FAILED;
+  }
+  for (k = 0; k < cb->file_count; k++) {
+    if (strcmp(cb->files[k], real) == 0)
+      return TRUE;
+  }
+
+  if (cb->file_count == cb->file_capacity) {
+    size_t capacity = (cb->file_capacity == 0) ? 64 : cb->file_capacity * 2;
+    char **grown;
+
+    if ((grown = (char **)XREALLOC(cb->files, sizeof(char *) * capacity)) == NULL)
+      return FAILED;
+    cb->files = grown;
+    cb->file_capacity = capacity;
+  }
+
+  if (lpi2_is_index(index_path))
+    ret = read_binary_index(cb, index_path);
+  else
+    ret = read_text_index(cb, index_path);
+  if (ret != TRUE || (cb->files[cb->file_count] = XSTRDUP(real)) == NULL) {
+    /* Leave the catalog as it was for this file */
+    cb->count = start;
+    fprintf(stderr, "ERR - Unable to add [%s] to the catalog\n", log_path);
+    return FAILED;
+  }
+  cb->file_count++;
+
+  if (cb->count >= CATALOG_BATCH_ENTRIES)
+    return catalog_flush(cb);
+  return TRUE;
+}
+
+int catalog_builder_finish(catalog_builder_t *cb) {
+  return catalog_flush(cb);
+}
+
+void catalog_builder_destroy(catalog_builder_t *cb) {
+  size_t k;
+
+  if (cb == NULL)
+    return;
+  for (k = 0; k < cb->file_count; k++)
+    XFREE(cb->files[k]);
+  if (cb->files != NULL)
+    XFREE(cb->files);
+  if (cb->entries != NULL)
+    XFREE(cb->entries);
+  if (cb->names.data != NULL)
+    XFREE(cb->names.data);
+  XFREE(cb->path);
+  XFREE(cb);
+}
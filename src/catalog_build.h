@@ -0,0 +1,64 @@
+/*****
+ *
+ * Description: Address Catalog Builder Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef CATALOG_BUILD_H
+#define CATALOG_BUILD_H
+
+#include "../include/common.h"
+#include "catalog.h"
+#include "writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CATALOG_BATCH_ENTRIES 2097152   /* Held before the catalog is rewritten */
+
+/* One address seen in one file of the batch */
+typedef struct catalog_entry_s {
+  lpi2_key_t key;               /* text is an offset in names */
+  const char *text;             /* Set once names stops growing */
+  uint32_t file;                /* Position in the batch */
+  uint64_t count;
+} catalog_entry_t;
+
+/*
+ * Files are added once their index is written.  Their keys are read
+ * back from the index and held until the batch is full or finished,
+ * then merged with the existing catalog into a new one that replaces
+ * it.  A file already in the catalog is dropped from it first, so
+ * indexing a file again updates its entry.
+ */
+typedef struct catalog_builder_s {
+  char *path;
+  char **files;                 /* Absolute paths of the batch */
+  size_t file_count;
+  size_t file_capacity;
+  catalog_entry_t *entries;
+  size_t count;
+  size_t capacity;
+  out_buffer_t names;
+} catalog_builder_t;
+
+/* Function prototypes */
+catalog_builder_t *catalog_builder_create(const char *path);
+int catalog_builder_add(catalog_builder_t *cb, const char *log_path);
+int catalog_builder_finish(catalog_builder_t *cb);
+void catalog_builder_destroy(catalog_builder_t *cb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CATALOG_BUILD_H */
@@ -0,0 +1,240 @@
+/*****
+ *
+ * Description: Index Membership Filter Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "filter.h"
+#include "mem.h"
+#include "xxhash.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define FILTER_SEED 0x4c504631ULL
+
+/* One odd multiplier per block word, picks the bit a key sets in it */
+static const uint32_t salts[FILTER_BLOCK_WORDS] = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+/****
+ *
+ * hash a key as the binary index would match it
+ *
+ ****/
+
+uint64_t filter_hash_key(const lpi2_key_t *key, const char *text) {
+  uint8_t buf[1 + sizeof(key->addr)];
+
+  if (key->family == LPI2_FAMILY_TEXT)
+    return xxhash64_small(text, key->text_len, FILTER_SEED);
+
+  buf[0] = key->family;
+  memcpy(buf + 1, key->addr, sizeof(key->addr));
+  return xxhash64_small(buf, sizeof(buf), FILTER_SEED);
+}
+
+uint64_t filter_hash(const char *text, size_t len) {
+  lpi2_key_t key;
+
+  lpi2_key_init(&key, text, len);
+  if (key.family == LPI2_FAMILY_TEXT)
+    return xxhash64_small(text, len, FILTER_SEED);
+  return filter_hash_key(&key, text);
+}
+
+/****
+ *
+ * build a filter sized for a number of keys
+ *
+ ****/
+
+filter_t *filter_create(uint64_t keys) {
+  uint64_t blocks = (keys * FILTER_BITS_PER_KEY + FILTER_BLOCK_SIZE * 8 - 1) / (FILTER_BLOCK_SIZE * 8);
+  filter_t *f;
+
+  if (blocks == 0)
+    blocks = 1;
+  if (blocks > UINT32_MAX) {
+    fprintf(stderr, "ERR - Too many keys [%llu] for an index filter\n", (unsigned long long)keys);
+    return NULL;
+  }
+
+  if ((f = (filter_t *)XMALLOC(sizeof(filter_t))) == NULL)
+    return NULL;
+  if ((f->data = (char *)XMALLOC(blocks * FILTER_BLOCK_SIZE)) == NULL) {
+    XFREE(f);
+    return NULL;
+  }
+  XMEMSET(f->data, 0, blocks * FILTER_BLOCK_SIZE);
+  f->words = (uint32_t *)f->data;
+  f->blocks = (uint32_t)blocks;
+  f->keys = 0;
+
+  return f;
+}
+
+static ALWAYS_INLINE uint32_t *filter_block(const filter_t *f, uint64_t hash) {
+  return f->words + (((hash >> 32) * f->blocks) >> 32) * FILTER_BLOCK_WORDS;
+}
+
+void filter_add(filter_t *f, uint64_t hash) {
+  uint32_t *block = filter_block(f, hash);
+  int i;
+
+  for (i = 0; i < FILTER_BLOCK_WORDS; i++)
+    block[i] |= 1U << (((uint32_t)hash * salts[i]) >> 27);
+  f->keys++;
+}
+
+int filter_contains(const filter_t *f, uint64_t hash) {
+  const uint32_t *block = filter_block(f, hash);
+  int i;
+
+  for (i = 0; i < FILTER_BLOCK_WORDS; i++) {
+    if (!(block[i] & (1U << (((uint32_t)hash * salts[i]) >> 27))))
+      return FALSE;
+  }
+  return TRUE;
+}
+
+void filter_header(const filter_t *f, filter_header_t *header, uint64_t index_size) {
+  XMEMSET(header, 0, sizeof(filter_header_t));
+  memcpy(header->magic, FILTER_MAGIC, sizeof(header->magic));
+  header->blocks = f->blocks;
+  header->keys = f->keys;
+  header->index_size = index_size;
+}
+
+/****
+ *
+ * use a filter in place, as found in a binary index section
+ *
+ ****/
+
+int filter_view(filter_t *f, const void *data, size_t len) {
+  filter_header_t header;
+
+  if (len < sizeof(header))
+    return FALSE;
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, FILTER_MAGIC, sizeof(header.magic)) != 0 || header.blocks == 0 ||
+      (uint64_t)header.blocks * FILTER_BLOCK_SIZE != len - sizeof(header))
+    return FALSE;
+
+  f->blocks = header.blocks;
+  f->keys = header.keys;
+  f->words = (uint32_t *)((const char *)data + sizeof(header));
+  f->data = NULL;
+  return TRUE;
+}
+
+/****
+ *
+ * sidecar for a text index
+ *
+ ****/
+
+static int filter_path(char *path, size_t len, const char *index_path) {
+  if (snprintf(path, len, "%s%s", index_path, FILTER_SUFFIX) >= (int)len) {
+    fprintf(stderr, "ERR - Filter path too long for [%s]\n", index_path);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+int filter_save(const filter_t *f, const char *index_path, off_t index_size) {
+  char path[PATH_MAX];
+  filter_header_t header;
+  FILE *fp;
+
+  if (!filter_path(path, sizeof(path), index_path))
+    return FAILED;
+  if ((fp = fopen(path, "w")) == NULL) {
+    fprintf(stderr, "ERR - Unable to open filter [%s] %d (%s)\n", path, errno, strerror(errno));
+    return FAILED;
+  }
+
+  filter_header(f, &header, (uint64_t)index_size);
+  fwrite(&header, sizeof(header), 1, fp);
+  fwrite(f->words, FILTER_BLOCK_SIZE, f->blocks, fp);
+  if (ferror(fp) || fclose(fp) != 0) {
+    fprintf(stderr, "ERR - Unable to write filter [%s]\n", path);
+    unlink(path);
+    return FAILED;
+  }
+
+  return TRUE;
+}
+
+/* Drop the sidecar of an index rewritten without one */
+void filter_remove(const char *index_path) {
+  char path[PATH_MAX];
+
+  if (filter_path(path, sizeof(path), index_path))
+    unlink(path);
+}
+
+/****
+ *
+ * load the sidecar of a text index, NULL if it has none
+ *
+ * A sidecar for a different size of index is stale, trusting it could
+ * skip an index that holds a term, so it is ignored.
+ *
+ ****/
+
+filter_t *filter_load(const char *index_path) {
+  char path[PATH_MAX];
+  struct stat index_st, st;
+  filter_t *f;
+  char *data;
+  FILE *fp;
+
+  if (!filter_path(path, sizeof(path), index_path) || stat(index_path, &index_st) != 0 ||
+      (fp = fopen(path, "r")) == NULL)
+    return NULL;
+  if (fstat(fileno(fp), &st) != 0 || (f = (filter_t *)XMALLOC(sizeof(filter_t))) == NULL) {
+    fclose(fp);
+    return NULL;
+  }
+  if (st.st_size < (off_t)sizeof(filter_header_t) || (data = (char *)XMALLOC(st.st_size)) == NULL) {
+    fprintf(stderr, "WARN - Ignoring stale filter [%s]\n", path);
+    fclose(fp);
+    XFREE(f);
+    return NULL;
+  }
+
+  if (fread(data, 1, st.st_size, fp) != (size_t)st.st_size || !filter_view(f, data, st.st_size) ||
+      ((filter_header_t *)data)->index_size != (uint64_t)index_st.st_size) {
+    fprintf(stderr, "WARN - Ignoring stale filter [%s]\n", path);
+    fclose(fp);
+    XFREE(data);
+    XFREE(f);
+    return NULL;
+  }
+  fclose(fp);
+  f->data = data;
+
+  return f;
+}
+
+void filter_free(filter_t *f) {
+  if (f == NULL)
+    return;
+  if (f->data != NULL)
+    XFREE(f->data);
+  XFREE(f);
+}
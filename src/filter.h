@@ -0,0 +1,77 @@
+/*****
+ *
+ * Description: Index Membership Filter Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "../include/common.h"
+#include "lpi2.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A split block Bloom filter over the keys of one index.  Each key
+ * sets one bit in each of the eight words of a single 32 byte block,
+ * so a lookup reads one cache line.  A binary index carries it as a
+ * filter section, a text index written with -w in a .lpf sidecar
+ * that also records the size of the index it describes.
+ *
+ * Keys are hashed by their address bytes when they parse as one, the
+ * same way the binary index matches them, so every spelling of an
+ * address tests the same bits.
+ */
+
+#define FILTER_SUFFIX ".lpf"
+#define FILTER_MAGIC "LPF1"
+#define FILTER_BITS_PER_KEY 16          /* About 0.1% false positives */
+#define FILTER_BLOCK_WORDS 8
+#define FILTER_BLOCK_SIZE (FILTER_BLOCK_WORDS * sizeof(uint32_t))
+
+typedef struct filter_header_s {        /* 24 bytes, the blocks follow */
+  char magic[4];
+  uint32_t blocks;
+  uint64_t keys;
+  uint64_t index_size;                  /* Sidecar only, 0 in a section */
+} filter_header_t;
+
+typedef struct filter_s {
+  uint32_t blocks;
+  uint64_t keys;
+  uint32_t *words;
+  char *data;                           /* Owned storage, NULL for a view */
+} filter_t;
+
+/* Function prototypes */
+uint64_t filter_hash_key(const lpi2_key_t *key, const char *text);
+uint64_t filter_hash(const char *text, size_t len);
+filter_t *filter_create(uint64_t keys);
+void filter_add(filter_t *f, uint64_t hash);
+int filter_contains(const filter_t *f, uint64_t hash);
+void filter_header(const filter_t *f, filter_header_t *header, uint64_t index_size);
+int filter_view(filter_t *f, const void *data, size_t len);
+int filter_save(const filter_t *f, const char *index_path, off_t index_size);
+void filter_remove(const char *index_path);
+filter_t *filter_load(const char *index_path);
+void filter_free(filter_t *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FILTER_H */
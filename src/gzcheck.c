@@ -0,0 +1,441 @@
+/*****
+ *
+ * Description: Gzip Log Checkpoint Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "gzcheck.h"
+#include "mem.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define GZCHECK_BUFFER (GZCHECK_WINDOW + GZCHECK_OUTPUT)
+
+static int gzcheck_path(char *path, size_t len, const char *index_path) {
+  if (snprintf(path, len, "%s%s", index_path, GZCHECK_SUFFIX) >= (int)len) {
+    fprintf(stderr, "ERR - Gzip checkpoint path too long for [%s]\n", index_path);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+gzcheck_t *gzcheck_create(void) {
+  gzcheck_t *gc;
+
+  if ((gc = (gzcheck_t *)XMALLOC(sizeof(gzcheck_t))) == NULL)
+    return NULL;
+  XMEMSET(gc, 0, sizeof(gzcheck_t));
+
+  return gc;
+}
+
+/****
+ *
+ * note a point where the reader stopped at the end of a block
+ *
+ * Its window is deflated, log text shrinks several times over.  The
+ * line is filled in once the reader returns the first line after it.
+ *
+ ****/
+
+static int gzcheck_add(gzreader_t *r) {
+  gzcheck_t *gc = r->build;
+  uLongf packed_len = compressBound(GZCHECK_WINDOW);
+  size_t window_len = (r->have < GZCHECK_WINDOW) ? r->have : GZCHECK_WINDOW;
+  gzpoint_t *points, *p;
+  unsigned char *windows;
+  size_t size;
+
+  if (gc->count == gc->capacity) {
+    size = (gc->capacity == 0) ? 64 : gc->capacity * 2;
+    if ((points = (gzpoint_t *)XREALLOC(gc->points, sizeof(gzpoint_t) * size)) == NULL)
+      return FAILED;
+    gc->points = points;
+    gc->capacity = size;
+  }
+  if (gc->windows_len + packed_len > gc->windows_size) {
+    size = (gc->windows_size == 0) ? packed_len * 16 : gc->windows_size;
+    while (size < gc->windows_len + packed_len)
+      size *= 2;
+    if ((windows = (unsigned char *)XREALLOC(gc->windows, size)) == NULL)
+      return FAILED;
+    gc->windows = windows;
+    gc->windows_size = size;
+  }
+
+  if (compress2(gc->windows + gc->windows_len, &packed_len, r->buf + r->have - window_len,
+                window_len, 1) != Z_OK)
+    return FAILED;
+
+  p = &gc->points[gc->count];
+  XMEMSET(p, 0, sizeof(gzpoint_t));
+  p->in = r->read - r->zs.avail_in;
+  p->out = r->out;
+  p->bits = r->zs.data_type & 7;
+  p->window = gc->windows_len;
+  p->window_len = (uint32_t)packed_len;
+  gc->windows_len += packed_len;
+
+  r->pending = (int)gc->count++;
+  r->last = r->out;
+  return TRUE;
+}
+
+/****
+ *
+ * write the sidecar of an index for a log of log_size bytes
+ *
+ ****/
+
+int gzcheck_save(const gzcheck_t *gc, const char *index_path, off_t log_size) {
+  char path[PATH_MAX];
+  gzcheck_header_t header;
+  FILE *fp;
+
+  if (!gzcheck_path(path, sizeof(path), index_path))
+    return FAILED;
+  if ((fp = fopen(path, "w")) == NULL) {
+    fprintf(stderr, "ERR - Unable to open gzip checkpoints [%s] %d (%s)\n", path, errno, strerror(errno));
+    return FAILED;
+  }
+
+  XMEMSET(&header, 0, sizeof(header));
+  memcpy(header.magic, GZCHECK_MAGIC, sizeof(header.magic));
+  header.span = GZCHECK_SPAN;
+  header.log_size = (uint64_t)log_size;
+  header.count = gc->count;
+  header.windows_len = gc->windows_len;
+  fwrite(&header, sizeof(header), 1, fp);
+  if (gc->count > 0) {
+    fwrite(gc->points, sizeof(gzpoint_t), gc->count, fp);
+    fwrite(gc->windows, 1, gc->windows_len, fp);
+  }
+  if (ferror(fp) || fclose(fp) != 0) {
+    fprintf(stderr, "ERR - Unable to write gzip checkpoints [%s]\n", path);
+    unlink(path);
+    return FAILED;
+  }
+
+  return TRUE;
+}
+
+/* Drop the sidecar of an index written without one */
+void gzcheck_remove(const char *index_path) {
+  char path[PATH_MAX];
+
+  if (gzcheck_path(path, sizeof(path), index_path))
+    unlink(path);
+}
+
+/****
+ *
+ * load the sidecar of an index, NULL if it has none or it is stale
+ *
+ ****/
+
+gzcheck_t *gzcheck_load(const char *index_path, const char *log_path) {
+  char path[PATH_MAX];
+  struct stat log_st, st;
+  gzcheck_header_t header;
+  gzcheck_t *gc;
+  size_t i;
+  int valid;
+  FILE *fp;
+
+  if (!gzcheck_path(path, sizeof(path), index_path) || stat(log_path, &log_st) != 0 ||
+      (fp = fopen(path, "r")) == NULL)
+    return NULL;
+  if (fstat(fileno(fp), &st) != 0 || (gc = gzcheck_create()) == NULL) {
+    fclose(fp);
+    return NULL;
+  }
+
+  valid = fread(&header, sizeof(header), 1, fp) == 1 &&
+          memcmp(header.magic, GZCHECK_MAGIC, sizeof(header.magic)) == 0 && header.count > 0 &&
+          header.log_size == (uint64_t)log_st.st_size &&
+          (uint64_t)st.st_size == sizeof(header) + header.count * sizeof(gzpoint_t) + header.windows_len &&
+          (gc->points = (gzpoint_t *)XMALLOC(sizeof(gzpoint_t) * header.count)) != NULL &&
+          (gc->windows = (unsigned char *)XMALLOC(header.windows_len + 1)) != NULL &&
+          fread(gc->points, sizeof(gzpoint_t), header.count, fp) == header.count &&
+          fread(gc->windows, 1, header.windows_len, fp) == header.windows_len;
+  fclose(fp);
+
+  if (valid) {
+    gc->count = gc->capacity = header.count;
+    gc->windows_len = gc->windows_size = header.windows_len;
+    for (i = 0; i < gc->count && valid; i++) {
+      const gzpoint_t *p = &gc->points[i];
+
+      valid = p->bits < 8 && p->window + p->window_len <= gc->windows_len && p->line > 0 &&
+              (i == 0 || (p->line > p[-1].line && p->in > p[-1].in));
+    }
+  }
+  if (!valid) {
+    fprintf(stderr, "WARN - Ignoring stale gzip checkpoints [%s]\n", path);
+    gzcheck_free(gc);
+    return NULL;
+  }
+
+  return gc;
+}
+
+/* The last point at or before a line */
+int gzcheck_find(const gzcheck_t *gc, size_t line, size_t *point) {
+  size_t lo = 0, hi = gc->count, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (gc->points[mid].line <= line)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0)
+    return FALSE;
+  *point = lo - 1;
+  return TRUE;
+}
+
+void gzcheck_free(gzcheck_t *gc) {
+  if (gc == NULL)
+    return;
+  if (gc->points != NULL)
+    XFREE(gc->points);
+  if (gc->windows != NULL)
+    XFREE(gc->windows);
+  XFREE(gc);
+}
+
+/****
+ *
+ * open a gzip log for reading by line, noting points in build
+ *
+ * NULL without a word when the file will not open or is not gzip, the
+ * caller falls back to gzopen, which reports the one and reads the
+ * other through as it is.
+ *
+ ****/
+
+gzreader_t *gzreader_open(const char *path, gzcheck_t *build) {
+  unsigned char magic[2];
+  gzreader_t *r;
+
+  if ((r = (gzreader_t *)XMALLOC(sizeof(gzreader_t))) == NULL)
+    return NULL;
+  XMEMSET(r, 0, sizeof(gzreader_t));
+  r->build = build;
+  r->pending = -1;
+
+  if ((r->buf = (unsigned char *)XMALLOC(GZCHECK_BUFFER)) == NULL) {
+    XFREE(r);
+    return NULL;
+  }
+  if ((r->fp = fopen(path, "r")) == NULL) {
+    XFREE(r->buf);
+    XFREE(r);
+    return NULL;
+  }
+  if (fread(magic, 1, sizeof(magic), r->fp) != sizeof(magic) || magic[0] != 0x1f || magic[1] != 0x8b ||
+      fseeko(r->fp, 0, SEEK_SET) != 0 || inflateInit2(&r->zs, 15 + 16) != Z_OK) {
+    fclose(r->fp);
+    XFREE(r->buf);
+    XFREE(r);
+    return NULL;
+  }
+
+  return r;
+}
+
+/****
+ *
+ * inflate more of the log, FALSE at its end
+ *
+ * Output goes after the last GZCHECK_WINDOW bytes, which are kept as
+ * the window of a point.  Inflating stops at each block end so a
+ * point can be noted there.  Members follow one another as gzip does,
+ * anything after the last one is ignored.
+ *
+ ****/
+
+static int gzreader_fill(gzreader_t *r) {
+  size_t keep, n, produced;
+  int ret;
+
+  if (GZCHECK_BUFFER - r->have < GZCHECK_OUTPUT / 2 && r->have > GZCHECK_WINDOW) {
+    keep = r->have - GZCHECK_WINDOW;
+    if (r->pos < keep)
+      keep = r->pos;
+    memmove(r->buf, r->buf + keep, r->have - keep);
+    r->pos -= keep;
+    r->have -= keep;
+  }
+
+  while (!r->eof && !r->error) {
+    if (r->zs.avail_in == 0) {
+      if ((n = fread(r->in, 1, sizeof(r->in), r->fp)) == 0) {
+        r->error = ferror(r->fp);
+        r->eof = TRUE;
+        break;
+      }
+      r->read += n;
+      r->zs.next_in = r->in;
+      r->zs.avail_in = (uInt)n;
+    }
+    if (r->skip_in > 0) {
+      n = (r->skip_in < r->zs.avail_in) ? r->skip_in : r->zs.avail_in;
+      r->zs.next_in += n;
+      r->zs.avail_in -= n;
+      r->skip_in -= n;
+      continue;
+    }
+    if (r->member_end) {
+      if (r->zs.next_in[0] != 0x1f) {
+        r->eof = TRUE;
+        break;
+      }
+      r->member_end = FALSE;
+    }
+
+    r->zs.next_out = r->buf + r->have;
+    r->zs.avail_out = (uInt)(GZCHECK_BUFFER - r->have);
+    ret = inflate(&r->zs, Z_BLOCK);
+    produced = GZCHECK_BUFFER - r->have - r->zs.avail_out;
+    r->have += produced;
+    r->out += produced;
+
+    if (ret == Z_STREAM_END) {
+      /* A restarted member has no wrapper to read its trailer */
+      if (r->raw) {
+        r->skip_in = 8;
+        r->raw = FALSE;
+        ret = inflateReset2(&r->zs, 15 + 16);
+      } else
+        ret = inflateReset(&r->zs);
+      r->member_end = TRUE;
+      r->error = ret != Z_OK;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      r->error = TRUE;
+    } else if (r->build != NULL && (r->zs.data_type & 128) && !(r->zs.data_type & 64) &&
+               r->out - r->last >= GZCHECK_SPAN && gzcheck_add(r) != TRUE) {
+      fprintf(stderr, "ERR - Unable to note gzip checkpoint\n");
+      r->error = TRUE;
+    }
+
+    if (produced > 0)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/****
+ *
+ * resume inflating at a point
+ *
+ ****/
+
+int gzreader_seek(gzreader_t *r, const gzcheck_t *gc, size_t point) {
+  const gzpoint_t *p = &gc->points[point];
+  unsigned char window[GZCHECK_WINDOW];
+  uLongf window_len = sizeof(window);
+  off_t start = (off_t)p->in - (p->bits ? 1 : 0);
+  size_t skip, n;
+  int c;
+
+  if (uncompress(window, &window_len, gc->windows + p->window, p->window_len) != Z_OK ||
+      inflateReset2(&r->zs, -15) != Z_OK || fseeko(r->fp, start, SEEK_SET) != 0)
+    return FAILED;
+
+  r->read = (uint64_t)start;
+  if (p->bits) {
+    if ((c = getc(r->fp)) == EOF)
+      return FAILED;
+    r->read++;
+    inflatePrime(&r->zs, (int)p->bits, c >> (8 - p->bits));
+  }
+  if (window_len > 0 && inflateSetDictionary(&r->zs, window, (uInt)window_len) != Z_OK)
+    return FAILED;
+
+  r->zs.avail_in = 0;
+  r->raw = TRUE;
+  r->member_end = r->eof = r->error = FALSE;
+  r->skip_in = 0;
+  r->pos = r->have = 0;
+  r->out = p->out;
+  r->line = p->line - 1;
+
+  /* Pass the end of the line the point fell in */
+  for (skip = p->skip; skip > 0; skip -= n) {
+    if (r->pos == r->have && !gzreader_fill(r))
+      return FAILED;
+    n = (skip < r->have - r->pos) ? skip : r->have - r->pos;
+    r->pos += n;
+  }
+
+  return TRUE;
+}
+
+/****
+ *
+ * read a line as gzgets would, up to size - 1 bytes
+ *
+ ****/
+
+char *gzreader_gets(gzreader_t *r, char *buf, int size) {
+  uint64_t start = r->out - (r->have - r->pos);
+  unsigned char *nl;
+  size_t n = 0, len;
+
+  while (n < (size_t)size - 1) {
+    if (r->pos == r->have && !gzreader_fill(r))
+      break;
+    len = r->have - r->pos;
+    if (len > (size_t)size - 1 - n)
+      len = (size_t)size - 1 - n;
+    if ((nl = memchr(r->buf + r->pos, '\n', len)) != NULL)
+      len = nl - (r->buf + r->pos) + 1;
+    memcpy(buf + n, r->buf + r->pos, len);
+    n += len;
+    r->pos += len;
+    if (nl != NULL)
+      break;
+  }
+  if (n == 0)
+    return NULL;
+  buf[n] = '\0';
+  r->line++;
+
+  /* The first line that starts after a point is where a search resumes */
+  if (r->pending >= 0 && start >= r->build->points[r->pending].out) {
+    r->build->points[r->pending].line = r->line;
+    r->build->points[r->pending].skip = (uint32_t)(start - r->build->points[r->pending].out);
+    r->pending = -1;
+  }
+
+  return buf;
+}
+
+/* A point no line followed is dropped */
+void gzreader_close(gzreader_t *r) {
+  if (r == NULL)
+    return;
+  if (r->pending >= 0) {
+    r->build->count = r->pending;
+    r->build->windows_len = r->build->points[r->pending].window;
+  }
+  inflateEnd(&r->zs);
+  fclose(r->fp);
+  XFREE(r->buf);
+  XFREE(r);
+}
@@ -0,0 +1,114 @@
+/*****
+ *
+ * Description: Gzip Log Checkpoint Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef GZCHECK_H
+#define GZCHECK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <zlib.h>
+#include "../include/common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A .lpg sidecar lets spi start inflating a gzip log part way in, as
+ * zlib's zran example does.  About every GZCHECK_SPAN bytes of output,
+ * at the end of a deflate block, logpi notes where the next block
+ * starts in the compressed file (byte and bit), the 32KB of output
+ * before it that back references can reach, and the first line that
+ * starts after it.  Lines are counted as gzgets returns them, so
+ * their numbers are the ones in the index.  The header records the
+ * size of the compressed log, a sidecar for a log that has changed is
+ * ignored.
+ */
+
+#define GZCHECK_SUFFIX ".lpg"
+#define GZCHECK_MAGIC "LPG1"
+#define GZCHECK_SPAN (16 * 1048576)     /* Output bytes between checkpoints */
+#define GZCHECK_WINDOW 32768            /* Deflate history a restart needs */
+#define GZCHECK_INPUT 65536             /* Compressed bytes read at a time */
+#define GZCHECK_OUTPUT 262144           /* Output inflated at a time */
+
+typedef struct gzcheck_header_s {
+  char magic[4];
+  uint32_t span;
+  uint64_t log_size;            /* Bytes of the compressed log */
+  uint64_t count;               /* Points that follow */
+  uint64_t windows_len;         /* Bytes of compressed windows after the points */
+} gzcheck_header_t;
+
+/* Where inflating can resume, as stored */
+typedef struct gzpoint_s {
+  uint64_t in;                  /* Compressed offset of the next block */
+  uint64_t out;                 /* Output offset there */
+  uint64_t line;                /* First line starting at or after out */
+  uint64_t window;              /* Offset of its deflated window in windows */
+  uint32_t window_len;
+  uint32_t skip;                /* Bytes from out to the start of line */
+  uint32_t bits;                /* Bits of the byte before in not yet used */
+  uint32_t reserved;
+} gzpoint_t;
+
+/* Checkpoints being noted or loaded */
+typedef struct gzcheck_s {
+  gzpoint_t *points;
+  size_t count;
+  size_t capacity;
+  unsigned char *windows;
+  size_t windows_len;
+  size_t windows_size;
+} gzcheck_t;
+
+/* Line reader over a gzip log */
+typedef struct gzreader_s {
+  FILE *fp;
+  z_stream zs;
+  int raw;                      /* Restarted mid member, no gzip wrapper */
+  int member_end;
+  int eof;
+  int error;
+  uint64_t read;                /* Compressed bytes read */
+  uint64_t skip_in;             /* Trailer bytes still to pass */
+  unsigned char in[GZCHECK_INPUT];
+  unsigned char *buf;           /* Recent output, the window then what is unread */
+  size_t pos;
+  size_t have;
+  uint64_t out;                 /* Output offset of buf[have] */
+  uint64_t line;                /* Lines returned */
+  gzcheck_t *build;             /* Points noted while reading, NULL for none */
+  uint64_t last;                /* Output offset of the last point noted */
+  int pending;                  /* Point still waiting for its line, -1 for none */
+} gzreader_t;
+
+/* Function prototypes */
+gzcheck_t *gzcheck_create(void);
+int gzcheck_save(const gzcheck_t *gc, const char *index_path, off_t log_size);
+void gzcheck_remove(const char *index_path);
+gzcheck_t *gzcheck_load(const char *index_path, const char *log_path);
+int gzcheck_find(const gzcheck_t *gc, size_t line, size_t *point);
+void gzcheck_free(gzcheck_t *gc);
+gzreader_t *gzreader_open(const char *path, gzcheck_t *build);
+int gzreader_seek(gzreader_t *r, const gzcheck_t *gc, size_t point);
+char *gzreader_gets(gzreader_t *r, char *buf, int size);
+void gzreader_close(gzreader_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GZCHECK_H */
@@ -34,20 +34,16 @@
 
 #include "hash.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /****
  *
  * local variables
  *
  ****/
 
-/* Prime numbers for hash table sizing */
-static size_t hashPrimes[] = {
-    53, 97, 193, 389, 769, 1543, 3079,
-    6151, 12289, 24593, 49157, 98317, 196613, 393241,
-    786433, 1572869, 3145739, 6291469, 12582917, 25165843, 50331653,
-    100663319, 201326611, 402653189, 805306457, 1610612741, 0
-};
-
 /* FNV-1a hash constants */
 #define FNV_OFFSET_BASIS 2166136261U
 #define FNV_PRIME 16777619U
@@ -59,69 +55,25 @@ static size_t hashPrimes[] = {
 #define XXH_PRIME32_4   0x27D4EB2FU
 #define XXH_PRIME32_5   0x165667B1U
 
-/* Memory pool constants */
-#define POOL_SIZE 1024
+/* Control bytes, a full slot holds the low 7 bits of its hash */
+#define CTRL_EMPTY      ((uint8_t)0x80)
+#define CTRL_DELETED    ((uint8_t)0xFE)
+#define CTRL_IS_FULL(c) (((c) & 0x80) == 0)
+#define CTRL_H2(h)      ((uint8_t)((h) & 0x7F))
+#define PROBE_START(h, mask) ((size_t)((h) >> 7) & (mask))
 
-/****
- *
- * external global variables
- *
- ****/
+/* Old slots moved per hash operation while a grow is in progress */
+#define HASH_MIGRATE_STEP 32
 
-extern Config_t *config;
+#define HASH_MAX_SLOTS ((size_t)1 << (sizeof(size_t) * 8 - 2))
 
 /****
  *
- * Memory pool management
+ * external global variables
  *
  ****/
 
-static struct hashRec_s *allocHashRecord(struct hash_s *hash)
-{
-  struct hashRecPool_s *pool = hash->pools;
-  struct hashRec_s *record;
-  
-  /* Find pool with available space */
-  while (pool && pool->used >= pool->capacity) {
-    pool = pool->next;
-  }
-  
-  /* Create new pool if needed */
-  if (!pool) {
-    if ((pool = (struct hashRecPool_s *)XMALLOC(sizeof(struct hashRecPool_s))) == NULL)
-      return NULL;
-      
-    if ((pool->records = (struct hashRec_s *)XMALLOC(sizeof(struct hashRec_s) * POOL_SIZE)) == NULL) {
-      XFREE(pool);
-      return NULL;
-    }
-    
-    pool->capacity = POOL_SIZE;
-    pool->used = 0;
-    pool->next = hash->pools;
-    hash->pools = pool;
-  }
-  
-  /* Return next available record */
-  record = &pool->records[pool->used++];
-  XMEMSET(record, 0, sizeof(struct hashRec_s));
-  return record;
-}
-
-static void freePools(struct hash_s *hash)
-{
-  struct hashRecPool_s *pool = hash->pools;
-  struct hashRecPool_s *next;
-  
-  while (pool) {
-    next = pool->next;
-    if (pool->records)
-      XFREE(pool->records);
-    XFREE(pool);
-    pool = next;
-  }
-  hash->pools = NULL;
-}
+extern Config_t *config;
 
 /****
  *
@@ -146,6 +98,19 @@ uint32_t calcHashWithLen(const char *keyString, int keyLen)
   return fnv1aHash(keyString, keyLen);
 }
 
+/****
+ *
+ * hash used for every table key
+ *
+ * 64 bits so the probe position and the 7-bit tag never run out of
+ * independent bits, even with billions of slots.
+ *
+ ****/
+
+static ALWAYS_INLINE uint64_t hashKey(const char *keyString, int keyLen) {
+  return xxhash64_small(keyString, (size_t)keyLen, 0);
+}
+
 /****
  *
  * functions
@@ -162,7 +127,7 @@ uint32_t calcHash(uint32_t hashSize, const char *keyString) {
   int32_t val = 0;
   const char *ptr;
   int i, tmp, keyLen = strlen( keyString ) + 1;
-  
+
 #ifdef DEBUG
   if (config->debug >= 3)
     printf("DEBUG - Calculating hash\n");
@@ -185,6 +150,252 @@ uint32_t calcHash(uint32_t hashSize, const char *keyString) {
   return val % hashSize;
 }
 
+/****
+ *
+ * Swiss table layout
+ *
+ * Open addressing over a power-of-two array of slots with one control
+ * byte per slot.  Probes test a whole group of control bytes at once,
+ * 16 with SSE2 or 8 with plain 64-bit arithmetic, so most misses never
+ * touch a slot.  The first group of control bytes is mirrored past the
+ * end of the array so a group load never has to wrap.  Lookups do not
+ * write to the table.
+ *
+ ****/
+
+#ifdef __SSE2__
+
+#define HASH_GROUP_WIDTH 16
+typedef uint32_t groupMask_t;
+#define GROUP_FIRST(bits) __builtin_ctz(bits)
+
+static ALWAYS_INLINE groupMask_t groupMatch(const uint8_t *ctrl, uint8_t h2) {
+  __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+  return (groupMask_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(group, _mm_set1_epi8((char)h2)));
+}
+
+static ALWAYS_INLINE groupMask_t groupMatchEmpty(const uint8_t *ctrl) {
+  return groupMatch(ctrl, CTRL_EMPTY);
+}
+
+/* Empty or deleted, both have the top bit set */
+static ALWAYS_INLINE groupMask_t groupMatchFree(const uint8_t *ctrl) {
+  return (groupMask_t)_mm_movemask_epi8(
+      _mm_loadu_si128((const __m128i *)ctrl));
+}
+
+#else
+
+#define HASH_GROUP_WIDTH 8
+typedef uint64_t groupMask_t;
+#define GROUP_FIRST(bits) (__builtin_ctzll(bits) >> 3)
+#define GROUP_LSBS 0x0101010101010101ULL
+#define GROUP_MSBS 0x8080808080808080ULL
+
+static ALWAYS_INLINE uint64_t loadGroup(const uint8_t *ctrl) {
+  uint64_t group;
+
+  memcpy(&group, ctrl, sizeof(group));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  group = __builtin_bswap64(group);
+#endif
+  return group;
+}
+
+/* May flag a full slot that does not match, never misses one that does */
+static ALWAYS_INLINE groupMask_t groupMatch(const uint8_t *ctrl, uint8_t h2) {
+  uint64_t x = loadGroup(ctrl) ^ (GROUP_LSBS * h2);
+  return (x - GROUP_LSBS) & ~x & GROUP_MSBS;
+}
+
+static ALWAYS_INLINE groupMask_t groupMatchEmpty(const uint8_t *ctrl) {
+  uint64_t group = loadGroup(ctrl);
+  return group & ~(group << 6) & GROUP_MSBS;
+}
+
+static ALWAYS_INLINE groupMask_t groupMatchFree(const uint8_t *ctrl) {
+  return loadGroup(ctrl) & GROUP_MSBS;
+}
+
+#endif
+
+static ALWAYS_INLINE void setCtrl(uint8_t *ctrl, size_t size, size_t i,
+                                  uint8_t c) {
+  ctrl[i] = c;
+  if (i < HASH_GROUP_WIDTH)
+    ctrl[size + i] = c;
+}
+
+static ALWAYS_INLINE struct hashRec_s *findInTable(const uint8_t *ctrl,
+                                                   struct hashRec_s *slots,
+                                                   size_t size,
+                                                   uint64_t hashValue,
+                                                   const char *keyString,
+                                                   int keyLen) {
+  size_t mask = size - 1;
+  size_t pos = PROBE_START(hashValue, mask);
+  size_t stride = 0;
+  groupMask_t bits;
+  struct hashRec_s *rec;
+
+  for (;;) {
+    for (bits = groupMatch(ctrl + pos, CTRL_H2(hashValue)); bits;
+         bits &= bits - 1) {
+      rec = &slots[(pos + GROUP_FIRST(bits)) & mask];
+      if (LIKELY(rec->hashValue == hashValue && rec->keyLen == keyLen &&
+                 memcmp(rec->keyString, keyString, keyLen) == 0))
+        return rec;
+    }
+    if (LIKELY(groupMatchEmpty(ctrl + pos)))
+      return NULL;
+    stride += HASH_GROUP_WIDTH;
+    pos = (pos + stride) & mask;
+  }
+}
+
+static ALWAYS_INLINE size_t findFreeSlot(const uint8_t *ctrl, size_t size,
+                                         uint64_t hashValue) {
+  size_t mask = size - 1;
+  size_t pos = PROBE_START(hashValue, mask);
+  size_t stride = 0;
+  groupMask_t bits;
+
+  while ((bits = groupMatchFree(ctrl + pos)) == 0) {
+    stride += HASH_GROUP_WIDTH;
+    pos = (pos + stride) & mask;
+  }
+  return (pos + GROUP_FIRST(bits)) & mask;
+}
+
+/* Claim a slot in the current table, caller fills in the record */
+static ALWAYS_INLINE struct hashRec_s *claimSlot(struct hash_s *hash,
+                                                 uint64_t hashValue) {
+  size_t i = findFreeSlot(hash->ctrl, hash->size, hashValue);
+
+  if (hash->ctrl[i] == CTRL_EMPTY)
+    hash->growthLeft--;
+  setCtrl(hash->ctrl, hash->size, i, CTRL_H2(hashValue));
+  return &hash->slots[i];
+}
+
+/* Slots move on grow, short keys move with them */
+static ALWAYS_INLINE void moveRecord(struct hashRec_s *dst,
+                                     const struct hashRec_s *src) {
+  *dst = *src;
+  if (src->keyString == src->inlineKey)
+    dst->keyString = dst->inlineKey;
+}
+
+static int allocTable(size_t size, uint8_t **ctrl, struct hashRec_s **slots) {
+  if ((*ctrl = (uint8_t *)XMALLOC(size + HASH_GROUP_WIDTH)) == NULL)
+    return FAILED;
+  XMEMSET(*ctrl, CTRL_EMPTY, size + HASH_GROUP_WIDTH);
+
+  if ((*slots = (struct hashRec_s *)XMALLOC(sizeof(struct hashRec_s) * size)) ==
+      NULL) {
+    XFREE(*ctrl);
+    return FAILED;
+  }
+  return TRUE;
+}
+
+/* Bytes used by the ctrl and slot arrays of a table with size slots */
+static ALWAYS_INLINE size_t tableBytes(size_t size) {
+  return size + HASH_GROUP_WIDTH + size * sizeof(struct hashRec_s);
+}
+
+/****
+ *
+ * Incremental growth
+ *
+ * dyGrowHash() only swaps in a table twice the size and keeps the old
+ * one.  Every later lookup or insert moves a few old slots into the new
+ * table and leaves a tombstone behind, so probes in the old table still
+ * run past it.  A key is always in exactly one of the two tables.
+ *
+ ****/
+
+static void migrateHashSlots(struct hash_s *hash, size_t count) {
+  struct hashRec_s *src;
+  size_t i;
+
+  while (count-- > 0 && hash->migratePos < hash->oldSize) {
+    i = hash->migratePos++;
+    if (!CTRL_IS_FULL(hash->oldCtrl[i]))
+      continue;
+    src = &hash->oldSlots[i];
+    moveRecord(claimSlot(hash, src->hashValue), src);
+    setCtrl(hash->oldCtrl, hash->oldSize, i, CTRL_DELETED);
+  }
+
+  if (hash->migratePos >= hash->oldSize) {
+#ifdef DEBUG
+    if (config->debug >= 2)
+      printf("DEBUG - Finished migrating %zu slots\n", hash->oldSize);
+#endif
+    XFREE(hash->oldCtrl);
+    XFREE(hash->oldSlots);
+    hash->oldCtrl = NULL;
+    hash->oldSlots = NULL;
+    hash->oldSize = hash->migratePos = 0;
+  }
+}
+
+void finishHashMigration(struct hash_s *hash) {
+  if (hash != NULL && hash->oldSlots != NULL)
+    migrateHashSlots(hash, hash->oldSize);
+}
+
+static ALWAYS_INLINE struct hashRec_s *findRecord(struct hash_s *hash,
+                                                  uint64_t hashValue,
+                                                  const char *keyString,
+                                                  int keyLen) {
+  struct hashRec_s *rec;
+
+  rec = findInTable(hash->ctrl, hash->slots, hash->size, hashValue, keyString,
+                    keyLen);
+  if (rec == NULL && UNLIKELY(hash->oldSlots != NULL))
+    rec = findInTable(hash->oldCtrl, hash->oldSlots, hash->oldSize, hashValue,
+                      keyString, keyLen);
+  return rec;
+}
+
+/****
+ *
+ * grow a full table, honouring its memory budget
+ *
+ * A grow needs the doubled table plus the old one until the migration
+ * is done.  If that would pass memLimit the table is first packed to
+ * 15/16 load, which costs longer probes but no memory.  Only when that
+ * is also used up does it grow past the budget, with a warning.
+ *
+ ****/
+
+static void growWithinBudget(struct hash_s *hash) {
+  if (hash->memLimit > 0 &&
+      getHashMemory(hash) + tableBytes(hash->size * 2) > hash->memLimit) {
+    if (!hash->packed) {
+      hash->packed = TRUE;
+      hash->growthLeft += hash->size / 16;
+#ifdef DEBUG
+      if (config->debug >= 2)
+        printf("DEBUG - Hash at memory limit, packing %zu slots\n", hash->size);
+#endif
+      return;
+    }
+    if (!hash->overBudget) {
+      hash->overBudget = TRUE;
+      fprintf(stderr,
+              "WARN - Address table passed its %zu MB memory limit, continuing "
+              "over budget\n",
+              hash->memLimit >> 20);
+    }
+  }
+
+  dyGrowHash(hash);
+}
+
 /****
  *
  * empty the hash table
@@ -192,141 +403,74 @@ uint32_t calcHash(uint32_t hashSize, const char *keyString) {
  ****/
 
 void freeHash(struct hash_s *hash) {
-  uint32_t key;
-  struct hashRec_s *record, *next;
-  
   if (hash == NULL)
     return;
-    
-  /* Free bucket chains and key strings */
-  if (hash->buckets != NULL) {
-    for (key = 0; key < hash->size; key++) {
-      record = hash->buckets[key];
-      while (record) {
-        next = record->next;
-        if (record->keyString)
-          XFREE(record->keyString);
-        record = next;
-      }
-    }
-    XFREE(hash->buckets);
+
+  /* Long keys and anything callers put in the arena go in one shot */
+  mempool_destroy(hash->arena);
+
+  XFREE(hash->ctrl);
+  XFREE(hash->slots);
+  if (hash->oldSlots != NULL) {
+    XFREE(hash->oldCtrl);
+    XFREE(hash->oldSlots);
   }
-  
-  /* Free memory pools */
-  freePools(hash);
-  
+
   XFREE(hash);
 }
 
 /****
  *
- * traverse all hash records, calling func() for each one
+ * step through every record, *cursor starts at 0
  *
  ****/
 
-int traverseHash(const struct hash_s *hash,
-                 int (*fn)(const struct hashRec_s *hashRec)) {
-  uint32_t bucket;
-  struct hashRec_s *record;
-  
-  if (!hash || !fn)
-    return FAILED;
-    
-#ifdef DEBUG
-  if (config->debug >= 3)
-    printf("DEBUG - Traversing hash table\n");
-#endif
-  
-  /* Traverse all buckets and their chains */
-  for (bucket = 0; bucket < hash->size; bucket++) {
-    record = hash->buckets[bucket];
-    while (record) {
-      if (fn(record))
-        return FAILED;
-      record = record->next;
+struct hashRec_s *nextHashRecord(const struct hash_s *hash, size_t *cursor) {
+  size_t i;
+
+  for (i = *cursor; i < hash->size; i++) {
+    if (CTRL_IS_FULL(hash->ctrl[i])) {
+      *cursor = i + 1;
+      return &hash->slots[i];
     }
   }
-  
-  return TRUE;
+
+  /* Then whatever has not been migrated out of the pre-grow table */
+  for (; i < (size_t)hash->size + hash->oldSize; i++) {
+    if (CTRL_IS_FULL(hash->oldCtrl[i - hash->size])) {
+      *cursor = i + 1;
+      return &hash->oldSlots[i - hash->size];
+    }
+  }
+
+  *cursor = i;
+  return NULL;
 }
 
 /****
  *
- * add a record to the hash
+ * traverse all hash records, calling func() for each one
  *
  ****/
 
-int addHashRec(struct hash_s *hash, uint32_t key, char *keyString, void *data,
-               time_t lastSeen) {
-  struct hashRec_s *tmpHashRec;
-  struct hashRec_s *curHashRec;
-  int tmpDepth = 0;
+int traverseHash(const struct hash_s *hash,
+                 int (*fn)(const struct hashRec_s *hashRec)) {
+  struct hashRec_s *record;
+  size_t cursor = 0;
+
+  if (!hash || !fn)
+    return FAILED;
 
 #ifdef DEBUG
   if (config->debug >= 3)
-    printf("DEBUG - Adding hash [%d] (%s)\n", key, keyString);
+    printf("DEBUG - Traversing hash table\n");
 #endif
 
-  if (hash->buckets[key] EQ NULL) {
-    /* nope, add it in the current slot */
-    if ((hash->buckets[key] =
-             (struct hashRec_s *)XMALLOC(sizeof(struct hashRec_s))) EQ NULL) {
-      fprintf(stderr, "ERR - Unable to allocate space for hash\n");
-      return FAILED;
-    }
-    XMEMSET((struct hashRec_s *)hash->buckets[key], 0,
-            sizeof(struct hashRec_s));
-    if ((hash->buckets[key]->keyString = (char *)XMALLOC(strlen(keyString) + 1))
-            EQ NULL) {
-      fprintf(stderr, "ERR - Unable to allocate space for hash label\n");
-      XFREE(hash->buckets[key]);
+  while ((record = nextHashRecord(hash, &cursor)) != NULL) {
+    if (fn(record))
       return FAILED;
-    }
-    XSTRCPY(hash->buckets[key]->keyString, keyString);
-    hash->buckets[key]->data = data;
-    hash->buckets[key]->lastSeen = hash->buckets[key]->createTime = lastSeen;
-    tmpDepth++;
-  } else {
-    /* yup, traverse the linked list and stick it at the end */
-
-    /* XXX we should make this dynamically optimizing, so the most accessed is
-     * at the top of the list */
-
-    /* advance to the end of the chain */
-    curHashRec = hash->buckets[key];
-    while (curHashRec != NULL) {
-      if (curHashRec->next != NULL) {
-        curHashRec = curHashRec->next;
-        tmpDepth++;
-      } else {
-        /* at the end of the chain */
-        if ((curHashRec->next = (struct hashRec_s *)XMALLOC(
-                 sizeof(struct hashRec_s))) EQ NULL) {
-          fprintf(stderr, "ERR - Unable to allocate space for hash\n");
-          return FAILED;
-        }
-        XMEMSET((struct hashRec_s *)curHashRec->next, 0,
-                sizeof(struct hashRec_s));
-        if ((curHashRec->next->keyString =
-                 (char *)XMALLOC(strlen(keyString) + 1)) EQ NULL) {
-          fprintf(stderr, "ERR - Unable to allocate space for hash label\n");
-          XFREE(curHashRec->next);
-          curHashRec->next = NULL;
-          return FAILED;
-        }
-        XSTRCPY(curHashRec->next->keyString, keyString);
-        curHashRec->next->data = data;
-        curHashRec->next->lastSeen = curHashRec->next->createTime = lastSeen;
-        curHashRec = NULL;
-      }
-    }
   }
 
-  if (hash->maxDepth < tmpDepth)
-    hash->maxDepth = tmpDepth;
-
-  hash->totalRecords++;
-
   return TRUE;
 }
 
@@ -336,100 +480,98 @@ int addHashRec(struct hash_s *hash, uint32_t key, char *keyString, void *data,
  *
  ****/
 
-int addUniqueHashRec(struct hash_s *hash, const char *keyString, int keyLen,
-                     void *data) {
-  uint32_t hashValue;
-  uint32_t bucket;
-  struct hashRec_s *record, *newRecord;
-  uint16_t depth = 0;
-  
-  if (!hash || !keyString)
-    return FAILED;
-    
-  if (keyLen == 0)
-    keyLen = strlen(keyString) + 1;
-    
-  /* Inline xxhash for better performance */
-  if (LIKELY(keyLen <= 32)) {
-    const uint8_t* p = (const uint8_t*)keyString;
-    const uint8_t* end = p + keyLen;
-    uint32_t h32 = XXH_PRIME32_5 + (uint32_t)keyLen;
-    
-    while (p + 4 <= end) {
-      h32 += (*(uint32_t*)p) * XXH_PRIME32_3;
-      h32 = ((h32 << 17) | (h32 >> 15)) * XXH_PRIME32_4;
-      p += 4;
-    }
-    
-    while (p < end) {
-      h32 += (*p++) * XXH_PRIME32_5;
-      h32 = ((h32 << 11) | (h32 >> 21)) * XXH_PRIME32_1;
-    }
-    
-    h32 ^= h32 >> 15;
-    h32 *= XXH_PRIME32_2;
-    h32 ^= h32 >> 13;
-    h32 *= XXH_PRIME32_3;
-    h32 ^= h32 >> 16;
-    
-    hashValue = h32;
-  } else {
-    hashValue = fnv1aHash(keyString, keyLen);
-  }
-  bucket = hashValue % hash->size;
-  
-  /* Check for existing record */
-  record = hash->buckets[bucket];
-  while (record) {
-    if (record->hashValue == hashValue &&
-        record->keyLen == keyLen &&
-        XMEMCMP(record->keyString, keyString, keyLen) == 0) {
-      /* Found existing record - update access time */
-      record->lastSeen = config->current_time;
-      record->accessCount++;
-      return FAILED; /* Duplicate */
+static struct hashRec_s *insertRecord(struct hash_s *hash,
+                                      const char *keyString, int keyLen,
+                                      uint64_t hashValue, void *data) {
+  struct hashRec_s *newRecord;
+  char *longKey = NULL;
+
+  /* Keep the load at or under 7/8 so every probe ends at an empty slot */
+  if (UNLIKELY(hash->growthLeft == 0)) {
+    growWithinBudget(hash);
+    if (hash->growthLeft == 0) {
+      fprintf(stderr, "ERR - Hash table full (%zu slots)\n", hash->size);
+      return NULL;
     }
-    record = record->next;
-    depth++;
-  }
-  
-  /* Allocate new record from pool */
-  if ((newRecord = allocHashRecord(hash)) == NULL) {
-    fprintf(stderr, "ERR - Unable to allocate hash record\n");
-    return FAILED;
   }
-  
-  /* Allocate and copy key string */
-  if ((newRecord->keyString = (char *)XMALLOC(keyLen)) == NULL) {
+
+  /* Short keys live in the slot itself, long ones in the table's arena */
+  if (keyLen > HASH_INLINE_KEY &&
+      (longKey = (char *)mempool_alloc_fast(hash->arena, keyLen)) == NULL) {
     fprintf(stderr, "ERR - Unable to allocate key string\n");
-    return FAILED;
+    return NULL;
   }
-  XMEMCPY(newRecord->keyString, (void *)keyString, keyLen);
-  
+
+  newRecord = claimSlot(hash, hashValue);
+  newRecord->keyString = (longKey != NULL) ? longKey : newRecord->inlineKey;
+  memcpy(newRecord->keyString, keyString, keyLen);
+
   /* Initialize record */
   newRecord->keyLen = keyLen;
   newRecord->hashValue = hashValue;
   newRecord->data = data;
-  newRecord->lastSeen = newRecord->createTime = config->current_time;
-  newRecord->accessCount = 1;
-  newRecord->modifyCount = 0;
-  
-  /* Add to front of bucket chain */
-  newRecord->next = hash->buckets[bucket];
-  hash->buckets[bucket] = newRecord;
-  
+
   /* Update statistics */
   hash->totalRecords++;
-  if (depth > hash->maxDepth)
-    hash->maxDepth = depth;
-    
+
 #ifdef DEBUG
   if (config->debug >= 4)
-    printf("DEBUG - Added hash record [bucket:%u, depth:%u, total:%u]\n", 
-           bucket, depth, hash->totalRecords);
+    printf("DEBUG - Added hash record [total:%zu]\n", hash->totalRecords);
 #endif
-  
-  return TRUE;
+
+  return newRecord;
+}
+
+int addUniqueHashRec(struct hash_s *hash, const char *keyString, int keyLen,
+                     void *data) {
+  uint64_t hashValue;
+
+  if (!hash || !keyString)
+    return FAILED;
+
+  if (keyLen == 0)
+    keyLen = strlen(keyString) + 1;
+
+  hashValue = hashKey(keyString, keyLen);
+
+  if (UNLIKELY(hash->oldSlots != NULL))
+    migrateHashSlots(hash, HASH_MIGRATE_STEP);
+
+  /* Check for existing record */
+  if (findRecord(hash, hashValue, keyString, keyLen) != NULL)
+    return FAILED; /* Duplicate */
+
+  return (insertRecord(hash, keyString, keyLen, hashValue, data) != NULL)
+             ? TRUE
+             : FAILED;
+}
+
+/****
+ *
+ * add a record under a hash from getKeyHash() unless the key exists
+ *
+ * Returns the data now stored for the key, which is the caller's data
+ * only if it was added.  NULL if the insert failed.
+ *
+ ****/
+
+void *getOrAddHashData(struct hash_s *hash, const char *keyString, int keyLen,
+                       uint64_t hashValue, void *data) {
+  struct hashRec_s *record;
+
+  if (UNLIKELY(!hash || !keyString))
+    return NULL;
+
+  if (UNLIKELY(hash->oldSlots != NULL))
+    migrateHashSlots(hash, HASH_MIGRATE_STEP);
+
+  if ((record = findRecord(hash, hashValue, keyString, keyLen)) != NULL)
+    return record->data;
+
+  if ((record = insertRecord(hash, keyString, keyLen, hashValue, data)) ==
+      NULL)
+    return NULL;
+  return record->data;
 }
 
 /****
@@ -438,735 +580,650 @@ int addUniqueHashRec(struct hash_s *hash, const char *keyString, int keyLen,
  *
  ****/
 
-struct hash_s *initHash(uint32_t hashSize) {
+struct hash_s *initHash(size_t hashSize) {
   struct hash_s *tmpHash;
-  int i;
-  
+  size_t size = HASH_GROUP_WIDTH;
+
   if ((tmpHash = (struct hash_s *)XMALLOC(sizeof(struct hash_s))) == NULL) {
     fprintf(stderr, "ERR - Unable to allocate hash\n");
     return NULL;
   }
   XMEMSET(tmpHash, 0, sizeof(struct hash_s));
-  
-  /* Pick a good prime hash size */
-  for (i = 0; ((hashSize > hashPrimes[i]) && (hashPrimes[i] > 0)); i++)
-    ;
-  
-  if (hashPrimes[i] == 0) {
-    fprintf(stderr, "ERR - Hash size too large\n");
+
+  /* Power of two slots */
+  while (size < hashSize && size < HASH_MAX_SLOTS)
+    size <<= 1;
+
+  if ((tmpHash->arena = mempool_create()) == NULL) {
+    fprintf(stderr, "ERR - Unable to allocate hash arena\n");
     XFREE(tmpHash);
     return NULL;
   }
-  
-  tmpHash->primeOff = i;
-  tmpHash->size = hashPrimes[i];
-  
-  /* Allocate bucket array */
-  if ((tmpHash->buckets = (struct hashRec_s **)XMALLOC(
-           sizeof(struct hashRec_s *) * tmpHash->size)) == NULL) {
-    fprintf(stderr, "ERR - Unable to allocate hash buckets\n");
+
+  if (allocTable(size, &tmpHash->ctrl, &tmpHash->slots) != TRUE) {
+    fprintf(stderr, "ERR - Unable to allocate hash slots\n");
+    mempool_destroy(tmpHash->arena);
     XFREE(tmpHash);
     return NULL;
   }
-  XMEMSET(tmpHash->buckets, 0, sizeof(struct hashRec_s *) * tmpHash->size);
-  
-  tmpHash->pools = NULL;
+
+  tmpHash->size = size;
+  tmpHash->growthLeft = size - size / 8;
   tmpHash->totalRecords = 0;
-  tmpHash->maxDepth = 0;
-  
+
 #ifdef DEBUG
   if (config->debug >= 4)
-    printf("DEBUG - Hash initialized [%u]\n", tmpHash->size);
+    printf("DEBUG - Hash initialized [%zu]\n", tmpHash->size);
 #endif
-  
+
   return tmpHash;
 }
 
 /****
  *
- * find a hash
+ * find a hash record, never modifies the record
  *
  ****/
 
-uint32_t searchHash(struct hash_s *hash, const char *keyString) {
-  struct hashRec_s *tmpHashRec = NULL;
-//  uint32_t key = calcHash(hash->size, keyString);
-  uint32_t key;
-  int depth = 0;
-  int keyLen = strlen(keyString)+1;
-  int i, tmp;
-  int32_t val = 0;
-  
-  /* generate the lookup hash */
-  for (i = 0; i < keyLen; i++) {
-    val = (val << 4) + (keyString[i] & 0xff);
-    if ((tmp = (val & 0xf0000000))) {
-      val = val ^ (tmp >> 24);
-      val = val ^ tmp;
-    }
-  }
-  key = val % hash->size;
-  
-#ifdef DEBUG
-  if (config->debug >= 3)
-    printf("DEBUG - Searching for (%s) in hash table at [%d]\n",
-           (char *)keyString, key);
-#endif
+struct hashRec_s *getHashRecord(struct hash_s *hash, const void *keyString) {
+  int keyLen;
 
-  /* check to see if the hash slot is allocated */
-  if (hash->buckets[key] EQ NULL) {
-    /* empty hash slot */
-#ifdef DEBUG
-    if (config->debug >= 5)
-      printf("DEBUG - (%s) not found in hash table\n", (char *)keyString);
-#endif
-    return hash->size + 1;
-  }
+  if (UNLIKELY(!hash || !keyString))
+    return NULL;
 
-  /* XXX switch to a single while loop */
-  tmpHashRec = hash->buckets[key];
-  while (tmpHashRec != NULL) {
-    if (tmpHashRec->keyLen EQ keyLen) {
-      if (strcmp((char *)tmpHashRec->keyString, (char *)keyString) EQ 0) {
-#ifdef DEBUG
-        if (config->debug >= 5)
-          printf("DEBUG - Found (%s) in hash table at [%d] at depth [%d]\n",
-                 (char *)keyString, key, depth);
-#endif
-        tmpHashRec->lastSeen = time(NULL);
-        tmpHashRec->accessCount++;
-        return key;
-      }
-    }
-    tmpHashRec = tmpHashRec->next;
-  }
+  keyLen = strlen(keyString) + 1;
 
-#ifdef DEBUG
-  if (config->debug >= 4)
-    printf("DEBUG - (%s) not found in hash table\n", (char *)keyString);
-#endif
+  if (UNLIKELY(hash->oldSlots != NULL))
+    migrateHashSlots(hash, HASH_MIGRATE_STEP);
 
-  return hash->size + 1;
+  return findRecord(hash, hashKey(keyString, keyLen), keyString, keyLen);
 }
 
 /****
  *
- * get hash record pointer
+ * hash a key for getHashDataBatch() and getOrAddHashData()
  *
  ****/
 
-/* Optimized inline version for hot path */
-static inline struct hashRec_s *getHashRecord_fast(struct hash_s *hash, 
-                                                   const void *keyString, 
-                                                   int keyLen,
-                                                   uint32_t hashValue) {
-  uint32_t bucket = hashValue % hash->size;
-  struct hashRec_s *record = hash->buckets[bucket];
-  
-  /* Prefetch bucket data for better cache performance */
-  __builtin_prefetch(record, 0, 3);
-  
-  while (record) {
-    /* Check hash value first (fastest comparison) */
-    if (record->hashValue == hashValue &&
-        record->keyLen == keyLen &&
-        XMEMCMP(record->keyString, keyString, keyLen) == 0) {
-      /* Found record - update access info */
-      record->lastSeen = config->current_time;
-      record->accessCount++;
-      return record;
-    }
-    record = record->next;
-    /* Prefetch next record for better cache locality */
-    if (record) __builtin_prefetch(record, 0, 3);
-  }
-  
-  return NULL; /* Not found */
+uint64_t getKeyHash(const char *keyString, int keyLen) {
+  return hashKey(keyString, keyLen);
 }
 
-struct hashRec_s *getHashRecord(struct hash_s *hash, const void *keyString) {
-  uint32_t hashValue;
-  uint32_t bucket;
+/****
+ *
+ * look up a batch of keys
+ *
+ * Every key's first control group and slot is prefetched before any of
+ * them is probed, so the cache misses overlap instead of being taken
+ * one after another.  keys[].hashValue must already be set, keys[].data
+ * is set to the stored data or NULL.  Only data is returned because a
+ * later insert may move records, the data pointers stay valid.
+ *
+ ****/
+
+void getHashDataBatch(struct hash_s *hash, struct hashKey_s *keys, int count) {
   struct hashRec_s *record;
-  int keyLen;
-  const uint8_t* p;
-  const uint8_t* end;
-  uint32_t h32;
-  
-  if (UNLIKELY(!hash || !keyString))
-    return NULL;
-    
-  /* Fast string length calculation */
-  keyLen = strlen(keyString) + 1;
-  
-  /* Use the same hash algorithm as addUniqueHashRec */
-  if (LIKELY(keyLen <= 32)) {
-    const uint8_t* p = (const uint8_t*)keyString;
-    const uint8_t* end = p + keyLen;
-    uint32_t h32 = XXH_PRIME32_5 + (uint32_t)keyLen;
-    
-    while (p + 4 <= end) {
-      h32 += (*(uint32_t*)p) * XXH_PRIME32_3;
-      h32 = ((h32 << 17) | (h32 >> 15)) * XXH_PRIME32_4;
-      p += 4;
-    }
-    
-    while (p < end) {
-      h32 += (*p++) * XXH_PRIME32_5;
-      h32 = ((h32 << 11) | (h32 >> 21)) * XXH_PRIME32_1;
-    }
-    
-    h32 ^= h32 >> 15;
-    h32 *= XXH_PRIME32_2;
-    h32 ^= h32 >> 13;
-    h32 *= XXH_PRIME32_3;
-    h32 ^= h32 >> 16;
-    
-    hashValue = h32;
-  } else {
-    hashValue = fnv1aHash(keyString, keyLen);
+  size_t mask, pos;
+  int i;
+
+  if (UNLIKELY(!hash || !keys))
+    return;
+
+  if (UNLIKELY(hash->oldSlots != NULL))
+    migrateHashSlots(hash, HASH_MIGRATE_STEP);
+
+  mask = hash->size - 1;
+  for (i = 0; i < count; i++) {
+    pos = PROBE_START(keys[i].hashValue, mask);
+    __builtin_prefetch(hash->ctrl + pos, 0, 3);
+    __builtin_prefetch(&hash->slots[pos], 0, 3);
   }
-  
-  /* Use simple modulo to match addUniqueHashRec */
-  bucket = hashValue % hash->size;
-  
-  record = hash->buckets[bucket];
-  
-  /* Prefetch bucket data */
-  __builtin_prefetch(record, 0, 3);
-  
-  /* Hot loop - optimized for common case of short chains */
-  while (record) {
-    /* Most likely path: different hash values */
-    if (LIKELY(record->hashValue != hashValue)) {
-      record = record->next;
-      continue;
-    }
-    
-    /* Hash matches, check length */
-    if (LIKELY(record->keyLen == keyLen)) {
-      /* Length matches, do final comparison */
-      if (LIKELY(XMEMCMP(record->keyString, keyString, keyLen) == 0)) {
-        /* Found! Update stats and return */
-        record->lastSeen = config->current_time;
-        record->accessCount++;
-        return record;
-      }
-    }
-    
-    record = record->next;
+
+  for (i = 0; i < count; i++) {
+    record = findRecord(hash, keys[i].hashValue, keys[i].keyString,
+                        keys[i].keyLen);
+    keys[i].data = (record != NULL) ? record->data : NULL;
   }
-  
-  return NULL; /* Not found */
 }
 
 /****
  *
- * snoop hash record pointer with precomputed key
+ * get data in hash record
  *
  ****/
 
-inline struct hashRec_s *snoopHashRecWithKey(struct hash_s *hash,
-                                             const char *keyString, int keyLen,
-                                             uint32_t key) {
+void *getHashData(struct hash_s *hash, const void *keyString) {
   struct hashRec_s *tmpHashRec;
-  const char *ptr;
-  int depth = 0;
-#ifdef DEBUG
-  char oBuf[4096];
-  char nBuf[4096];
-#endif
-
-#ifdef DEBUG
-  if (config->debug >= 3)
-    printf("DEBUG - Searching for [%s]\n",
-           hexConvert(keyString, keyLen, nBuf, sizeof(nBuf)));
-#endif
-
-  // if ( keyLen EQ 0 )
-  //  keyLen = strlen( keyString );
-
-  /* XXX switch to a single while loop */
 
-  tmpHashRec = hash->buckets[key];
-  while (tmpHashRec != NULL) {
-    if (bcmp(tmpHashRec->keyString, keyString, keyLen) EQ 0) {
-#ifdef DEBUG
-      if (config->debug >= 4)
-        printf("DEBUG - Found (%s) in hash table at [%d] at depth [%d] [%s]\n",
-               hexConvert(keyString, keyLen, nBuf, sizeof(nBuf)), key, depth,
-               hexConvert(tmpHashRec->keyString, tmpHashRec->keyLen, oBuf,
-                          sizeof(oBuf)));
-#endif
-      return tmpHashRec;
-    }
-    tmpHashRec = tmpHashRec->next;
-    depth++;
-  }
-
-  return NULL;
+  if ((tmpHashRec = getHashRecord(hash, keyString)) == NULL)
+    return NULL;
+  return tmpHashRec->data;
 }
 
 /****
  *
- * snoop hash record pointer
+ * dynamic hash grow
+ *
+ * Doubles the table and starts an incremental migration, see
+ * migrateHashSlots().  The hash is grown in place and returned so
+ * existing callers keep working.
  *
  ****/
 
-struct hashRec_s *snoopHashRecord(struct hash_s *hash, const char *keyString,
-                                  int keyLen) {
-  uint32_t key;
-  int depth = 0;
-  struct hashRec_s *tmpHashRec;
-  uint32_t val = 0;
-  const char *ptr;
-  char oBuf[4096];
-  char nBuf[4096];
-  int i = 0;
+struct hash_s *dyGrowHash(struct hash_s *oldHash) {
+  uint8_t *newCtrl;
+  struct hashRec_s *newSlots;
 
-#ifdef DEBUG
-  if (config->debug >= 3)
-    printf("DEBUG - Searching for [%s]\n",
-           hexConvert(keyString, keyLen, nBuf, sizeof(nBuf)));
-#endif
+  if (!oldHash || oldHash->size >= HASH_MAX_SLOTS)
+    return oldHash;
 
-  if (keyLen EQ 0)
-    keyLen = strlen(keyString);
+  /* Only one migration at a time */
+  finishHashMigration(oldHash);
 
-  /* generate the lookup hash */
-  for (i = 0; i < keyLen; i++) {
-    int tmp;
-    val = (val << 4) + (keyString[i] & 0xff);
-    if ((tmp = (val & 0xf0000000))) {
-      val = val ^ (tmp >> 24);
-      val = val ^ tmp;
-    }
+  if (allocTable(oldHash->size * 2, &newCtrl, &newSlots) != TRUE) {
+    fprintf(stderr, "ERR - Unable to allocate new hash slots\n");
+    return oldHash;
   }
-  key = val % hash->size;
 
-  /* XXX switch to a single while loop */
+  oldHash->oldCtrl = oldHash->ctrl;
+  oldHash->oldSlots = oldHash->slots;
+  oldHash->oldSize = oldHash->size;
+  oldHash->migratePos = 0;
+  oldHash->ctrl = newCtrl;
+  oldHash->slots = newSlots;
+  oldHash->size = oldHash->size * 2;
+  oldHash->growthLeft = oldHash->size - oldHash->size / 8;
+  oldHash->packed = FALSE;
 
-  tmpHashRec = hash->buckets[key];
-  while (tmpHashRec != NULL) {
-    if (bcmp(tmpHashRec->keyString, keyString, keyLen) EQ 0) {
 #ifdef DEBUG
-      if (config->debug >= 4)
-        printf("DEBUG - Found (%s) in hash table at [%d] at depth [%d] [%s]\n",
-               hexConvert(keyString, keyLen, nBuf, sizeof(nBuf)), key, depth,
-               hexConvert(tmpHashRec->keyString, tmpHashRec->keyLen, oBuf,
-                          sizeof(oBuf)));
+  if (config->debug >= 2)
+    printf("DEBUG - Growing hash from %zu to %zu slots\n", oldHash->oldSize, oldHash->size);
 #endif
-      return tmpHashRec;
-    }
-    depth++;
-    tmpHashRec = tmpHashRec->next;
-  }
 
-  return NULL;
+  return oldHash;
 }
 
 /****
  *
- * get data in hash record
+ * remove hash record
  *
  ****/
 
-void *getHashData(struct hash_s *hash, const void *keyString) {
-  uint32_t key = calcHash(hash->size, keyString);
-  struct hashRec_s *tmpHashRec;
+void *deleteHashRecord(struct hash_s *hash, const char *keyString, int keyLen) {
+  struct hashRec_s *record;
+  void *data;
 
-  return getDataByKey(hash, key, (void *)keyString);
-}
+  if (!hash || !keyString)
+    return NULL;
 
-void *getDataByKey(struct hash_s *hash, uint32_t key, void *keyString) {
-  int depth = 0;
-  struct hashRec_s *tmpHashRec;
+  if (keyLen == 0)
+    keyLen = strlen(keyString) + 1;
+
+  /* Tombstones are only ever written to the current table */
+  finishHashMigration(hash);
+
+  if ((record = findInTable(hash->ctrl, hash->slots, hash->size,
+                            hashKey(keyString, keyLen), keyString, keyLen)) ==
+      NULL)
+    return NULL;
 
 #ifdef DEBUG
   if (config->debug >= 3)
-    printf("DEBUG - Getting data from hash table\n");
+    printf("DEBUG - Removing hash record\n");
 #endif
 
-  tmpHashRec = hash->buckets[key];
-  while (tmpHashRec != NULL) {
-    if (strcmp(tmpHashRec->keyString, (char *)keyString) EQ 0) {
-#ifdef DEBUG
-      if (config->debug >= 4)
-        printf("DEBUG - Found (%s) in hash table at [%d] at depth [%d]\n",
-               (char *)keyString, key, depth);
-#endif
-      /* XXX would be faster with a global current time updated periodically */
-      tmpHashRec->lastSeen = time(NULL);
-      tmpHashRec->accessCount++;
-      return tmpHashRec->data;
-    }
-    depth++;
-    tmpHashRec = tmpHashRec->next;
-  }
+  /* A long key stays in the arena until the table is freed */
+  data = record->data;
+  setCtrl(hash->ctrl, hash->size, (size_t)(record - hash->slots), CTRL_DELETED);
+  hash->totalRecords--;
 
-  return NULL;
+  return data;
 }
 
 /****
  *
- * dump the hash
+ * print key string in hex (just in case it is not ascii)
  *
  ****/
 
-void dumpHash(struct hash_s *hash) {
-  uint32_t key = 0;
-  int count = 0;
-  struct hashRec_s *tmpHashRec;
+char *hexConvert(const char *keyString, int keyLen, char *buf,
+                 const int bufLen) {
+  int i;
+  char *ptr = buf;
+  for (i = 0; i < keyLen & i < (bufLen / 2) - 1; i++) {
+    snprintf(ptr, bufLen, "%02x", keyString[i] & 0xff);
+    ptr += 2;
+  }
+  return buf;
+}
 
-  for (key = 0; key < hash->size; key++) {
-    tmpHashRec = hash->buckets[key];
-    while (tmpHashRec != NULL) {
-      if (tmpHashRec->keyString != NULL) {
-        // fprintf( stderr, "%d: %s\n", key, tmpHashRec->keyString );
-        count++;
-      }
-      tmpHashRec = tmpHashRec->next;
-    }
+/****
+ *
+ * print key string in hex (just in case it is not ascii)
+ *
+ ****/
+
+char *utfConvert(const char *keyString, int keyLen, char *buf,
+                 const int bufLen) {
+  int i;
+  char *ptr = buf;
+  /* XXX should check for buf len */
+  for (i = 0; i < (keyLen / 2); i++) {
+    buf[i] = keyString[(i * 2)];
   }
+  buf[i] = '\0';
 
-  // fprintf( stderr, "%d total items\n", count );
+  return buf;
 }
 
 /****
  *
- * grow the hash
+ * return size of hash
  *
  ****/
 
-struct hash_s *growHash(struct hash_s *oldHash, size_t newHashSize) {
-  return NULL;
+size_t getHashSize(struct hash_s *hash) {
+  if (hash != NULL)
+    return hash->size;
+  return FAILED;
 }
 
 /****
  *
- * shrink the hash
+ * return the bytes held by the table arrays and its arena
  *
  ****/
 
-struct hash_s *shrinkHash(struct hash_s *oldHash, size_t newHashSize) {
-  return NULL;
+size_t getHashMemory(const struct hash_s *hash) {
+  if (hash == NULL)
+    return 0;
+  return tableBytes(hash->size) +
+         ((hash->oldSlots != NULL) ? tableBytes(hash->oldSize) : 0) +
+         mempool_get_usage(hash->arena);
 }
 
 /****
  *
- * dynamic hash grow
+ * concurrent hash helpers
  *
  ****/
 
-struct hash_s *dyGrowHash(struct hash_s *oldHash) {
-  struct hash_s *newHash;
-  uint32_t bucket;
-  struct hashRec_s *record, *next, *newRecord;
-  
-  if (!oldHash || oldHash->primeOff >= (sizeof(hashPrimes)/sizeof(hashPrimes[0]) - 2))
-    return oldHash;
-    
-  /* Create new larger hash */
-  if ((newHash = initHash(hashPrimes[oldHash->primeOff + 1])) == NULL) {
-    fprintf(stderr, "ERR - Unable to allocate new hash\n");
-    return oldHash;
-  }
-  
-  /* Rehash all records */
-  for (bucket = 0; bucket < oldHash->size; bucket++) {
-    record = oldHash->buckets[bucket];
-    while (record) {
-      next = record->next;
-      
-      /* Recalculate bucket in new table */
-      uint32_t newBucket = record->hashValue % newHash->size;
-      
-      /* Allocate new record */
-      if ((newRecord = allocHashRecord(newHash)) == NULL) {
-        fprintf(stderr, "ERR - Failed to allocate during grow\n");
-        freeHash(newHash);
-        return oldHash;
-      }
-      
-      /* Copy record (shallow copy of data pointer) */
-      newRecord->keyLen = record->keyLen;
-      newRecord->hashValue = record->hashValue;
-      newRecord->data = record->data;
-      newRecord->lastSeen = record->lastSeen;
-      newRecord->createTime = record->createTime;
-      newRecord->accessCount = record->accessCount;
-      newRecord->modifyCount = record->modifyCount;
-      
-      /* Allocate and copy key */
-      if ((newRecord->keyString = (char *)XMALLOC(record->keyLen)) == NULL) {
-        fprintf(stderr, "ERR - Failed to allocate key during grow\n");
-        freeHash(newHash);
-        return oldHash;
-      }
-      XMEMCPY(newRecord->keyString, record->keyString, record->keyLen);
-      
-      /* Add to new hash bucket */
-      newRecord->next = newHash->buckets[newBucket];
-      newHash->buckets[newBucket] = newRecord;
-      newHash->totalRecords++;
-      
-      record = next;
+static ALWAYS_INLINE uint64_t reverseBits64(uint64_t v) {
+  v = ((v >> 1) & 0x5555555555555555ULL) | ((v & 0x5555555555555555ULL) << 1);
+  v = ((v >> 2) & 0x3333333333333333ULL) | ((v & 0x3333333333333333ULL) << 2);
+  v = ((v >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((v & 0x0F0F0F0F0F0F0F0FULL) << 4);
+  return __builtin_bswap64(v);
+}
+
+/* Records carry the low bit so they sort after their bucket's dummy */
+#define SO_RECORD_KEY(h) (reverseBits64((uint64_t)(h)) | 1)
+#define SO_DUMMY_KEY(b) reverseBits64((uint64_t)(b))
+
+static ALWAYS_INLINE int concurrentNodeMatch(const struct cHashNode_s *node,
+                                             const char *keyString,
+                                             int keyLen) {
+  const struct hashRec_s *rec;
+
+  /* Dummy keys are unique per bucket */
+  if (!(node->soKey & 1))
+    return TRUE;
+  rec = &((const struct cHashRec_s *)node)->rec;
+  return (rec->keyLen == keyLen &&
+          memcmp(rec->keyString, keyString, keyLen) == 0);
+}
+
+/****
+ *
+ * link node into the ordered list after start, or return the node that
+ * already holds the same key
+ *
+ ****/
+
+static struct cHashNode_s *insertSplitOrdered(struct cHashNode_s *prev,
+                                              struct cHashNode_s *node,
+                                              const char *keyString,
+                                              int keyLen) {
+  struct cHashNode_s *cur;
+
+  for (;;) {
+    cur = __atomic_load_n(&prev->next, __ATOMIC_ACQUIRE);
+    while (cur != NULL &&
+           (cur->soKey < node->soKey ||
+            (cur->soKey == node->soKey &&
+             !concurrentNodeMatch(cur, keyString, keyLen)))) {
+      prev = cur;
+      cur = __atomic_load_n(&cur->next, __ATOMIC_ACQUIRE);
     }
+
+    if (cur != NULL && cur->soKey == node->soKey)
+      return cur;
+
+    node->next = cur;
+    if (__atomic_compare_exchange_n(&prev->next, &cur, node, FALSE,
+                                    __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+      return node;
+    /* lost the race, everything before prev is still ordered */
   }
-  
-#ifdef DEBUG
-  if (config->debug >= 2)
-    printf("DEBUG - Grew hash from %u to %u buckets\n", oldHash->size, newHash->size);
-#endif
-  
-  /* Free old hash */
-  freeHash(oldHash);
-  
-  return newHash;
 }
 
 /****
  *
- * dynamic hash shring
+ * return the bucket slot, allocating its segment on first use
  *
  ****/
 
-struct hash_s *dyShrinkHash(struct hash_s *oldHash) {
-  struct hash_s *tmpHash;
-  int i;
-  uint32_t tmpKey;
+static struct cHashNode_s **concurrentBucketSlot(struct cHash_s *hash,
+                                                 uint32_t bucket) {
+  struct cHashNode_s **segment, **expected = NULL;
+  int seg = (bucket < 2) ? 0 : 31 - __builtin_clz(bucket);
+  uint32_t segSize = (seg == 0) ? 2 : (1U << seg);
+
+  segment = __atomic_load_n(&hash->segments[seg], __ATOMIC_ACQUIRE);
+  if (UNLIKELY(segment == NULL)) {
+    segment = (struct cHashNode_s **)XMALLOC(sizeof(struct cHashNode_s *) *
+                                             segSize);
+    if (!__atomic_compare_exchange_n(&hash->segments[seg], &expected, segment,
+                                     FALSE, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)) {
+      XFREE(segment);
+      segment = expected;
+    }
+  }
 
-  if ((oldHash->totalRecords / oldHash->size) < 0.3) {
-    /* the hash should be shrunk */
-    if (oldHash->primeOff EQ 0)
-      return oldHash;
+  return &segment[(seg == 0) ? bucket : bucket - segSize];
+}
 
-    if ((tmpHash = initHash(hashPrimes[oldHash->primeOff - 1])) EQ NULL) {
-      fprintf(stderr, "ERR - Unable to allocate new hash\n");
-      return oldHash;
-    }
+/****
+ *
+ * return the dummy node for a bucket, splitting it off its parent if
+ * this is the first time the bucket has been touched
+ *
+ ****/
 
-    for (i = 0; i < oldHash->size; i++) {
-      if (oldHash->buckets[i] != NULL) {
-        /* move hash records */
-        tmpKey = calcHash(tmpHash->size, oldHash->buckets[i]->keyString);
-        tmpHash->buckets[tmpKey] = oldHash->buckets[i];
-        oldHash->buckets[i] = NULL;
-      }
-    }
+static struct cHashNode_s *concurrentBucket(struct cHash_s *hash,
+                                            uint32_t bucket) {
+  struct cHashNode_s **slot = concurrentBucketSlot(hash, bucket);
+  struct cHashNode_s *dummy, *parent, *node;
 
-    tmpHash->totalRecords = oldHash->totalRecords;
-    tmpHash->maxDepth = oldHash->maxDepth;
-    freeHash(oldHash);
-    return tmpHash;
-  }
+  if (LIKELY((dummy = __atomic_load_n(slot, __ATOMIC_ACQUIRE)) != NULL))
+    return dummy;
 
-  return oldHash;
+  /* the parent bucket is this one with its top bit cleared */
+  parent = concurrentBucket(hash, bucket & ~(1U << (31 - __builtin_clz(bucket))));
+
+  node = (struct cHashNode_s *)XMALLOC(sizeof(struct cHashNode_s));
+  node->soKey = SO_DUMMY_KEY(bucket);
+  if ((dummy = insertSplitOrdered(parent, node, NULL, 0)) != node)
+    XFREE(node);
+
+  __atomic_store_n(slot, dummy, __ATOMIC_RELEASE);
+  return dummy;
 }
 
 /****
  *
- * remove hash record
+ * initialize a concurrent hash
  *
  ****/
 
-void *deleteHashRecord(struct hash_s *hash, const char *keyString, int keyLen) {
-  uint32_t hashValue;
-  uint32_t bucket;
-  struct hashRec_s *record, *prevRecord = NULL;
-  void *data;
+struct cHash_s *initConcurrentHash(uint32_t hashSize) {
+  struct cHash_s *tmpHash;
+  uint32_t size = 2;
 
-  if (!hash || !keyString)
+  if ((tmpHash = (struct cHash_s *)XMALLOC(sizeof(struct cHash_s))) == NULL) {
+    fprintf(stderr, "ERR - Unable to allocate concurrent hash\n");
     return NULL;
-    
-  if (keyLen == 0)
-    keyLen = strlen(keyString);
-
-  /* Calculate hash and bucket */
-  hashValue = fnv1aHash(keyString, keyLen);
-  bucket = hashValue % hash->size;
-
-  /* Search bucket chain */
-  record = hash->buckets[bucket];
-  while (record) {
-    if (record->hashValue == hashValue &&
-        record->keyLen == keyLen &&
-        XMEMCMP(record->keyString, keyString, keyLen) == 0) {
-      
+  }
+
+  while (size < hashSize && size < (1U << 30))
+    size <<= 1;
+  tmpHash->size = size;
+  tmpHash->totalRecords = 0;
+  tmpHash->head.soKey = SO_DUMMY_KEY(0);
+  tmpHash->head.next = NULL;
+  *concurrentBucketSlot(tmpHash, 0) = &tmpHash->head;
+
 #ifdef DEBUG
-      if (config->debug >= 3)
-        printf("DEBUG - Removing hash record\n");
+  if (config->debug >= 4)
+    printf("DEBUG - Concurrent hash initialized [%u]\n", tmpHash->size);
 #endif
-      
-      /* Remove from chain */
-      if (prevRecord)
-        prevRecord->next = record->next;
-      else
-        hash->buckets[bucket] = record->next;
-
-      /* Save data and free record */
-      data = record->data;
-      XFREE(record->keyString);
-      XFREE(record);
-      hash->totalRecords--;
-
-      return data;
-    }
-    prevRecord = record;
-    record = record->next;
-  }
 
-  return NULL;
+  return tmpHash;
 }
 
 /****
  *
- * get an old record
+ * free a concurrent hash, no other thread may be using it
+ *
+ * Record nodes belong to the inserters' arenas, so this must run
+ * before those arenas are destroyed.
  *
  ****/
 
-/* XXX really inefficient, should generate a list of old records and return a
- * linked list */
+void freeConcurrentHash(struct cHash_s *hash) {
+  struct cHashNode_s *node, *next;
+  int i;
 
-void *purgeOldHashData(struct hash_s *hash, time_t age) {
-  uint32_t bucket;
-  struct hashRec_s *record, *prevRecord, *next;
-  void *data;
+  if (hash == NULL)
+    return;
 
-#ifdef DEBUG
-  if (config->debug >= 3)
-    printf("DEBUG - Purging hash records older than [%u]\n", (unsigned int)age);
-#endif
+  /* bucket dummies other than the head were allocated separately */
+  for (node = hash->head.next; node != NULL; node = next) {
+    next = node->next;
+    if (!(node->soKey & 1))
+      XFREE(node);
+  }
 
-  for (bucket = 0; bucket < hash->size; bucket++) {
-    prevRecord = NULL;
-    record = hash->buckets[bucket];
-    
-    while (record != NULL) {
-      next = record->next;
-      
-      if (record->lastSeen == 0) {
-        fprintf(stderr, "ERR - hash rec with bad time\n");
-        prevRecord = record;
-      } else if (record->lastSeen < age) {
-#ifdef DEBUG
-        if (config->debug >= 4)
-          printf("DEBUG - Removing old hash record\n");
-#endif
-        /* Remove from chain */
-        if (prevRecord)
-          prevRecord->next = record->next;
-        else
-          hash->buckets[bucket] = record->next;
-          
-        hash->totalRecords--;
-        
-        /* Save data and free record */
-        data = record->data;
-        XFREE(record->keyString);
-        XFREE(record);
-        
-        /* Return first old data found */
-        if (data != NULL)
-          return data;
-      } else {
-        prevRecord = record;
-      }
-      record = next;
-    }
+  for (i = 0; i < CHASH_SEGMENTS; i++)
+    if (hash->segments[i] != NULL)
+      XFREE(hash->segments[i]);
+
+  XFREE(hash);
+}
+
+/****
+ *
+ * find a record in the concurrent hash, safe against concurrent inserts
+ *
+ ****/
+
+static ALWAYS_INLINE struct cHashNode_s *concurrentHomeBucket(
+    struct cHash_s *hash, uint64_t hashValue) {
+  return concurrentBucket(hash,
+                          (uint32_t)hashValue &
+                              (__atomic_load_n(&hash->size, __ATOMIC_RELAXED) - 1));
+}
+
+/* walk the ordered list from a bucket dummy to the key's position */
+static struct hashRec_s *findConcurrentRecord(struct cHashNode_s *node,
+                                              const char *keyString,
+                                              int keyLen, uint64_t hashValue) {
+  uint64_t soKey = SO_RECORD_KEY(hashValue);
+
+  for (node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+       node != NULL && node->soKey <= soKey;
+       node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) {
+    if (node->soKey == soKey && concurrentNodeMatch(node, keyString, keyLen))
+      return &((struct cHashRec_s *)node)->rec;
   }
 
-  /* no old records */
   return NULL;
 }
 
+struct hashRec_s *getConcurrentHashRecord(struct cHash_s *hash,
+                                          const char *keyString, int keyLen) {
+  uint64_t hashValue;
+
+  if (UNLIKELY(!hash || !keyString))
+    return NULL;
+
+  if (keyLen == 0)
+    keyLen = strlen(keyString) + 1;
+
+  hashValue = hashKey(keyString, keyLen);
+  return findConcurrentRecord(concurrentHomeBucket(hash, hashValue), keyString,
+                              keyLen, hashValue);
+}
+
 /****
  *
- * pop data out of hash
+ * look up a batch of keys in the concurrent hash
+ *
+ * Same contract as getHashDataBatch().  The bucket dummies are fetched
+ * for the whole batch first and the first node after each is
+ * prefetched, so the list walks start on warm lines.
  *
  ****/
 
-/* XXX inefficient, should generate a list of records to pop and return a linked
- * list */
-
-void *popHash(struct hash_s *hash) {
-  uint32_t bucket;
+void getConcurrentHashDataBatch(struct cHash_s *hash, struct hashKey_s *keys,
+                                int count) {
+  struct cHashNode_s *buckets[HASH_BATCH_MAX];
   struct hashRec_s *record;
-  void *data;
+  int i, n;
 
-#ifdef DEBUG
-  printf("DEBUG - POPing hash record\n");
-#endif
+  if (UNLIKELY(!hash || !keys))
+    return;
 
-  for (bucket = 0; bucket < hash->size; bucket++) {
-    record = hash->buckets[bucket];
-    if (record != NULL) {
-#ifdef DEBUG
-      printf("DEBUG - Popping hash record\n");
-#endif
-      /* Remove first record from bucket */
-      hash->buckets[bucket] = record->next;
-      hash->totalRecords--;
-      
-      /* Save data and free record */
-      data = record->data;
-      XFREE(record->keyString);
-      XFREE(record);
-      
-      /* Return first data found */
-      if (data != NULL)
-        return data;
+  while (count > 0) {
+    n = (count > HASH_BATCH_MAX) ? HASH_BATCH_MAX : count;
+
+    for (i = 0; i < n; i++) {
+      buckets[i] = concurrentHomeBucket(hash, keys[i].hashValue);
+      __builtin_prefetch(__atomic_load_n(&buckets[i]->next, __ATOMIC_RELAXED),
+                         0, 3);
     }
-  }
 
-  /* no records */
-  return NULL;
+    for (i = 0; i < n; i++) {
+      record = findConcurrentRecord(buckets[i], keys[i].keyString,
+                                    keys[i].keyLen, keys[i].hashValue);
+      keys[i].data = (record != NULL) ? record->data : NULL;
+    }
+
+    keys += n;
+    count -= n;
+  }
 }
 
 /****
  *
- * print key string in hex (just in case it is not ascii)
+ * add a record to the concurrent hash
+ *
+ * Returns the record that holds keyString.  If another thread inserted
+ * the same key first, its record is returned unchanged and data is not
+ * stored, callers compare ->data to tell which happened.
+ *
+ * The node is carved from arena, which must be private to the calling
+ * thread and outlive the table.  A node that loses the race stays in
+ * the arena, races are rare enough that this is cheaper than a free.
  *
  ****/
 
-char *hexConvert(const char *keyString, int keyLen, char *buf,
-                 const int bufLen) {
-  int i;
-  char *ptr = buf;
-  for (i = 0; i < keyLen & i < (bufLen / 2) - 1; i++) {
-    snprintf(ptr, bufLen, "%02x", keyString[i] & 0xff);
-    ptr += 2;
+static struct hashRec_s *addConcurrentRecord(struct cHash_s *hash,
+                                             const char *keyString,
+                                             int keyLen, uint64_t hashValue,
+                                             void *data, mempool_t *arena) {
+  struct cHashRec_s *newRec;
+  struct cHashNode_s *found;
+  uint32_t size;
+  size_t count;
+
+  /* Short keys fit in the record, only long ones need trailing storage */
+  if ((newRec = (struct cHashRec_s *)mempool_alloc_fast(
+           arena, sizeof(struct cHashRec_s) +
+                      ((keyLen > HASH_INLINE_KEY) ? keyLen : 0))) == NULL) {
+    fprintf(stderr, "ERR - Unable to allocate hash record\n");
+    return NULL;
   }
-  return buf;
+  newRec->node.soKey = SO_RECORD_KEY(hashValue);
+  newRec->rec.keyString = (keyLen > HASH_INLINE_KEY) ? (char *)(newRec + 1)
+                                                     : newRec->rec.inlineKey;
+  memcpy(newRec->rec.keyString, keyString, keyLen);
+  newRec->rec.keyLen = keyLen;
+  newRec->rec.hashValue = hashValue;
+  newRec->rec.data = data;
+
+  size = __atomic_load_n(&hash->size, __ATOMIC_RELAXED);
+  found = insertSplitOrdered(concurrentBucket(hash, (uint32_t)hashValue & (size - 1)),
+                             &newRec->node, keyString, keyLen);
+  if (found != &newRec->node)
+    return &((struct cHashRec_s *)found)->rec;
+
+  /* double the bucket count, buckets split lazily on first use */
+  count = __atomic_add_fetch(&hash->totalRecords, 1, __ATOMIC_RELAXED);
+  if (count > (size_t)size * CHASH_LOAD_FACTOR && size < (1U << 31))
+    __atomic_compare_exchange_n(&hash->size, &size, size << 1, FALSE,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+  /* Nodes cannot be moved out of the shared list, so only report it */
+  if (UNLIKELY(hash->memLimit > 0) &&
+      count * sizeof(struct cHashRec_s) > hash->memLimit &&
+      __atomic_exchange_n(&hash->overBudget, TRUE, __ATOMIC_RELAXED) == FALSE)
+    fprintf(stderr,
+            "WARN - Address table passed its %zu MB memory limit, continuing "
+            "over budget\n",
+            hash->memLimit >> 20);
+
+#ifdef DEBUG
+  if (config->debug >= 4)
+    printf("DEBUG - Added concurrent hash record [total:%zu]\n", count);
+#endif
+
+  return &newRec->rec;
+}
+
+struct hashRec_s *addUniqueConcurrentHashRec(struct cHash_s *hash,
+                                             const char *keyString,
+                                             int keyLen, void *data,
+                                             mempool_t *arena) {
+  if (!hash || !keyString || !arena)
+    return NULL;
+
+  if (keyLen == 0)
+    keyLen = strlen(keyString) + 1;
+
+  return addConcurrentRecord(hash, keyString, keyLen,
+                             hashKey(keyString, keyLen), data, arena);
 }
 
 /****
  *
- * print key string in hex (just in case it is not ascii)
+ * add a record under a hash from getKeyHash() unless the key exists
+ *
+ * Returns the data now stored for the key, see getOrAddHashData().
  *
  ****/
 
-char *utfConvert(const char *keyString, int keyLen, char *buf,
-                 const int bufLen) {
-  int i;
-  char *ptr = buf;
-  /* XXX should check for buf len */
-  for (i = 0; i < (keyLen / 2); i++) {
-    buf[i] = keyString[(i * 2)];
-  }
-  buf[i] = '\0';
+void *getOrAddConcurrentHashData(struct cHash_s *hash, const char *keyString,
+                                 int keyLen, uint64_t hashValue, void *data,
+                                 mempool_t *arena) {
+  struct hashRec_s *record;
 
-  return buf;
+  if (UNLIKELY(!hash || !keyString || !arena))
+    return NULL;
+
+  if ((record = addConcurrentRecord(hash, keyString, keyLen, hashValue, data,
+                                    arena)) == NULL)
+    return NULL;
+  return record->data;
 }
 
 /****
  *
- * return size of hash
+ * traverse all concurrent hash records, calling func() for each one
  *
  ****/
 
-uint32_t getHashSize(struct hash_s *hash) {
-  if (hash != NULL)
-    return hash->size;
-  return FAILED;
+int traverseConcurrentHash(const struct cHash_s *hash,
+                           int (*fn)(const struct hashRec_s *hashRec)) {
+  const struct cHashNode_s *node;
+
+  if (!hash || !fn)
+    return FAILED;
+
+  for (node = hash->head.next; node != NULL; node = node->next) {
+    if ((node->soKey & 1) && fn(&((const struct cHashRec_s *)node)->rec))
+      return FAILED;
+  }
+
+  return TRUE;
 }
@@ -43,6 +43,7 @@
 #include "util.h"
 #include "../include/common.h"
 #include "xxhash.h"
+#include "mempool.h"
 #include <stdint.h>
 
 /****
@@ -51,33 +52,81 @@
  *
  ****/
 
+/* Keys up to this length (with the NUL) are stored in the record */
+#define HASH_INLINE_KEY 20
+
 struct hashRec_s {
-  char *keyString;
-  int keyLen;
-  uint32_t hashValue;    /* Cached hash value for faster lookups */
+  char *keyString;       /* Points at inlineKey for short keys */
   void *data;
-  time_t lastSeen;
-  time_t createTime;
-  uint32_t accessCount;
-  uint16_t modifyCount;
-  struct hashRec_s *next;  /* For linked list in buckets (removed prev for better cache locality) */
+  uint64_t hashValue;    /* Cached hash value for faster lookups */
+  int keyLen;
+  char inlineKey[HASH_INLINE_KEY];
 };
 
-/* Memory pool for hash records */
-struct hashRecPool_s {
-  struct hashRec_s *records;
-  size_t capacity;
-  size_t used;
-  struct hashRecPool_s *next;
+/* One key of a batched lookup, hashValue comes from getKeyHash() */
+#define HASH_BATCH_MAX 32
+
+struct hashKey_s {
+  const char *keyString;
+  int keyLen;
+  uint64_t hashValue;
+  void *data;            /* Set by the lookup, NULL if the key is absent */
 };
 
+/* Swiss table, records are stored directly in the slot array */
 struct hash_s {
-  uint32_t size;
-  uint32_t totalRecords;
-  uint16_t maxDepth;
-  uint8_t primeOff;
-  struct hashRec_s **buckets;      /* Renamed from records for clarity */
-  struct hashRecPool_s *pools;     /* Memory pools for records */
+  size_t size;                     /* Slot count, always a power of two */
+  size_t totalRecords;
+  size_t growthLeft;               /* Empty slots left before a grow */
+  uint8_t *ctrl;                   /* One control byte per slot */
+  struct hashRec_s *slots;
+  uint8_t *oldCtrl;                /* Pre-grow table not yet migrated */
+  struct hashRec_s *oldSlots;
+  size_t oldSize;
+  size_t migratePos;               /* Old slots below this have been moved */
+  mempool_t *arena;                /* Long keys and caller data, freed with the table */
+  size_t memLimit;                 /* Byte budget for the table, 0 for none */
+  int packed;                      /* Load raised to 15/16 to stay in budget */
+  int overBudget;                  /* Set once the budget has been exceeded */
+};
+
+/****
+ *
+ * concurrent (lock-free, insert-only) hash
+ *
+ * All records live on a single linked list ordered by the bit-reversed
+ * hash value (split-ordered list).  Buckets are shortcut pointers to
+ * dummy nodes in that list, so doubling the bucket count never moves a
+ * record.  Inserts are a single CAS on the predecessor's next pointer.
+ * Nothing is ever unlinked until the whole table is freed, so readers
+ * need no reclamation scheme.
+ *
+ ****/
+
+#define CHASH_SEGMENTS 32        /* Segment k holds buckets [2^k, 2^(k+1)) */
+#define CHASH_LOAD_FACTOR 2      /* Average records per bucket before doubling */
+
+struct cHashNode_s {
+  struct cHashNode_s *next;
+  uint64_t soKey;                /* Bit-reversed hash, low bit set on records */
+};
+
+/*
+ * Record node, keys too long for inlineKey are stored after the record.
+ * Nodes come from the inserting caller's arena, not from the table.
+ */
+struct cHashRec_s {
+  struct cHashNode_s node;
+  struct hashRec_s rec;
+};
+
+struct cHash_s {
+  uint32_t size;                 /* Bucket count, always a power of two */
+  size_t totalRecords;
+  size_t memLimit;               /* Byte budget for the table, 0 for none */
+  int overBudget;
+  struct cHashNode_s **segments[CHASH_SEGMENTS];
+  struct cHashNode_s head;       /* Dummy node for bucket 0 */
 };
 
 /****
@@ -90,33 +139,41 @@ uint32_t calcHash(uint32_t hashSize, const char *keyString);
 uint32_t fnv1aHash(const char *keyString, int keyLen);
 uint32_t calcHashWithLen(const char *keyString, int keyLen);
 void freeHash(struct hash_s *hash);
-int addHashRec(struct hash_s *hash, uint32_t key, char *keyString, void *data,
-               time_t lastSeen);
 int addUniqueHashRec(struct hash_s *hash, const char *keyString, int keyLen,
                      void *data);
-struct hash_s *initHash(uint32_t hashSize);
-uint32_t searchHash(struct hash_s *hash, const char *keyString);
-void updateData(struct hash_s *hash, const void *keyString, const void *data);
-void dumpHash(struct hash_s *hash);
+struct hash_s *initHash(size_t hashSize);
 struct hashRec_s *getHashRecord(struct hash_s *hash, const void *keyString);
+uint64_t getKeyHash(const char *keyString, int keyLen);
+void getHashDataBatch(struct hash_s *hash, struct hashKey_s *keys, int count);
+void *getOrAddHashData(struct hash_s *hash, const char *keyString, int keyLen,
+                       uint64_t hashValue, void *data);
 void *getHashData(struct hash_s *hash, const void *keyString);
-struct hashRec_s *snoopHashRecord(struct hash_s *hash, const char *keyString,
-                                  int keyLen);
-struct hashRec_s *snoopHashRecWithKey(struct hash_s *hash,
-                                      const char *keyString, int keyLen,
-                                      uint32_t key);
-void *getDataByKey(struct hash_s *hash, uint32_t key, void *keyString);
 struct hash_s *dyGrowHash(struct hash_s *oldHash);
-struct hash_s *dyShrinkHash(struct hash_s *oldHash);
-void *purgeOldHashData(struct hash_s *hash, time_t age);
-void *popHash(struct hash_s *hash);
+void finishHashMigration(struct hash_s *hash);
 char *hexConvert(const char *keyString, int keyLen, char *buf,
                  const int bufLen);
 char *utfConvert(const char *keyString, int keyLen, char *buf,
                  const int bufLen);
-uint32_t getHashSize(struct hash_s *hash);
+size_t getHashSize(struct hash_s *hash);
+size_t getHashMemory(const struct hash_s *hash);
 int traverseHash(const struct hash_s *hash,
                  int (*fn)(const struct hashRec_s *hashRec));
+struct hashRec_s *nextHashRecord(const struct hash_s *hash, size_t *cursor);
 void *deleteHashRecord(struct hash_s *hash, const char *keyString, int keyLen);
+struct cHash_s *initConcurrentHash(uint32_t hashSize);
+void freeConcurrentHash(struct cHash_s *hash);
+struct hashRec_s *getConcurrentHashRecord(struct cHash_s *hash,
+                                          const char *keyString, int keyLen);
+struct hashRec_s *addUniqueConcurrentHashRec(struct cHash_s *hash,
+                                             const char *keyString,
+                                             int keyLen, void *data,
+                                             mempool_t *arena);
+void getConcurrentHashDataBatch(struct cHash_s *hash, struct hashKey_s *keys,
+                                int count);
+void *getOrAddConcurrentHashData(struct cHash_s *hash, const char *keyString,
+                                 int keyLen, uint64_t hashValue, void *data,
+                                 mempool_t *arena);
+int traverseConcurrentHash(const struct cHash_s *hash,
+                           int (*fn)(const struct hashRec_s *hashRec));
 
 #endif /* end of HASH_DOT_H */
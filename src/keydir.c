@@ -0,0 +1,244 @@
+/*****
+ *
+ * Description: Text Index Key Directory Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "keydir.h"
+#include "mem.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+int keydir_path(char *path, size_t len, const char *index_path) {
+  if (snprintf(path, len, "%s%s", index_path, KEYDIR_SUFFIX) >= (int)len) {
+    fprintf(stderr, "ERR - Key directory path too long for [%s]\n", index_path);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/****
+ *
+ * start a sidecar for an index being written
+ *
+ ****/
+
+keydir_writer_t *keydir_create(const char *index_path, int compressed) {
+  keydir_writer_t *kd;
+
+  if ((kd = (keydir_writer_t *)XMALLOC(sizeof(keydir_writer_t))) == NULL)
+    return NULL;
+  XMEMSET(kd, 0, sizeof(keydir_writer_t));
+
+  if (!keydir_path(kd->path, sizeof(kd->path), index_path)) {
+    XFREE(kd);
+    return NULL;
+  }
+  if ((kd->fp = fopen(kd->path, "w")) == NULL) {
+    fprintf(stderr, "ERR - Unable to open key directory [%s] %d (%s)\n", kd->path, errno,
+            strerror(errno));
+    XFREE(kd);
+    return NULL;
+  }
+  fprintf(kd->fp, "%s\n", compressed ? KEYDIR_ZMAGIC : KEYDIR_MAGIC);
+
+  return kd;
+}
+
+/****
+ *
+ * note a record written to the index
+ *
+ * Long records start a block of their own, only a search for a term
+ * between one and the key after it reads through it.
+ *
+ ****/
+
+int keydir_add(keydir_writer_t *kd, const char *key, off_t offset, size_t len) {
+  if (kd == NULL)
+    return TRUE;
+  if (kd->count > 0 && offset - kd->last < KEYDIR_BLOCK_SIZE && len < KEYDIR_BLOCK_SIZE)
+    return TRUE;
+  return keydir_mark(kd, key, offset);
+}
+
+/* List a key whatever the block size, each compressed block needs one */
+int keydir_mark(keydir_writer_t *kd, const char *key, off_t offset) {
+  if (kd == NULL)
+    return TRUE;
+
+  kd->last = offset;
+  kd->count++;
+  return fprintf(kd->fp, "%s,%lld\n", key, (long long)offset) > 0 ? TRUE : FAILED;
+}
+
+/****
+ *
+ * finish a sidecar with the size of its index
+ *
+ * A sidecar that could not be written completely is removed, spi
+ * then scans the index instead.
+ *
+ ****/
+
+int keydir_close(keydir_writer_t *kd, off_t size) {
+  int ret = TRUE;
+
+  if (kd == NULL)
+    return TRUE;
+
+  fprintf(kd->fp, ",%lld\n", (long long)size);
+  if (ferror(kd->fp) || fclose(kd->fp) != 0) {
+    fprintf(stderr, "ERR - Unable to write key directory [%s]\n", kd->path);
+    unlink(kd->path);
+    ret = FAILED;
+  }
+  XFREE(kd);
+
+  return ret;
+}
+
+/* Drop the sidecar of an index rewritten without one */
+void keydir_remove(const char *index_path) {
+  char path[PATH_MAX];
+
+  if (keydir_path(path, sizeof(path), index_path))
+    unlink(path);
+}
+
+/****
+ *
+ * load the sidecar of an index, NULL if it has none
+ *
+ * Keys must be in strcmp order with offsets that never go backwards,
+ * and the final size must match the index, anything else is treated
+ * as stale and the index is scanned as before.
+ *
+ ****/
+
+keydir_t *keydir_load(const char *index_path) {
+  char path[PATH_MAX];
+  struct stat index_st, st;
+  keydir_t *kd;
+  FILE *fp;
+  char *line, *next, *comma, *end;
+  size_t lines = 0, i;
+  int valid = FALSE;
+
+  if (!keydir_path(path, sizeof(path), index_path) || stat(index_path, &index_st) != 0 ||
+      (fp = fopen(path, "r")) == NULL)
+    return NULL;
+  if (fstat(fileno(fp), &st) != 0 || (kd = (keydir_t *)XMALLOC(sizeof(keydir_t))) == NULL) {
+    fclose(fp);
+    return NULL;
+  }
+  XMEMSET(kd, 0, sizeof(keydir_t));
+
+  if ((kd->data = (char *)XMALLOC(st.st_size + 1)) == NULL ||
+      fread(kd->data, 1, st.st_size, fp) != (size_t)st.st_size) {
+    fclose(fp);
+    keydir_free(kd);
+    return NULL;
+  }
+  fclose(fp);
+  kd->data[st.st_size] = '\0';
+
+  for (i = 0; i < (size_t)st.st_size; i++) {
+    if (kd->data[i] == '\n')
+      lines++;
+  }
+  if (lines < 2 ||
+      (kd->keys = (char **)XMALLOC(sizeof(char *) * lines)) == NULL ||
+      (kd->offsets = (off_t *)XMALLOC(sizeof(off_t) * lines)) == NULL) {
+    keydir_free(kd);
+    return NULL;
+  }
+
+  line = kd->data;
+  if ((next = strchr(line, '\n')) != NULL)
+    *next++ = '\0';
+  if (strcmp(line, KEYDIR_ZMAGIC) == 0)
+    kd->compressed = TRUE;
+  else if (strcmp(line, KEYDIR_MAGIC) != 0)
+    next = NULL;
+
+  for (line = next; line != NULL && *line != '\0'; line = next) {
+    if ((next = strchr(line, '\n')) == NULL)
+      break;
+    *next++ = '\0';
+    if ((comma = strrchr(line, ',')) == NULL)
+      break;
+    *comma = '\0';
+    kd->offsets[kd->count] = (off_t)strtoll(comma + 1, &end, 10);
+    if (*end != '\0' || (kd->count > 0 && kd->offsets[kd->count] < kd->offsets[kd->count - 1]))
+      break;
+
+    if (*line == '\0') {
+      /* The closing size, it must be the last line */
+      valid = *next == '\0' && kd->offsets[kd->count] == index_st.st_size;
+      break;
+    }
+    if (kd->count > 0 && strcmp(kd->keys[kd->count - 1], line) >= 0)
+      break;
+    kd->keys[kd->count++] = line;
+  }
+
+  if (!valid) {
+    fprintf(stderr, "WARN - Ignoring stale key directory [%s]\n", path);
+    keydir_free(kd);
+    return NULL;
+  }
+
+  return kd;
+}
+
+/****
+ *
+ * find the block of the index that would hold a term
+ *
+ * The block runs from the last listed key not after the term to the
+ * next listed key.  Returns FALSE when the term sorts before every key.
+ *
+ ****/
+
+int keydir_find(const keydir_t *kd, const char *term, off_t *start, off_t *end) {
+  size_t lo = 0, hi = kd->count, mid;
+
+  /* First key after the term */
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (strcmp(kd->keys[mid], term) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0)
+    return FALSE;
+
+  *start = kd->offsets[lo - 1];
+  *end = kd->offsets[lo];
+  return TRUE;
+}
+
+void keydir_free(keydir_t *kd) {
+  if (kd == NULL)
+    return;
+  if (kd->data != NULL)
+    XFREE(kd->data);
+  if (kd->keys != NULL)
+    XFREE(kd->keys);
+  if (kd->offsets != NULL)
+    XFREE(kd->offsets);
+  XFREE(kd);
+}
@@ -0,0 +1,76 @@
+/*****
+ *
+ * Description: Text Index Key Directory Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef KEYDIR_H
+#define KEYDIR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "../include/common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A .lpx sidecar indexes a text .lpi written in address (strcmp)
+ * order.  After an LPX1 line it holds KEY,OFFSET for the first record
+ * and for each record that starts at least KEYDIR_BLOCK_SIZE bytes
+ * after the last one listed, or is itself that long.  A final
+ * ,SIZE line gives the size of the index it describes, a sidecar
+ * that does not match its index is ignored.
+ *
+ * A compressed index (see zblock.h) starts with LPZ1 instead and
+ * lists every block, at the offset its gzip member starts.
+ */
+
+#define KEYDIR_SUFFIX ".lpx"
+#define KEYDIR_MAGIC "LPX1"
+#define KEYDIR_ZMAGIC "LPZ1"
+#define KEYDIR_BLOCK_SIZE 65536
+
+/* Sidecar being written next to an index */
+typedef struct keydir_writer_s {
+  FILE *fp;
+  char path[PATH_MAX];
+  off_t last;                   /* Offset of the last key listed */
+  int count;
+} keydir_writer_t;
+
+/* Sidecar loaded for searching */
+typedef struct keydir_s {
+  char *data;                   /* The file, keys are NUL terminated in place */
+  char **keys;
+  off_t *offsets;               /* One more than keys, the last is the index size */
+  size_t count;
+  int compressed;               /* Each listed offset starts a compressed block */
+} keydir_t;
+
+/* Function prototypes */
+int keydir_path(char *path, size_t len, const char *index_path);
+keydir_writer_t *keydir_create(const char *index_path, int compressed);
+int keydir_add(keydir_writer_t *kd, const char *key, off_t offset, size_t len);
+int keydir_mark(keydir_writer_t *kd, const char *key, off_t offset);
+int keydir_close(keydir_writer_t *kd, off_t size);
+void keydir_remove(const char *index_path);
+keydir_t *keydir_load(const char *index_path);
+int keydir_find(const keydir_t *kd, const char *term, off_t *start, off_t *end);
+void keydir_free(keydir_t *kd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KEYDIR_H */
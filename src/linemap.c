@@ -0,0 +1,219 @@
+/*****
+ *
+ * Description: Log Line Checkpoint Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "linemap.h"
+#include "mem.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static int linemap_path(char *path, size_t len, const char *index_path) {
+  if (snprintf(path, len, "%s%s", index_path, LINEMAP_SUFFIX) >= (int)len) {
+    fprintf(stderr, "ERR - Line checkpoint path too long for [%s]\n", index_path);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/****
+ *
+ * start noting checkpoints, line 1 is at offset 0
+ *
+ ****/
+
+linemap_t *linemap_create(void) {
+  linemap_t *lm;
+
+  if ((lm = (linemap_t *)XMALLOC(sizeof(linemap_t))) == NULL)
+    return NULL;
+  XMEMSET(lm, 0, sizeof(linemap_t));
+  lm->interval = LINEMAP_INTERVAL;
+  if (linemap_append(lm, 0) != TRUE) {
+    linemap_free(lm);
+    return NULL;
+  }
+
+  return lm;
+}
+
+int linemap_append(linemap_t *lm, uint64_t offset) {
+  uint64_t *offsets;
+  size_t capacity;
+
+  if (lm->count == lm->capacity) {
+    capacity = (lm->capacity == 0) ? 1024 : lm->capacity * 2;
+    if ((offsets = (uint64_t *)XREALLOC(lm->offsets, sizeof(uint64_t) * capacity)) == NULL) {
+      fprintf(stderr, "ERR - Unable to grow line checkpoints\n");
+      return FAILED;
+    }
+    lm->offsets = offsets;
+    lm->capacity = capacity;
+  }
+  lm->offsets[lm->count++] = offset;
+  return TRUE;
+}
+
+/****
+ *
+ * write the sidecar of an index for a log of log_size bytes
+ *
+ * A log ending in a newline leaves a checkpoint at its end that starts
+ * no line, it is dropped.
+ *
+ ****/
+
+int linemap_save(const linemap_t *lm, const char *index_path, off_t log_size) {
+  char path[PATH_MAX];
+  linemap_header_t header;
+  size_t count = lm->count;
+  FILE *fp;
+
+  while (count > 1 && lm->offsets[count - 1] >= (uint64_t)log_size)
+    count--;
+
+  if (!linemap_path(path, sizeof(path), index_path))
+    return FAILED;
+  if ((fp = fopen(path, "w")) == NULL) {
+    fprintf(stderr, "ERR - Unable to open line checkpoints [%s] %d (%s)\n", path, errno, strerror(errno));
+    return FAILED;
+  }
+
+  XMEMSET(&header, 0, sizeof(header));
+  memcpy(header.magic, LINEMAP_MAGIC, sizeof(header.magic));
+  header.interval = lm->interval;
+  header.lines = lm->lines;
+  header.log_size = (uint64_t)log_size;
+  header.count = count;
+  fwrite(&header, sizeof(header), 1, fp);
+  fwrite(lm->offsets, sizeof(uint64_t), count, fp);
+  if (ferror(fp) || fclose(fp) != 0) {
+    fprintf(stderr, "ERR - Unable to write line checkpoints [%s]\n", path);
+    unlink(path);
+    return FAILED;
+  }
+
+  return TRUE;
+}
+
+/* Drop the sidecar of an index written without one */
+void linemap_remove(const char *index_path) {
+  char path[PATH_MAX];
+
+  if (linemap_path(path, sizeof(path), index_path))
+    unlink(path);
+}
+
+/* Load a sidecar written for a log of log_size bytes */
+static linemap_t *load(const char *index_path, off_t log_size) {
+  char path[PATH_MAX];
+  struct stat st;
+  linemap_header_t header;
+  linemap_t *lm;
+  FILE *fp;
+
+  if (!linemap_path(path, sizeof(path), index_path) || (fp = fopen(path, "r")) == NULL)
+    return NULL;
+  if (fstat(fileno(fp), &st) != 0 || (lm = (linemap_t *)XMALLOC(sizeof(linemap_t))) == NULL) {
+    fclose(fp);
+    return NULL;
+  }
+  XMEMSET(lm, 0, sizeof(linemap_t));
+
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, LINEMAP_MAGIC, sizeof(header.magic)) != 0 || header.interval == 0 ||
+      header.count == 0 || (uint64_t)st.st_size != sizeof(header) + header.count * sizeof(uint64_t) ||
+      header.log_size != (uint64_t)log_size ||
+      (lm->offsets = (uint64_t *)XMALLOC(sizeof(uint64_t) * header.count)) == NULL ||
+      fread(lm->offsets, sizeof(uint64_t), header.count, fp) != header.count) {
+    fprintf(stderr, "WARN - Ignoring stale line checkpoints [%s]\n", path);
+    fclose(fp);
+    linemap_free(lm);
+    return NULL;
+  }
+  fclose(fp);
+
+  lm->count = lm->capacity = header.count;
+  lm->lines = header.lines;
+  lm->interval = header.interval;
+
+  return lm;
+}
+
+/****
+ *
+ * load the sidecar of an index, NULL if it has none or it is stale
+ *
+ ****/
+
+linemap_t *linemap_load(const char *index_path, const char *log_path) {
+  struct stat log_st;
+
+  if (stat(log_path, &log_st) != 0)
+    return NULL;
+  return load(index_path, log_st.st_size);
+}
+
+/****
+ *
+ * load the sidecar of an index to go on noting lines past log_size
+ *
+ * The log has grown since it was indexed up to log_size.  A line that
+ * started there was dropped when the sidecar was saved, it is put back.
+ *
+ ****/
+
+linemap_t *linemap_resume(const char *index_path, off_t log_size) {
+  linemap_t *lm;
+
+  if ((lm = load(index_path, log_size)) == NULL)
+    return NULL;
+  if (lm->interval != LINEMAP_INTERVAL ||
+      ((lm->lines & (LINEMAP_INTERVAL - 1)) == 0 && lm->count == lm->lines / LINEMAP_INTERVAL &&
+       linemap_append(lm, (uint64_t)log_size) != TRUE)) {
+    linemap_free(lm);
+    return NULL;
+  }
+
+  return lm;
+}
+
+/****
+ *
+ * find the last checkpoint at or before a line
+ *
+ ****/
+
+int linemap_seek(const linemap_t *lm, size_t line, size_t *start_line, off_t *offset) {
+  size_t c;
+
+  if (line == 0 || lm->count == 0)
+    return FALSE;
+
+  c = (line - 1) / lm->interval;
+  if (c >= lm->count)
+    c = lm->count - 1;
+  *start_line = c * lm->interval + 1;
+  *offset = (off_t)lm->offsets[c];
+  return TRUE;
+}
+
+void linemap_free(linemap_t *lm) {
+  if (lm == NULL)
+    return;
+  if (lm->offsets != NULL)
+    XFREE(lm->offsets);
+  XFREE(lm);
+}
@@ -0,0 +1,77 @@
+/*****
+ *
+ * Description: Log Line Checkpoint Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef LINEMAP_H
+#define LINEMAP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "../include/common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A .lpl sidecar holds the byte offset in the log of every
+ * LINEMAP_INTERVAL'th line, counted as spi reads them, so spi can seek
+ * close to a matched line instead of reading every line before it.
+ * The header records the size of the log the lines were counted in, a
+ * sidecar for a log that has since changed is ignored.
+ */
+
+#define LINEMAP_SUFFIX ".lpl"
+#define LINEMAP_MAGIC "LPL1"
+#define LINEMAP_INTERVAL 1024           /* Lines between checkpoints, a power of two */
+
+typedef struct linemap_header_s {
+  char magic[4];
+  uint32_t interval;
+  uint64_t lines;               /* Lines in the log */
+  uint64_t log_size;            /* Bytes of the log they were counted in */
+  uint64_t count;               /* Offsets that follow */
+} linemap_header_t;
+
+/* Checkpoints being noted or loaded, offsets[i] starts line i * interval + 1 */
+typedef struct linemap_s {
+  uint64_t *offsets;
+  size_t count;
+  size_t capacity;
+  uint64_t lines;
+  uint32_t interval;
+} linemap_t;
+
+/* Function prototypes */
+linemap_t *linemap_create(void);
+int linemap_append(linemap_t *lm, uint64_t offset);
+int linemap_save(const linemap_t *lm, const char *index_path, off_t log_size);
+void linemap_remove(const char *index_path);
+linemap_t *linemap_load(const char *index_path, const char *log_path);
+linemap_t *linemap_resume(const char *index_path, off_t log_size);
+int linemap_seek(const linemap_t *lm, size_t line, size_t *start_line, off_t *offset);
+void linemap_free(linemap_t *lm);
+
+/* A line ended, the next one starts at offset */
+static inline int linemap_line(linemap_t *lm, uint64_t offset) {
+  if ((++lm->lines & (LINEMAP_INTERVAL - 1)) != 0)
+    return TRUE;
+  return linemap_append(lm, offset);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LINEMAP_H */
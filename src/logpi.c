@@ -28,6 +28,16 @@
 
 #include "logpi.h"
 #include "parallel.h"
+#include "budget.h"
+#include "writer.h"
+#include "lpi2_build.h"
+#include "keydir.h"
+#include "filter.h"
+#include "zblock.h"
+#include "linemap.h"
+#include "gzcheck.h"
+#include "stamp.h"
+#include "merge.h"
 
 /****
  *
@@ -44,6 +54,16 @@
 /* hashes */
 struct hash_s *addrHash = NULL;
 
+/* postings for addrHash, kept apart so the budget can tell them from the table */
+mempool_t *addrPostings = NULL;
+
+/* sorted runs written once addrHash reaches the memory budget */
+spill_set_t *addrSpill = NULL;
+
+/* what the serial table last reported to the budget */
+PRIVATE size_t addrTableReported = 0;
+PRIVATE size_t addrPostingsReported = 0;
+
 /****
  *
  * external variables
@@ -64,222 +84,165 @@ extern int reload;
 
 /****
  *
- * create location array
+ * create metadata in a writer's slab
+ *
+ * Metadata is only released with its slab.  An address seen once costs
+ * the header and one small posting block.
  *
  ****/
 
-location_array_t* create_location_array(size_t initial_capacity) {
-  location_array_t *array;
-  
-  if (initial_capacity < 64) initial_capacity = 64;  /* Minimum size */
-  
-  array = (location_array_t *)XMALLOC(sizeof(location_array_t));
-  if (array == NULL) {
-    fprintf(stderr, "ERR - Unable to allocate location array\n");
-    return NULL;
-  }
+metaData_t* create_metadata(mempool_t *slab) {
+  metaData_t *metadata;
   
-  array->entries = (location_entry_t *)XMALLOC(sizeof(location_entry_t) * initial_capacity);
-  if (array->entries == NULL) {
-    fprintf(stderr, "ERR - Unable to allocate location entries\n");
-    XFREE(array);
+  if ((metadata = (metaData_t *)mempool_alloc_fast(slab, sizeof(metaData_t))) == NULL) {
+    fprintf(stderr, "ERR - Unable to allocate metadata\n");
     return NULL;
   }
   
-  array->count = 0;
-  array->capacity = initial_capacity;
-  array->reserved_count = 0;
-  
-  /* Initialize mutex for thread-safe operations */
-  if (pthread_mutex_init(&array->mutex, NULL) != 0) {
-    fprintf(stderr, "ERR - Unable to initialize location array mutex\n");
-    XFREE(array->entries);
-    XFREE(array);
-    return NULL;
-  }
+  metadata->total_count = 0;
+  posting_list_init(&metadata->lists, -1);
   
-  return array;
+  return metadata;
 }
 
 /****
  *
- * free location array
+ * find or claim the posting list a writer slot appends to
  *
- ****/
-
-void free_location_array(location_array_t *array) {
-  if (array == NULL) return;
-  
-  /* Destroy the mutex */
-  pthread_mutex_destroy(&array->mutex);
-  
-  if (array->entries) {
-    XFREE(array->entries);
-  }
-  XFREE(array);
-}
-
-/****
- *
- * grow location array (called when capacity exceeded)
+ * The inline list goes to whichever slot claims it first, later slots
+ * push a list from their own slab.  Both steps are lock-free, so
+ * workers sharing an address never wait on each other.
  *
  ****/
 
-int grow_location_array(location_array_t *array, size_t new_capacity) {
-  location_entry_t *new_entries;
-  int result;
-  
-  if (array == NULL) {
-    return FALSE;
-  }
+posting_list_t* get_slot_postings(metaData_t *tmpMd, int slot, mempool_t *slab) {
+  posting_list_t *list;
+  int unclaimed = -1;
   
-  /* Safety check for overflow - prevent ridiculously large allocations */
-  if (new_capacity > SIZE_MAX / sizeof(location_entry_t) || 
-      new_capacity < array->capacity) {
-    fprintf(stderr, "ERR - Invalid location array capacity %zu (current: %zu)\n", 
-            new_capacity, array->capacity);
-    return FALSE;
-  }
-  
-  if (new_capacity <= array->capacity) {
-    return FALSE;
+  for (list = &tmpMd->lists; list != NULL; list = __atomic_load_n(&list->next, __ATOMIC_ACQUIRE)) {
+    if (__atomic_load_n(&list->slot, __ATOMIC_RELAXED) == slot)
+      return list;
   }
   
-  /* Lock the array for thread-safe resizing */
-  pthread_mutex_lock(&array->mutex);
+  if (__atomic_compare_exchange_n(&tmpMd->lists.slot, &unclaimed, slot, FALSE,
+                                  __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    return &tmpMd->lists;
   
-  /* Double-check capacity after acquiring lock (another thread might have grown it) */
-  if (new_capacity <= array->capacity) {
-    pthread_mutex_unlock(&array->mutex);
-    return TRUE;  /* Already grown by another thread */
-  }
-  
-  new_entries = (location_entry_t *)realloc(array->entries, 
-                                          sizeof(location_entry_t) * new_capacity);
-  if (new_entries == NULL) {
-    fprintf(stderr, "ERR - Unable to grow location array to %zu entries (%zu MB)\n", 
-            new_capacity, (new_capacity * sizeof(location_entry_t)) / 1048576);
-    result = FALSE;
-  } else {
-    array->entries = new_entries;
-    array->capacity = new_capacity;
-    result = TRUE;
+  if ((list = (posting_list_t *)mempool_alloc_fast(slab, sizeof(posting_list_t))) == NULL) {
+    fprintf(stderr, "ERR - Unable to allocate posting list\n");
+    return NULL;
   }
+  posting_list_init(list, slot);
+  list->next = __atomic_load_n(&tmpMd->lists.next, __ATOMIC_ACQUIRE);
+  while (!__atomic_compare_exchange_n(&tmpMd->lists.next, &list->next, list, TRUE,
+                                      __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+    ;
   
-  /* Unlock the array */
-  pthread_mutex_unlock(&array->mutex);
-  
-  return result;
+  return list;
 }
 
 /****
  *
- * create metadata with per-thread arrays
+ * append a location to one thread slot of an address
  *
  ****/
 
-metaData_t* create_metadata(int max_threads) {
-  metaData_t *metadata;
-  int i;
+int append_thread_location(metaData_t *tmpMd, int slot, mempool_t *slab, size_t line, uint16_t offset) {
+  posting_list_t *list;
   
-  metadata = (metaData_t *)XMALLOC(sizeof(metaData_t));
-  if (metadata == NULL) {
-    fprintf(stderr, "ERR - Unable to allocate metadata\n");
-    return NULL;
-  }
-  
-  metadata->total_count = 0;
-  metadata->max_threads = max_threads;
-  
-  metadata->thread_data = (thread_location_data_t *)XMALLOC(sizeof(thread_location_data_t) * max_threads);
-  if (metadata->thread_data == NULL) {
-    fprintf(stderr, "ERR - Unable to allocate thread data array\n");
-    XFREE(metadata);
-    return NULL;
-  }
-  
-  /* Initialize each thread's data */
-  for (i = 0; i < max_threads; i++) {
-    metadata->thread_data[i].locations = NULL;
-    metadata->thread_data[i].count = 0;
-  }
+  if ((list = get_slot_postings(tmpMd, slot, slab)) == NULL)
+    return FALSE;
   
-  return metadata;
+  return posting_append(list, slab, line, offset);
 }
 
 /****
  *
- * free metadata and all thread arrays
+ * queue an address for the next batched lookup
+ *
+ * The key is copied and hashed once here, the lookup and any insert
+ * reuse that hash.  Returns FALSE if the address cannot be batched.
  *
  ****/
 
-void free_metadata(metaData_t *metadata) {
-  int i;
-  
-  if (metadata == NULL) return;
+int batch_address(address_batch_t *batch, const char *address, size_t line, uint16_t offset) {
+  size_t len = strlen(address) + 1;
   
-  if (metadata->thread_data != NULL) {
-    /* Free each thread's location array */
-    for (i = 0; i < metadata->max_threads; i++) {
-      if (metadata->thread_data[i].locations != NULL) {
-        free_location_array(metadata->thread_data[i].locations);
-      }
-    }
-    XFREE(metadata->thread_data);
+  if (len > ADDRESS_BATCH_KEY_LEN) {
+    fprintf(stderr, "ERR - Address too long to index [%.*s...]\n", ADDRESS_BATCH_KEY_LEN, address);
+    return FALSE;
   }
   
-  XFREE(metadata);
+  return batch_hashed_address(batch, address, (int)len, getKeyHash(address, (int)len), line, offset);
 }
 
 /****
  *
- * get or create location array for specific thread
+ * queue an address whose key length and hash are already known
  *
  ****/
 
-location_array_t* get_thread_location_array(metaData_t *metadata, int thread_id) {
-  if (metadata == NULL || thread_id < 0 || thread_id >= metadata->max_threads) {
-    return NULL;
-  }
+int batch_hashed_address(address_batch_t *batch, const char *address, int keyLen, uint64_t hashValue, size_t line, uint16_t offset) {
+  struct hashKey_s *key = &batch->keys[batch->count];
   
-  /* Create array if it doesn't exist for this thread */
-  if (metadata->thread_data[thread_id].locations == NULL) {
-    metadata->thread_data[thread_id].locations = create_location_array(1024);
-  }
+  memcpy(batch->strings[batch->count], address, keyLen);
+  key->keyString = batch->strings[batch->count];
+  key->keyLen = keyLen;
+  key->hashValue = hashValue;
+  batch->lines[batch->count] = line;
+  batch->offsets[batch->count] = offset;
+  batch->count++;
   
-  return metadata->thread_data[thread_id].locations;
+  return TRUE;
 }
 
 /****
  *
- * add location atomically (thread-safe)
+ * resolve a batch against a single-writer table, locations go to slot 0
+ *
+ * Used by the serial scan and by workers with private tables.  A new
+ * address seen twice in one batch is handed its metadata directly so
+ * the second copy never reaches the table.  On return every key's data
+ * holds its metadata.  Postings are drawn from slab, which must outlive
+ * any table the lists are later merged into.
  *
  ****/
 
-int add_location_atomic(location_array_t *array, size_t line, uint16_t offset) {
-  size_t index;
-  int result = TRUE;
-  
-  if (array == NULL || array->entries == NULL) return FALSE;
+int record_address_batch(struct hash_s *hash, mempool_t *slab, address_batch_t *batch) {
+  metaData_t *tmpMd;
+  int i, j;
   
-  /* Lock the array for thread-safe access */
-  pthread_mutex_lock(&array->mutex);
+  getHashDataBatch(hash, batch->keys, batch->count);
   
-  /* Check if array is full */
-  if (array->count >= array->capacity) {
-    result = FALSE;  /* Array is full, needs growing */
-  } else {
-    /* Reserve a slot and store the location */
-    index = array->count;
-    array->entries[index].line = line;
-    array->entries[index].offset = offset;
-    array->count++;
+  for (i = 0; i < batch->count; i++) {
+    struct hashKey_s *key = &batch->keys[i];
+    
+    if ((tmpMd = (metaData_t *)key->data) == NULL) {
+      if ((tmpMd = create_metadata(hash->arena)) == NULL) {
+        fprintf(stderr, "ERR - Unable to create metadata, aborting\n");
+        abort();
+      }
+      /* The table grows itself, only a failed grow leaves it full */
+      if (getOrAddHashData(hash, key->keyString, key->keyLen, key->hashValue, tmpMd) != tmpMd) {
+        fprintf(stderr, "ERR - Unable to add address to hash, aborting\n");
+        abort();
+      }
+      key->data = tmpMd;
+      for (j = i + 1; j < batch->count; j++) {
+        if (batch->keys[j].hashValue == key->hashValue &&
+            batch->keys[j].keyLen == key->keyLen &&
+            memcmp(batch->keys[j].keyString, key->keyString, key->keyLen) == 0)
+          batch->keys[j].data = tmpMd;
+      }
+    }
+    
+    if (!append_thread_location(tmpMd, 0, slab, batch->lines[i], batch->offsets[i]))
+      return FALSE;
+    tmpMd->total_count++;
   }
   
-  /* Unlock the array */
-  pthread_mutex_unlock(&array->mutex);
-  
-  return result;
+  batch->count = 0;
+  return TRUE;
 }
 
 /****
@@ -288,10 +251,6 @@ int add_location_atomic(location_array_t *array, size_t line, uint16_t offset) {
  *
  ****/
 
-/* Global mega-buffer for batched output */
-static char mega_buffer[1048576];  /* 1MB buffer */
-static int mega_buffer_pos = 0;
-
 /* Forward declarations */
 static struct Address_s* mergeAddresses(struct Address_s* left, struct Address_s* right);
 
@@ -348,20 +307,11 @@ static struct Address_s* mergeAddresses(struct Address_s* left, struct Address_s
   return dummy.next;
 }
 
-/* Comparison function for qsort - sort by line number */
-static int compare_locations(const void *a, const void *b) {
-  const location_entry_t *loc_a = (const location_entry_t *)a;
-  const location_entry_t *loc_b = (const location_entry_t *)b;
-  
-  if (loc_a->line < loc_b->line) return -1;
-  if (loc_a->line > loc_b->line) return 1;
-  return 0;  /* Equal line numbers */
-}
-
 /* Global array for collecting addresses for sorting */
 static address_for_sorting_t *addresses_to_sort = NULL;
 static size_t addresses_to_sort_count = 0;
 static size_t addresses_to_sort_capacity = 0;
+static size_t addresses_to_sort_reported = 0;
 
 /* Comparison function for address sorting: frequency desc, then IP numerical */
 static int compare_addresses_for_output(const void *a, const void *b) {
@@ -377,21 +327,26 @@ static int compare_addresses_for_output(const void *a, const void *b) {
   return strcmp(addr_a->address, addr_b->address);
 }
 
+/* Address order for -k, the order the .lpx key directory is searched in */
+static int compare_addresses_by_key(const void *a, const void *b) {
+  return strcmp(((const address_for_sorting_t *)a)->address, ((const address_for_sorting_t *)b)->address);
+}
+
+/* Order the output threads sort in */
+static int (*output_order)(const void *a, const void *b) = compare_addresses_for_output;
+
 /* Collect address for sorting instead of printing immediately */
 static int collectAddressForSorting(const struct hashRec_s *hashRec) {
   metaData_t *tmpMd;
+  posting_list_t *list;
   size_t total_count = 0;
-  int i;
 
   if (hashRec->data != NULL) {
     tmpMd = (metaData_t *)hashRec->data;
 
     /* Calculate total count across all threads */
-    for (i = 0; i < tmpMd->max_threads; i++) {
-      if (tmpMd->thread_data[i].locations != NULL) {
-        total_count += tmpMd->thread_data[i].count;
-      }
-    }
+    for (list = &tmpMd->lists; list != NULL; list = list->next)
+      total_count += list->count;
 
     /* Grow collection array if needed */
     if (addresses_to_sort_count >= addresses_to_sort_capacity) {
@@ -404,79 +359,182 @@ static int collectAddressForSorting(const struct hashRec_s *hashRec) {
       }
       addresses_to_sort = new_array;
       addresses_to_sort_capacity = new_capacity;
+      budget_publish(BUDGET_OUTPUT, &addresses_to_sort_reported, sizeof(address_for_sorting_t) * new_capacity);
     }
 
-    /* Store address info for later sorting */
-    addresses_to_sort[addresses_to_sort_count].address = strdup(hashRec->keyString);
+    /* Store address info for later sorting, the key lives as long as the table */
+    addresses_to_sort[addresses_to_sort_count].address = hashRec->keyString;
     addresses_to_sort[addresses_to_sort_count].total_count = total_count;
     addresses_to_sort[addresses_to_sort_count].hash_record = (struct hashRec_s *)hashRec;
+    addresses_to_sort[addresses_to_sort_count].length = 0;
     addresses_to_sort_count++;
   }
 
   return FALSE; /* Continue traversal */
 }
 
-/* K-way merge streaming output - no memory allocation needed */
-static void stream_sorted_locations(FILE *output_stream, metaData_t *tmpMd) {
-  size_t thread_indices[MAX_THREADS] = {0}; /* Current position in each thread's array */
-  location_array_t *thread_arrays[MAX_THREADS];
-  int active_threads = 0;
+/****
+ *
+ * visit an address's locations in line order
+ *
+ * Every writer appends in scan order, so each list is already sorted
+ * and an address held by one writer streams straight through.  More
+ * lists are merged with a binary heap of cursors ordered by (line,
+ * field), log k per location instead of a scan over every list.
+ * Stops early and returns FALSE if fn does.
+ *
+ ****/
+
+typedef struct location_head_s {
+  size_t line;
+  uint16_t offset;
+  posting_cursor_t *cursor;
+} location_head_t;
+
+static ALWAYS_INLINE int location_before(const location_head_t *a, const location_head_t *b) {
+  return a->line < b->line || (a->line == b->line && a->offset < b->offset);
+}
+
+static void location_sift_down(location_head_t *heap, int count, int i) {
+  location_head_t item = heap[i];
+  int child;
+  
+  while ((child = 2 * i + 1) < count) {
+    if (child + 1 < count && location_before(&heap[child + 1], &heap[child]))
+      child++;
+    if (!location_before(&heap[child], &item))
+      break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = item;
+}
+
+int visit_sorted_locations(metaData_t *tmpMd, int (*fn)(void *arg, size_t line, uint16_t offset), void *arg) {
+  posting_cursor_t cursors[MAX_THREADS];
+  location_head_t heap[MAX_THREADS];
+  posting_list_t *list;
+  int num_lists = 0;
+  int count = 0;
+  int ret = TRUE;
   int i;
   
-  /* Initialize thread arrays and sort each one */
-  for (i = 0; i < tmpMd->max_threads; i++) {
-    if (tmpMd->thread_data[i].locations != NULL && tmpMd->thread_data[i].locations->count > 0) {
-      thread_arrays[i] = tmpMd->thread_data[i].locations;
-      /* Sort this thread's array in-place */
-      qsort(thread_arrays[i]->entries, thread_arrays[i]->count, 
-            sizeof(location_entry_t), compare_locations);
-      active_threads++;
-    } else {
-      thread_arrays[i] = NULL;
+  /* Open a cursor on each writer's postings and load its first entry */
+  for (list = &tmpMd->lists; list != NULL && num_lists < MAX_THREADS; list = list->next) {
+    posting_cursor_t *cursor = &cursors[num_lists];
+    
+    if (list->count == 0 || !posting_cursor_init(cursor, list))
+      continue;
+    num_lists++;
+    if (posting_cursor_next(cursor, &heap[count].line, &heap[count].offset)) {
+      heap[count++].cursor = cursor;
     }
   }
   
-  /* Stream output using k-way merge (simple linear scan for k=4) */
-  while (active_threads > 0) {
-    size_t min_line = SIZE_MAX;
-    uint16_t min_offset = 0;
-    int min_thread = -1;
-    
-    /* Find thread with minimum line number */
-    for (i = 0; i < tmpMd->max_threads; i++) {
-      if (thread_arrays[i] != NULL && thread_indices[i] < thread_arrays[i]->count) {
-        location_entry_t *entry = &thread_arrays[i]->entries[thread_indices[i]];
-        if (entry->line < min_line) {
-          min_line = entry->line;
-          min_offset = entry->offset;
-          min_thread = i;
-        }
+  if (count == 1) {
+    /* One writer, its list is the answer */
+    do {
+      if (!fn(arg, heap[0].line, heap[0].offset)) {
+        ret = FALSE;
+        break;
       }
-    }
+    } while (posting_cursor_next(heap[0].cursor, &heap[0].line, &heap[0].offset));
+  } else {
+    for (i = count / 2 - 1; i >= 0; i--)
+      location_sift_down(heap, count, i);
     
-    /* Output the minimum entry */
-    if (min_thread >= 0) {
-      fprintf(output_stream, ",%zu:%u", min_line + 1, min_offset);
-      
-      /* Advance the pointer for this thread */
-      thread_indices[min_thread]++;
+    while (count > 0) {
+      if (!fn(arg, heap[0].line, heap[0].offset)) {
+        ret = FALSE;
+        break;
+      }
       
-      /* Check if this thread is exhausted */
-      if (thread_indices[min_thread] >= thread_arrays[min_thread]->count) {
-        thread_arrays[min_thread] = NULL;
-        active_threads--;
+      /* Advance the smallest cursor, dropping it once exhausted */
+      if (!posting_cursor_next(heap[0].cursor, &heap[0].line, &heap[0].offset)) {
+        if (--count == 0)
+          break;
+        heap[0] = heap[count];
       }
-    } else {
-      break; /* Safety break - shouldn't happen */
+      location_sift_down(heap, count, 0);
     }
   }
+  
+  for (i = 0; i < num_lists; i++)
+    posting_cursor_free(&cursors[i]);
+  
+  return ret;
+}
+
+/****
+ *
+ * .lpi record formatting
+ *
+ * Records are formatted into a growable buffer instead of one fprintf
+ * per location, so formatting threads never share a writer.
+ *
+ ****/
+
+/* Write one location in .lpi form, lines are stored zero based */
+static int format_location(void *arg, size_t line, uint16_t offset) {
+  out_buffer_t *buf = (out_buffer_t *)arg;
+  char *p;
+  
+  if (!out_reserve(buf, WRITER_MAX_DECIMAL + 8))  /* ,line:field */
+    return FALSE;
+  p = buf->data + buf->len;
+  *p++ = ',';
+  p = writer_decimal(p, line + 1);
+  *p++ = ':';
+  p = writer_decimal(p, offset);
+  buf->len = p - buf->data;
+  return TRUE;
+}
+
+/* Append ADDRESS,COUNT,LINE:FIELD,...\n for one address */
+static int format_address(out_buffer_t *buf, const struct hashRec_s *hashRec, size_t total_count) {
+  char *p;
+  
+  if (!out_reserve(buf, hashRec->keyLen + WRITER_MAX_DECIMAL + 1))
+    return FALSE;
+  p = buf->data + buf->len;
+  memcpy(p, hashRec->keyString, hashRec->keyLen - 1);  /* keyLen counts the NUL */
+  p += hashRec->keyLen - 1;
+  *p++ = ',';
+  p = writer_decimal(p, total_count);
+  buf->len = p - buf->data;
+  
+  /* Stream sorted locations directly into the buffer */
+  if (total_count > 0 && !visit_sorted_locations((metaData_t *)hashRec->data, format_location, buf))
+    return FALSE;
+  
+  if (!out_reserve(buf, 1))
+    return FALSE;
+  buf->data[buf->len++] = '\n';
+  return TRUE;
+}
+
+/* Add one location to a binary postings list, lines are stored zero based */
+static int encode_location(void *arg, size_t line, uint16_t offset) {
+  return lpi2_postings_add((lpi2_postings_t *)arg, line + 1, offset) == TRUE;
+}
+
+/* Append the binary postings of one address */
+static int encode_address(out_buffer_t *buf, const address_for_sorting_t *addr) {
+  lpi2_postings_t postings;
+  
+  if (lpi2_postings_begin(&postings, buf, addr->total_count) != TRUE)
+    return FALSE;
+  if (addr->total_count > 0 &&
+      !visit_sorted_locations((metaData_t *)addr->hash_record->data, encode_location, &postings))
+    return FALSE;
+  return lpi2_postings_end(&postings) == TRUE;
 }
 
 int printAddress(const struct hashRec_s *hashRec) {
   metaData_t *tmpMd;
-  FILE *output_stream;
+  posting_list_t *list;
+  out_buffer_t buf = { NULL, 0, 0 };
   size_t total_count = 0;
-  int i;
 
   if (hashRec->data != NULL) {
     tmpMd = (metaData_t *)hashRec->data;
@@ -486,28 +544,14 @@ int printAddress(const struct hashRec_s *hashRec) {
       printf("DEBUG - Searching for [%s]\n", hashRec->keyString);
 #endif
 
-    output_stream = config->outFile_st ? config->outFile_st : stdout;
-
     /* Calculate total count across all threads */
-    for (i = 0; i < tmpMd->max_threads; i++) {
-      if (tmpMd->thread_data[i].locations != NULL) {
-        total_count += tmpMd->thread_data[i].count;
-      }
-    }
-
-    /* Write address and total count */
-    fprintf(output_stream, "%s,%zu", hashRec->keyString, total_count);
-
-    /* Stream sorted locations directly - no memory allocation needed! */
-    if (total_count > 0) {
-      stream_sorted_locations(output_stream, tmpMd);
-    }
+    for (list = &tmpMd->lists; list != NULL; list = list->next)
+      total_count += list->count;
 
-    /* Write newline */
-    fprintf(output_stream, "\n");
-    
-    /* Free all thread metadata */
-    free_metadata(tmpMd);
+    if (format_address(&buf, hashRec, total_count))
+      fwrite(buf.data, 1, buf.len, config->outFile_st ? config->outFile_st : stdout);
+    if (buf.data != NULL)
+      XFREE(buf.data);
   }
 
   /* can use this later to interrupt traversing the hash */
@@ -522,6 +566,566 @@ void flushOutputBuffer(void) {
   fflush(output_stream);
 }
 
+/****
+ *
+ * output threads
+ *
+ * Sorting and formatting split the collected addresses into one
+ * contiguous range per thread.  Ranges are sorted in place, then
+ * adjacent sorted ranges are merged pairwise, each pair by its own
+ * thread.  Formatting runs in rounds: each thread formats the next
+ * OUTPUT_BATCH records of its range into its own buffer and the
+ * buffers are handed to the index writer in order.  The writer's I/O
+ * thread writes one round while the next is formatted.  With -z each
+ * thread also compresses its records into blocks, so compression runs
+ * on every thread too.
+ *
+ ****/
+
+/* A compressed block of a round and the record it starts with */
+typedef struct output_block_s {
+  size_t first;
+  size_t length;
+} output_block_t;
+
+typedef struct output_job_s {
+  address_for_sorting_t *src;
+  address_for_sorting_t *dst;
+  size_t start;
+  size_t mid;
+  size_t end;
+  out_buffer_t buf;
+  out_buffer_t zbuf;            /* buf compressed with -z */
+  output_block_t *blocks;
+  size_t block_count;
+  int status;
+  pthread_t thread;
+} output_job_t;
+
+static int output_threads(size_t count) {
+  size_t threads;
+  
+  if (config->force_serial || count < OUTPUT_MIN_PER_THREAD * 2)
+    return 1;
+  threads = get_available_cores();
+  if (threads > count / OUTPUT_MIN_PER_THREAD)
+    threads = count / OUTPUT_MIN_PER_THREAD;
+  return (threads < 1) ? 1 : (int)threads;
+}
+
+/* Run every job, inline when there is only one or a thread can't start */
+static void run_output_jobs(output_job_t *jobs, int count, void *(*fn)(void *)) {
+  int i;
+  
+  for (i = 0; i < count; i++) {
+    if (count == 1 || pthread_create(&jobs[i].thread, NULL, fn, &jobs[i]) != 0) {
+      jobs[i].thread = 0;
+      fn(&jobs[i]);
+    }
+  }
+  for (i = 0; i < count; i++) {
+    if (jobs[i].thread)
+      pthread_join(jobs[i].thread, NULL);
+  }
+}
+
+static void *sort_range_thread(void *arg) {
+  output_job_t *job = (output_job_t *)arg;
+  
+  qsort(job->src + job->start, job->end - job->start, sizeof(address_for_sorting_t),
+        output_order);
+  return NULL;
+}
+
+/* Merge src[start,mid) and src[mid,end) into dst[start,end) */
+static void *merge_range_thread(void *arg) {
+  output_job_t *job = (output_job_t *)arg;
+  size_t left = job->start, right = job->mid, out = job->start;
+  
+  while (left < job->mid && right < job->end) {
+    if (output_order(&job->src[left], &job->src[right]) <= 0)
+      job->dst[out++] = job->src[left++];
+    else
+      job->dst[out++] = job->src[right++];
+  }
+  if (left < job->mid)
+    memcpy(&job->dst[out], &job->src[left], (job->mid - left) * sizeof(address_for_sorting_t));
+  else if (right < job->end)
+    memcpy(&job->dst[out], &job->src[right], (job->end - right) * sizeof(address_for_sorting_t));
+  return NULL;
+}
+
+/* Cut a round of records into blocks of about ZBLOCK_SIZE and compress them */
+static int compress_range(output_job_t *job) {
+  const char *data = job->buf.data;
+  size_t first = job->start, len = 0, before, i;
+  
+  job->zbuf.len = 0;
+  job->block_count = 0;
+  if (job->blocks == NULL &&
+      (job->blocks = (output_block_t *)XMALLOC(sizeof(output_block_t) * OUTPUT_BATCH)) == NULL)
+    return FAILED;
+  
+  for (i = job->start; i < job->end; i++) {
+    len += job->src[i].length;
+    if (len < ZBLOCK_SIZE && i + 1 < job->end)
+      continue;
+    
+    before = job->zbuf.len;
+    if (zblock_compress(&job->zbuf, data, len) != TRUE)
+      return FAILED;
+    job->blocks[job->block_count].first = first;
+    job->blocks[job->block_count++].length = job->zbuf.len - before;
+    data += len;
+    len = 0;
+    first = i + 1;
+  }
+  return TRUE;
+}
+
+static void *format_range_thread(void *arg) {
+  output_job_t *job = (output_job_t *)arg;
+  size_t i;
+  
+  job->buf.len = 0;
+  job->status = TRUE;
+  for (i = job->start; i < job->end; i++) {
+    size_t start = job->buf.len;
+    
+    if (config->binary_index ? !encode_address(&job->buf, &job->src[i])
+                             : !format_address(&job->buf, job->src[i].hash_record, job->src[i].total_count)) {
+      job->status = FAILED;
+      break;
+    }
+    job->src[i].length = job->buf.len - start;
+  }
+  if (job->status == TRUE && config->compress_index)
+    job->status = compress_range(job);
+  return NULL;
+}
+
+/* Sort addresses in output order, frequency (desc) then address (asc) unless -k */
+static void sortCollectedAddresses(output_job_t *jobs, int threads) {
+  address_for_sorting_t *src = addresses_to_sort, *dst, *tmp;
+  size_t bounds[MAX_THREADS + 1];
+  size_t ranges = (size_t)threads, width, i;
+  int merges;
+  
+  for (i = 0; i <= ranges; i++)
+    bounds[i] = addresses_to_sort_count * i / ranges;
+  
+  for (i = 0; i < ranges; i++) {
+    jobs[i].src = src;
+    jobs[i].start = bounds[i];
+    jobs[i].end = bounds[i + 1];
+  }
+  run_output_jobs(jobs, threads, sort_range_thread);
+  if (threads == 1)
+    return;
+  
+  /* Same allocator as the collection array, either may be freed last */
+  if ((dst = (address_for_sorting_t *)malloc(sizeof(address_for_sorting_t) * addresses_to_sort_count)) == NULL) {
+    /* Fall back to one more sort over the sorted ranges */
+    qsort(src, addresses_to_sort_count, sizeof(address_for_sorting_t), output_order);
+    return;
+  }
+  budget_add(BUDGET_OUTPUT, (int64_t)(sizeof(address_for_sorting_t) * addresses_to_sort_count));
+  
+  for (width = 1; width < ranges; width *= 2) {
+    merges = 0;
+    for (i = 0; i < ranges; i += 2 * width) {
+      jobs[merges].src = src;
+      jobs[merges].dst = dst;
+      jobs[merges].start = bounds[i];
+      jobs[merges].mid = bounds[(i + width < ranges) ? i + width : ranges];
+      jobs[merges].end = bounds[(i + 2 * width < ranges) ? i + 2 * width : ranges];
+      merges++;
+    }
+    run_output_jobs(jobs, merges, merge_range_thread);
+    tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+  
+  /* Keep whichever array ended up sorted, the collection's size is still the one charged */
+  free(dst);
+  budget_add(BUDGET_OUTPUT, -(int64_t)(sizeof(address_for_sorting_t) * addresses_to_sort_count));
+  addresses_to_sort = src;
+}
+
+/****
+ *
+ * add a round of encoded postings to a binary index
+ *
+ ****/
+
+static int addBinaryAddresses(lpi2_builder_t *index, output_job_t *job) {
+  const char *postings = job->buf.data;
+  size_t i;
+  
+  for (i = job->start; i < job->end; i++) {
+    address_for_sorting_t *addr = &job->src[i];
+    
+    if (lpi2_builder_add(index, addr->address, addr->hash_record->keyLen - 1, addr->total_count,
+                         postings, addr->length) != TRUE)
+      return FAILED;
+    postings += addr->length;
+  }
+  return TRUE;
+}
+
+/****
+ *
+ * write a round of compressed blocks, each listed in the key directory
+ *
+ ****/
+
+static int writeCompressedBlocks(writer_t *out, keydir_writer_t *keys, output_job_t *job, off_t *offset) {
+  const char *data = job->zbuf.data;
+  size_t b;
+  
+  for (b = 0; b < job->block_count; b++) {
+    if (keydir_mark(keys, job->src[job->blocks[b].first].address, *offset) != TRUE ||
+        writer_write(out, data, job->blocks[b].length) != TRUE)
+      return FAILED;
+    data += job->blocks[b].length;
+    *offset += job->blocks[b].length;
+  }
+  return TRUE;
+}
+
+/****
+ *
+ * sort the collected addresses and print them
+ *
+ * Text records go out by count, or by address with -k so the .lpx key
+ * directory can point into them, compressed in blocks with -z.  A
+ * binary index sorts its own keys,
+ * the count order only keeps its postings layout the same from run to
+ * run.
+ *
+ ****/
+
+static int writeSortedAddresses(void) {
+  FILE *output_stream = config->outFile_st ? config->outFile_st : stdout;
+  output_job_t jobs[MAX_THREADS];
+  lpi2_builder_t *index = NULL;
+  keydir_writer_t *keys = NULL;
+  filter_t *filter = NULL;
+  writer_t *out;
+  off_t offset = 0;
+  size_t next, a;
+  int threads, i, ret = TRUE;
+
+  if ((addresses_to_sort_count > 0 || config->binary_index || config->key_order) &&
+      (out = writer_create(output_stream, !config->force_serial && get_available_cores() > 1)) != NULL) {
+    if (config->binary_index) {
+      if ((index = lpi2_builder_create(out, 0)) == NULL ||
+          (budget_limit() &&
+           lpi2_builder_spill(index, config->temp_dir, budget_limit() / BUDGET_OUTPUT_SHARE) != TRUE))
+        ret = FAILED;
+    } else {
+      if (config->key_order) {
+        output_order = compare_addresses_by_key;
+        if (config->index_filename != NULL)
+          keys = keydir_create(config->index_filename, config->compress_index);
+      }
+      if (config->index_filename != NULL && (filter = filter_create(addresses_to_sort_count)) != NULL)
+        budget_add(BUDGET_OUTPUT, (int64_t)filter->blocks * FILTER_BLOCK_SIZE);
+    }
+    threads = output_threads(addresses_to_sort_count);
+    XMEMSET(jobs, 0, sizeof(jobs));
+    if (addresses_to_sort_count > 0)
+      sortCollectedAddresses(jobs, threads);
+    
+#ifdef DEBUG
+    if (config->debug >= 2)
+      fprintf(stderr, "DEBUG - Writing %zu addresses with %d threads\n",
+              addresses_to_sort_count, threads);
+#endif
+    
+    /* Format in rounds, each thread fills its own buffer, written in order */
+    for (next = 0; next < addresses_to_sort_count && ret == TRUE && !quit;) {
+      for (i = 0; i < threads; i++) {
+        jobs[i].src = addresses_to_sort;
+        jobs[i].start = next;
+        next += OUTPUT_BATCH;
+        if (next > addresses_to_sort_count)
+          next = addresses_to_sort_count;
+        jobs[i].end = next;
+      }
+      run_output_jobs(jobs, threads, format_range_thread);
+      for (i = 0; i < threads && ret == TRUE; i++) {
+        if (jobs[i].status != TRUE)
+          ret = FAILED;
+        else if (index != NULL)
+          ret = addBinaryAddresses(index, &jobs[i]);
+        else if (config->compress_index)
+          ret = writeCompressedBlocks(out, keys, &jobs[i], &offset);
+        else if (jobs[i].buf.len > 0)
+          ret = writer_write(out, jobs[i].buf.data, jobs[i].buf.len);
+        
+        for (a = jobs[i].start; a < jobs[i].end && index == NULL && ret == TRUE; a++) {
+          if (filter != NULL)
+            filter_add(filter, filter_hash(addresses_to_sort[a].address, strlen(addresses_to_sort[a].address)));
+          if (!config->compress_index) {
+            ret = keydir_add(keys, addresses_to_sort[a].address, offset, addresses_to_sort[a].length);
+            offset += addresses_to_sort[a].length;
+          }
+        }
+      }
+    }
+    
+    if (index != NULL) {
+      if (ret == TRUE)
+        ret = lpi2_builder_finish(index);
+      lpi2_builder_destroy(index);
+    }
+    output_order = compare_addresses_for_output;
+    if (writer_close(out) != TRUE)
+      ret = FAILED;
+    if (ret != TRUE)
+      fprintf(stderr, "ERR - Unable to write index\n");
+    if (keys != NULL && (keydir_close(keys, offset) != TRUE || ret != TRUE))
+      keydir_remove(config->index_filename);
+    if (filter != NULL) {
+      if (ret != TRUE || filter_save(filter, config->index_filename, offset) != TRUE)
+        filter_remove(config->index_filename);
+      budget_add(BUDGET_OUTPUT, -(int64_t)filter->blocks * FILTER_BLOCK_SIZE);
+      filter_free(filter);
+    }
+    
+    for (i = 0; i < threads; i++) {
+      if (jobs[i].buf.data != NULL)
+        XFREE(jobs[i].buf.data);
+      if (jobs[i].zbuf.data != NULL)
+        XFREE(jobs[i].zbuf.data);
+      if (jobs[i].blocks != NULL)
+        XFREE(jobs[i].blocks);
+    }
+  } else if (addresses_to_sort_count > 0 || config->binary_index || config->key_order)
+    ret = FAILED;
+  
+  /* Clean up */
+  if (addresses_to_sort != NULL) {
+    free(addresses_to_sort);
+    addresses_to_sort = NULL;
+    addresses_to_sort_capacity = 0;
+    addresses_to_sort_count = 0;
+    budget_publish(BUDGET_OUTPUT, &addresses_to_sort_reported, 0);
+  }
+  
+  flushOutputBuffer();
+  return ret;
+}
+
+/****
+ *
+ * has a table and its postings reached the memory budget
+ *
+ * A packed table is one growth away from passing its budget, so it
+ * spills before that grow rather than after.  Spilling sorts an index
+ * of the table's records, so that counts too.
+ *
+ ****/
+
+int table_over_budget(struct hash_s *hash, mempool_t *slab) {
+  size_t used;
+  
+  if (hash->memLimit == 0)
+    return FALSE;
+  
+  used = getHashMemory(hash) + hash->totalRecords * sizeof(struct hashRec_s *);
+  if (slab != hash->arena)
+    used += mempool_get_usage(slab);
+  
+  return hash->packed || used >= hash->memLimit;
+}
+
+/****
+ *
+ * give a table its budget, never less than twice its empty size
+ *
+ * A budget an empty table already fills would spill every batch.
+ *
+ ****/
+
+void set_table_budget(struct hash_s *hash, size_t limit) {
+  static int warned = FALSE;
+  size_t floor = getHashMemory(hash) * 2;
+  
+  if (limit != 0 && limit < floor) {
+    if (!__atomic_exchange_n(&warned, TRUE, __ATOMIC_RELAXED))
+      fprintf(stderr, "WARN - Memory limit too small for an address table, using %zu MB\n",
+              (floor + 1048575) >> 20);
+    limit = floor;
+  }
+  hash->memLimit = limit;
+}
+
+/****
+ *
+ * can a table of keys be written from memory within the budget
+ *
+ * Sorting in memory takes the collected addresses twice over and the
+ * filter on top of the table, a binary index its share for keys too.
+ * A table that would not fit spills and is written by the bounded
+ * merge instead.
+ *
+ ****/
+
+int output_fits(size_t keys) {
+  size_t need, used;
+  
+  if (!budget_limit())
+    return TRUE;
+  
+  need = keys * (sizeof(address_for_sorting_t) * 2 + FILTER_BITS_PER_KEY / 8);
+  if (config->binary_index)
+    need += budget_limit() / BUDGET_OUTPUT_SHARE;
+  used = budget_used(BUDGET_CHUNKS) + budget_used(BUDGET_TABLES) + budget_used(BUDGET_POSTINGS) +
+         budget_used(BUDGET_OUTPUT);
+  
+  return used + need <= budget_limit();
+}
+
+/****
+ *
+ * create the serial table and its postings slab
+ *
+ ****/
+
+static void initAddressTable(void) {
+  if ((addrHash = initHash(65536)) == NULL ||
+      (addrPostings == NULL && (addrPostings = mempool_create()) == NULL)) {
+    fprintf(stderr, "ERR - Unable to allocate address table, aborting\n");
+    abort();
+  }
+  set_table_budget(addrHash, config->memory_limit);
+}
+
+/****
+ *
+ * report the serial table's memory to the budget
+ *
+ ****/
+
+static void publishAddressTable(void) {
+  budget_publish(BUDGET_TABLES, &addrTableReported, getHashMemory(addrHash));
+  budget_publish(BUDGET_POSTINGS, &addrPostingsReported, mempool_get_usage(addrPostings));
+}
+
+/****
+ *
+ * free the serial table and its postings
+ *
+ ****/
+
+static void freeAddressTable(void) {
+  freeHash(addrHash);
+  addrHash = NULL;
+  mempool_destroy(addrPostings);
+  addrPostings = NULL;
+  budget_publish(BUDGET_TABLES, &addrTableReported, 0);
+  budget_publish(BUDGET_POSTINGS, &addrPostingsReported, 0);
+}
+
+/****
+ *
+ * write the serial table out as a sorted run and start an empty one
+ *
+ ****/
+
+static void spillAddressTable(void) {
+  if (addrSpill == NULL && (addrSpill = spill_create(config->temp_dir)) == NULL) {
+    fprintf(stderr, "ERR - Unable to create spill set, aborting\n");
+    abort();
+  }
+  
+  if (spill_write_run(addrSpill, addrHash) != TRUE) {
+    fprintf(stderr, "ERR - Unable to spill address table, aborting\n");
+    abort();
+  }
+  
+  freeHash(addrHash);
+  mempool_reset(addrPostings);
+  budget_trim();
+  initAddressTable();
+  publishAddressTable();
+}
+
+/****
+ *
+ * write the serial table, merging it with any spilled runs
+ *
+ ****/
+
+static int writeAddressTable(void) {
+  FILE *output_stream = config->outFile_st ? config->outFile_st : stdout;
+  int ret = TRUE;
+  
+  publishAddressTable();
+  if (!spill_has_runs(addrSpill) && output_fits(addrHash->totalRecords)) {
+    /* Collect all addresses for sorting */
+    addresses_to_sort_count = 0;
+    traverseHash(addrHash, collectAddressForSorting);
+    return writeSortedAddresses();
+  }
+  
+  /* The rest of the table becomes the last run, and is let go before the merge */
+  if (addrSpill == NULL && (addrSpill = spill_create(config->temp_dir)) == NULL)
+    return FAILED;
+  if (spill_write_run(addrSpill, addrHash) != TRUE)
+    ret = FAILED;
+  freeAddressTable();
+  budget_trim();
+  if (ret != TRUE || spill_merge_runs(addrSpill, output_stream) != TRUE) {
+    fprintf(stderr, "ERR - Unable to write index from spilled runs\n");
+    ret = FAILED;
+  }
+  flushOutputBuffer();
+  
+  spill_destroy(addrSpill);
+  addrSpill = NULL;
+  return ret;
+}
+
+/****
+ *
+ * close an auto-named index, catching writes that failed on the way
+ *
+ ****/
+
+static int closeIndexFile(void) {
+  int ret = ferror(config->outFile_st) ? FAILED : TRUE;
+
+  if (fclose(config->outFile_st) != 0)
+    ret = FAILED;
+  config->outFile_st = NULL;
+  return ret;
+}
+
+/****
+ *
+ * give up on an index that could not be written
+ *
+ * Its stamp goes too, so the next -w run writes it again rather than
+ * skipping the log.  A tail merge leaves the old index in place.
+ *
+ ****/
+
+static void dropIndexFile(const char *fName, const char *outFileName, int partial) {
+  fprintf(stderr, "ERR - Unable to write index [%s] for [%s]\n", outFileName, fName);
+  stamp_remove(outFileName);
+  if (partial) {
+    unlink(outFileName);
+    keydir_remove(outFileName);
+    filter_remove(outFileName);
+    linemap_remove(outFileName);
+    gzcheck_remove(outFileName);
+  }
+}
+
 /****
  *
  * process file
@@ -530,7 +1134,7 @@ void flushOutputBuffer(void) {
 
 int processFile(const char *fName) {
   FILE *inFile = NULL, *outFile = NULL;
-  gzFile gzInFile;
+  gzFile gzInFile = NULL;
   char inBuf[65536];  /* Increased buffer size for better I/O performance */
   char outFileName[PATH_MAX];
   char patternBuf[4096];
@@ -541,11 +1145,27 @@ int processFile(const char *fName) {
                minLineLen = sizeof(inBuf), maxLineLen = 0, totLineLen = 0;
   unsigned int argCount = 0, totArgCount = 0, minArgCount = MAX_FIELD_POS,
                maxArgCount = 0;
-  struct hashRec_s *tmpRec;
-  metaData_t *tmpMd;
   struct Address_s *tmpAddr;
   struct Fields_s **curFieldPtr;
-  int isGz = FALSE;
+  address_batch_t addrBatch;
+  linemap_t *checkpoints = NULL;
+  gzcheck_t *gzPoints = NULL;
+  gzreader_t *gzReader = NULL;
+  uint64_t inOffset = 0;
+  char tailFileName[PATH_MAX];
+  stamp_t stamp;
+  off_t tailFrom = 0, stampSize = -1;
+  uint64_t tailLines = 0, stampLines = 0;
+  int isGz = FALSE, written = TRUE;
+
+  addrBatch.count = 0;
+
+  /* XXX need to add bzip2 */
+
+  /* check to see if the file is compressed */
+  if ((((foundPtr = strrchr(fName, '.')) != NULL)) &&
+      (strncmp(foundPtr, ".gz", 3) EQ 0))
+    isGz = TRUE;
 
   /* Handle automatic .lpi file naming */
   if (config->auto_lpi_naming) {
@@ -560,37 +1180,69 @@ int processFile(const char *fName) {
       fprintf(stderr, "ERR - Unsafe output file path [%s]\n", outFileName);
       return (EXIT_FAILURE);
     }
+
+    /* A log indexed before is skipped if unchanged, a grown one has only its new lines read */
+    if (stamp_load(&stamp, outFileName) EQ TRUE) {
+      switch (stamp_check(&stamp, outFileName, fName)) {
+      case STAMP_CURRENT:
+        fprintf(stderr, "Index [%s] is current, skipping [%s]\n", outFileName, fName);
+        return (EXIT_SUCCESS);
+      case STAMP_GROWN:
+        if (!isGz && snprintf(tailFileName, sizeof(tailFileName), "%s.tail", outFileName) < sizeof(tailFileName) &&
+            (checkpoints = linemap_resume(outFileName, (off_t)stamp.size)) != NULL) {
+          if (checkpoints->lines EQ stamp.lines) {
+            tailFrom = (off_t)stamp.size;
+            tailLines = stamp.lines;
+            inOffset = stamp.size;
+          } else {
+            linemap_free(checkpoints);
+            checkpoints = NULL;
+          }
+        }
+        break;
+      }
+    }
     
-    /* Open the output file for this specific input file */
-    if ((config->outFile_st = fopen(outFileName, "w")) == NULL) {
+    /* Open the output file for this specific input file, or for its new lines */
+    if ((config->outFile_st = fopen((tailFrom > 0) ? tailFileName : outFileName, "w")) == NULL) {
       fprintf(stderr, "ERR - Unable to open output file [%s]: %s\n", 
-              outFileName, strerror(errno));
+              (tailFrom > 0) ? tailFileName : outFileName, strerror(errno));
+      linemap_free(checkpoints);
       return (EXIT_FAILURE);
     }
     
-    fprintf(stderr, "Writing index to [%s]\n", outFileName);
+    if (tailFrom > 0) {
+      fprintf(stderr, "Adding lines after line %llu of [%s] to [%s]\n", (unsigned long long)tailLines, fName,
+              outFileName);
+    } else {
+      fprintf(stderr, "Writing index to [%s]\n", outFileName);
+
+      /* A key directory left from an earlier -k run no longer matches */
+      if (!config->key_order || config->binary_index)
+        keydir_remove(outFileName);
+      /* Nor does an old filter, a text index writes a new one */
+      filter_remove(outFileName);
+      /* Line checkpoints and the stamp are written again once the log has been read */
+      linemap_remove(outFileName);
+      gzcheck_remove(outFileName);
+      stamp_remove(outFileName);
+    }
   }
 
   /* initialize the hash if we need to */
   if (addrHash EQ NULL)
-    addrHash = initHash(65536);  /* Start with 64K buckets for better performance */
+    initAddressTable();  /* Start with 64K buckets for better performance */
 
   initParser();
 
-  /* XXX need to add bzip2 */
-
-  /* check to see if the file is compressed */
-  if ((((foundPtr = strrchr(fName, '.')) != NULL)) &&
-      (strncmp(foundPtr, ".gz", 3) EQ 0))
-    isGz = TRUE;
-
   fprintf(stderr, "Opening [%s] for read\n", fName);
   
   /* Check if we should use parallel processing */
   int use_parallel = FALSE;
   parallel_context_t *parallel_ctx = NULL;
   
-  if (!isGz && strcmp(fName, "-") != 0) {
+  /* New lines are read serially from where the index stopped */
+  if (!isGz && strcmp(fName, "-") != 0 && tailFrom EQ 0) {
     /* Open file to check size */
     FILE *testFile = NULL;
 #ifdef HAVE_FOPEN64
@@ -614,7 +1266,16 @@ int processFile(const char *fName) {
     }
   }
 
-  if (isGz) {
+  /* A gzip log being indexed is inflated here, noting where spi can resume */
+  if (isGz && config->auto_lpi_naming && (gzPoints = gzcheck_create()) != NULL &&
+      (gzReader = gzreader_open(fName, gzPoints)) EQ NULL) {
+    gzcheck_free(gzPoints);
+    gzPoints = NULL;
+  }
+
+  if (gzReader != NULL) {
+    /* gzip compressed, read by gzReader */
+  } else if (isGz) {
     /* gzip compressed */
     if ((gzInFile = gzopen(fName, "rb")) EQ NULL) {
       fprintf(stderr, "ERR - Unable to open file [%s] %d (%s)\n", fName, errno,
@@ -632,66 +1293,77 @@ int processFile(const char *fName) {
 #endif
         fprintf(stderr, "ERR - Unable to open file [%s] %d (%s)\n", fName,
                 errno, strerror(errno));
+        linemap_free(checkpoints);
+        return (EXIT_FAILURE);
+      }
+      if (tailFrom > 0 && fseeko(inFile, tailFrom, SEEK_SET) != 0) {
+        fprintf(stderr, "ERR - Unable to seek in [%s]\n", fName);
+        linemap_free(checkpoints);
+        fclose(inFile);
         return (EXIT_FAILURE);
       }
     }
   }
+
+  /* Note where lines start so spi can seek into the log */
+  if (config->auto_lpi_naming && inFile != NULL && inFile != stdin && checkpoints EQ NULL)
+    checkpoints = linemap_create();
   
   /* Use parallel processing for large files */
   if (use_parallel && inFile != NULL && inFile != stdin) {
-    parallel_ctx = init_parallel_context(fName, inFile, addrHash);
+    parallel_ctx = init_parallel_context(fName, inFile);
     if (parallel_ctx != NULL) {
+      parallel_ctx->lines = checkpoints;
       int result = process_file_parallel(parallel_ctx);
       
-      
-      /* Save updated hash pointer and update global before freeing context */
-      struct hash_s *final_hash = parallel_ctx->global_hash;
-      addrHash = final_hash;  /* Update global pointer */
-      
-      free_parallel_context(parallel_ctx);
+      /* The I/O thread drops them if they could not grow */
+      checkpoints = parallel_ctx->lines;
+      if (checkpoints != NULL) {
+        if (result == TRUE && !quit) {
+          linemap_save(checkpoints, outFileName, parallel_ctx->file_size);
+          stampSize = parallel_ctx->file_size;
+          stampLines = checkpoints->lines;
+        }
+        linemap_free(checkpoints);
+      }
       fclose(inFile);
       deInitParser();
       
+      /* An index missing part of the log is not written */
+      if (result != TRUE && config->auto_lpi_naming && config->outFile_st) {
+        fprintf(stderr, "ERR - Unable to index [%s]\n", fName);
+        fclose(config->outFile_st);
+        config->outFile_st = NULL;
+        unlink(outFileName);
+      }
+      
       /* Close auto-generated output file */
       if (config->auto_lpi_naming && config->outFile_st) {
         /* Write addresses to this file in sorted order */
-        if (final_hash != NULL) {
-          /* Reset collection arrays */
-          addresses_to_sort_count = 0;
-          
-          /* Collect all addresses for sorting */
-          traverseHash(final_hash, collectAddressForSorting);
-          
-          /* Sort addresses by frequency (desc) then IP (asc) */
-          if (addresses_to_sort_count > 0) {
-            qsort(addresses_to_sort, addresses_to_sort_count, sizeof(address_for_sorting_t), compare_addresses_for_output);
-            
-            /* Output addresses in sorted order */
-            for (size_t i = 0; i < addresses_to_sort_count; i++) {
-              /* Print this address using the original printAddress logic */
-              printAddress(addresses_to_sort[i].hash_record);
-              
-              /* Free the duplicated address string */
-              free(addresses_to_sort[i].address);
-            }
+        config->index_filename = outFileName;
+        if (spill_has_runs(parallel_ctx->spill)) {
+          if (spill_merge_runs(parallel_ctx->spill, config->outFile_st) != TRUE) {
+            fprintf(stderr, "ERR - Unable to write index from spilled runs\n");
+            result = FAILED;
           }
-          
-          /* Clean up */
-          if (addresses_to_sort != NULL) {
-            free(addresses_to_sort);
-            addresses_to_sort = NULL;
-            addresses_to_sort_capacity = 0;
-            addresses_to_sort_count = 0;
-          }
-          
           flushOutputBuffer();
-          freeHash(final_hash);
-          addrHash = NULL; /* Reset global for next file */
+        } else {
+          addresses_to_sort_count = 0;
+          traverse_parallel_results(parallel_ctx, collectAddressForSorting);
+          if (writeSortedAddresses() != TRUE)
+            result = FAILED;
         }
-        fclose(config->outFile_st);
-        config->outFile_st = NULL;
+        if (closeIndexFile() != TRUE)
+          result = FAILED;
+        config->index_filename = NULL;
+        if (result != TRUE)
+          dropIndexFile(fName, outFileName, TRUE);
+        else if (stampSize >= 0)
+          stamp_save(outFileName, fName, stampSize, stampLines);
       }
       
+      free_parallel_context(parallel_ctx);
+      
       return (result == TRUE) ? EXIT_SUCCESS : EXIT_FAILURE;
     } else {
       fprintf(stderr, "WARN - Failed to initialize parallel processing, falling back to sequential\n");
@@ -699,19 +1371,18 @@ int processFile(const char *fName) {
     }
   }
 
-  /* Optimization: Only check hash growth every N new addresses to reduce overhead */
-  unsigned int new_addresses_since_check = 0;
-  const unsigned int HASH_GROWTH_CHECK_INTERVAL = 4096;  /* Check every 4K new addresses */
-
   /* XXX should block read based on filesystem BS */
   /* XXX should switch to file offsets instead of line numbers, should speed up
    * the index searches */
-  while (((isGz) ? gzgets(gzInFile, inBuf, sizeof(inBuf))
-                 : fgets(inBuf, sizeof(inBuf), inFile)) != NULL &&
+  while (((gzReader != NULL) ? gzreader_gets(gzReader, inBuf, sizeof(inBuf))
+           : (isGz) ? gzgets(gzInFile, inBuf, sizeof(inBuf))
+                    : fgets(inBuf, sizeof(inBuf), inFile)) != NULL &&
          !quit) {
 
     if (reload EQ TRUE) {
       fprintf(stderr, "Processed %d lines/min\n", lineCount);
+      if (config->memory_limit)
+        budget_report(stderr);
 #ifdef DEBUG
       if (config->debug) {
         fprintf(stderr, "Line length: min=%d, max=%d, avg=%2.0f\n", minLineLen,
@@ -737,6 +1408,11 @@ int processFile(const char *fName) {
     }
 #endif
 
+    if (checkpoints != NULL && linemap_line(checkpoints, (inOffset += strlen(inBuf))) != TRUE) {
+      linemap_free(checkpoints);
+      checkpoints = NULL;
+    }
+
     if (config->debug >= 3)
       printf("DEBUG - Before [%s]", inBuf);
 
@@ -759,94 +1435,17 @@ int processFile(const char *fName) {
           /* Strip parser prefix - hash functions should only use clean IP/MAC addresses */
           const char *clean_address = oBuf + 1;  /* Skip 'i', 'I', or 'm' prefix */
           
-          if ((tmpRec = getHashRecord(addrHash, clean_address))
-                  EQ NULL) { /* store line metadata */
-
-            /* Create per-thread metadata (serial mode uses single thread 0) */
-            tmpMd = create_metadata(1);  /* Serial mode = 1 thread */
-            if (tmpMd == NULL) {
-              fprintf(stderr, "ERR - Unable to create metadata, aborting\n");
-              abort();
-            }
-
-            /* Get thread 0's location array (serial mode) */
-            location_array_t *thread_array = get_thread_location_array(tmpMd, 0);
-            if (thread_array == NULL) {
-              fprintf(stderr, "ERR - Unable to get thread location array, aborting\n");
+          /* Lookups are batched so their cache misses overlap */
+          if (batch_address(&addrBatch, clean_address, totLineCount, i) &&
+              addrBatch.count == ADDRESS_BATCH_SIZE) {
+            if (record_address_batch(addrHash, addrPostings, &addrBatch) != TRUE) {
+              fprintf(stderr, "ERR - Unable to record addresses, aborting\n");
               abort();
             }
-            
-            /* Add first location to thread 0's array */
-            if (!add_location_atomic(thread_array, totLineCount, i)) {
-              fprintf(stderr, "ERR - Failed to add first location, aborting\n");
-              abort();
-            }
-            
-            /* Update counts */
-            tmpMd->thread_data[0].count = 1;
-            tmpMd->total_count = 1;
-
-            /* add to the hash */
-            addUniqueHashRec(addrHash, clean_address, strlen(clean_address) + 1, tmpMd);
-            new_addresses_since_check++;
-
-            /* Only check hash growth periodically to reduce overhead */
-            if (new_addresses_since_check >= HASH_GROWTH_CHECK_INTERVAL) {
-              new_addresses_since_check = 0;
-              
-              /* rebalance the hash if it gets too full, with limits */
-              if (((float)addrHash->totalRecords / (float)addrHash->size) > 0.8) {
-                if (addrHash->size >= MAX_HASH_SIZE) {
-                  fprintf(stderr, "WARNING - Hash table at maximum size (%d), performance may degrade\n", MAX_HASH_SIZE);
-                } else if (addrHash->totalRecords >= MAX_HASH_ENTRIES) {
-                  fprintf(stderr, "ERR - Maximum number of hash entries reached (%d), aborting\n", MAX_HASH_ENTRIES);
-                  abort();
-                } else {
-                  addrHash = dyGrowHash(addrHash);
-                }
-              }
-            }
-          } else {
-            /* update the address counts */
-            if (tmpRec->data != NULL) {
-              tmpMd = (metaData_t *)tmpRec->data;
-              
-              /* Get thread 0's location array (serial mode) */
-              location_array_t *thread_array = get_thread_location_array(tmpMd, 0);
-              if (thread_array == NULL) {
-                fprintf(stderr, "ERR - Unable to get thread location array for existing address\n");
-                continue;
-              }
-              
-              /* Add location to thread 0's array */
-              if (!add_location_atomic(thread_array, totLineCount, i)) {
-                /* Array is full, grow it directly */
-                size_t current_capacity = thread_array->capacity;
-                size_t new_capacity;
-                
-                if (current_capacity >= 1048576) {  /* 1M entries = 16MB */
-                  /* Large array - grow conservatively */
-                  new_capacity = current_capacity + (current_capacity / 4);  /* Grow by 25% */
-                } else {
-                  new_capacity = current_capacity * 2;  /* Normal doubling */
-                }
-                
-                if (!grow_location_array(thread_array, new_capacity)) {
-                  fprintf(stderr, "ERR - Failed to grow location array from %zu to %zu, aborting\n", 
-                          current_capacity, new_capacity);
-                  abort();
-                }
-                /* Try again after growing */
-                if (!add_location_atomic(thread_array, totLineCount, i)) {
-                  fprintf(stderr, "ERR - Failed to add location after growing, aborting\n");
-                  abort();
-                }
-              }
-              
-              /* Update counts */
-              tmpMd->thread_data[0].count++;
-              tmpMd->total_count++;
-            }
+            if (table_over_budget(addrHash, addrPostings))
+              spillAddressTable();
+            else
+              publishAddressTable();
           }
         }
       }
@@ -856,6 +1455,12 @@ int processFile(const char *fName) {
     }
   }
 
+  /* Whatever is left of the last batch */
+  if (addrBatch.count > 0 && record_address_batch(addrHash, addrPostings, &addrBatch) != TRUE) {
+    fprintf(stderr, "ERR - Unable to record addresses, aborting\n");
+    abort();
+  }
+
 #ifdef DEBUG
   if (config->debug) {
     fprintf(stderr, "Line length: min=%d, max=%d, avg=%2.0f\n", minLineLen,
@@ -867,7 +1472,30 @@ int processFile(const char *fName) {
   }
 #endif
 
-  if (inFile != stdin) {
+  if (checkpoints != NULL) {
+    if (!quit) {
+      linemap_save(checkpoints, outFileName, (off_t)inOffset);
+      stampSize = (off_t)inOffset;
+      stampLines = checkpoints->lines;
+    }
+    linemap_free(checkpoints);
+  }
+
+  if (gzReader != NULL) {
+    struct stat gzStat;
+    int gzFailed = gzReader->error;
+
+    if (gzFailed)
+      fprintf(stderr, "ERR - Unable to inflate [%s]\n", fName);
+    gzreader_close(gzReader);
+    /* A log shorter than one span has nothing to skip */
+    if (!gzFailed && !quit && stat(fName, &gzStat) EQ 0) {
+      if (gzPoints->count > 0)
+        gzcheck_save(gzPoints, outFileName, gzStat.st_size);
+      stampSize = gzStat.st_size;
+    }
+    gzcheck_free(gzPoints);
+  } else if (inFile != stdin) {
     if (isGz)
       gzclose(gzInFile);
     else
@@ -879,41 +1507,30 @@ int processFile(const char *fName) {
   /* For auto-naming, write addresses to file and close it */
   if (config->auto_lpi_naming && config->outFile_st) {
     /* Write addresses to this file in sorted order */
+    config->index_filename = (tailFrom > 0) ? tailFileName : outFileName;
     if (addrHash != NULL) {
-      /* Reset collection arrays */
-      addresses_to_sort_count = 0;
-      
-      /* Collect all addresses for sorting */
-      traverseHash(addrHash, collectAddressForSorting);
-      
-      /* Sort addresses by frequency (desc) then IP (asc) */
-      if (addresses_to_sort_count > 0) {
-        qsort(addresses_to_sort, addresses_to_sort_count, sizeof(address_for_sorting_t), compare_addresses_for_output);
-        
-        /* Output addresses in sorted order */
-        for (size_t i = 0; i < addresses_to_sort_count; i++) {
-          /* Print this address using the original printAddress logic */
-          printAddress(addresses_to_sort[i].hash_record);
-          
-          /* Free the duplicated address string */
-          free(addresses_to_sort[i].address);
-        }
-      }
-      
-      /* Clean up */
-      if (addresses_to_sort != NULL) {
-        free(addresses_to_sort);
-        addresses_to_sort = NULL;
-        addresses_to_sort_capacity = 0;
-        addresses_to_sort_count = 0;
-      }
-      
-      flushOutputBuffer();
-      freeHash(addrHash);
-      addrHash = NULL; /* Reset for next file */
+      if (writeAddressTable() != TRUE)
+        written = FAILED;
+      freeAddressTable(); /* Reset for next file */
     }
-    fclose(config->outFile_st);
-    config->outFile_st = NULL;
+    if (closeIndexFile() != TRUE)
+      written = FAILED;
+    config->index_filename = NULL;
+
+    /* The new lines follow the ones already in the index */
+    if (tailFrom > 0) {
+      if (written EQ TRUE && !quit && merge_append(outFileName, tailFileName, tailLines) != TRUE)
+        written = FAILED;
+      unlink(tailFileName);
+      keydir_remove(tailFileName);
+      filter_remove(tailFileName);
+    }
+    if (written != TRUE) {
+      dropIndexFile(fName, outFileName, tailFrom EQ 0);
+      return (EXIT_FAILURE);
+    }
+    if (stampSize >= 0)
+      stamp_save(outFileName, fName, stampSize, stampLines);
   }
 
   return (EXIT_SUCCESS);
@@ -926,48 +1543,17 @@ int processFile(const char *fName) {
  ****/
 
 int showAddresses(void) {
-  FILE *output_stream;
-  size_t i;
-  
+  int ret;
+
 #ifdef DEBUG
   if (config->debug >= 1)
     printf("DEBUG - Finished processing file, printing\n");
 #endif
 
   if (addrHash != NULL) {
-    output_stream = config->outFile_st ? config->outFile_st : stdout;
-    
-    /* Reset collection arrays */
-    addresses_to_sort_count = 0;
-    
-    /* Collect all addresses for sorting */
-    traverseHash(addrHash, collectAddressForSorting);
-    
-    /* Sort addresses by frequency (desc) then IP (asc) */
-    if (addresses_to_sort_count > 0) {
-      qsort(addresses_to_sort, addresses_to_sort_count, sizeof(address_for_sorting_t), compare_addresses_for_output);
-      
-      /* Output addresses in sorted order */
-      for (i = 0; i < addresses_to_sort_count; i++) {
-        /* Print this address using the original printAddress logic */
-        printAddress(addresses_to_sort[i].hash_record);
-        
-        /* Free the duplicated address string */
-        free(addresses_to_sort[i].address);
-      }
-    }
-    
-    /* Clean up */
-    if (addresses_to_sort != NULL) {
-      free(addresses_to_sort);
-      addresses_to_sort = NULL;
-      addresses_to_sort_capacity = 0;
-      addresses_to_sort_count = 0;
-    }
-    
-    flushOutputBuffer();
-    freeHash(addrHash);
-    return (EXIT_SUCCESS);
+    ret = writeAddressTable();
+    freeAddressTable();
+    return (ret EQ TRUE) ? EXIT_SUCCESS : EXIT_FAILURE;
   }
 
   return (EXIT_FAILURE);
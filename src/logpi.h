@@ -30,8 +30,6 @@
  ****/
 
 #define LINEBUF_SIZE 4096
-#define MAX_HASH_SIZE 1000000  /* Maximum hash table size to prevent memory exhaustion */
-#define MAX_HASH_ENTRIES 10000000  /* Maximum total entries to prevent DoS */
 
 /****
  *
@@ -54,6 +52,9 @@
 #include "mem.h"
 #include "parser.h"
 #include "hash.h"
+#include "mempool.h"
+#include "postings.h"
+#include "spill.h"
 #include "bintree.h"
 #include "match.h"
 
@@ -69,32 +70,13 @@
  *
  ****/
 
-/* Location entry for growable array - optimized for memory efficiency */
-typedef struct {
-  size_t line;          /* Line number (8 bytes on 64-bit) */
-  uint16_t offset;      /* Field position (2 bytes, supports up to 65535 fields) */
-} location_entry_t;
-
-/* Growable array for storing address locations */
-typedef struct {
-  location_entry_t *entries;    /* Array of line:offset pairs */
-  size_t count;                 /* Number of locations stored */
-  size_t capacity;              /* Current array capacity */
-  size_t reserved_count;        /* Thread-safe reservation counter */
-  pthread_mutex_t mutex;        /* Mutex for thread-safe operations */
-} location_array_t;
-
-/* Per-thread location data for an IP/MAC address */
-typedef struct {
-  location_array_t *locations;  /* This thread's locations for this address */
-  size_t count;                 /* This thread's count for this address */
-} thread_location_data_t;
-
-/* Metadata structure - supports per-thread location arrays */
+/*
+ * Metadata for an IP/MAC address.  The first writer's postings live in
+ * the header, other writers push their own list onto lists.next.
+ */
 typedef struct {
   size_t total_count;           /* Total occurrences across all threads */
-  int max_threads;              /* Maximum number of threads */
-  thread_location_data_t *thread_data;  /* Array of per-thread data */
+  posting_list_t lists;         /* Per-writer posting lists, first one inline */
 } metaData_t;
 
 /* Legacy struct for compatibility (will be phased out) */
@@ -110,24 +92,43 @@ struct Address_s {
  *
  ****/
 
-/* Growable array functions */
-location_array_t* create_location_array(size_t initial_capacity);
-void free_location_array(location_array_t *array);
-int add_location_atomic(location_array_t *array, size_t line, uint16_t offset);
-int grow_location_array(location_array_t *array, size_t new_capacity);
-
 /* Per-thread metadata functions */
-metaData_t* create_metadata(int max_threads);
-void free_metadata(metaData_t *metadata);
-location_array_t* get_thread_location_array(metaData_t *metadata, int thread_id);
+metaData_t* create_metadata(mempool_t *slab);
+posting_list_t* get_slot_postings(metaData_t *tmpMd, int slot, mempool_t *slab);
+int visit_sorted_locations(metaData_t *tmpMd, int (*fn)(void *arg, size_t line, uint16_t offset), void *arg);
+
+/* Addresses waiting for one batched table lookup, in arrival order */
+#define ADDRESS_BATCH_SIZE HASH_BATCH_MAX
+#define ADDRESS_BATCH_KEY_LEN 48        /* Parser addresses are under 40 chars */
+
+typedef struct address_batch_s {
+  struct hashKey_s keys[ADDRESS_BATCH_SIZE];
+  size_t lines[ADDRESS_BATCH_SIZE];
+  uint16_t offsets[ADDRESS_BATCH_SIZE];
+  char strings[ADDRESS_BATCH_SIZE][ADDRESS_BATCH_KEY_LEN];
+  int count;
+} address_batch_t;
+
+int append_thread_location(metaData_t *tmpMd, int slot, mempool_t *slab, size_t line, uint16_t offset);
+int batch_address(address_batch_t *batch, const char *address, size_t line, uint16_t offset);
+int batch_hashed_address(address_batch_t *batch, const char *address, int keyLen, uint64_t hashValue, size_t line, uint16_t offset);
+int record_address_batch(struct hash_s *hash, mempool_t *slab, address_batch_t *batch);
+int table_over_budget(struct hash_s *hash, mempool_t *slab);
+void set_table_budget(struct hash_s *hash, size_t limit);
+int output_fits(size_t keys);
 
 /* Address sorting for index output */
 typedef struct address_for_sorting_s {
   char *address;                /* IP/MAC address string */
   size_t total_count;           /* Total occurrences */
   struct hashRec_s *hash_record; /* Pointer to original hash record */
+  size_t length;                /* Bytes of its text record or binary postings */
 } address_for_sorting_t;
 
+/* Output formatting */
+#define OUTPUT_BATCH 2048               /* Records each thread formats per round */
+#define OUTPUT_MIN_PER_THREAD 4096      /* Fewer addresses per thread are done inline */
+
 int printAddress( const struct hashRec_s *hashRec );
 void flushOutputBuffer(void);
 int processFile( const char *fName );
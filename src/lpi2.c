@@ -0,0 +1,443 @@
+/*****
+ *
+ * Description: Binary Index Format Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "lpi2.h"
+#include "mem.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static ALWAYS_INLINE int hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/****
+ *
+ * parse a MAC address, six hex pairs split by one kind of separator
+ *
+ ****/
+
+static int parse_mac(const char *text, size_t len, uint8_t *bytes) {
+  int i, hi, lo;
+
+  if (len != 17 || (text[2] != ':' && text[2] != '-'))
+    return FALSE;
+  for (i = 0; i < 6; i++) {
+    const char *p = text + i * 3;
+
+    if (i < 5 && p[2] != text[2])
+      return FALSE;
+    if ((hi = hex_value(p[0])) < 0 || (lo = hex_value(p[1])) < 0)
+      return FALSE;
+    bytes[i] = (uint8_t)((hi << 4) | lo);
+  }
+  return TRUE;
+}
+
+/****
+ *
+ * fill a key's family and address bytes from its text
+ *
+ * Addresses are keyed by their bytes so every spelling of one address
+ * sorts together, anything else is kept as text and matched exactly.
+ *
+ ****/
+
+void lpi2_key_init(lpi2_key_t *key, const char *text, size_t len) {
+  char buf[64];
+
+  XMEMSET(key, 0, sizeof(lpi2_key_t));
+  key->family = LPI2_FAMILY_TEXT;
+  key->text_len = (uint8_t)((len > LPI2_MAX_TEXT) ? LPI2_MAX_TEXT : len);
+
+  if (len >= sizeof(buf))
+    return;
+  memcpy(buf, text, len);
+  buf[len] = '\0';
+
+  if (memchr(buf, ':', len) == NULL && memchr(buf, '-', len) == NULL) {
+    if (inet_pton(AF_INET, buf, key->addr) == 1)
+      key->family = LPI2_FAMILY_IPV4;
+  } else if (parse_mac(buf, len, key->addr))
+    key->family = LPI2_FAMILY_MAC;
+  else if (inet_pton(AF_INET6, buf, key->addr) == 1)
+    key->family = LPI2_FAMILY_IPV6;
+
+  if (key->family == LPI2_FAMILY_TEXT)
+    XMEMSET(key->addr, 0, sizeof(key->addr));
+}
+
+/****
+ *
+ * the canonical text of an address key
+ *
+ * Dotted quads, inet_ntop's IPv6 and lower case colon separated MACs.
+ * Returns the length written to buf, LPI2_TEXT_BUF bytes, or 0 for a
+ * text key.
+ *
+ ****/
+
+size_t lpi2_key_format(const lpi2_key_t *key, char *buf) {
+  const uint8_t *a = key->addr;
+
+  switch (key->family) {
+  case LPI2_FAMILY_IPV4:
+  case LPI2_FAMILY_IPV6:
+    if (inet_ntop((key->family == LPI2_FAMILY_IPV4) ? AF_INET : AF_INET6, a, buf, LPI2_TEXT_BUF) == NULL)
+      return 0;
+    return strlen(buf);
+  case LPI2_FAMILY_MAC:
+    return (size_t)snprintf(buf, LPI2_TEXT_BUF, "%02x:%02x:%02x:%02x:%02x:%02x", a[0], a[1], a[2], a[3], a[4], a[5]);
+  default:
+    return 0;
+  }
+}
+
+/****
+ *
+ * order two keys by (family, address bytes, text)
+ *
+ ****/
+
+static ALWAYS_INLINE int compare_text(const char *a, size_t a_len, const char *b, size_t b_len) {
+  int ret = memcmp(a, b, (a_len < b_len) ? a_len : b_len);
+
+  if (ret != 0)
+    return ret;
+  return (a_len > b_len) - (a_len < b_len);
+}
+
+int lpi2_key_compare(const lpi2_key_t *a, const char *a_text, const lpi2_key_t *b, const char *b_text) {
+  int ret;
+
+  if (a->family != b->family)
+    return (a->family > b->family) ? 1 : -1;
+  if ((ret = memcmp(a->addr, b->addr, sizeof(a->addr))) != 0)
+    return ret;
+  return compare_text(a_text, a->text_len, b_text, b->text_len);
+}
+
+/****
+ *
+ * does a file start with the binary index magic
+ *
+ ****/
+
+int lpi2_is_index(const char *path) {
+  char magic[4];
+  FILE *fp;
+  int ret;
+
+  if ((fp = fopen(path, "rb")) == NULL)
+    return FALSE;
+  ret = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+        memcmp(magic, LPI2_MAGIC, sizeof(magic)) == 0;
+  fclose(fp);
+
+  return ret;
+}
+
+/****
+ *
+ * map an index and find its sections
+ *
+ * Only the header, trailer and section directory are checked here, a
+ * key's text and postings are bounds checked when they are used so a
+ * lookup touches no more pages than it needs.
+ *
+ ****/
+
+static int section_fits(const lpi2_index_t *index, const lpi2_section_t *section) {
+  return section->offset <= index->size && section->length <= index->size - section->offset;
+}
+
+lpi2_index_t *lpi2_open(const char *path) {
+  const lpi2_header_t *header;
+  const lpi2_section_t *section;
+  lpi2_index_t *index;
+  struct stat st;
+  uint32_t i;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  fprintf(stderr, "ERR - Binary indexes are not supported on big endian hosts\n");
+  return NULL;
+#endif
+
+  if ((index = (lpi2_index_t *)XMALLOC(sizeof(lpi2_index_t))) == NULL)
+    return NULL;
+  XMEMSET(index, 0, sizeof(lpi2_index_t));
+
+  if ((index->fd = open(path, O_RDONLY)) < 0) {
+    fprintf(stderr, "ERR - Unable to open file [%s] %d (%s)\n", path, errno, strerror(errno));
+    XFREE(index);
+    return NULL;
+  }
+  if (fstat(index->fd, &st) != 0 ||
+      (size_t)st.st_size < sizeof(lpi2_header_t) + sizeof(lpi2_trailer_t)) {
+    fprintf(stderr, "ERR - Index [%s] is truncated\n", path);
+    lpi2_close(index);
+    return NULL;
+  }
+  index->size = (size_t)st.st_size;
+  if ((index->map = (const uint8_t *)mmap(NULL, index->size, PROT_READ, MAP_SHARED, index->fd, 0)) == MAP_FAILED) {
+    fprintf(stderr, "ERR - Unable to map index [%s] %d (%s)\n", path, errno, strerror(errno));
+    index->map = NULL;
+    lpi2_close(index);
+    return NULL;
+  }
+  /* Lookups jump around, read ahead would only fault in unused pages */
+  madvise((void *)index->map, index->size, MADV_RANDOM);
+
+  header = (const lpi2_header_t *)index->map;
+  index->trailer = (const lpi2_trailer_t *)(index->map + index->size - sizeof(lpi2_trailer_t));
+  if (memcmp(header->magic, LPI2_MAGIC, 4) != 0 || memcmp(index->trailer->magic, LPI2_MAGIC, 4) != 0 ||
+      index->trailer->file_size != index->size) {
+    fprintf(stderr, "ERR - Index [%s] is corrupt or truncated\n", path);
+    lpi2_close(index);
+    return NULL;
+  }
+  if (header->version != LPI2_VERSION) {
+    fprintf(stderr, "ERR - Index [%s] is version %u, expected %u\n", path, header->version, LPI2_VERSION);
+    lpi2_close(index);
+    return NULL;
+  }
+  if (index->trailer->directory % LPI2_ALIGN != 0 ||
+      index->trailer->directory > index->size - sizeof(lpi2_trailer_t) ||
+      index->trailer->section_count > (index->size - sizeof(lpi2_trailer_t) - index->trailer->directory) / sizeof(lpi2_section_t)) {
+    fprintf(stderr, "ERR - Index [%s] has a corrupt section directory\n", path);
+    lpi2_close(index);
+    return NULL;
+  }
+  index->flags = header->flags;
+  index->sections = (const lpi2_section_t *)(index->map + index->trailer->directory);
+
+  for (i = 0; i < index->trailer->section_count; i++) {
+    if (!section_fits(index, &index->sections[i])) {
+      fprintf(stderr, "ERR - Index [%s] has a section past its end\n", path);
+      lpi2_close(index);
+      return NULL;
+    }
+  }
+
+  if ((section = lpi2_find_section(index, LPI2_SECTION_KEYS)) == NULL || section->offset % LPI2_ALIGN != 0 ||
+      section->length % sizeof(lpi2_key_t) != 0 ||
+      section->length / sizeof(lpi2_key_t) != index->trailer->key_count) {
+    fprintf(stderr, "ERR - Index [%s] has no valid key section\n", path);
+    lpi2_close(index);
+    return NULL;
+  }
+  index->keys = (const lpi2_key_t *)(index->map + section->offset);
+  index->key_count = index->trailer->key_count;
+
+  if ((section = lpi2_find_section(index, LPI2_SECTION_SUMMARY)) != NULL && section->offset % LPI2_ALIGN == 0 &&
+      section->length % sizeof(lpi2_summary_t) == 0) {
+    index->summary = (const lpi2_summary_t *)(index->map + section->offset);
+    index->summary_count = section->length / sizeof(lpi2_summary_t);
+  }
+  if ((section = lpi2_find_section(index, LPI2_SECTION_STRINGS)) != NULL) {
+    index->strings = (const char *)(index->map + section->offset);
+    index->strings_len = section->length;
+  }
+  if ((section = lpi2_find_section(index, LPI2_SECTION_POSTINGS)) != NULL) {
+    index->postings = index->map + section->offset;
+    index->postings_len = section->length;
+  }
+
+  return index;
+}
+
+void lpi2_close(lpi2_index_t *index) {
+  if (index == NULL)
+    return;
+  if (index->map != NULL)
+    munmap((void *)index->map, index->size);
+  if (index->fd >= 0)
+    close(index->fd);
+  XFREE(index);
+}
+
+const lpi2_section_t *lpi2_find_section(const lpi2_index_t *index, uint32_t type) {
+  uint32_t i;
+
+  for (i = 0; i < index->trailer->section_count; i++) {
+    if (index->sections[i].type == type)
+      return &index->sections[i];
+  }
+  return NULL;
+}
+
+/****
+ *
+ * a key's text, NULL if it lies outside the strings section
+ *
+ * Canonical text is not stored, it is written to buf, LPI2_TEXT_BUF
+ * bytes, and good until the next call with the same buffer.
+ *
+ ****/
+
+const char *lpi2_key_text(const lpi2_index_t *index, const lpi2_key_t *key, char *buf) {
+  if (key->flags & LPI2_KEY_CANONICAL)
+    return (lpi2_key_format(key, buf) == key->text_len) ? buf : NULL;
+  if (index->strings == NULL || (uint64_t)key->text + key->text_len > index->strings_len)
+    return NULL;
+  return index->strings + key->text;
+}
+
+/****
+ *
+ * find the keys matching a search term
+ *
+ * An address matches every spelling of the same bytes, other terms
+ * match their text exactly.  Two binary searches bound the run of
+ * matching keys, returns its length with the first key in first.
+ *
+ ****/
+
+static int compare_probe(const lpi2_index_t *index, const lpi2_key_t *key,
+                         const lpi2_key_t *probe, const char *term) {
+  char buf[LPI2_TEXT_BUF];
+  const char *text;
+  int ret;
+
+  if (key->family != probe->family)
+    return (key->family > probe->family) ? 1 : -1;
+  if ((ret = memcmp(key->addr, probe->addr, sizeof(key->addr))) != 0)
+    return ret;
+  if (probe->family != LPI2_FAMILY_TEXT)
+    return 0;
+  if ((text = lpi2_key_text(index, key, buf)) == NULL)
+    return -1;
+  return compare_text(text, key->text_len, term, probe->text_len);
+}
+
+uint64_t lpi2_find(const lpi2_index_t *index, const char *term, uint64_t *first) {
+  lpi2_key_t probe;
+  uint64_t lo = 0, hi = index->key_count, mid, end;
+  size_t len = strlen(term);
+
+  if (len > LPI2_MAX_TEXT)
+    return 0;
+  lpi2_key_init(&probe, term, len);
+
+  /* First key not before the term */
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (compare_probe(index, &index->keys[mid], &probe, term) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *first = lo;
+
+  /* First key after it */
+  hi = index->key_count;
+  end = lo;
+  while (end < hi) {
+    mid = end + (hi - end) / 2;
+    if (compare_probe(index, &index->keys[mid], &probe, term) <= 0)
+      end = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return end - lo;
+}
+
+/****
+ *
+ * start a cursor on a key's postings
+ *
+ * A sequential walk skips the block table, the deltas restart at each
+ * block boundary so the cursor needs no table lookups.  An inline
+ * location is encoded into the cursor and walked the same way.
+ *
+ ****/
+
+int lpi2_cursor_init(const lpi2_index_t *index, const lpi2_key_t *key, lpi2_cursor_t *cursor) {
+  uint64_t table = 0, left;
+
+  cursor->left = key->count;
+  cursor->line = 0;
+  cursor->in_block = 0;
+
+  if (key->flags & LPI2_KEY_INLINE) {
+    if (key->count != 1)
+      return FALSE;
+    cursor->p = cursor->buf;
+    cursor->end = lpi2_put_varint(lpi2_put_varint(cursor->buf, key->postings), key->slot);
+    return TRUE;
+  }
+
+  if (index->postings == NULL || key->postings > index->postings_len)
+    return FALSE;
+  left = index->postings_len - key->postings;
+  if (key->count > LPI2_BLOCK_ENTRIES)
+    table = ((key->count + LPI2_BLOCK_ENTRIES - 1) / LPI2_BLOCK_ENTRIES) * sizeof(lpi2_block_t);
+  /* A location takes at least two bytes */
+  if (table > left || key->count > (left - table) / 2)
+    return FALSE;
+
+  cursor->p = index->postings + key->postings + table;
+  cursor->end = index->postings + index->postings_len;
+  return TRUE;
+}
+
+/****
+ *
+ * the first and last line of a key
+ *
+ * A long list has them in the summary, an inline location in its
+ * entry, anything else is walked, which is at most one block unless
+ * the index has no summary.  Returns FAILED if the postings are bad.
+ *
+ ****/
+
+int lpi2_key_lines(const lpi2_index_t *index, const lpi2_key_t *key, uint64_t *first, uint64_t *last) {
+  lpi2_cursor_t cursor;
+  uint64_t line, field;
+  int ret;
+
+  *first = *last = 0;
+  if (lpi2_summarized(key) && index->summary != NULL) {
+    if (key->slot >= index->summary_count)
+      return FAILED;
+    *first = index->summary[key->slot].first_line;
+    *last = index->summary[key->slot].last_line;
+    return TRUE;
+  }
+  if (key->flags & LPI2_KEY_INLINE) {
+    *first = *last = key->postings;
+    return TRUE;
+  }
+
+  if (lpi2_cursor_init(index, key, &cursor) != TRUE)
+    return FAILED;
+  while ((ret = lpi2_cursor_next(&cursor, &line, &field)) == TRUE) {
+    if (*first == 0)
+      *first = line;
+    *last = line;
+  }
+  return (ret == FAILED) ? FAILED : TRUE;
+}
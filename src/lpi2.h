@@ -0,0 +1,235 @@
+/*****
+ *
+ * Description: Binary Index Format Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef LPI2_H
+#define LPI2_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "../include/common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A binary .lpi is built to be mapped and searched in place:
+ *
+ *   header | sections ... | section directory | trailer
+ *
+ * The trailer sits at a fixed distance from the end and points at the
+ * section directory, so an index can be streamed to a pipe and still
+ * be found from either end.  Sections are typed, a reader skips types
+ * it does not know.  Every integer is little endian.
+ *
+ * The key section is an array of fixed size entries sorted by
+ * (family, address bytes, text), searched with a binary search.  An
+ * address spelled the way lpi2_key_format writes it stores no text,
+ * it is rebuilt from the address bytes.  The postings of a key are
+ * count (varint line delta, varint field) pairs in line order, lines
+ * one based as in the text index.  Lists longer than one block start
+ * with a table of (first line, data offset) pairs, one per block, and
+ * the deltas restart at each block.  A key seen once holds its line
+ * and field in its entry and has no postings.
+ *
+ * The filter section lets a search rule out an index before it looks
+ * at a single key.  The summary section holds the first and last line
+ * of each key with more than LPI2_SUMMARY_MIN locations, in key order
+ * and found through the key's slot, so with the count in the key entry
+ * a query that only wants how often and when an address was seen reads
+ * no long postings.  A shorter list is one block and is read instead.
+ */
+
+#define LPI2_MAGIC "LPI2"
+#define LPI2_VERSION 3
+#define LPI2_ALIGN 8
+#define LPI2_BLOCK_ENTRIES 128          /* Locations per postings block */
+#define LPI2_MAX_TEXT 255               /* Longest key text */
+#define LPI2_TEXT_BUF 64                /* Room for a key's text rebuilt from its address */
+#define LPI2_SUMMARY_MIN LPI2_BLOCK_ENTRIES /* Keys with more locations are summarized */
+
+/* Section types */
+#define LPI2_SECTION_POSTINGS 1
+#define LPI2_SECTION_STRINGS 2
+#define LPI2_SECTION_KEYS 3
+#define LPI2_SECTION_FILTER 4           /* Membership filter over the keys, see filter.h */
+#define LPI2_SECTION_FILES 5            /* Catalog file paths, see catalog.h */
+#define LPI2_SECTION_SUMMARY 6          /* First and last line of long keys, not in a catalog */
+
+/* Header flags */
+#define LPI2_FLAG_CATALOG 0x1           /* Postings are (file, count), not (line, field) */
+
+/* Key families, the order keys sort in */
+#define LPI2_FAMILY_TEXT 0              /* Not a canonical address, matched exactly */
+#define LPI2_FAMILY_IPV4 4
+#define LPI2_FAMILY_IPV6 6
+#define LPI2_FAMILY_MAC 7
+
+/* Key flags */
+#define LPI2_KEY_CANONICAL 0x1          /* No text stored, it is the formatted address */
+#define LPI2_KEY_INLINE 0x2             /* The only location is in the entry, no postings */
+
+typedef struct lpi2_header_s {          /* 16 bytes */
+  char magic[4];
+  uint16_t version;
+  uint16_t header_size;
+  uint32_t flags;
+  uint32_t reserved;
+} lpi2_header_t;
+
+typedef struct lpi2_section_s {         /* 24 bytes */
+  uint32_t type;
+  uint32_t flags;
+  uint64_t offset;                      /* From the start of the file */
+  uint64_t length;
+} lpi2_section_t;
+
+typedef struct lpi2_trailer_s {         /* 48 bytes */
+  uint64_t directory;                   /* Offset of the section directory */
+  uint32_t section_count;
+  uint32_t flags;
+  uint64_t key_count;
+  uint64_t location_count;
+  uint64_t file_size;                   /* Catches a truncated copy */
+  uint32_t reserved;
+  char magic[4];
+} lpi2_trailer_t;
+
+typedef struct lpi2_key_s {             /* 40 bytes */
+  uint8_t family;
+  uint8_t text_len;
+  uint16_t flags;
+  uint32_t text;                        /* Offset in the strings section */
+  uint32_t count;                       /* Locations */
+  uint32_t slot;                        /* Field of an inline location, or the key's summary entry */
+  uint8_t addr[16];                     /* Address bytes, zero padded */
+  uint64_t postings;                    /* Offset in the postings section, or an inline line */
+} lpi2_key_t;
+
+typedef struct lpi2_summary_s {         /* 16 bytes */
+  uint64_t first_line;
+  uint64_t last_line;
+} lpi2_summary_t;
+
+typedef struct lpi2_block_s {           /* 16 bytes */
+  uint64_t first_line;
+  uint64_t offset;                      /* From the end of the block table */
+} lpi2_block_t;
+
+/* An index mapped for searching */
+typedef struct lpi2_index_s {
+  int fd;
+  const uint8_t *map;
+  size_t size;
+  uint32_t flags;                       /* From the header */
+  const lpi2_trailer_t *trailer;
+  const lpi2_section_t *sections;
+  const lpi2_key_t *keys;
+  uint64_t key_count;
+  const lpi2_summary_t *summary;        /* NULL in an index written without one */
+  uint64_t summary_count;
+  const char *strings;
+  uint64_t strings_len;
+  const uint8_t *postings;
+  uint64_t postings_len;
+} lpi2_index_t;
+
+/* Walks one key's postings */
+typedef struct lpi2_cursor_s {
+  const uint8_t *p;
+  const uint8_t *end;
+  uint64_t left;
+  uint64_t line;
+  int in_block;
+  uint8_t buf[20];                      /* An inline location, encoded */
+} lpi2_cursor_t;
+
+/* Function prototypes */
+void lpi2_key_init(lpi2_key_t *key, const char *text, size_t len);
+size_t lpi2_key_format(const lpi2_key_t *key, char *buf);
+int lpi2_key_compare(const lpi2_key_t *a, const char *a_text, const lpi2_key_t *b, const char *b_text);
+int lpi2_is_index(const char *path);
+lpi2_index_t *lpi2_open(const char *path);
+void lpi2_close(lpi2_index_t *index);
+const lpi2_section_t *lpi2_find_section(const lpi2_index_t *index, uint32_t type);
+uint64_t lpi2_find(const lpi2_index_t *index, const char *term, uint64_t *first);
+const char *lpi2_key_text(const lpi2_index_t *index, const lpi2_key_t *key, char *buf);
+int lpi2_cursor_init(const lpi2_index_t *index, const lpi2_key_t *key, lpi2_cursor_t *cursor);
+int lpi2_key_lines(const lpi2_index_t *index, const lpi2_key_t *key, uint64_t *first, uint64_t *last);
+
+/* Does a key outside a catalog have a summary entry */
+static ALWAYS_INLINE int lpi2_summarized(const lpi2_key_t *key) {
+  return key->count > LPI2_SUMMARY_MIN;
+}
+
+/* Varints hold seven bits a byte, low bits first */
+static ALWAYS_INLINE uint8_t *lpi2_put_varint(uint8_t *p, uint64_t value) {
+  while (value >= 0x80) {
+    *p++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *p++ = (uint8_t)value;
+  return p;
+}
+
+static ALWAYS_INLINE int lpi2_get_varint(const uint8_t **p, const uint8_t *end, uint64_t *value) {
+  uint64_t result = 0;
+  int shift = 0;
+
+  while (*p < end && shift < 64) {
+    uint8_t c = *(*p)++;
+    result |= (uint64_t)(c & 0x7F) << shift;
+    if (!(c & 0x80)) {
+      *value = result;
+      return TRUE;
+    }
+    shift += 7;
+  }
+  return FALSE;
+}
+
+/****
+ *
+ * next location of a cursor
+ *
+ * Returns TRUE with line and field set, FALSE at the end of the list
+ * and FAILED if the postings run past their section.
+ *
+ ****/
+
+static ALWAYS_INLINE int lpi2_cursor_next(lpi2_cursor_t *cursor, uint64_t *line, uint64_t *field) {
+  uint64_t delta;
+
+  if (cursor->left == 0)
+    return FALSE;
+  if (cursor->in_block == 0) {
+    cursor->line = 0;
+    cursor->in_block = LPI2_BLOCK_ENTRIES;
+  }
+  if (!lpi2_get_varint(&cursor->p, cursor->end, &delta) ||
+      !lpi2_get_varint(&cursor->p, cursor->end, field))
+    return FAILED;
+  cursor->line += delta;
+  cursor->left--;
+  cursor->in_block--;
+  *line = cursor->line;
+  return TRUE;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LPI2_H */
@@ -0,0 +1,894 @@
+/*****
+ *
+ * Description: Binary Index Builder Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "lpi2_build.h"
+#include "filter.h"
+#include "budget.h"
+#include "mem.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* A key entry and its text while the keys are sorted */
+typedef struct sort_entry_s {
+  lpi2_key_t *key;
+  const char *text;
+} sort_entry_t;
+
+/* A key run being read back, positioned on an entry */
+typedef struct key_reader_s {
+  FILE *fp;
+  lpi2_key_t key;
+  lpi2_summary_t summary;
+  char text[LPI2_MAX_TEXT];
+} key_reader_t;
+
+/* Key runs merged in key order */
+typedef struct key_merge_s {
+  key_reader_t *readers;
+  key_reader_t **heap;
+  int count;
+  int live;
+} key_merge_t;
+
+/****
+ *
+ * write through the builder, keeping track of the file offset
+ *
+ ****/
+
+static int emit(lpi2_builder_t *b, const void *data, size_t len) {
+  if (b->error)
+    return FAILED;
+  if (len > 0 && writer_write(b->out, (const char *)data, len) != TRUE) {
+    b->error = TRUE;
+    return FAILED;
+  }
+  b->offset += len;
+  return TRUE;
+}
+
+static int emit_pad(lpi2_builder_t *b) {
+  static const char zeros[LPI2_ALIGN];
+
+  return emit(b, zeros, (LPI2_ALIGN - b->offset % LPI2_ALIGN) % LPI2_ALIGN);
+}
+
+/****
+ *
+ * start an index on a writer
+ *
+ ****/
+
+lpi2_builder_t *lpi2_builder_create(writer_t *out, uint32_t flags) {
+  lpi2_header_t header;
+  lpi2_builder_t *b;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  fprintf(stderr, "ERR - Binary indexes are not supported on big endian hosts\n");
+  return NULL;
+#endif
+
+  if ((b = (lpi2_builder_t *)XMALLOC(sizeof(lpi2_builder_t))) == NULL)
+    return NULL;
+  XMEMSET(b, 0, sizeof(lpi2_builder_t));
+  b->out = out;
+  b->flags = flags;
+
+  XMEMSET(&header, 0, sizeof(header));
+  memcpy(header.magic, LPI2_MAGIC, sizeof(header.magic));
+  header.version = LPI2_VERSION;
+  header.header_size = sizeof(header);
+  header.flags = flags;
+  if (emit(b, &header, sizeof(header)) != TRUE) {
+    XFREE(b);
+    return NULL;
+  }
+  b->postings = b->offset;
+
+  return b;
+}
+
+/****
+ *
+ * hold at most limit bytes of keys, spilling sorted runs to dir
+ *
+ ****/
+
+int lpi2_builder_spill(lpi2_builder_t *b, const char *dir, size_t limit) {
+  if ((b->runs = spill_create(dir)) == NULL)
+    return FAILED;
+  b->limit = limit;
+  return TRUE;
+}
+
+/* Bytes a held key costs, with its share of the sort */
+static size_t key_bytes(const lpi2_builder_t *b) {
+  return sizeof(lpi2_key_t) + sizeof(sort_entry_t) +
+         ((b->flags & LPI2_FLAG_CATALOG) ? 0 : sizeof(lpi2_summary_t));
+}
+
+static void publish_keys(lpi2_builder_t *b) {
+  budget_publish(BUDGET_OUTPUT, &b->reported,
+                 b->capacity * (key_bytes(b) - sizeof(sort_entry_t)) + b->names.size);
+}
+
+/****
+ *
+ * the first and last line of a key's encoded postings
+ *
+ * A list with a block table gives its first line there and only its
+ * last block is decoded.
+ *
+ ****/
+
+static void summarize(const char *postings, size_t len, uint64_t count, lpi2_summary_t *summary) {
+  const uint8_t *p = (const uint8_t *)postings, *end = p + len;
+  lpi2_block_t first, last;
+  uint64_t blocks, table, entries, i, delta, field, line = 0;
+
+  XMEMSET(summary, 0, sizeof(lpi2_summary_t));
+  if (count == 0)
+    return;
+
+  entries = count;
+  if (count > LPI2_BLOCK_ENTRIES) {
+    blocks = (count + LPI2_BLOCK_ENTRIES - 1) / LPI2_BLOCK_ENTRIES;
+    table = blocks * sizeof(lpi2_block_t);
+    if (table > len)
+      return;
+    memcpy(&first, p, sizeof(first));
+    memcpy(&last, p + table - sizeof(last), sizeof(last));
+    if (last.offset > len - table)
+      return;
+    summary->first_line = first.first_line;
+    entries = count - (blocks - 1) * LPI2_BLOCK_ENTRIES;
+    p += table + last.offset;
+  }
+
+  /* The deltas restart at each block */
+  for (i = 0; i < entries; i++) {
+    if (!lpi2_get_varint(&p, end, &delta) || !lpi2_get_varint(&p, end, &field))
+      return;
+    line += delta;
+    if (i == 0 && count <= LPI2_BLOCK_ENTRIES)
+      summary->first_line = line;
+  }
+  summary->last_line = line;
+}
+
+static int compare_entries(const void *a, const void *b) {
+  const sort_entry_t *entry_a = (const sort_entry_t *)a;
+  const sort_entry_t *entry_b = (const sort_entry_t *)b;
+
+  return lpi2_key_compare(entry_a->key, entry_a->text, entry_b->key, entry_b->text);
+}
+
+/* The held keys in key order, NULL with none or no memory */
+static sort_entry_t *sort_keys(lpi2_builder_t *b) {
+  sort_entry_t *sorted;
+  size_t i;
+
+  if (b->count == 0)
+    return NULL;
+  if ((sorted = (sort_entry_t *)XMALLOC(sizeof(sort_entry_t) * b->count)) == NULL) {
+    fprintf(stderr, "ERR - Unable to sort binary index keys\n");
+    b->error = TRUE;
+    return NULL;
+  }
+  budget_add(BUDGET_OUTPUT, (int64_t)(sizeof(sort_entry_t) * b->count));
+  for (i = 0; i < b->count; i++) {
+    sorted[i].key = &b->keys[i];
+    sorted[i].text = b->names.data + b->keys[i].text;
+  }
+  qsort(sorted, b->count, sizeof(sort_entry_t), compare_entries);
+  return sorted;
+}
+
+static void free_sorted(lpi2_builder_t *b, sort_entry_t *sorted) {
+  if (sorted == NULL)
+    return;
+  XFREE(sorted);
+  budget_add(BUDGET_OUTPUT, -(int64_t)(sizeof(sort_entry_t) * b->count));
+}
+
+/* Is a key's summary kept */
+static ALWAYS_INLINE int has_summary(const lpi2_builder_t *b, const lpi2_key_t *key) {
+  return !(b->flags & LPI2_FLAG_CATALOG) && lpi2_summarized(key);
+}
+
+/* A run entry is the key, its summary if it has one, then its text */
+static int put_key(lpi2_builder_t *b, FILE *fp, const lpi2_key_t *key, const lpi2_summary_t *summary,
+                   const char *text) {
+  if (fwrite(key, sizeof(lpi2_key_t), 1, fp) != 1 ||
+      (has_summary(b, key) && fwrite(summary, sizeof(lpi2_summary_t), 1, fp) != 1) ||
+      fwrite(text, 1, key->text_len, fp) != key->text_len)
+    return FAILED;
+  return TRUE;
+}
+
+/****
+ *
+ * sort the held keys and write them out as a run
+ *
+ ****/
+
+static int spill_keys(lpi2_builder_t *b) {
+  sort_entry_t *sorted;
+  char path[PATH_MAX];
+  FILE *fp;
+  size_t i;
+  int ok = TRUE;
+
+  if ((sorted = sort_keys(b)) == NULL)
+    return FAILED;
+  if ((fp = spill_open_temp(b->runs, "keys", path, sizeof(path))) == NULL) {
+    free_sorted(b, sorted);
+    b->error = TRUE;
+    return FAILED;
+  }
+  for (i = 0; i < b->count && ok; i++)
+    ok = put_key(b, fp, sorted[i].key, (b->summary != NULL) ? &b->summary[sorted[i].key - b->keys] : NULL,
+                 sorted[i].text) == TRUE;
+  free_sorted(b, sorted);
+  if (ok)
+    budget_add(BUDGET_SPILLED, ftello(fp));
+  if (fclose(fp) != 0 || !ok || !spill_add_run(b->runs, path)) {
+    fprintf(stderr, "ERR - Unable to write key run [%s] %d (%s)\n", path, errno, strerror(errno));
+    unlink(path);
+    b->error = TRUE;
+    return FAILED;
+  }
+
+  b->spilled += b->count;
+  b->count = 0;
+  b->names.len = 0;
+  return TRUE;
+}
+
+/****
+ *
+ * move a key's only location into its entry
+ *
+ ****/
+
+static int inline_location(lpi2_key_t *entry, const char *postings, size_t len) {
+  const uint8_t *p = (const uint8_t *)postings, *end = p + len;
+  uint64_t line, field;
+
+  if (!lpi2_get_varint(&p, end, &line) || !lpi2_get_varint(&p, end, &field) || field > UINT32_MAX)
+    return FALSE;
+  entry->flags |= LPI2_KEY_INLINE;
+  entry->slot = (uint32_t)field;
+  entry->postings = line;
+  return TRUE;
+}
+
+/****
+ *
+ * add a key with its encoded postings
+ *
+ * Canonical address text is held for sorting but not written.  A key
+ * seen once outside a catalog keeps its location in the entry.  With
+ * a budget the arrays grow by doubling, so a chunk is cut at half of
+ * it.
+ *
+ ****/
+
+int lpi2_builder_add(lpi2_builder_t *b, const char *key, size_t key_len, uint64_t count,
+                     const char *postings, size_t len) {
+  char canonical[LPI2_TEXT_BUF];
+  lpi2_key_t *entry;
+
+  if (b->error)
+    return FAILED;
+  if (key_len == 0 || key_len > LPI2_MAX_TEXT) {
+    fprintf(stderr, "ERR - Address [%.*s] is too long for a binary index\n", (int)key_len, key);
+    b->error = TRUE;
+    return FAILED;
+  }
+  if ((uint64_t)b->names.len + key_len > UINT32_MAX) {
+    fprintf(stderr, "ERR - Binary index key text is over 4GB\n");
+    b->error = TRUE;
+    return FAILED;
+  }
+  if (count > UINT32_MAX) {
+    fprintf(stderr, "ERR - Address [%.*s] has too many locations for a binary index\n", (int)key_len, key);
+    b->error = TRUE;
+    return FAILED;
+  }
+  if (!(b->flags & LPI2_FLAG_CATALOG) && count > LPI2_SUMMARY_MIN && b->summarized++ == UINT32_MAX) {
+    fprintf(stderr, "ERR - Binary index summary is over %u keys\n", UINT32_MAX);
+    b->error = TRUE;
+    return FAILED;
+  }
+
+  if (b->runs != NULL && b->count > 0 &&
+      (b->count + 1) * key_bytes(b) + b->names.len + key_len > b->limit / 2 && spill_keys(b) != TRUE)
+    return FAILED;
+
+  if (b->count == b->capacity) {
+    size_t capacity = (b->capacity == 0) ? 1024 : b->capacity * 2;
+    lpi2_key_t *grown;
+
+    if ((grown = (lpi2_key_t *)XREALLOC(b->keys, sizeof(lpi2_key_t) * capacity)) == NULL) {
+      fprintf(stderr, "ERR - Unable to grow binary index key table\n");
+      b->error = TRUE;
+      return FAILED;
+    }
+    b->keys = grown;
+    if (!(b->flags & LPI2_FLAG_CATALOG)) {
+      lpi2_summary_t *summary;
+
+      if ((summary = (lpi2_summary_t *)XREALLOC(b->summary, sizeof(lpi2_summary_t) * capacity)) == NULL) {
+        fprintf(stderr, "ERR - Unable to grow binary index summary\n");
+        b->error = TRUE;
+        return FAILED;
+      }
+      b->summary = summary;
+    }
+    b->capacity = capacity;
+  }
+  if (!out_reserve(&b->names, key_len)) {
+    b->error = TRUE;
+    return FAILED;
+  }
+  publish_keys(b);
+
+  entry = &b->keys[b->count];
+  lpi2_key_init(entry, key, key_len);
+  entry->text = (uint32_t)b->names.len;
+  entry->count = (uint32_t)count;
+  entry->postings = b->offset - b->postings;
+  if (lpi2_key_format(entry, canonical) == key_len && memcmp(canonical, key, key_len) == 0)
+    entry->flags |= LPI2_KEY_CANONICAL;
+  memcpy(b->names.data + b->names.len, key, key_len);
+  b->names.len += key_len;
+  if (has_summary(b, entry))
+    summarize(postings, len, count, &b->summary[b->count]);
+  b->count++;
+  b->locations += count;
+
+  if (count == 1 && !(b->flags & LPI2_FLAG_CATALOG) && inline_location(entry, postings, len))
+    return TRUE;
+  return emit(b, postings, len);
+}
+
+/****
+ *
+ * add a section of the caller's, written at the end
+ *
+ ****/
+
+int lpi2_builder_section(lpi2_builder_t *b, uint32_t type, const char *data, size_t len) {
+  out_buffer_t *section;
+
+  if (b->error)
+    return FAILED;
+  if (b->extra_count == LPI2_BUILDER_EXTRA) {
+    fprintf(stderr, "ERR - Too many sections for a binary index\n");
+    b->error = TRUE;
+    return FAILED;
+  }
+
+  section = &b->extra[b->extra_count];
+  if (len > 0) {
+    if (!out_reserve(section, len)) {
+      b->error = TRUE;
+      return FAILED;
+    }
+    memcpy(section->data, data, len);
+    section->len = len;
+  }
+  b->extra_types[b->extra_count++] = type;
+
+  return TRUE;
+}
+
+/****
+ *
+ * a filter over the keys so a search can skip the index
+ *
+ ****/
+
+static filter_t *create_filter(lpi2_builder_t *b, uint64_t keys) {
+  filter_t *f;
+
+  if ((f = filter_create(keys)) == NULL) {
+    b->error = TRUE;
+    return NULL;
+  }
+  budget_add(BUDGET_OUTPUT, (int64_t)f->blocks * FILTER_BLOCK_SIZE);
+  return f;
+}
+
+static int emit_filter(lpi2_builder_t *b, filter_t *f) {
+  filter_header_t header;
+
+  if (f == NULL)
+    return FAILED;
+  filter_header(f, &header, 0);
+  emit(b, &header, sizeof(header));
+  emit(b, f->words, (size_t)f->blocks * FILTER_BLOCK_SIZE);
+  budget_add(BUDGET_OUTPUT, -(int64_t)f->blocks * FILTER_BLOCK_SIZE);
+  filter_free(f);
+
+  return b->error ? FAILED : TRUE;
+}
+
+/****
+ *
+ * read key runs back in key order
+ *
+ * Returns TRUE with the next entry on top of the heap, FALSE once the
+ * runs are done and FAILED if one could not be read.
+ *
+ ****/
+
+static int get_key(lpi2_builder_t *b, key_reader_t *reader) {
+  if (fread(&reader->key, sizeof(lpi2_key_t), 1, reader->fp) != 1)
+    return ferror(reader->fp) ? FAILED : FALSE;
+  if ((has_summary(b, &reader->key) && fread(&reader->summary, sizeof(lpi2_summary_t), 1, reader->fp) != 1) ||
+      fread(reader->text, 1, reader->key.text_len, reader->fp) != reader->key.text_len)
+    return FAILED;
+  return TRUE;
+}
+
+static ALWAYS_INLINE int key_before(const key_reader_t *a, const key_reader_t *b) {
+  return lpi2_key_compare(&a->key, a->text, &b->key, b->text) < 0;
+}
+
+static void key_sift_down(key_reader_t **heap, int count, int i) {
+  key_reader_t *item = heap[i];
+  int child;
+
+  while ((child = 2 * i + 1) < count) {
+    if (child + 1 < count && key_before(heap[child + 1], heap[child]))
+      child++;
+    if (!key_before(heap[child], item))
+      break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = item;
+}
+
+static void close_key_runs(key_merge_t *merge) {
+  int i;
+
+  for (i = 0; i < merge->count; i++) {
+    if (merge->readers[i].fp != NULL) {
+      fclose(merge->readers[i].fp);
+      budget_add(BUDGET_OUTPUT, -SPILL_READ_BUFFER);
+    }
+  }
+  if (merge->readers != NULL)
+    XFREE(merge->readers);
+  if (merge->heap != NULL)
+    XFREE(merge->heap);
+  XMEMSET(merge, 0, sizeof(key_merge_t));
+}
+
+/* Open the first count key runs */
+static int open_key_runs(lpi2_builder_t *b, key_merge_t *merge, int count) {
+  int i, ret;
+
+  XMEMSET(merge, 0, sizeof(key_merge_t));
+  if ((merge->readers = (key_reader_t *)XMALLOC(sizeof(key_reader_t) * count)) == NULL ||
+      (merge->heap = (key_reader_t **)XMALLOC(sizeof(key_reader_t *) * count)) == NULL) {
+    close_key_runs(merge);
+    return FAILED;
+  }
+  XMEMSET(merge->readers, 0, sizeof(key_reader_t) * count);
+  merge->count = count;
+
+  for (i = 0; i < count; i++) {
+    key_reader_t *reader = &merge->readers[i];
+
+    if ((reader->fp = fopen(b->runs->paths[i], "rb")) == NULL) {
+      fprintf(stderr, "ERR - Unable to open key run [%s] %d (%s)\n", b->runs->paths[i], errno,
+              strerror(errno));
+      close_key_runs(merge);
+      return FAILED;
+    }
+    setvbuf(reader->fp, NULL, _IOFBF, SPILL_READ_BUFFER);
+    budget_add(BUDGET_OUTPUT, SPILL_READ_BUFFER);
+    if ((ret = get_key(b, reader)) == FAILED) {
+      close_key_runs(merge);
+      return FAILED;
+    }
+    if (ret == TRUE)
+      merge->heap[merge->live++] = reader;
+  }
+  for (i = merge->live / 2 - 1; i >= 0; i--)
+    key_sift_down(merge->heap, merge->live, i);
+
+  return TRUE;
+}
+
+/* Move past the entry on top of the heap */
+static int next_key(lpi2_builder_t *b, key_merge_t *merge) {
+  key_reader_t *top = merge->heap[0];
+  int ret;
+
+  if ((ret = get_key(b, top)) == FAILED)
+    return FAILED;
+  if (ret == FALSE)
+    merge->heap[0] = merge->heap[--merge->live];
+  if (merge->live > 0)
+    key_sift_down(merge->heap, merge->live, 0);
+  return TRUE;
+}
+
+/* Merge the oldest SPILL_MAX_FANIN key runs into one */
+static int merge_key_runs(lpi2_builder_t *b) {
+  key_merge_t merge;
+  char path[PATH_MAX];
+  FILE *fp;
+  int ret = TRUE;
+
+  if (open_key_runs(b, &merge, SPILL_MAX_FANIN) != TRUE)
+    return FAILED;
+  if ((fp = spill_open_temp(b->runs, "keys", path, sizeof(path))) == NULL) {
+    close_key_runs(&merge);
+    return FAILED;
+  }
+  while (merge.live > 0 && ret == TRUE) {
+    key_reader_t *top = merge.heap[0];
+
+    if (put_key(b, fp, &top->key, &top->summary, top->text) != TRUE || next_key(b, &merge) != TRUE)
+      ret = FAILED;
+  }
+  close_key_runs(&merge);
+  if (fclose(fp) != 0 || ret != TRUE) {
+    fprintf(stderr, "ERR - Unable to merge key runs into [%s]\n", path);
+    unlink(path);
+    return FAILED;
+  }
+
+  spill_drop_runs(b->runs, SPILL_MAX_FANIN);
+  return spill_add_run(b->runs, path) ? TRUE : FAILED;
+}
+
+/* Copy an unlinked temporary file to the index */
+static int emit_file(lpi2_builder_t *b, FILE *fp) {
+  char buf[8192];
+  size_t len;
+
+  if (fflush(fp) != 0 || fseeko(fp, 0, SEEK_SET) != 0) {
+    b->error = TRUE;
+    return FAILED;
+  }
+  while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+    emit(b, buf, len);
+  if (ferror(fp))
+    b->error = TRUE;
+  return b->error ? FAILED : TRUE;
+}
+
+/****
+ *
+ * write the key sections from spilled key runs
+ *
+ * The text goes out as the runs are merged, the entries and summary
+ * go to temporary files until it is done and follow it.
+ *
+ ****/
+
+static int emit_key_runs(lpi2_builder_t *b, lpi2_section_t *sections, int *count) {
+  key_merge_t merge;
+  filter_t *f = NULL;
+  FILE *entries = NULL, *summary = NULL;
+  char path[PATH_MAX];
+  uint64_t start;
+  uint32_t slot = 0;
+  int ret = TRUE;
+
+  if (b->count > 0 && spill_keys(b) != TRUE)
+    return FAILED;
+
+  /* Only the runs are needed from here */
+  if (b->keys != NULL)
+    XFREE(b->keys);
+  b->keys = NULL;
+  if (b->summary != NULL)
+    XFREE(b->summary);
+  b->summary = NULL;
+  if (b->names.data != NULL)
+    XFREE(b->names.data);
+  XMEMSET(&b->names, 0, sizeof(b->names));
+  b->capacity = 0;
+  publish_keys(b);
+
+  while (b->runs->count > SPILL_MAX_FANIN) {
+    if (merge_key_runs(b) != TRUE) {
+      b->error = TRUE;
+      return FAILED;
+    }
+  }
+
+  if ((entries = spill_open_temp(b->runs, "entries", path, sizeof(path))) != NULL)
+    unlink(path);
+  if (!(b->flags & LPI2_FLAG_CATALOG) && (summary = spill_open_temp(b->runs, "summary", path, sizeof(path))) != NULL)
+    unlink(path);
+  if (entries == NULL || (!(b->flags & LPI2_FLAG_CATALOG) && summary == NULL) ||
+      (f = create_filter(b, b->spilled)) == NULL || open_key_runs(b, &merge, b->runs->count) != TRUE)
+    ret = FAILED;
+
+  if (ret == TRUE) {
+    emit_pad(b);
+    start = sections[1].offset = b->offset;
+    sections[1].type = LPI2_SECTION_STRINGS;
+    while (merge.live > 0 && ret == TRUE) {
+      key_reader_t *top = merge.heap[0];
+
+      top->key.text = 0;
+      if (!(top->key.flags & LPI2_KEY_CANONICAL)) {
+        top->key.text = (uint32_t)(b->offset - start);
+        emit(b, top->text, top->key.text_len);
+      }
+      filter_add(f, filter_hash_key(&top->key, top->text));
+      if (has_summary(b, &top->key))
+        top->key.slot = slot++;
+      if (fwrite(&top->key, sizeof(lpi2_key_t), 1, entries) != 1 ||
+          (has_summary(b, &top->key) && fwrite(&top->summary, sizeof(lpi2_summary_t), 1, summary) != 1) ||
+          next_key(b, &merge) != TRUE)
+        ret = FAILED;
+    }
+    close_key_runs(&merge);
+    sections[1].length = b->offset - start;
+
+    emit_pad(b);
+    sections[2].type = LPI2_SECTION_KEYS;
+    sections[2].offset = b->offset;
+    if (ret == TRUE)
+      ret = emit_file(b, entries);
+    sections[2].length = b->offset - sections[2].offset;
+
+    emit_pad(b);
+    sections[3].type = LPI2_SECTION_FILTER;
+    sections[3].offset = b->offset;
+    if (ret == TRUE) {
+      ret = emit_filter(b, f);
+      f = NULL;
+    }
+    sections[3].length = b->offset - sections[3].offset;
+
+    if (summary != NULL) {
+      emit_pad(b);
+      sections[*count].type = LPI2_SECTION_SUMMARY;
+      sections[*count].offset = b->offset;
+      if (ret == TRUE)
+        ret = emit_file(b, summary);
+      sections[*count].length = b->offset - sections[*count].offset;
+      (*count)++;
+    }
+  }
+
+  if (f != NULL) {
+    budget_add(BUDGET_OUTPUT, -(int64_t)f->blocks * FILTER_BLOCK_SIZE);
+    filter_free(f);
+  }
+  if (entries != NULL)
+    fclose(entries);
+  if (summary != NULL)
+    fclose(summary);
+  if (ret != TRUE) {
+    fprintf(stderr, "ERR - Unable to write binary index keys from runs\n");
+    b->error = TRUE;
+  }
+  return ret;
+}
+
+/****
+ *
+ * write the key text, the sorted keys, the filter and the summary
+ *
+ * Key text goes out in key order, so a search that compares text reads
+ * it from the same few pages as the keys it lands on.  Canonical text
+ * is left out.
+ *
+ ****/
+
+static int emit_keys(lpi2_builder_t *b, lpi2_section_t *sections, int *count) {
+  sort_entry_t *sorted;
+  filter_t *f;
+  uint64_t start;
+  uint32_t slot = 0;
+  size_t i;
+
+  if ((sorted = sort_keys(b)) == NULL && b->count > 0)
+    return FAILED;
+
+  emit_pad(b);
+  start = sections[1].offset = b->offset;
+  sections[1].type = LPI2_SECTION_STRINGS;
+  for (i = 0; i < b->count; i++) {
+    sorted[i].key->text = 0;
+    if (!(sorted[i].key->flags & LPI2_KEY_CANONICAL)) {
+      sorted[i].key->text = (uint32_t)(b->offset - start);
+      emit(b, sorted[i].text, sorted[i].key->text_len);
+    }
+  }
+  sections[1].length = b->offset - start;
+
+  emit_pad(b);
+  sections[2].type = LPI2_SECTION_KEYS;
+  sections[2].offset = b->offset;
+  for (i = 0; i < b->count; i++) {
+    if (has_summary(b, sorted[i].key))
+      sorted[i].key->slot = slot++;
+    emit(b, sorted[i].key, sizeof(lpi2_key_t));
+  }
+  sections[2].length = b->offset - sections[2].offset;
+
+  emit_pad(b);
+  sections[3].type = LPI2_SECTION_FILTER;
+  sections[3].offset = b->offset;
+  if ((f = create_filter(b, b->count)) != NULL) {
+    for (i = 0; i < b->count; i++)
+      filter_add(f, filter_hash_key(sorted[i].key, sorted[i].text));
+  }
+  emit_filter(b, f);
+  sections[3].length = b->offset - sections[3].offset;
+
+  /* In key order, as the slots were given out */
+  if (!(b->flags & LPI2_FLAG_CATALOG)) {
+    emit_pad(b);
+    sections[*count].type = LPI2_SECTION_SUMMARY;
+    sections[*count].offset = b->offset;
+    for (i = 0; i < b->count; i++) {
+      if (has_summary(b, sorted[i].key))
+        emit(b, &b->summary[sorted[i].key - b->keys], sizeof(lpi2_summary_t));
+    }
+    sections[*count].length = b->offset - sections[*count].offset;
+    (*count)++;
+  }
+
+  free_sorted(b, sorted);
+  return b->error ? FAILED : TRUE;
+}
+
+/****
+ *
+ * write the key sections, the directory and the trailer
+ *
+ ****/
+
+int lpi2_builder_finish(lpi2_builder_t *b) {
+  lpi2_section_t sections[5 + LPI2_BUILDER_EXTRA];
+  lpi2_trailer_t trailer;
+  uint64_t keys = b->spilled + b->count;
+  size_t i;
+  int count = 4;
+
+  if (b->error)
+    return FAILED;
+
+  XMEMSET(sections, 0, sizeof(sections));
+  sections[0].type = LPI2_SECTION_POSTINGS;
+  sections[0].offset = b->postings;
+  sections[0].length = b->offset - b->postings;
+
+  if ((b->spilled > 0 ? emit_key_runs(b, sections, &count) : emit_keys(b, sections, &count)) != TRUE)
+    return FAILED;
+
+  for (i = 0; i < (size_t)b->extra_count; i++, count++) {
+    emit_pad(b);
+    sections[count].type = b->extra_types[i];
+    sections[count].offset = b->offset;
+    sections[count].length = b->extra[i].len;
+    emit(b, b->extra[i].data, b->extra[i].len);
+  }
+  emit_pad(b);
+
+  XMEMSET(&trailer, 0, sizeof(trailer));
+  trailer.directory = b->offset;
+  trailer.section_count = count;
+  trailer.key_count = keys;
+  trailer.location_count = b->locations;
+  trailer.file_size = b->offset + sizeof(lpi2_section_t) * count + sizeof(trailer);
+  memcpy(trailer.magic, LPI2_MAGIC, sizeof(trailer.magic));
+  emit(b, sections, sizeof(lpi2_section_t) * count);
+  emit(b, &trailer, sizeof(trailer));
+
+  return b->error ? FAILED : TRUE;
+}
+
+void lpi2_builder_destroy(lpi2_builder_t *b) {
+  int i;
+
+  if (b == NULL)
+    return;
+  if (b->keys != NULL)
+    XFREE(b->keys);
+  if (b->summary != NULL)
+    XFREE(b->summary);
+  if (b->names.data != NULL)
+    XFREE(b->names.data);
+  b->capacity = 0;
+  XMEMSET(&b->names, 0, sizeof(b->names));
+  publish_keys(b);
+  spill_destroy(b->runs);
+  for (i = 0; i < b->extra_count; i++) {
+    if (b->extra[i].data != NULL)
+      XFREE(b->extra[i].data);
+  }
+  XFREE(b);
+}
+
+/****
+ *
+ * postings encoding
+ *
+ * Lists longer than a block reserve their block table first and fill
+ * it in as each block starts.  The count must be known up front and
+ * locations added in line order.
+ *
+ ****/
+
+int lpi2_postings_begin(lpi2_postings_t *p, out_buffer_t *buf, uint64_t count) {
+  size_t table = 0;
+
+  if (count > LPI2_BLOCK_ENTRIES)
+    table = ((count + LPI2_BLOCK_ENTRIES - 1) / LPI2_BLOCK_ENTRIES) * sizeof(lpi2_block_t);
+  if (table > 0) {
+    if (!out_reserve(buf, table))
+      return FAILED;
+    XMEMSET(buf->data + buf->len, 0, table);
+  }
+
+  p->buf = buf;
+  p->table = buf->len;
+  buf->len += table;
+  p->data = buf->len;
+  p->count = count;
+  p->added = 0;
+  p->last_line = 0;
+  return TRUE;
+}
+
+int lpi2_postings_add(lpi2_postings_t *p, uint64_t line, uint64_t field) {
+  out_buffer_t *buf = p->buf;
+  char *end;
+
+  if (p->added == p->count)
+    return FAILED;
+
+  if (p->added % LPI2_BLOCK_ENTRIES == 0) {
+    if (p->count > LPI2_BLOCK_ENTRIES) {
+      lpi2_block_t block;
+
+      block.first_line = line;
+      block.offset = buf->len - p->data;
+      memcpy(buf->data + p->table + (p->added / LPI2_BLOCK_ENTRIES) * sizeof(lpi2_block_t),
+             &block, sizeof(block));
+    }
+    p->last_line = 0;
+  }
+
+  if (!out_reserve(buf, 20))  /* Two varints */
+    return FAILED;
+  end = (char *)lpi2_put_varint((uint8_t *)buf->data + buf->len, line - p->last_line);
+  end = (char *)lpi2_put_varint((uint8_t *)end, field);
+  buf->len = end - buf->data;
+  p->last_line = line;
+  p->added++;
+  return TRUE;
+}
+
+int lpi2_postings_end(lpi2_postings_t *p) {
+  return (p->added == p->count) ? TRUE : FAILED;
+}
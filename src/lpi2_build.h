@@ -0,0 +1,92 @@
+/*****
+ *
+ * Description: Binary Index Builder Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef LPI2_BUILD_H
+#define LPI2_BUILD_H
+
+#include "../include/common.h"
+#include "lpi2.h"
+#include "writer.h"
+#include "spill.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LPI2_BUILDER_EXTRA 2            /* Sections a caller can add */
+
+/*
+ * Postings are streamed to the writer as keys are added, in any key
+ * order.  The key entries are held until the end, sorted, and written
+ * after the postings with the key text, the section directory and the
+ * trailer, so the output never has to be seekable.  Sections a caller
+ * adds are held the same way and written before the directory.  The
+ * first and last line of a key with more than a block of locations
+ * are read back from its postings as it is added, for the summary
+ * section.  A key with one location keeps
+ * it in its entry and streams nothing.
+ *
+ * Given a budget, keys past it are sorted a chunk at a time and spilled
+ * as runs of (entry, summary, text), merged back as the key sections
+ * are written.
+ */
+typedef struct lpi2_builder_s {
+  writer_t *out;
+  uint64_t offset;              /* Bytes written so far */
+  uint64_t postings;            /* Start of the postings section */
+  uint64_t locations;
+  uint32_t flags;
+  lpi2_key_t *keys;             /* text is an offset in names until the end */
+  lpi2_summary_t *summary;      /* One per key, none in a catalog */
+  size_t count;
+  size_t capacity;
+  out_buffer_t names;
+  spill_set_t *runs;            /* Key runs, NULL unless a budget was given */
+  size_t limit;                 /* Bytes of keys held before a chunk is spilled */
+  size_t spilled;               /* Keys in the runs */
+  uint64_t summarized;          /* Keys with a summary entry */
+  size_t reported;              /* Bytes charged to the budget */
+  uint32_t extra_types[LPI2_BUILDER_EXTRA];
+  out_buffer_t extra[LPI2_BUILDER_EXTRA];
+  int extra_count;
+  int error;
+} lpi2_builder_t;
+
+/* Encodes one key's postings into an output buffer */
+typedef struct lpi2_postings_s {
+  out_buffer_t *buf;
+  size_t table;                 /* Block table, when the list has one */
+  size_t data;                  /* First block */
+  uint64_t count;
+  uint64_t added;
+  uint64_t last_line;
+} lpi2_postings_t;
+
+/* Function prototypes */
+lpi2_builder_t *lpi2_builder_create(writer_t *out, uint32_t flags);
+int lpi2_builder_spill(lpi2_builder_t *b, const char *dir, size_t limit);
+int lpi2_builder_add(lpi2_builder_t *b, const char *key, size_t key_len, uint64_t count,
+                     const char *postings, size_t len);
+int lpi2_builder_section(lpi2_builder_t *b, uint32_t type, const char *data, size_t len);
+int lpi2_builder_finish(lpi2_builder_t *b);
+void lpi2_builder_destroy(lpi2_builder_t *b);
+int lpi2_postings_begin(lpi2_postings_t *p, out_buffer_t *buf, uint64_t count);
+int lpi2_postings_add(lpi2_postings_t *p, uint64_t line, uint64_t field);
+int lpi2_postings_end(lpi2_postings_t *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LPI2_BUILD_H */
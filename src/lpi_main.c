@@ -64,6 +64,8 @@ int main(int argc, char *argv[]) {
   char inBuf[8192];
   char outFileName[PATH_MAX];
   PRIVATE int c = 0, i, ret;
+  int status = EXIT_SUCCESS;
+  catalog_builder_t *catalog = NULL;
 
 #ifndef DEBUG
   struct rlimit rlim;
@@ -94,10 +96,18 @@ int main(int argc, char *argv[]) {
         {"greedy", no_argument, 0, 'g'},      {"version", no_argument, 0, 'v'},
         {"debug", required_argument, 0, 'd'}, {"help", no_argument, 0, 'h'},
         {"write", no_argument, 0, 'w'}, {"serial", no_argument, 0, 's'}, 
+        {"private", no_argument, 0, 'p'},
+        {"memory-limit", required_argument, 0, 'm'},
+        {"temp-dir", required_argument, 0, 't'},
+        {"binary", no_argument, 0, 'b'},
+        {"key-order", no_argument, 0, 'k'},
+        {"catalog", required_argument, 0, 'C'},
+        {"compress", no_argument, 0, 'z'},
+        {"merge", required_argument, 0, 'M'},
         {0, no_argument, 0, 0}};
-    c = getopt_long(argc, argv, "vd:hwgs", long_options, &option_index);
+    c = getopt_long(argc, argv, "vd:hwgspm:t:bkC:zM:", long_options, &option_index);
 #else
-    c = getopt(argc, argv, "vd:hwgs");
+    c = getopt(argc, argv, "vd:hwgspm:t:bkC:zM:");
 #endif
 
     if (c EQ - 1)
@@ -149,16 +159,98 @@ int main(int argc, char *argv[]) {
       config->auto_lpi_naming = TRUE;
       break;
 
+    case 'b':
+      /* mapped binary index instead of text */
+      config->binary_index = TRUE;
+      break;
+
+    case 'k':
+      /* text index in address order with a key directory */
+      config->key_order = TRUE;
+      break;
+
+    case 'z':
+      /* address ordered text index compressed in blocks */
+      config->compress_index = TRUE;
+      config->key_order = TRUE;
+      break;
+
+    case 'C':
+      /* add the indexes written to an address catalog */
+      if (!optarg || strlen(optarg) == 0) {
+        display(LOG_ERR, "Catalog filename required");
+        return (EXIT_FAILURE);
+      }
+      if (!is_path_safe(optarg)) {
+        fprintf(stderr, "ERR - Unsafe catalog path [%s]\n", optarg);
+        return (EXIT_FAILURE);
+      }
+      if (config->catalog_filename != NULL)
+        XFREE(config->catalog_filename);
+      config->catalog_filename = XSTRDUP(optarg);
+      break;
+
+    case 'M':
+      /* merge the indexes of the logs given instead of reading them */
+      if (!optarg || strlen(optarg) == 0) {
+        display(LOG_ERR, "Merged index filename required");
+        return (EXIT_FAILURE);
+      }
+      if (config->merge_filename != NULL)
+        XFREE(config->merge_filename);
+      config->merge_filename = XSTRDUP(optarg);
+      break;
+
     case 's':
       /* force serial processing */
       config->force_serial = TRUE;
       break;
 
+    case 'p':
+      /* per-worker private tables, merged after the scan */
+      config->private_tables = TRUE;
+      break;
+
+    case 'm':
+      /* memory budget for the whole pipeline */
+      if (optarg && strlen(optarg) > 0) {
+        char *endptr;
+        unsigned long long limit_mb = strtoull(optarg, &endptr, 10);
+
+        if (*endptr != '\0' || endptr == optarg || optarg[0] == '-' ||
+            limit_mb > (SIZE_MAX >> 20)) {
+          display(LOG_ERR, "Invalid memory limit, expecting megabytes");
+          return (EXIT_FAILURE);
+        }
+        config->memory_limit = (size_t)limit_mb << 20;
+      } else {
+        display(LOG_ERR, "Memory limit required");
+        return (EXIT_FAILURE);
+      }
+      break;
+
+    case 't':
+      /* directory for spill runs */
+      if (optarg && strlen(optarg) > 0) {
+        if (config->temp_dir != NULL)
+          XFREE(config->temp_dir);
+        config->temp_dir = XSTRDUP(optarg);
+      } else {
+        display(LOG_ERR, "Temporary directory required");
+        return (EXIT_FAILURE);
+      }
+      break;
+
     default:
       fprintf(stderr, "Unknown option code [0%o]\n", c);
     }
   }
 
+  /* Only private tables can spill, so a budget implies -p in parallel mode */
+  if (config->memory_limit)
+    config->private_tables = TRUE;
+  budget_init(config->memory_limit);
+
   /* check dirs and files for danger */
 
   if (time(&config->current_time) EQ - 1) {
@@ -200,6 +292,38 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  /* Only text indexes are compressed, a binary index is already packed */
+  if (config->compress_index && config->binary_index) {
+    fprintf(stderr, "ERR - The -z switch cannot be used with -b\n");
+    cleanup();
+    return (EXIT_FAILURE);
+  }
+
+  /* The catalog is built from the indexes written */
+  if (config->catalog_filename != NULL) {
+    if (!config->auto_lpi_naming) {
+      fprintf(stderr, "ERR - The -C switch needs -w\n");
+      cleanup();
+      return (EXIT_FAILURE);
+    }
+    if ((catalog = catalog_builder_create(config->catalog_filename)) == NULL) {
+      cleanup();
+      return (EXIT_FAILURE);
+    }
+  }
+
+  /* Existing indexes are merged, no log is parsed */
+  if (config->merge_filename != NULL) {
+    if (config->auto_lpi_naming) {
+      fprintf(stderr, "ERR - The -M switch cannot be used with -w\n");
+      cleanup();
+      return (EXIT_FAILURE);
+    }
+    ret = merge_indexes(config->merge_filename, argv + optind, argc - optind);
+    cleanup();
+    return (ret EQ TRUE) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   /* process all the files */
   while (optind < argc) {
     /* Validate file path for security */
@@ -208,7 +332,16 @@ int main(int argc, char *argv[]) {
       optind++;
       continue;
     }
-    processFile(argv[optind++]);
+    if (processFile(argv[optind]) != EXIT_SUCCESS)
+      status = EXIT_FAILURE;
+    else if (catalog != NULL && !quit)
+      catalog_builder_add(catalog, argv[optind]);
+    optind++;
+  }
+
+  if (catalog != NULL) {
+    catalog_builder_finish(catalog);
+    catalog_builder_destroy(catalog);
   }
 
   /* show addresses (only if not using auto-naming) */
@@ -222,7 +355,7 @@ int main(int argc, char *argv[]) {
 
   cleanup();
 
-  return (EXIT_SUCCESS);
+  return (status);
 }
 
 /****
@@ -269,19 +402,35 @@ PRIVATE void print_help(void) {
   fprintf(stderr, "Options:\n");
 
 #ifdef HAVE_GETOPT_LONG
+  fprintf(stderr, " -b|--binary            write a binary index that spi searches in place\n");
+  fprintf(stderr, " -C|--catalog FILE      add each index written to an address catalog for spi -c\n");
   fprintf(stderr, " -d|--debug (0-9)       enable debugging info (0=none, 9=verbose)\n");
   fprintf(stderr, " -g|--greedy            ignore quotes when parsing fields\n");
   fprintf(stderr, " -h|--help              display this help information\n");
+  fprintf(stderr, " -k|--key-order         write text indexes in address order with a .lpx key directory\n");
+  fprintf(stderr, " -M|--merge FILE        merge the indexes of the logs given into FILE, lines numbered end to end\n");
+  fprintf(stderr, " -m|--memory-limit MB   memory budget for scanning and writing the index, spill past it (0=none)\n");
+  fprintf(stderr, " -p|--private           parallel workers use private tables, merged at the end\n");
   fprintf(stderr, " -s|--serial            force serial processing (disable parallel mode)\n");
+  fprintf(stderr, " -t|--temp-dir DIR      directory for spill runs (default $TMPDIR or /tmp)\n");
   fprintf(stderr, " -v|--version           display version information\n");
   fprintf(stderr, " -w|--write             auto-generate .lpi files for each input file\n");
+  fprintf(stderr, " -z|--compress          write -k text indexes compressed in blocks spi inflates as needed\n");
 #else
+  fprintf(stderr, " -b            write a binary index that spi searches in place\n");
+  fprintf(stderr, " -C {fname}    add each index written to an address catalog for spi -c\n");
   fprintf(stderr, " -d {0-9}      enable debugging info (0=none, 9=verbose)\n");
   fprintf(stderr, " -g            ignore quotes when parsing fields\n");
   fprintf(stderr, " -h            display this help information\n");
+  fprintf(stderr, " -k            write text indexes in address order with a .lpx key directory\n");
+  fprintf(stderr, " -M {fname}    merge the indexes of the logs given into FILE, lines numbered end to end\n");
+  fprintf(stderr, " -m {MB}       memory budget for scanning and writing the index, spill past it (0=none)\n");
+  fprintf(stderr, " -p            parallel workers use private tables, merged at the end\n");
   fprintf(stderr, " -s            force serial processing (disable parallel mode)\n");
+  fprintf(stderr, " -t {dir}      directory for spill runs (default $TMPDIR or /tmp)\n");
   fprintf(stderr, " -v            display version information\n");
   fprintf(stderr, " -w            auto-generate .lpi files for each input file\n");
+  fprintf(stderr, " -z            write -k text indexes compressed in blocks spi inflates as needed\n");
 #endif
 
   fprintf(stderr, "\n");
@@ -291,7 +440,7 @@ PRIVATE void print_help(void) {
   fprintf(stderr, "\n");
   fprintf(stderr, "Performance Features:\n");
   fprintf(stderr, " - Automatic parallel processing for files >100MB\n");
-  fprintf(stderr, " - Multi-threaded architecture with dedicated I/O and hash threads\n");
+  fprintf(stderr, " - Multi-threaded architecture with a dedicated I/O thread and lock-free address table\n");
   fprintf(stderr, " - Optimized for IPv4, IPv6, and MAC address extraction\n");
   fprintf(stderr, " - Serial processing: ~60M lines/minute, Parallel: 125M+ lines/minute\n");
   fprintf(stderr, " - Serial mode available for debugging or memory-constrained systems\n");
@@ -300,11 +449,21 @@ PRIVATE void print_help(void) {
   fprintf(stderr, " Without -w: Network addresses printed to stdout\n");
   fprintf(stderr, " With -w:    Creates .lpi index files (input.log -> input.log.lpi)\n");
   fprintf(stderr, " Index format: ADDRESS,COUNT,LINE:FIELD,LINE:FIELD,...\n");
+  fprintf(stderr, " With -b:    The same locations in a binary index with sorted keys\n");
+  fprintf(stderr, " With -k:    Records in address order, plus input.log.lpi.lpx for spi\n");
+  fprintf(stderr, " With -z:    The -k records as gzip blocks, one per key directory entry\n");
+  fprintf(stderr, " With -C:    Each address mapped to the files it is in and their counts\n");
+  fprintf(stderr, " With -M:    One index of the logs given as if they were one log, in the order given\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "Examples:\n");
   fprintf(stderr, " %s -w /var/log/syslog                    # Create syslog.lpi index\n", PACKAGE);
   fprintf(stderr, " %s -d 1 -w *.log                        # Process all .log files with debug\n", PACKAGE);
   fprintf(stderr, " %s -s -w huge_file.log                  # Force serial processing for large file\n", PACKAGE);
+  fprintf(stderr, " %s -b -w huge_file.log                  # Binary index for fast lookups\n", PACKAGE);
+  fprintf(stderr, " %s -k -w huge_file.log                  # Text index spi can search without a full scan\n", PACKAGE);
+  fprintf(stderr, " %s -z -w huge_file.log                  # Compressed text index, still searchable by key\n", PACKAGE);
+  fprintf(stderr, " %s -C logs.lpc -w /var/log/*.log        # Index the logs and add them to a catalog\n", PACKAGE);
+  fprintf(stderr, " %s -M all.log.lpi m.2.gz m.1 m          # Merge rotated indexes, oldest first\n", PACKAGE);
   fprintf(stderr, " tail -f /var/log/access.log | %s -      # Real-time processing from stdin\n", PACKAGE);
   fprintf(stderr, "\n");
 }
@@ -322,6 +481,12 @@ PRIVATE void cleanup(void) {
   if (config->outFile_st != NULL)
     fclose(config->outFile_st);
   XFREE(config->hostname);
+  if (config->temp_dir != NULL)
+    XFREE(config->temp_dir);
+  if (config->catalog_filename != NULL)
+    XFREE(config->catalog_filename);
+  if (config->merge_filename != NULL)
+    XFREE(config->merge_filename);
 #ifdef MEM_DEBUG
   XFREE_ALL();
 #else
@@ -53,6 +53,9 @@
 #include "util.h"
 #include "mem.h"
 #include "logpi.h"
+#include "budget.h"
+#include "catalog_build.h"
+#include "merge.h"
 #include "match.h"
 
 /****
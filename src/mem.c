@@ -109,7 +109,7 @@ PUBLIC char *copy_argv(char *argv[]) {
  *
  ****/
 
-void *xmalloc_(const int size, const char *filename, const int linenumber) {
+void *xmalloc_(const size_t size, const char *filename, const int linenumber) {
   void *result;
 #ifdef MEM_DEBUG
   PRIVATE struct Mem_s *d_result;
@@ -118,7 +118,7 @@ void *xmalloc_(const int size, const char *filename, const int linenumber) {
   /* allocate buf */
   result = malloc(size);
   if (result EQ NULL) {
-    fprintf(stderr, "out of memory (%d at %s:%d)!\n", size, filename,
+    fprintf(stderr, "out of memory (%zu at %s:%d)!\n", size, filename,
             linenumber);
 #ifdef MEM_DEBUG
     XFREE_ALL();
@@ -138,7 +138,7 @@ void *xmalloc_(const int size, const char *filename, const int linenumber) {
   bzero(d_result, sizeof(struct Mem_s));
 
 #ifdef SHOW_MEM_DEBUG
-  fprintf(stderr, "0x%08x malloc() called from %s:%d (%d bytes)\n", (int)result,
+  fprintf(stderr, "0x%08x malloc() called from %s:%d (%zu bytes)\n", (int)result,
           filename, linenumber, size);
 #endif
 
@@ -173,7 +173,7 @@ void *xmalloc_(const int size, const char *filename, const int linenumber) {
  *
  ****/
 
-void *xmemcpy_(void *d_ptr, void *s_ptr, const int size, const char *filename,
+void *xmemcpy_(void *d_ptr, void *s_ptr, const size_t size, const char *filename,
                const int linenumber) {
   void *result;
 #ifdef MEM_DEBUG
@@ -281,7 +281,7 @@ void *xmemcpy_(void *d_ptr, void *s_ptr, const int size, const char *filename,
   }
 
 #ifdef SHOW_MEM_DEBUG
-  fprintf(stderr, "0x%08x memcpy() called from %s:%d (%d bytes)\n",
+  fprintf(stderr, "0x%08x memcpy() called from %s:%d (%zu bytes)\n",
           (unsigned int)result, filename, linenumber, size);
 #endif
 
@@ -414,7 +414,7 @@ char *xmemncpy_(char *d_ptr, const char *s_ptr, const size_t len,
  *
  ****/
 
-void *xmemset_(void *ptr, const char value, const int size,
+void *xmemset_(void *ptr, const char value, const size_t size,
                const char *filename, const int linenumber) {
   void *result;
 
@@ -433,7 +433,7 @@ void *xmemset_(void *ptr, const char value, const int size,
   }
 
 #ifdef DEBUG_MEM
-  fprintf(stderr, "0x%x memset %s:%d (%d bytes)\n", result, filename,
+  fprintf(stderr, "0x%x memset %s:%d (%zu bytes)\n", result, filename,
           linenumber, size);
 #endif
 
@@ -474,7 +474,7 @@ int xmemcmp_(const void *s1, const void *s2, size_t n, const char *filename,
  *
  ****/
 
-void *xrealloc_(void *ptr, int size, const char *filename,
+void *xrealloc_(void *ptr, size_t size, const char *filename,
                 const int linenumber) {
   void *result;
 #ifdef MEM_DEBUG
@@ -487,12 +487,12 @@ void *xrealloc_(void *ptr, int size, const char *filename,
     result = realloc(ptr, size);
 
 #ifdef DEBUG_MEM
-  fprintf(stderr, "0x%x realloc %s:%d (%d bytes)\n", (int)result, filename,
+  fprintf(stderr, "0x%x realloc %s:%d (%zu bytes)\n", (int)result, filename,
           linenumber, size);
 #endif
 
   if (result EQ NULL) {
-    fprintf(stderr, "out of memory (%d at %s:%d)!\n", size, filename,
+    fprintf(stderr, "out of memory (%zu at %s:%d)!\n", size, filename,
             linenumber);
 #ifdef DEBUG_MEM
     XFREE_ALL();
@@ -512,7 +512,7 @@ void *xrealloc_(void *ptr, int size, const char *filename,
   bzero(d_result, sizeof(struct Mem_s));
 
 #ifdef SHOW_MEM_DEBUG
-  fprintf(stderr, "0x%08x malloc() called from %s:%d (%d bytes)\n", (int)result,
+  fprintf(stderr, "0x%08x malloc() called from %s:%d (%zu bytes)\n", (int)result,
           filename, linenumber, size);
 #endif
 
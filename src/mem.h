@@ -70,7 +70,7 @@
 
 struct Mem_s {
   void *buf_ptr;
-  unsigned int buf_size;
+  size_t buf_size;
   int status;
   struct Mem_s *prev;
   struct Mem_s *next;
@@ -83,12 +83,12 @@ struct Mem_s {
  ****/
 
 char *copy_argv(char *argv[]);
-void *xmalloc_(int size, const char *filename, const int linenumber);
-void *xrealloc_(void *ptr, int size, const char *filename,
+void *xmalloc_(size_t size, const char *filename, const int linenumber);
+void *xrealloc_(void *ptr, size_t size, const char *filename,
                 const int linenumber);
-void *xmemset_(void *ptr, const char value, const int size,
+void *xmemset_(void *ptr, const char value, const size_t size,
                const char *filename, const int linenumber);
-void *xmemcpy_(void *d_ptr, void *s_ptr, const int size, const char *filename,
+void *xmemcpy_(void *d_ptr, void *s_ptr, const size_t size, const char *filename,
                const int linenumber);
 int xmemcmp_(const void *s1, const void *s2, size_t n, const char *filename,
              const int linenumber);
@@ -102,6 +102,10 @@ void *mempool_alloc(mempool_t *pool, size_t size) {
             pool->total_allocated += aligned_size;
             return ptr;
         }
+        
+        /* Too small, keep it for a later reset instead of leaking it */
+        block->next = pool->free_blocks;
+        pool->free_blocks = block;
     }
     
     /* Allocate new block */
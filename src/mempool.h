@@ -24,8 +24,8 @@ extern "C" {
 #endif
 
 /* Memory pool configuration */
-#define POOL_BLOCK_SIZE 8192    /* 8KB blocks */
-#define POOL_ALIGNMENT 16       /* 16-byte alignment for SIMD */
+#define POOL_BLOCK_SIZE 65536   /* 64KB blocks */
+#define POOL_ALIGNMENT 8        /* Pointer alignment, keys pack tightly */
 
 /* Memory pool block */
 typedef struct pool_block_s {
@@ -55,10 +55,12 @@ size_t mempool_get_usage(mempool_t *pool);
 /* Inline fast allocation for small objects */
 static ALWAYS_INLINE void *mempool_alloc_fast(mempool_t *pool, size_t size) {
     pool_block_t *block = pool->current_block;
+    size_t aligned_size = (size + POOL_ALIGNMENT - 1) & ~(POOL_ALIGNMENT - 1);
     
-    if (LIKELY(block && (block->current + size <= block->end))) {
+    if (LIKELY(block && size > 0 && (block->current + aligned_size <= block->end))) {
         void *ptr = block->current;
-        block->current += (size + POOL_ALIGNMENT - 1) & ~(POOL_ALIGNMENT - 1);
+        block->current += aligned_size;
+        pool->total_allocated += aligned_size;
         return ptr;
     }
     
@@ -0,0 +1,603 @@
+/*****
+ *
+ * Description: Index Merge Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "merge.h"
+#include "mem.h"
+#include "util.h"
+#include "spill.h"
+#include "keydir.h"
+#include "filter.h"
+#include "linemap.h"
+#include "gzcheck.h"
+#include "zblock.h"
+#include "stamp.h"
+#include "parallel.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern Config_t *config;
+extern volatile int quit;
+
+/* Sources handed out to the threads opening them */
+typedef struct merge_work_s {
+  merge_source_t *sources;
+  int count;
+  int next;
+  pthread_mutex_t lock;
+} merge_work_t;
+
+static int corrupt(merge_source_t *s) {
+  if (!s->error)
+    fprintf(stderr, "ERR - Index is corrupt [%s]\n", s->index_path);
+  s->error = TRUE;
+  return FAILED;
+}
+
+/****
+ *
+ * bytes of a text index
+ *
+ * A mapped index is read from the start of a record to the end of the
+ * map, a streamed one a buffer at a time.
+ *
+ ****/
+
+static int source_fill(merge_source_t *s) {
+  int n;
+
+  if (s->gz == NULL)
+    return FALSE;
+  if ((n = gzread(s->gz, s->buf, MERGE_READ_BUFFER)) < 0) {
+    fprintf(stderr, "ERR - Unable to read index [%s]\n", s->index_path);
+    s->error = TRUE;
+    return FALSE;
+  }
+  s->p = s->buf;
+  s->end = s->buf + n;
+  return n > 0;
+}
+
+static ALWAYS_INLINE int source_byte(merge_source_t *s) {
+  if (s->p == s->end && !source_fill(s))
+    return EOF;
+  return (unsigned char)*s->p++;
+}
+
+/* A decimal field, returns the byte after it */
+static int source_decimal(merge_source_t *s, uint64_t *value) {
+  int c, digits = 0;
+
+  *value = 0;
+  while ((c = source_byte(s)) >= '0' && c <= '9') {
+    *value = *value * 10 + (uint64_t)(c - '0');
+    digits++;
+  }
+  return (digits > 0) ? c : FAILED;
+}
+
+/****
+ *
+ * next record of a source in strcmp order
+ *
+ * Returns TRUE with the key and its count set, FALSE past the last
+ * record and FAILED if the index cannot be read.
+ *
+ ****/
+
+int merge_source_record(merge_source_t *s, char *key, size_t key_size, uint64_t *count) {
+  const lpi2_key_t *entry;
+  const char *text;
+  size_t len = 0;
+  int c;
+
+  if (s->error)
+    return FAILED;
+
+  if (s->kind == MERGE_SOURCE_BINARY) {
+    if (s->next == s->key_count)
+      return FALSE;
+    entry = &s->index->keys[s->keys[s->next].number];
+    text = s->keys[s->next++].text;
+    if (entry->text_len >= key_size || lpi2_cursor_init(s->index, entry, &s->cursor) != TRUE)
+      return corrupt(s);
+    memcpy(key, text, entry->text_len);
+    key[entry->text_len] = '\0';
+    *count = s->left = entry->count;
+    return TRUE;
+  }
+
+  if (s->kind == MERGE_SOURCE_TEXT) {
+    if (s->next == s->key_count)
+      return FALSE;
+    s->p = s->keys[s->next++].text;
+  }
+
+  while ((c = source_byte(s)) != EOF && c != ',') {
+    if (c == '\n' || len == key_size - 1)
+      return corrupt(s);
+    key[len++] = (char)c;
+  }
+  if (c == EOF) {
+    if (len > 0)
+      return corrupt(s);
+    return s->error ? FAILED : FALSE;
+  }
+  key[len] = '\0';
+
+  /* A streamed index is trusted to be in order, so check that it is */
+  if (s->kind == MERGE_SOURCE_STREAM) {
+    if (s->last[0] != '\0' && strcmp(s->last, key) >= 0) {
+      fprintf(stderr, "ERR - Index is not in address order [%s]\n", s->index_path);
+      s->error = TRUE;
+      return FAILED;
+    }
+    memcpy(s->last, key, len + 1);
+  }
+
+  if (source_decimal(s, count) != ',' || *count == 0)
+    return corrupt(s);
+  s->left = *count;
+  return TRUE;
+}
+
+/* Next location of the record, its line counted from the first source */
+int merge_source_entry(merge_source_t *s, uint64_t *line, uint64_t *field) {
+  int c;
+
+  if (s->left == 0 || s->error)
+    return FAILED;
+
+  if (s->kind == MERGE_SOURCE_BINARY) {
+    if (lpi2_cursor_next(&s->cursor, line, field) != TRUE)
+      return corrupt(s);
+  } else {
+    if (source_decimal(s, line) != ':')
+      return corrupt(s);
+    c = source_decimal(s, field);
+    if (s->left > 1 ? c != ',' : (c != '\n' && c != EOF))
+      return corrupt(s);
+  }
+  if (*line == 0)
+    return corrupt(s);
+  s->left--;
+  *line += s->line_base - 1;
+  return TRUE;
+}
+
+/****
+ *
+ * key order, strcmp over keys that are not NUL terminated
+ *
+ ****/
+
+static int compare_keys(const void *a, const void *b) {
+  const merge_key_t *key_a = (const merge_key_t *)a;
+  const merge_key_t *key_b = (const merge_key_t *)b;
+  int ret;
+
+  if ((ret = memcmp(key_a->text, key_b->text, (key_a->len < key_b->len) ? key_a->len : key_b->len)) != 0)
+    return ret;
+  return (key_a->len > key_b->len) - (key_a->len < key_b->len);
+}
+
+static int add_key(merge_source_t *s, size_t *capacity, const char *text, size_t len, uint64_t number) {
+  if (s->key_count == *capacity) {
+    size_t grow = (*capacity == 0) ? 4096 : *capacity * 2;
+    merge_key_t *grown;
+
+    if ((grown = (merge_key_t *)XREALLOC(s->keys, sizeof(merge_key_t) * grow)) == NULL) {
+      fprintf(stderr, "ERR - Unable to grow keys of [%s]\n", s->index_path);
+      return FAILED;
+    }
+    s->keys = grown;
+    *capacity = grow;
+  }
+  s->keys[s->key_count].text = text;
+  s->keys[s->key_count].len = len;
+  s->keys[s->key_count].number = number;
+  s->key_count++;
+  return TRUE;
+}
+
+/****
+ *
+ * open a text index, mapped with its records sorted by key
+ *
+ ****/
+
+static int open_text(merge_source_t *s) {
+  struct stat st;
+  const char *p, *end, *nl, *comma;
+  size_t capacity = 0;
+
+  if ((s->fd = open(s->index_path, O_RDONLY)) < 0 || fstat(s->fd, &st) != 0) {
+    fprintf(stderr, "ERR - Unable to open index [%s] %d (%s)\n", s->index_path, errno, strerror(errno));
+    return FAILED;
+  }
+  s->kind = MERGE_SOURCE_TEXT;
+  if ((s->size = (size_t)st.st_size) == 0)
+    return TRUE;
+  if ((s->map = (const char *)mmap(NULL, s->size, PROT_READ, MAP_PRIVATE, s->fd, 0)) == MAP_FAILED) {
+    s->map = NULL;
+    fprintf(stderr, "ERR - Unable to map index [%s] %d (%s)\n", s->index_path, errno, strerror(errno));
+    return FAILED;
+  }
+  madvise((void *)s->map, s->size, MADV_WILLNEED);
+
+  for (p = s->map, end = s->map + s->size; p < end; p = nl + 1) {
+    if ((nl = memchr(p, '\n', end - p)) == NULL)
+      nl = end;
+    if (nl == p)
+      continue;
+    if ((comma = memchr(p, ',', nl - p)) == NULL)
+      return corrupt(s);
+    if (add_key(s, &capacity, p, comma - p, 0) != TRUE)
+      return FAILED;
+  }
+  s->end = end;
+  qsort(s->keys, s->key_count, sizeof(merge_key_t), compare_keys);
+
+  return TRUE;
+}
+
+/* A -z index, inflated in order as it is merged */
+static int open_stream(merge_source_t *s) {
+  s->kind = MERGE_SOURCE_STREAM;
+  if ((s->gz = gzopen(s->index_path, "rb")) == NULL) {
+    fprintf(stderr, "ERR - Unable to open index [%s] %d (%s)\n", s->index_path, errno, strerror(errno));
+    return FAILED;
+  }
+  gzbuffer(s->gz, MERGE_READ_BUFFER);
+  if ((s->buf = (char *)XMALLOC(MERGE_READ_BUFFER)) == NULL)
+    return FAILED;
+  s->p = s->end = s->buf;
+  return TRUE;
+}
+
+/* A binary index, its keys put in strcmp order, canonical text rebuilt into buf */
+static int open_binary(merge_source_t *s) {
+  const lpi2_key_t *key;
+  const char *text;
+  size_t capacity = 0, rebuilt = 0, used = 0;
+  uint64_t i;
+
+  s->kind = MERGE_SOURCE_BINARY;
+  if ((s->index = lpi2_open(s->index_path)) == NULL)
+    return FAILED;
+  if (s->index->flags & LPI2_FLAG_CATALOG) {
+    fprintf(stderr, "ERR - [%s] is a catalog, not an index\n", s->index_path);
+    return FAILED;
+  }
+  for (i = 0; i < s->index->key_count; i++) {
+    if (s->index->keys[i].flags & LPI2_KEY_CANONICAL)
+      rebuilt += s->index->keys[i].text_len;
+  }
+  if ((s->buf = (char *)XMALLOC(rebuilt + LPI2_TEXT_BUF)) == NULL)
+    return FAILED;
+  for (i = 0; i < s->index->key_count; i++) {
+    key = &s->index->keys[i];
+    if ((text = lpi2_key_text(s->index, key, s->buf + used)) == NULL)
+      return corrupt(s);
+    if (text == s->buf + used)
+      used += key->text_len;
+    if (add_key(s, &capacity, text, key->text_len, i) != TRUE)
+      return FAILED;
+  }
+  qsort(s->keys, s->key_count, sizeof(merge_key_t), compare_keys);
+
+  return TRUE;
+}
+
+/****
+ *
+ * count the lines of a log as processFile numbers them
+ *
+ * Each read of a line, at most MERGE_LINE_PIECE bytes, is a line.  A
+ * current .lpl sidecar already has the count, so the log is only
+ * read when there is none, through zlib for a .gz log.
+ *
+ ****/
+
+static int count_lines(merge_source_t *s) {
+  linemap_t *lm;
+  gzFile fp;
+  char *buf;
+  const char *p, *end, *nl;
+  size_t run = 0;
+  int n;
+
+  if ((lm = linemap_load(s->index_path, s->log_path)) != NULL) {
+    s->lines = lm->lines;
+    linemap_free(lm);
+    return TRUE;
+  }
+
+  if ((fp = gzopen(s->log_path, "rb")) == NULL) {
+    fprintf(stderr, "ERR - Unable to open file [%s] %d (%s)\n", s->log_path, errno, strerror(errno));
+    return FAILED;
+  }
+  gzbuffer(fp, MERGE_READ_BUFFER);
+  if ((buf = (char *)XMALLOC(MERGE_READ_BUFFER)) == NULL) {
+    gzclose(fp);
+    return FAILED;
+  }
+
+  s->lines = 0;
+  while ((n = gzread(fp, buf, MERGE_READ_BUFFER)) > 0) {
+    for (p = buf, end = buf + n; p < end; p = nl + 1) {
+      nl = memchr(p, '\n', end - p);
+      run += ((nl != NULL) ? nl : end) - p;
+      while (run >= MERGE_LINE_PIECE) {
+        s->lines++;
+        run -= MERGE_LINE_PIECE;
+      }
+      if (nl == NULL)
+        break;
+      s->lines++;
+      run = 0;
+    }
+  }
+  if (run > 0)
+    s->lines++;
+
+  XFREE(buf);
+  gzclose(fp);
+  if (n < 0) {
+    fprintf(stderr, "ERR - Unable to read [%s]\n", s->log_path);
+    return FAILED;
+  }
+  return TRUE;
+}
+
+/* Open one source and count its log, every source but the last */
+static int open_source(merge_source_t *s, int last) {
+  int ret;
+
+  if (lpi2_is_index(s->index_path))
+    ret = open_binary(s);
+  else if (zblock_is_compressed(s->index_path))
+    ret = open_stream(s);
+  else
+    ret = open_text(s);
+
+  if (ret == TRUE && !last)
+    ret = count_lines(s);
+  return ret;
+}
+
+static void *open_thread(void *arg) {
+  merge_work_t *work = (merge_work_t *)arg;
+  int i;
+
+  for (;;) {
+    pthread_mutex_lock(&work->lock);
+    i = work->next++;
+    pthread_mutex_unlock(&work->lock);
+    if (i >= work->count || quit)
+      break;
+    if (open_source(&work->sources[i], i == work->count - 1) != TRUE)
+      work->sources[i].error = TRUE;
+  }
+  return NULL;
+}
+
+static void close_source(merge_source_t *s) {
+  if (s->index != NULL)
+    lpi2_close(s->index);
+  if (s->map != NULL)
+    munmap((void *)s->map, s->size);
+  if (s->fd >= 0)
+    close(s->fd);
+  if (s->gz != NULL)
+    gzclose(s->gz);
+  if (s->buf != NULL)
+    XFREE(s->buf);
+  if (s->keys != NULL)
+    XFREE(s->keys);
+}
+
+/****
+ *
+ * write the merged sources beside out_path and rename it over it
+ *
+ ****/
+
+static int write_merged(const char *out_path, merge_source_t *sources, int count) {
+  char tmp_path[PATH_MAX];
+  spill_set_t *set;
+  FILE *out;
+  int ret;
+
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", out_path) >= (int)sizeof(tmp_path)) {
+    fprintf(stderr, "ERR - Output filename too long for [%s]\n", out_path);
+    return FAILED;
+  }
+
+  /* Sidecars of an earlier index at out_path no longer match */
+  if (!config->key_order || config->binary_index)
+    keydir_remove(out_path);
+  filter_remove(out_path);
+
+  if ((set = spill_create(config->temp_dir)) == NULL)
+    return FAILED;
+  if ((out = fopen(tmp_path, "w")) == NULL) {
+    fprintf(stderr, "ERR - Unable to open output file [%s]: %s\n", tmp_path, strerror(errno));
+    spill_destroy(set);
+    return FAILED;
+  }
+
+  config->index_filename = (char *)out_path;
+  ret = spill_merge_sources(set, sources, count, out);
+  config->index_filename = NULL;
+  if (fclose(out) != 0)
+    ret = FAILED;
+  if (ret == TRUE && rename(tmp_path, out_path) != 0) {
+    fprintf(stderr, "ERR - Unable to replace index [%s] %d (%s)\n", out_path, errno, strerror(errno));
+    ret = FAILED;
+  }
+  if (ret != TRUE) {
+    fprintf(stderr, "ERR - Unable to write merged index [%s]\n", out_path);
+    unlink(tmp_path);
+  }
+  spill_destroy(set);
+
+  return ret;
+}
+
+/****
+ *
+ * merge the indexes of logs into out_path
+ *
+ * A log is named as it was indexed, or by its .lpi.  The sources are
+ * opened and their logs counted in parallel, then merged in one pass
+ * and written beside out_path before they replace it, so a source
+ * index can also be the output.
+ *
+ ****/
+
+int merge_indexes(const char *out_path, char **logs, int count) {
+  merge_source_t *sources;
+  merge_work_t work;
+  pthread_t *threads;
+  uint64_t base = 0;
+  size_t len;
+  int i, num_threads, ret = TRUE;
+
+  if (count == 0) {
+    fprintf(stderr, "ERR - No indexes to merge\n");
+    return FAILED;
+  }
+  if (!is_path_safe(out_path)) {
+    fprintf(stderr, "ERR - Unsafe output file path [%s]\n", out_path);
+    return FAILED;
+  }
+  if ((sources = (merge_source_t *)XMALLOC(sizeof(merge_source_t) * count)) == NULL)
+    return FAILED;
+  XMEMSET(sources, 0, sizeof(merge_source_t) * count);
+
+  for (i = 0; i < count && ret == TRUE; i++) {
+    len = strlen(logs[i]);
+    if (!is_path_safe(logs[i])) {
+      fprintf(stderr, "ERR - Unsafe file path [%s]\n", logs[i]);
+      ret = FAILED;
+    } else if (len > 4 && strcmp(logs[i] + len - 4, ".lpi") == 0) {
+      snprintf(sources[i].index_path, sizeof(sources[i].index_path), "%s", logs[i]);
+      snprintf(sources[i].log_path, sizeof(sources[i].log_path), "%.*s", (int)(len - 4), logs[i]);
+    } else if (snprintf(sources[i].index_path, sizeof(sources[i].index_path), "%s.lpi", logs[i]) >=
+               (int)sizeof(sources[i].index_path)) {
+      fprintf(stderr, "ERR - Index filename too long for [%s]\n", logs[i]);
+      ret = FAILED;
+    } else
+      snprintf(sources[i].log_path, sizeof(sources[i].log_path), "%s", logs[i]);
+    sources[i].fd = -1;
+  }
+  if (ret != TRUE) {
+    XFREE(sources);
+    return FAILED;
+  }
+
+  fprintf(stderr, "Merging %d indexes into [%s]\n", count, out_path);
+
+  /* Open the sources and count their logs, a thread per core */
+  num_threads = config->force_serial ? 1 : get_available_cores();
+  if (num_threads > count)
+    num_threads = count;
+  work.sources = sources;
+  work.count = count;
+  work.next = 0;
+  pthread_mutex_init(&work.lock, NULL);
+  if ((threads = (pthread_t *)XMALLOC(sizeof(pthread_t) * num_threads)) == NULL)
+    ret = FAILED;
+  for (i = 0; ret == TRUE && i < num_threads; i++) {
+    if (pthread_create(&threads[i], NULL, open_thread, &work) != 0) {
+      fprintf(stderr, "WARN - Unable to start merge thread, continuing with %d\n", i);
+      break;
+    }
+  }
+  if (ret == TRUE && i == 0)
+    open_thread(&work);
+  while (--i >= 0)
+    pthread_join(threads[i], NULL);
+  if (threads != NULL)
+    XFREE(threads);
+  pthread_mutex_destroy(&work.lock);
+
+  /* Each log follows every line of the ones before it */
+  for (i = 0; i < count && ret == TRUE; i++) {
+    if (sources[i].error || quit) {
+      fprintf(stderr, "ERR - Unable to merge [%s]\n", sources[i].index_path);
+      ret = FAILED;
+    }
+    sources[i].line_base = base;
+    base += sources[i].lines;
+#ifdef DEBUG
+    if (config->debug >= 1)
+      fprintf(stderr, "DEBUG - [%s] numbered from line %llu\n", sources[i].index_path,
+              (unsigned long long)sources[i].line_base + 1);
+#endif
+  }
+
+  if (ret == TRUE) {
+    /* The merged log has no line or gzip checkpoints of its own */
+    linemap_remove(out_path);
+    gzcheck_remove(out_path);
+    stamp_remove(out_path);
+    ret = write_merged(out_path, sources, count);
+  }
+
+  for (i = 0; i < count; i++)
+    close_source(&sources[i]);
+  XFREE(sources);
+
+  return ret;
+}
+
+/****
+ *
+ * merge the index of a log's new lines into the index of the rest
+ *
+ * The lines of the tail index follow the lines already indexed.
+ *
+ ****/
+
+int merge_append(const char *index_path, const char *tail_path, uint64_t lines) {
+  merge_source_t sources[2];
+  int i, ret = TRUE;
+
+  XMEMSET(sources, 0, sizeof(sources));
+  snprintf(sources[0].index_path, sizeof(sources[0].index_path), "%s", index_path);
+  snprintf(sources[1].index_path, sizeof(sources[1].index_path), "%s", tail_path);
+  sources[1].line_base = lines;
+
+  for (i = 0; i < 2; i++) {
+    sources[i].fd = -1;
+    if (ret == TRUE && open_source(&sources[i], TRUE) != TRUE) {
+      fprintf(stderr, "ERR - Unable to merge [%s]\n", sources[i].index_path);
+      ret = FAILED;
+    }
+  }
+  if (ret == TRUE)
+    ret = write_merged(index_path, sources, 2);
+
+  for (i = 0; i < 2; i++)
+    close_source(&sources[i]);
+
+  return ret;
+}
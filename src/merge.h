@@ -0,0 +1,97 @@
+/*****
+ *
+ * Description: Index Merge Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef MERGE_H
+#define MERGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <zlib.h>
+#include "../include/common.h"
+#include "lpi2.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * logpi -M merges the indexes of several logs into one index of the
+ * logs read end to end in the order given, rotated files oldest first
+ * or the shards of a split log.  The lines of each source are moved
+ * past every line of the sources before it, so a merged index reads
+ * as if the logs had been concatenated and indexed as one.
+ *
+ * Each source index is read in place, a text index mapped and a binary
+ * one through lpi2_open, with its keys put in strcmp order as a spill
+ * run holds them.  A -z index is already in that order and is inflated
+ * as it is read.  The sources then go through the spill run merge, so
+ * the merged index can be written in any of the formats.
+ *
+ * logpi -w merges the same way when a log has grown, the index of its
+ * new lines into the index of the rest, see stamp.h.
+ */
+
+#define MERGE_READ_BUFFER 65536
+#define MERGE_LINE_PIECE 65535          /* processFile numbers each fgets() of a longer line */
+
+/* Kinds of source index */
+#define MERGE_SOURCE_TEXT 0             /* Mapped, records sorted by key */
+#define MERGE_SOURCE_STREAM 1           /* Compressed, read through zlib in key order */
+#define MERGE_SOURCE_BINARY 2
+
+/* A key of a source, text is its record in a text index */
+typedef struct merge_key_s {
+  const char *text;
+  size_t len;
+  uint64_t number;              /* Key number in a binary index */
+} merge_key_t;
+
+/* One source index, positioned on a record and a location */
+typedef struct merge_source_s {
+  char log_path[PATH_MAX];
+  char index_path[PATH_MAX];
+  int kind;
+  uint64_t lines;               /* Lines in the log */
+  uint64_t line_base;           /* Lines of the sources before it */
+  int error;
+  /* Text, mapped or streamed */
+  int fd;
+  const char *map;
+  size_t size;
+  merge_key_t *keys;            /* In strcmp order, text or binary */
+  size_t key_count;
+  size_t next;
+  gzFile gz;
+  char *buf;                    /* Streamed text, or a binary index's rebuilt key text */
+  const char *p;
+  const char *end;
+  char last[LPI2_MAX_TEXT + 1]; /* Previous streamed key, which must sort before the next */
+  uint64_t left;                /* Locations left in the record */
+  /* Binary */
+  lpi2_index_t *index;
+  lpi2_cursor_t cursor;
+} merge_source_t;
+
+/* Function prototypes */
+int merge_source_record(merge_source_t *s, char *key, size_t key_size, uint64_t *count);
+int merge_source_entry(merge_source_t *s, uint64_t *line, uint64_t *field);
+int merge_indexes(const char *out_path, char **logs, int count);
+int merge_append(const char *index_path, const char *tail_path, uint64_t lines);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MERGE_H */
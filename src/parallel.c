@@ -30,6 +30,7 @@
 #include "parser.h"
 #include "mem.h"
 #include "util.h"
+#include "budget.h"
 #include <sys/stat.h>
 #include <unistd.h>
 #include <time.h>
@@ -169,7 +170,7 @@ int find_line_boundary(FILE *file, off_t offset) {
  *
  ****/
 
-parallel_context_t *init_parallel_context(const char *filename, FILE *file, struct hash_s *hash) {
+parallel_context_t *init_parallel_context(const char *filename, FILE *file) {
   parallel_context_t *ctx;
   
   ctx = (parallel_context_t *)XMALLOC(sizeof(parallel_context_t));
@@ -181,16 +182,13 @@ parallel_context_t *init_parallel_context(const char *filename, FILE *file, stru
   
   ctx->filename = filename;
   ctx->file = file;
-  ctx->global_hash = hash;
   ctx->file_size = get_file_size(file);
   
-  /* Initialize hash rwlock for thread-safe hash growth */
-  if (pthread_rwlock_init(&ctx->hash_rwlock, NULL) != 0) {
-    fprintf(stderr, "ERR - Unable to initialize hash rwlock\n");
+  /* Workers look up and insert addresses directly, no hash thread */
+  if ((ctx->addr_hash = initConcurrentHash(65536)) == NULL) {
     XFREE(ctx);
     return NULL;
   }
-  
   /* Determine number of worker threads */
   int cores = get_available_cores();
   int threads = cores / 2;  /* Use half the cores by default */
@@ -208,16 +206,48 @@ parallel_context_t *init_parallel_context(const char *filename, FILE *file, stru
     ctx->chunk_size = DEFAULT_CHUNK_SIZE;
   }
   
+  ctx->queue_depth = DEFAULT_QUEUE_DEPTH;
+  if (config->memory_limit) {
+    /*
+     * The chunk pipeline gets a fixed share of the budget: one chunk
+     * queued per worker, one being scanned per worker and one being
+     * read.  A full queue blocks the I/O thread, that is the
+     * back-pressure.  Tables and postings get whatever is left.
+     */
+    size_t share = config->memory_limit / BUDGET_CHUNK_SHARE;
+    size_t in_flight;
+    
+    ctx->queue_depth = threads;
+    in_flight = ctx->queue_depth + threads + 1;
+    if (share / in_flight < MIN_CHUNK_SIZE + CARRY_FORWARD_SIZE)
+      ctx->chunk_size = MIN_CHUNK_SIZE;
+    else if (ctx->chunk_size > share / in_flight - CARRY_FORWARD_SIZE)
+      ctx->chunk_size = share / in_flight - CARRY_FORWARD_SIZE;
+    
+    share = in_flight * (ctx->chunk_size + CARRY_FORWARD_SIZE);
+    ctx->table_budget = (share < config->memory_limit) ? config->memory_limit - share : 0;
+    if (ctx->table_budget == 0) {
+      fprintf(stderr, "WARN - Memory limit too small for %d workers, chunks alone need %zu MB\n",
+              threads, (share + 1048575) >> 20);
+      ctx->table_budget = 1;  /* Tables fall back to their minimum budget */
+    }
+  }
+  ctx->addr_hash->memLimit = ctx->table_budget;
+  
 #ifdef DEBUG
   if (config->debug >= 1) {
-    fprintf(stderr, "DEBUG - Parallel processing: %ld MB file, %d threads, %ld MB chunks\n",
-            ctx->file_size / 1048576, threads, ctx->chunk_size / 1048576);
+    fprintf(stderr, "DEBUG - Parallel processing: %ld MB file, %d threads, %ld MB chunks, %d queued\n",
+            ctx->file_size / 1048576, threads, ctx->chunk_size / 1048576, ctx->queue_depth);
+    if (ctx->table_budget)
+      fprintf(stderr, "DEBUG - Memory budget: %zu MB for tables and postings\n",
+              ctx->table_budget >> 20);
   }
 #endif
   
   /* Create thread pool */
-  ctx->pool = create_thread_pool(threads);
+  ctx->pool = create_thread_pool(threads, ctx->queue_depth);
   if (ctx->pool == NULL) {
+    freeConcurrentHash(ctx->addr_hash);
     XFREE(ctx);
     return NULL;
   }
@@ -225,11 +255,36 @@ parallel_context_t *init_parallel_context(const char *filename, FILE *file, stru
   /* Set back pointer for workers to access context */
   ctx->pool->ctx = ctx;
   
+  /* Every worker keeps its postings in its own slab */
+  for (int i = 0; i < threads; i++) {
+    if ((ctx->pool->workers[i].arena = mempool_create()) == NULL) {
+      free_parallel_context(ctx);
+      return NULL;
+    }
+  }
+  
+  /* Workers over their share of the budget spill sorted runs */
+  if (config->memory_limit && (ctx->spill = spill_create(config->temp_dir)) == NULL) {
+    free_parallel_context(ctx);
+    return NULL;
+  }
+  
+  /* Private mode: each worker aggregates into its own table, merged at the end */
+  if (config->private_tables) {
+    for (int i = 0; i < threads; i++) {
+      if ((ctx->pool->workers[i].local_hash = initHash(65536)) == NULL) {
+        free_parallel_context(ctx);
+        return NULL;
+      }
+      /* The workers split the budget between them */
+      set_table_budget(ctx->pool->workers[i].local_hash, ctx->table_budget / threads);
+    }
+  }
+  
   /* Initialize chunk dispatcher */
   ctx->pool->dispatcher = init_chunk_dispatcher(file, ctx->file_size, ctx->chunk_size);
   if (ctx->pool->dispatcher == NULL) {
-    destroy_thread_pool(ctx->pool);
-    XFREE(ctx);
+    free_parallel_context(ctx);
     return NULL;
   }
   
@@ -245,13 +300,33 @@ parallel_context_t *init_parallel_context(const char *filename, FILE *file, stru
 void free_parallel_context(parallel_context_t *ctx) {
   if (ctx == NULL) return;
   
+  /* Address metadata has already been released by the output pass */
+  freeConcurrentHash(ctx->addr_hash);
+  
   if (ctx->pool) {
+    /* Private tables are normally released by the merge */
+    for (int i = 0; i < ctx->pool->num_workers; i++) {
+      if (ctx->pool->workers[i].local_hash)
+        freeHash(ctx->pool->workers[i].local_hash);
+      /* Shared table nodes and merged postings live here, so only after the tables are gone */
+      if (ctx->pool->workers[i].arena)
+        mempool_destroy(ctx->pool->workers[i].arena);
+      budget_publish(BUDGET_TABLES, &ctx->pool->workers[i].tables_reported, 0);
+      budget_publish(BUDGET_POSTINGS, &ctx->pool->workers[i].postings_reported, 0);
+    }
     /* Don't free dispatcher here - destroy_thread_pool handles it */
     destroy_thread_pool(ctx->pool);
   }
   
-  /* Destroy hash rwlock */
-  pthread_rwlock_destroy(&ctx->hash_rwlock);
+  spill_destroy(ctx->spill);
+  
+  if (ctx->merged) {
+    for (int i = 0; i < ctx->merge_partitions; i++) {
+      if (ctx->merged[i])
+        freeHash(ctx->merged[i]);
+    }
+    XFREE(ctx->merged);
+  }
   
   XFREE(ctx);
 }
@@ -262,7 +337,7 @@ void free_parallel_context(parallel_context_t *ctx) {
  *
  ****/
 
-thread_pool_t *create_thread_pool(int num_threads) {
+thread_pool_t *create_thread_pool(int num_threads, int queue_depth) {
   thread_pool_t *pool;
   
   pool = (thread_pool_t *)XMALLOC(sizeof(thread_pool_t));
@@ -286,7 +361,7 @@ thread_pool_t *create_thread_pool(int num_threads) {
   pthread_cond_init(&pool->work_done, NULL);
   
   /* Create chunk queue for producer-consumer */
-  pool->chunk_queue = create_chunk_queue(16);  /* Queue capacity of 16 chunks */
+  pool->chunk_queue = create_chunk_queue(queue_depth);
   if (pool->chunk_queue == NULL) {
     fprintf(stderr, "ERR - Unable to create chunk queue\n");
     XFREE(pool->workers);
@@ -296,25 +371,11 @@ thread_pool_t *create_thread_pool(int num_threads) {
     return NULL;
   }
   
-  /* Create address queue for parser->hash communication */
-  pool->address_queue = create_address_queue(50000);  /* Queue capacity of 50K hash operations */
-  if (pool->address_queue == NULL) {
-    fprintf(stderr, "ERR - Unable to create address queue\n");
-    destroy_chunk_queue(pool->chunk_queue);
-    XFREE(pool->workers);
-    pthread_mutex_destroy(&pool->pool_mutex);
-    pthread_cond_destroy(&pool->work_done);
-    XFREE(pool);
-    return NULL;
-  }
-  
   /* Initialize workers */
   for (int i = 0; i < num_threads; i++) {
     pool->workers[i].thread_id = i;
     pool->workers[i].status = 0;  /* idle */
     pool->workers[i].pool = pool;  /* Set back pointer */
-    /* Add 64KB overhead for carry-forward buffer */
-    pool->workers[i].max_chunk_size = DEFAULT_CHUNK_SIZE + 65536;
     
     /* Pre-allocate chunk structure */
     pool->workers[i].chunk = (chunk_t *)XMALLOC(sizeof(chunk_t));
@@ -322,10 +383,8 @@ thread_pool_t *create_thread_pool(int num_threads) {
       fprintf(stderr, "ERR - Unable to allocate chunk structure for thread %d\n", i);
       /* Clean up and return */
       for (int j = 0; j < i; j++) {
-        if (pool->workers[j].chunk_buffer) XFREE(pool->workers[j].chunk_buffer);
         if (pool->workers[j].chunk) XFREE(pool->workers[j].chunk);
       }
-      destroy_address_queue(pool->address_queue);
       destroy_chunk_queue(pool->chunk_queue);
       XFREE(pool->workers);
       pthread_mutex_destroy(&pool->pool_mutex);
@@ -334,50 +393,6 @@ thread_pool_t *create_thread_pool(int num_threads) {
       return NULL;
     }
     XMEMSET(pool->workers[i].chunk, 0, sizeof(chunk_t));
-    
-    /* Pre-allocate chunk buffer */
-    pool->workers[i].chunk_buffer = (char *)XMALLOC(pool->workers[i].max_chunk_size + 1);
-    if (pool->workers[i].chunk_buffer == NULL) {
-      fprintf(stderr, "ERR - Unable to allocate chunk buffer for thread %d\n", i);
-      XFREE(pool->workers[i].chunk);
-      /* Clean up and return */
-      for (int j = 0; j < i; j++) {
-        if (pool->workers[j].chunk_buffer) XFREE(pool->workers[j].chunk_buffer);
-        if (pool->workers[j].chunk) XFREE(pool->workers[j].chunk);
-      }
-      destroy_address_queue(pool->address_queue);
-      destroy_chunk_queue(pool->chunk_queue);
-      XFREE(pool->workers);
-      pthread_mutex_destroy(&pool->pool_mutex);
-      pthread_cond_destroy(&pool->work_done);
-      XFREE(pool);
-      return NULL;
-    }
-    
-    /* Allocate local address buffer for batching (1024 addresses per batch) */
-    pool->workers[i].local_buffer_capacity = 1024;
-    pool->workers[i].local_buffer = (hash_operation_entry_t *)XMALLOC(sizeof(hash_operation_entry_t) * pool->workers[i].local_buffer_capacity);
-    if (pool->workers[i].local_buffer == NULL) {
-      fprintf(stderr, "ERR - Unable to allocate local buffer for thread %d\n", i);
-      XFREE(pool->workers[i].chunk_buffer);
-      XFREE(pool->workers[i].chunk);
-      /* Clean up and return */
-      for (int j = 0; j < i; j++) {
-        if (pool->workers[j].local_buffer) XFREE(pool->workers[j].local_buffer);
-        if (pool->workers[j].chunk_buffer) XFREE(pool->workers[j].chunk_buffer);
-        if (pool->workers[j].chunk) XFREE(pool->workers[j].chunk);
-      }
-      destroy_address_queue(pool->address_queue);
-      destroy_chunk_queue(pool->chunk_queue);
-      XFREE(pool->workers);
-      pthread_mutex_destroy(&pool->pool_mutex);
-      pthread_cond_destroy(&pool->work_done);
-      XFREE(pool);
-      return NULL;
-    }
-    pool->workers[i].local_buffer_count = 0;
-    
-    /* No local hash needed - worker will send addresses to hash thread */
   }
   
   return pool;
@@ -405,37 +420,16 @@ void destroy_thread_pool(thread_pool_t *pool) {
     pthread_mutex_unlock(&pool->chunk_queue->queue_mutex);
   }
   
-  /* Signal address queue shutdown */
-  if (pool->address_queue) {
-    pthread_mutex_lock(&pool->address_queue->queue_mutex);
-    pool->address_queue->finished = 1;
-    pool->address_queue->active_producers = 0;
-    pthread_cond_broadcast(&pool->address_queue->not_empty);
-    pthread_mutex_unlock(&pool->address_queue->queue_mutex);
-  }
-  
   /* Stop I/O thread if running */
   if (pool->io_thread_created) {
     pthread_join(pool->io_thread, NULL);
   }
   
-  /* Stop hash thread if running */
-  if (pool->hash_thread_created) {
-    pthread_join(pool->hash_thread, NULL);
-  }
-  
   /* Wait for worker threads to finish */
   for (int i = 0; i < pool->num_workers; i++) {
     if (pool->workers[i].thread) {
       pthread_join(pool->workers[i].thread, NULL);
     }
-    /* No local hash to free - using shared hash thread */
-    if (pool->workers[i].local_buffer) {
-      XFREE(pool->workers[i].local_buffer);
-    }
-    if (pool->workers[i].chunk_buffer) {
-      XFREE(pool->workers[i].chunk_buffer);
-    }
     if (pool->workers[i].chunk) {
       XFREE(pool->workers[i].chunk);
     }
@@ -447,12 +441,6 @@ void destroy_thread_pool(thread_pool_t *pool) {
     pool->chunk_queue = NULL;
   }
   
-  /* Clean up address queue */
-  if (pool->address_queue) {
-    destroy_address_queue(pool->address_queue);
-    pool->address_queue = NULL;
-  }
-  
   /* Free dispatcher if exists */
   if (pool->dispatcher) {
     free_chunk_dispatcher(pool->dispatcher);
@@ -492,7 +480,7 @@ chunk_dispatcher_t *init_chunk_dispatcher(FILE *file, off_t file_size, size_t ch
   dispatcher->target_chunk_size = chunk_size;
   
   /* Initialize carry forward buffer for partial lines */
-  dispatcher->carry_forward_capacity = 65536;  /* 64KB buffer for partial lines */
+  dispatcher->carry_forward_capacity = CARRY_FORWARD_SIZE;
   dispatcher->carry_forward_buffer = (char *)XMALLOC(dispatcher->carry_forward_capacity);
   if (dispatcher->carry_forward_buffer == NULL) {
     fprintf(stderr, "ERR - Unable to allocate carry forward buffer\n");
@@ -570,6 +558,20 @@ chunk_queue_t *create_chunk_queue(int capacity) {
   return queue;
 }
 
+/****
+ *
+ * free a chunk and return its buffer to the budget
+ *
+ ****/
+
+static void free_chunk(chunk_t *chunk) {
+  if (chunk->buffer) {
+    XFREE(chunk->buffer);
+    budget_add(BUDGET_CHUNKS, -(int64_t)chunk->capacity);
+  }
+  XFREE(chunk);
+}
+
 /****
  *
  * destroy chunk queue
@@ -584,10 +586,8 @@ void destroy_chunk_queue(chunk_queue_t *queue) {
   /* Free any remaining chunks */
   while (queue->count > 0) {
     chunk_t *chunk = queue->chunks[queue->head];
-    if (chunk) {
-      if (chunk->buffer) XFREE(chunk->buffer);
-      XFREE(chunk);
-    }
+    if (chunk)
+      free_chunk(chunk);
     queue->head = (queue->head + 1) % queue->capacity;
     queue->count--;
   }
@@ -670,419 +670,190 @@ chunk_t *dequeue_chunk(chunk_queue_t *queue) {
 
 /****
  *
- * create address queue
+ * record a batch of address locations in the shared table
  *
  ****/
 
-address_queue_t *create_address_queue(int capacity) {
-  address_queue_t *queue;
+int record_address_location(worker_data_t *worker, address_batch_t *batch) {
+  struct cHash_s *hash = worker->pool->ctx->addr_hash;
+  metaData_t *tmpMd, *newMd;
+  int i;
   
-  queue = (address_queue_t *)XMALLOC(sizeof(address_queue_t));
-  if (queue == NULL) {
-    fprintf(stderr, "ERR - Unable to allocate address queue\n");
-    return NULL;
-  }
-  XMEMSET(queue, 0, sizeof(address_queue_t));
+  getConcurrentHashDataBatch(hash, batch->keys, batch->count);
   
-  queue->entries = (hash_operation_entry_t *)XMALLOC(sizeof(hash_operation_entry_t) * capacity);
-  if (queue->entries == NULL) {
-    fprintf(stderr, "ERR - Unable to allocate address queue array\n");
-    XFREE(queue);
-    return NULL;
+  for (i = 0; i < batch->count; i++) {
+    struct hashKey_s *key = &batch->keys[i];
+    
+    if ((tmpMd = (metaData_t *)key->data) == NULL) {
+      /* New address - another worker may insert it first, the loser's copy stays in its arena */
+      newMd = create_metadata(worker->arena);
+      if (newMd == NULL) {
+        fprintf(stderr, "ERR - Unable to create per-thread metadata, aborting\n");
+        abort();
+      }
+      
+      if ((tmpMd = (metaData_t *)getOrAddConcurrentHashData(hash, key->keyString, key->keyLen,
+                                                            key->hashValue, newMd, worker->arena)) == NULL)
+        return FALSE;
+      key->data = tmpMd;
+      
+      /* Later copies in this batch were looked up before the insert */
+      for (int j = i + 1; j < batch->count; j++) {
+        if (batch->keys[j].data == NULL &&
+            batch->keys[j].hashValue == key->hashValue &&
+            batch->keys[j].keyLen == key->keyLen &&
+            memcmp(batch->keys[j].keyString, key->keyString, key->keyLen) == 0)
+          batch->keys[j].data = tmpMd;
+      }
+    }
+    
+    /* Each worker only ever touches its own slot, no contention */
+    if (!append_thread_location(tmpMd, worker->thread_id, worker->arena, batch->lines[i], batch->offsets[i]))
+      return FALSE;
+    __atomic_fetch_add(&tmpMd->total_count, 1, __ATOMIC_RELAXED);
   }
   
-  queue->capacity = capacity;
-  queue->count = 0;
-  queue->head = 0;
-  queue->tail = 0;
-  queue->finished = 0;
-  queue->active_producers = 0;
-  
-  pthread_mutex_init(&queue->queue_mutex, NULL);
-  pthread_cond_init(&queue->not_empty, NULL);
-  pthread_cond_init(&queue->not_full, NULL);
-  
-  return queue;
+  batch->count = 0;
+  return TRUE;
 }
 
 /****
  *
- * destroy address queue
- *
- ****/
-
-void destroy_address_queue(address_queue_t *queue) {
-  if (queue == NULL) return;
-  
-  pthread_mutex_destroy(&queue->queue_mutex);
-  pthread_cond_destroy(&queue->not_empty);
-  pthread_cond_destroy(&queue->not_full);
-  
-  XFREE(queue->entries);
-  XFREE(queue);
-}
-
-/****
+ * spill a private table that reached the worker's share of the budget
  *
- * enqueue address (producer)
+ * The table and its postings are thrown away once the run is written,
+ * so the hot cache, which points at that metadata, is cleared too.
  *
  ****/
 
-int enqueue_address(address_queue_t *queue, const char *address, unsigned int line_number, uint16_t field_offset, int worker_id) {
-  if (queue == NULL || address == NULL) return FALSE;
+static int check_worker_budget(worker_data_t *worker) {
+  struct hash_s *hash = worker->local_hash;
+  size_t limit;
   
-  pthread_mutex_lock(&queue->queue_mutex);
+  /* Shared table nodes this worker inserted live in its slab, they count as postings */
+  budget_publish(BUDGET_TABLES, &worker->tables_reported, getHashMemory(hash));
+  budget_publish(BUDGET_POSTINGS, &worker->postings_reported, mempool_get_usage(worker->arena));
   
-  /* Wait for space in queue */
-  while (queue->count >= queue->capacity && !queue->finished) {
-    pthread_cond_wait(&queue->not_full, &queue->queue_mutex);
-  }
+  if (hash == NULL || !table_over_budget(hash, worker->arena))
+    return TRUE;
   
-  if (queue->finished) {
-    pthread_mutex_unlock(&queue->queue_mutex);
+  if (spill_write_run(worker->pool->ctx->spill, hash) != TRUE)
     return FALSE;
-  }
-  
-  /* Add entry to queue */
-  address_entry_t *entry = &queue->entries[queue->tail];
-  strncpy(entry->address, address, sizeof(entry->address) - 1);
-  entry->address[sizeof(entry->address) - 1] = '\0';
-  entry->line_number = line_number;
-  entry->field_offset = field_offset;
-  entry->worker_id = worker_id;
-  
-  queue->tail = (queue->tail + 1) % queue->capacity;
-  queue->count++;
-  
-  /* Signal consumer */
-  pthread_cond_signal(&queue->not_empty);
-  
-  pthread_mutex_unlock(&queue->queue_mutex);
-  
-  return TRUE;
-}
-
-/****
- *
- * enqueue hash operation (new distributed architecture)
- *
- ****/
-
-int enqueue_hash_operation(address_queue_t *queue, hash_operation_t op_type, const char *address, unsigned int line_number, uint16_t field_offset, struct hashRec_s *hash_record, int worker_id) {
-  if (queue == NULL || address == NULL) return FALSE;
-  
-  pthread_mutex_lock(&queue->queue_mutex);
   
-  /* Wait for space in queue */
-  while (queue->count >= queue->capacity && !queue->finished) {
-    pthread_cond_wait(&queue->not_full, &queue->queue_mutex);
-  }
+  limit = hash->memLimit;
+  freeHash(hash);
+  mempool_reset(worker->arena);
+  budget_trim();
+  XMEMSET(worker->hot_cache, 0, sizeof(worker->hot_cache));
   
-  if (queue->finished) {
-    pthread_mutex_unlock(&queue->queue_mutex);
+  if ((worker->local_hash = initHash(65536)) == NULL) {
+    fprintf(stderr, "ERR - Unable to allocate private table for thread %d\n", worker->thread_id);
     return FALSE;
   }
-  
-  /* Add entry to queue */
-  hash_operation_entry_t *entry = &queue->entries[queue->tail];
-  entry->op_type = op_type;
-  strncpy(entry->address, address, sizeof(entry->address) - 1);
-  entry->address[sizeof(entry->address) - 1] = '\0';
-  entry->line_number = line_number;
-  entry->field_offset = field_offset;
-  entry->hash_record = hash_record;
-  entry->worker_id = worker_id;
-  
-  queue->tail = (queue->tail + 1) % queue->capacity;
-  queue->count++;
-  
-  /* Signal consumer */
-  pthread_cond_signal(&queue->not_empty);
-  
-  pthread_mutex_unlock(&queue->queue_mutex);
+  set_table_budget(worker->local_hash, limit);
+  budget_publish(BUDGET_TABLES, &worker->tables_reported, getHashMemory(worker->local_hash));
+  budget_publish(BUDGET_POSTINGS, &worker->postings_reported, 0);
   
   return TRUE;
 }
 
 /****
  *
- * dequeue address (consumer)
- *
- ****/
-
-address_entry_t *dequeue_address(address_queue_t *queue) {
-  static address_entry_t entry;
-  
-  if (queue == NULL) return NULL;
-  
-  pthread_mutex_lock(&queue->queue_mutex);
-  
-  /* Wait for entry or finish signal */
-  while (queue->count == 0 && queue->active_producers > 0) {
-    pthread_cond_wait(&queue->not_empty, &queue->queue_mutex);
-  }
-  
-  if (queue->count > 0) {
-    /* Copy entry from queue */
-    entry = queue->entries[queue->head];
-    queue->head = (queue->head + 1) % queue->capacity;
-    queue->count--;
-    
-    /* Signal producer */
-    pthread_cond_signal(&queue->not_full);
-    
-    pthread_mutex_unlock(&queue->queue_mutex);
-    return &entry;
-  }
-  
-  pthread_mutex_unlock(&queue->queue_mutex);
-  return NULL;
-}
-
-/****
- *
- * dequeue hash operation (new distributed architecture)
+ * resolve a worker's pending batch in whichever table it writes to
  *
  ****/
 
-hash_operation_entry_t *dequeue_hash_operation(address_queue_t *queue) {
-  static hash_operation_entry_t entry;
-  
-  if (queue == NULL) return NULL;
-  
-  pthread_mutex_lock(&queue->queue_mutex);
+static int flush_worker_batch(worker_data_t *worker, address_batch_t *batch) {
+  int count = batch->count;
   
-  /* Wait for entries or shutdown */
-  while (queue->count == 0 && queue->active_producers > 0 && !queue->finished) {
-    pthread_cond_wait(&queue->not_empty, &queue->queue_mutex);
-  }
+  /* Private metadata only needs one slot, the merge moves it to this worker's slot */
+  if (((worker->local_hash != NULL) ?
+       record_address_batch(worker->local_hash, worker->arena, batch) :
+       record_address_location(worker, batch)) != TRUE)
+    return FALSE;
   
-  if (queue->count > 0) {
-    entry = queue->entries[queue->head];
-    queue->head = (queue->head + 1) % queue->capacity;
-    queue->count--;
-    
-    /* Signal producer */
-    pthread_cond_signal(&queue->not_full);
+  /* Remember what was just resolved, the last address to land in a slot wins */
+  for (int i = 0; i < count; i++) {
+    struct hashKey_s *key = &batch->keys[i];
+    hot_entry_t *entry = &worker->hot_cache[(key->hashValue >> 32) & (HOT_CACHE_SIZE - 1)];
     
-    pthread_mutex_unlock(&queue->queue_mutex);
-    return &entry;
+    entry->hashValue = key->hashValue;
+    entry->keyLen = key->keyLen;
+    memcpy(entry->key, key->keyString, key->keyLen);
+    entry->data = (metaData_t *)key->data;
   }
   
-  pthread_mutex_unlock(&queue->queue_mutex);
-  return NULL;
+  worker->addresses_found += count;
+  return check_worker_budget(worker);
 }
 
 /****
  *
- * check if worker has pending "add new IP" for this address in local buffer
- *
- ****/
-
-int has_pending_new_address_in_buffer(worker_data_t *worker, const char *address) {
-  for (int i = 0; i < worker->local_buffer_count; i++) {
-    if (worker->local_buffer[i].op_type == HASH_OP_NEW_ADDRESS && 
-        strcmp(worker->local_buffer[i].address, address) == 0) {
-      return TRUE;
-    }
-  }
-  return FALSE;
-}
-
-/****
+ * record one address, skipping the table when the hot cache knows it
  *
- * flush local address buffer to hash thread
+ * Cached entries point at metadata, not table records.  Metadata is
+ * never moved or freed while the context is alive, table growth only
+ * relocates records, so entries stay valid without invalidation.  An
+ * address only enters the cache once its batch has been flushed, which
+ * keeps each address's locations in scan order.
  *
  ****/
 
-int flush_local_buffer(worker_data_t *worker) {
-  if (worker->local_buffer_count == 0) return TRUE;
-  
-  address_queue_t *queue = worker->pool->address_queue;
-  pthread_mutex_lock(&queue->queue_mutex);
+static int record_worker_address(worker_data_t *worker, address_batch_t *batch, const char *address, size_t line, uint16_t offset) {
+  size_t len = strlen(address) + 1;
+  uint64_t hashValue;
+  hot_entry_t *entry;
+  metaData_t *tmpMd;
   
-  /* Wait for space in queue for entire batch */
-  while (queue->count + worker->local_buffer_count >= queue->capacity && !queue->finished) {
-    pthread_cond_wait(&queue->not_full, &queue->queue_mutex);
+  if (len > ADDRESS_BATCH_KEY_LEN) {
+    fprintf(stderr, "ERR - Address too long to index [%.*s...]\n", ADDRESS_BATCH_KEY_LEN, address);
+    return TRUE;
   }
   
-  if (queue->finished) {
-    pthread_mutex_unlock(&queue->queue_mutex);
-    return FALSE;
-  }
+  hashValue = getKeyHash(address, (int)len);
+  entry = &worker->hot_cache[(hashValue >> 32) & (HOT_CACHE_SIZE - 1)];
   
-  /* Copy entire batch to queue */
-  for (int i = 0; i < worker->local_buffer_count; i++) {
-    queue->entries[queue->tail] = worker->local_buffer[i];
-    queue->tail = (queue->tail + 1) % queue->capacity;
-    queue->count++;
+  if ((tmpMd = entry->data) != NULL && entry->hashValue == hashValue &&
+      entry->keyLen == (int)len && memcmp(entry->key, address, len) == 0) {
+    if (worker->local_hash != NULL) {
+      if (!append_thread_location(tmpMd, 0, worker->arena, line, offset))
+        return FALSE;
+      tmpMd->total_count++;
+    } else {
+      if (!append_thread_location(tmpMd, worker->thread_id, worker->arena, line, offset))
+        return FALSE;
+      __atomic_fetch_add(&tmpMd->total_count, 1, __ATOMIC_RELAXED);
+    }
+    worker->addresses_found++;
+    return TRUE;
   }
   
-  /* Signal hash thread */
-  pthread_cond_signal(&queue->not_empty);
-  pthread_mutex_unlock(&queue->queue_mutex);
+  batch_hashed_address(batch, address, (int)len, hashValue, line, offset);
+  if (batch->count == ADDRESS_BATCH_SIZE)
+    return flush_worker_batch(worker, batch);
   
-  worker->local_buffer_count = 0;
   return TRUE;
 }
 
 /****
  *
- * flush local buffer immediately for small batches 
+ * dedicated I/O thread (producer)
  *
  ****/
 
-int flush_local_buffer_immediate(worker_data_t *worker) {
-  if (worker->local_buffer_count == 0) return TRUE;
-  
-  address_queue_t *queue = worker->pool->address_queue;
-  pthread_mutex_lock(&queue->queue_mutex);
-  
-  /* Wait for space in queue for immediate small batch */
-  while (queue->count + worker->local_buffer_count >= queue->capacity && !queue->finished) {
-    pthread_cond_wait(&queue->not_full, &queue->queue_mutex);
-  }
-  
-  if (queue->finished) {
-    pthread_mutex_unlock(&queue->queue_mutex);
-    return FALSE;
-  }
-  
-  /* Copy immediate batch to queue */
-  for (int i = 0; i < worker->local_buffer_count; i++) {
-    queue->entries[queue->tail] = worker->local_buffer[i];
-    queue->tail = (queue->tail + 1) % queue->capacity;
-    queue->count++;
-  }
+void *io_thread(void *arg) {
+  thread_pool_t *pool = (thread_pool_t *)arg;
+  chunk_dispatcher_t *dispatcher = pool->dispatcher;
+  linemap_t *lines = pool->ctx->lines;
+  off_t current_offset = 0;
+  unsigned int current_line_number = 0;
+  unsigned int chunk_id = 0;
+  time_t current_time;
   
-  /* Signal hash thread immediately */
-  pthread_cond_signal(&queue->not_empty);
-  pthread_mutex_unlock(&queue->queue_mutex);
-  
-  worker->local_buffer_count = 0;
-  return TRUE;
-}
-
-/****
- *
- * add address to local buffer (with batching)
- *
- ****/
-
-/* 
- * NEW DISTRIBUTED ARCHITECTURE: Workers do hash lookups locally, 
- * only send operations to hash thread for writes
- */
-int buffer_address_local(worker_data_t *worker, const char *address, unsigned int line_number, uint16_t field_offset) {
-  struct hash_s *hash;
-  struct hashRec_s *tmpRec;
-  hash_operation_entry_t *entry;
-  
-  /* STEP 1: Check if we have pending "add new IP" for this address in local buffer */
-  if (has_pending_new_address_in_buffer(worker, address)) {
-    /* Flush immediately to resolve pending adds before doing hash lookup */
-    if (!flush_local_buffer_immediate(worker)) {
-      fprintf(stderr, "ERR - Failed to flush pending new address requests\n");
-      return FALSE;
-    }
-  }
-  
-  /* STEP 2: Acquire read lock and do hash lookup */
-  pthread_rwlock_rdlock(&worker->pool->ctx->hash_rwlock);
-  hash = worker->pool->ctx->global_hash;
-  tmpRec = getHashRecord(hash, address);
-  pthread_rwlock_unlock(&worker->pool->ctx->hash_rwlock);
-  
-  if (tmpRec == NULL) {
-    /* NEW ADDRESS: Send to hash thread for insertion */
-    entry = &worker->local_buffer[worker->local_buffer_count];
-    entry->op_type = HASH_OP_NEW_ADDRESS;
-    strncpy(entry->address, address, sizeof(entry->address) - 1);
-    entry->address[sizeof(entry->address) - 1] = '\0';
-    entry->line_number = line_number;
-    entry->field_offset = field_offset;
-    entry->hash_record = NULL;  /* New address, no existing record */
-    entry->worker_id = worker->thread_id;
-    
-    worker->local_buffer_count++;
-    
-    /* Use small batch sizes for new IP requests (1-5) to reduce race conditions */
-    if (worker->local_buffer_count >= 5) {
-      return flush_local_buffer_immediate(worker);
-    }
-  } else {
-    /* EXISTING ADDRESS: Handle with per-thread array - NO CONTENTION! */
-    metaData_t *tmpMd;
-    location_array_t *thread_array;
-    
-    if (tmpRec->data != NULL) {
-      tmpMd = (metaData_t *)tmpRec->data;
-      
-      /* Get this thread's location array for this address */
-      thread_array = get_thread_location_array(tmpMd, worker->thread_id);
-      if (thread_array == NULL) {
-        fprintf(stderr, "ERR - Unable to get thread location array\n");
-        return FALSE;
-      }
-      
-      /* Add location to THIS THREAD's array - no blocking! */
-      if (!add_location_atomic(thread_array, line_number, field_offset)) {
-        /* Array is full, grow it directly (no hash thread needed) */
-        size_t current_capacity = thread_array->capacity;
-        size_t new_capacity;
-        
-        if (current_capacity >= 1048576) {  /* 1M entries = 16MB */
-          new_capacity = current_capacity + (current_capacity / 4);  /* Grow by 25% */
-        } else {
-          new_capacity = current_capacity * 2;  /* Normal doubling */
-        }
-        
-        if (grow_location_array(thread_array, new_capacity)) {
-          /* Try again after growing */
-          if (!add_location_atomic(thread_array, line_number, field_offset)) {
-            fprintf(stderr, "ERR - Failed to add location after growing thread array\n");
-            return FALSE;
-          }
-        } else {
-          fprintf(stderr, "ERR - Failed to grow thread location array\n");
-          return FALSE;
-        }
-      }
-      
-      /* Update this thread's count */
-      tmpMd->thread_data[worker->thread_id].count++;
-      
-      /* Update total count atomically */
-      __atomic_fetch_add(&tmpMd->total_count, 1, __ATOMIC_RELAXED);
-    }
-  }
-  
-  /* For existing address updates, use larger batch sizes for better throughput */
-  if (worker->local_buffer_count >= worker->local_buffer_capacity) {
-    return flush_local_buffer(worker);
-  }
-  
-  return TRUE;
-}
-
-/****
- *
- * dedicated I/O thread (producer)
- *
- ****/
-
-void *io_thread(void *arg) {
-  thread_pool_t *pool = (thread_pool_t *)arg;
-  chunk_dispatcher_t *dispatcher = pool->dispatcher;
-  off_t current_offset = 0;
-  unsigned int current_line_number = 0;
-  unsigned int chunk_id = 0;
-  time_t current_time;
-  
-#ifdef DEBUG
-  if (config->debug >= 2)
-    fprintf(stderr, "DEBUG - I/O thread started\n");
-#endif
+#ifdef DEBUG
+  if (config->debug >= 2)
+    fprintf(stderr, "DEBUG - I/O thread started\n");
+#endif
   
   while (current_offset < dispatcher->file_size && !pool->shutdown && !quit) {
     chunk_t *chunk;
@@ -1107,14 +878,17 @@ void *io_thread(void *arg) {
     }
     
     /* Allocate buffer with space for carry-forward data */
-    buffer = (char *)XMALLOC(dispatcher->target_chunk_size + dispatcher->carry_forward_capacity + 1);
+    chunk->capacity = dispatcher->target_chunk_size + dispatcher->carry_forward_capacity + 1;
+    buffer = (char *)XMALLOC(chunk->capacity);
     if (buffer == NULL) {
       fprintf(stderr, "ERR - I/O thread: Unable to allocate buffer\n");
       XFREE(chunk);
       break;
     }
+    budget_add(BUDGET_CHUNKS, chunk->capacity);
     
     /* Add carry forward data first */
+    off_t buffer_offset = current_offset - dispatcher->carry_forward_size;
     size_t buffer_pos = 0;
     unsigned int carry_forward_lines = 0;
     if (dispatcher->carry_forward_size > 0) {
@@ -1163,11 +937,15 @@ void *io_thread(void *arg) {
       /* Process what we have */
     }
     
-    /* Count lines */
+    /* Count lines, noting where every LINEMAP_INTERVAL'th one starts */
     lines_in_chunk = 0;
     for (char *ptr = buffer; ptr < buffer + buffer_pos; ptr++) {
       if (*ptr == '\n') {
         lines_in_chunk++;
+        if (lines != NULL && linemap_line(lines, buffer_offset + (ptr - buffer) + 1) != TRUE) {
+          linemap_free(lines);
+          lines = pool->ctx->lines = NULL;
+        }
       }
     }
     
@@ -1190,6 +968,8 @@ void *io_thread(void *arg) {
     /* Check for signal-triggered reporting (matches serial mode) */
     if (reload == TRUE) {
       fprintf(stderr, "Processed %u lines/min\n", current_line_number);
+      if (config->memory_limit)
+        budget_report(stderr);
       current_line_number = 0;  /* Reset counter for next minute */
       reload = FALSE;
     }
@@ -1197,8 +977,7 @@ void *io_thread(void *arg) {
     /* Add chunk to queue for workers */
     if (!enqueue_chunk(pool->chunk_queue, chunk)) {
       /* Queue is shutting down */
-      if (chunk->buffer) XFREE(chunk->buffer);
-      XFREE(chunk);
+      free_chunk(chunk);
       break;
     }
     
@@ -1224,147 +1003,6 @@ void *io_thread(void *arg) {
   return NULL;
 }
 
-/****
- *
- * fill next chunk using worker's pre-allocated buffer (streaming)
- *
- ****/
-
-int fill_next_chunk(chunk_dispatcher_t *dispatcher, worker_data_t *worker) {
-  chunk_t *chunk = worker->chunk;
-  char *buffer = worker->chunk_buffer;
-  size_t available_space, bytes_to_read, bytes_read;
-  char *last_newline;
-  off_t read_start_offset;
-  unsigned int start_line_number, lines_in_chunk;
-  time_t current_time;
-  
-  if (dispatcher == NULL || worker == NULL) return FALSE;
-  
-  pthread_mutex_lock(&dispatcher->file_mutex);
-  
-  /* Check if we've reached end of file and no carry forward data */
-  if (dispatcher->current_offset >= dispatcher->file_size && 
-      dispatcher->carry_forward_size == 0) {
-    pthread_mutex_unlock(&dispatcher->file_mutex);
-    return FALSE;
-  }
-  
-  /* Progress reporting handled by I/O thread - don't duplicate here */
-  current_time = time(NULL);
-  
-  start_line_number = dispatcher->current_line_number;
-  read_start_offset = dispatcher->current_offset;
-  
-  /* Start with carry forward data if any */
-  size_t buffer_pos = 0;
-  if (dispatcher->carry_forward_size > 0) {
-    memcpy(buffer, dispatcher->carry_forward_buffer, dispatcher->carry_forward_size);
-    buffer_pos = dispatcher->carry_forward_size;
-    dispatcher->carry_forward_size = 0;
-  }
-  
-  /* Calculate available space for new data */
-  available_space = worker->max_chunk_size - buffer_pos;
-  
-  /* Don't read past end of file */
-  bytes_to_read = available_space;
-  if (dispatcher->current_offset + bytes_to_read > dispatcher->file_size) {
-    bytes_to_read = dispatcher->file_size - dispatcher->current_offset;
-  }
-  
-  /* Read new data if not at EOF */
-  if (bytes_to_read > 0 && dispatcher->current_offset < dispatcher->file_size) {
-    if (fseeko(dispatcher->file, dispatcher->current_offset, SEEK_SET) != 0) {
-      fprintf(stderr, "ERR - Unable to seek to offset %ld\n", dispatcher->current_offset);
-      pthread_mutex_unlock(&dispatcher->file_mutex);
-      return FALSE;
-    }
-    
-    bytes_read = fread(buffer + buffer_pos, 1, bytes_to_read, dispatcher->file);
-    if (bytes_read > 0) {
-      buffer_pos += bytes_read;
-      dispatcher->current_offset += bytes_read;
-    }
-  }
-  
-  /* Null terminate for safety */
-  buffer[buffer_pos] = '\0';
-  
-  /* Find the last complete line */
-  last_newline = strrchr(buffer, '\n');
-  
-  if (last_newline == NULL) {
-    /* No complete lines in buffer */
-    if (dispatcher->current_offset >= dispatcher->file_size) {
-      /* EOF reached, process incomplete line if any */
-      if (buffer_pos > 0) {
-        chunk->buffer_size = buffer_pos;
-      } else {
-        pthread_mutex_unlock(&dispatcher->file_mutex);
-        return FALSE;  /* Nothing to process */
-      }
-    } else {
-      /* No complete lines but more file data available - likely very long lines */
-      /* Process what we have as an incomplete line to avoid thread starvation */
-      if (buffer_pos > 0) {
-        chunk->buffer_size = buffer_pos;
-        /* Don't store as carry forward, just process the incomplete line */
-      } else {
-        pthread_mutex_unlock(&dispatcher->file_mutex);
-        return FALSE;
-      }
-    }
-  } else {
-    /* Found complete lines */
-    size_t complete_data_size = (last_newline - buffer) + 1;
-    chunk->buffer_size = complete_data_size;
-    
-    /* Store remainder as carry forward for next chunk */
-    size_t remainder_size = buffer_pos - complete_data_size;
-    if (remainder_size > 0 && remainder_size <= dispatcher->carry_forward_capacity) {
-      memcpy(dispatcher->carry_forward_buffer, buffer + complete_data_size, remainder_size);
-      dispatcher->carry_forward_size = remainder_size;
-    }
-    
-    /* Adjust current offset to account for carried forward data */
-    dispatcher->current_offset -= remainder_size;
-  }
-  
-  /* Count lines in this chunk */
-  lines_in_chunk = 0;
-  for (char *ptr = buffer; ptr < buffer + chunk->buffer_size; ptr++) {
-    if (*ptr == '\n') {
-      lines_in_chunk++;
-    }
-  }
-  
-  /* Fill chunk metadata */
-  chunk->chunk_id = dispatcher->chunks_dispatched++;
-  chunk->start_offset = read_start_offset;
-  chunk->end_offset = dispatcher->current_offset;
-  chunk->start_line_number = start_line_number;
-  chunk->buffer = buffer;
-  
-  /* Update dispatcher state */
-  dispatcher->current_line_number += lines_in_chunk;
-  
-  /* Ensure buffer is null terminated at actual data end */
-  buffer[chunk->buffer_size] = '\0';
-  
-  pthread_mutex_unlock(&dispatcher->file_mutex);
-  
-#ifdef DEBUG
-  if (config->debug >= 3) {
-    fprintf(stderr, "DEBUG - Filled chunk %d for worker %d: %ld-%ld (%zu bytes, %u lines)\n",
-            chunk->chunk_id, worker->thread_id, chunk->start_offset, chunk->end_offset, 
-            chunk->buffer_size, lines_in_chunk);
-  }
-#endif
-  
-  return TRUE;
-}
-
 /****
  *
  * process a chunk of data
@@ -1378,6 +1016,9 @@ int process_chunk(worker_data_t *worker) {
   char line_buf[65536];
   int ret;
   char oBuf[4096];
+  address_batch_t batch;
+  
+  batch.count = 0;
   
   /* Initialize parser for this thread */
   initParser();
@@ -1399,14 +1040,14 @@ int process_chunk(worker_data_t *worker) {
           getParsedField(oBuf, sizeof(oBuf), i);
           
           if ((oBuf[0] == 'i') || (oBuf[0] == 'I') || (oBuf[0] == 'm')) {
-            /* Send address to hash management thread */
             /* Strip parser prefix - hash functions should only use clean IP/MAC addresses */
             const char *clean_address = oBuf + 1;  /* Skip 'i', 'I', or 'm' prefix */
             
             /* Line number: chunk start + carry-forward lines + lines processed by this worker */
             unsigned int absolute_line = chunk->start_line_number + chunk->carry_forward_lines + worker->lines_processed;
-            if (buffer_address_local(worker, clean_address, absolute_line, i)) {
-              worker->addresses_found++;
+            if (!record_worker_address(worker, &batch, clean_address, absolute_line, i)) {
+              deInitParser();
+              return FAILED;
             }
           }
         }
@@ -1418,6 +1059,13 @@ int process_chunk(worker_data_t *worker) {
     line_start = line_end + 1;
   }
   
+  /* Cache hits grow postings without a flush, so check once more */
+  if ((batch.count > 0 && !flush_worker_batch(worker, &batch)) ||
+      !check_worker_budget(worker)) {
+    deInitParser();
+    return FAILED;
+  }
+  
 #ifdef DEBUG
   if (config->debug >= 2) {
     fprintf(stderr, "DEBUG - Thread %d: Processed %u lines, found %u unique addresses\n",
@@ -1425,9 +1073,6 @@ int process_chunk(worker_data_t *worker) {
   }
 #endif
   
-  /* Flush any remaining addresses in local buffer */
-  flush_local_buffer(worker);
-  
   /* Clean up thread-local parser resources */
   deInitParser();
   
@@ -1436,194 +1081,23 @@ int process_chunk(worker_data_t *worker) {
 
 /****
  *
- * dedicated hash management thread (consumer)
+ * stop the pool after a worker failed
+ *
+ * The queue is closed so the I/O thread stops reading and the other
+ * workers take no more chunks, whatever is queued is freed with it.
  *
  ****/
 
-void *hash_thread(void *arg) {
-  parallel_context_t *ctx = (parallel_context_t *)arg;
-  thread_pool_t *pool = ctx->pool;
-  struct hash_s *hash = ctx->global_hash;
-  hash_operation_entry_t *operation;
-  unsigned int addresses_processed = 0;
-  unsigned int new_addresses = 0;
-  unsigned int updated_addresses = 0;
-  time_t last_report_time = time(NULL);
-  
-  /* Only check hash growth every N inserts to reduce overhead */
-  unsigned int new_addresses_since_check = 0;
-  const unsigned int HASH_GROWTH_CHECK_INTERVAL = 4096;  /* Check every 4K new addresses */
-  
-#ifdef DEBUG
-  if (config->debug >= 2)
-    fprintf(stderr, "DEBUG - Hash management thread started\n");
-#endif
-  
-  while (!pool->shutdown && !quit) {
-    operation = dequeue_hash_operation(pool->address_queue);
-    
-    if (operation == NULL) {
-      /* Check if all parser threads are done */
-      if (pool->address_queue->active_producers == 0) {
-        break;
-      }
-      continue;
-    }
-    
-    /* Process hash operation based on type */
-    struct hashRec_s *tmpRec;
-    metaData_t *tmpMd;
-    struct Address_s *tmpAddr;
-    
-    if (operation->op_type == HASH_OP_NEW_ADDRESS) {
-      /* NEW ADDRESS: Worker determined this is new, but hash thread must always check for duplicates */
-      tmpRec = getHashRecord(hash, operation->address);
-      
-      if (tmpRec != NULL) {
-        /* RACE CONDITION DETECTED: Worker's hash lookup was stale */
-#ifdef DEBUG
-        if (config->debug >= 2) {
-          fprintf(stderr, "DEBUG - Worker %d requested new address [%s] but it already exists in hash (race condition)\n", 
-                  operation->worker_id, operation->address);
-        }
-#endif
-        
-        /* Treat as existing address update instead */
-        tmpMd = (metaData_t *)tmpRec->data;
-        
-        if (tmpMd != NULL) {
-          /* Get the requesting thread's location array */
-          location_array_t *thread_array = get_thread_location_array(tmpMd, operation->worker_id);
-          if (thread_array != NULL) {
-            /* Add location to the requesting thread's array */
-            if (!add_location_atomic(thread_array, operation->line_number, operation->field_offset)) {
-              /* Array full, grow it */
-              size_t current_capacity = thread_array->capacity;
-              size_t new_capacity;
-              
-              if (current_capacity >= 1048576) {
-                new_capacity = current_capacity + (current_capacity / 4);
-              } else {
-                new_capacity = current_capacity * 2;
-              }
-              
-              if (grow_location_array(thread_array, new_capacity)) {
-                if (!add_location_atomic(thread_array, operation->line_number, operation->field_offset)) {
-#ifdef DEBUG
-                  if (config->debug >= 1) {
-                    fprintf(stderr, "DEBUG - Failed to add location after growing in hash thread race condition\n");
-                  }
-#endif
-                }
-              }
-            }
-            
-            /* Update counts */
-            tmpMd->thread_data[operation->worker_id].count++;
-            tmpMd->total_count++;
-            updated_addresses++;
-          }
-        }
-        continue;  /* Skip the "new address" insertion */
-      }
-      
-      /* Truly new address - create per-thread metadata structure */
-      tmpMd = create_metadata(pool->num_workers);
-      if (tmpMd == NULL) {
-        fprintf(stderr, "ERR - Unable to create per-thread metadata in hash thread, aborting\n");
-        abort();
-      }
-      
-      /* Get the requesting thread's location array */
-      location_array_t *thread_array = get_thread_location_array(tmpMd, operation->worker_id);
-      if (thread_array == NULL) {
-        fprintf(stderr, "ERR - Unable to get thread location array in hash thread, aborting\n");
-        abort();
-      }
-      
-      /* Add first location to the requesting thread's array */
-      if (!add_location_atomic(thread_array, operation->line_number, operation->field_offset)) {
-        fprintf(stderr, "ERR - Failed to add first location in hash thread, aborting\n");
-        abort();
-      }
-      
-      /* Update counts */
-      tmpMd->thread_data[operation->worker_id].count = 1;
-      tmpMd->total_count = 1;
-      
-      /* Add to the hash */
-      addUniqueHashRec(hash, operation->address, strlen(operation->address) + 1, tmpMd);
-      new_addresses++;
-      new_addresses_since_check++;
-      
-      /* Only check hash growth periodically to reduce overhead */
-      if (new_addresses_since_check >= HASH_GROWTH_CHECK_INTERVAL) {
-        new_addresses_since_check = 0;
-        
-        /* Rebalance the hash if it gets too full */
-        if (((float)hash->totalRecords / (float)hash->size) > 0.8) {
-          if (hash->size >= MAX_HASH_SIZE) {
-            fprintf(stderr, "WARNING - Hash table at maximum size (%d), performance may degrade\n", MAX_HASH_SIZE);
-          } else if (hash->totalRecords >= MAX_HASH_ENTRIES) {
-            fprintf(stderr, "ERR - Maximum number of hash entries reached (%d), aborting\n", MAX_HASH_ENTRIES);
-            abort();
-          } else {
-            /* Growing hash with %d unique entries */
-#ifdef DEBUG
-            if (config->debug >= 2)
-              fprintf(stderr, "DEBUG - Growing hash table from %d to larger size (%d unique entries)\n", 
-                      hash->size, hash->totalRecords);
-#endif
-            
-            /* Acquire write lock for hash growth */
-            pthread_rwlock_wrlock(&ctx->hash_rwlock);
-            hash = dyGrowHash(hash);
-            ctx->global_hash = hash;  /* Update the context pointer */
-            pthread_rwlock_unlock(&ctx->hash_rwlock);
-          }
-        }
-      }
-      
-    } /* No HASH_OP_UPDATE_COUNT needed - workers handle their own arrays */
-    
-    addresses_processed++;
-    
-    /* Progress reporting every 60 seconds */
-    time_t current_time = time(NULL);
-    if (current_time - last_report_time >= 60) {
-#ifdef DEBUG
-      if (config->debug >= 2)
-        fprintf(stderr, "DEBUG - Hash thread: %u total (%u new, %u updates), %u unique entries\n", 
-                addresses_processed, new_addresses, updated_addresses, hash->totalRecords);
-#endif
-      last_report_time = current_time;
-    }
-  }
-  
-  /* Final hash size check in case we need one more grow */
-  if (((float)hash->totalRecords / (float)hash->size) > 0.8) {
-    if (hash->size < MAX_HASH_SIZE && hash->totalRecords < MAX_HASH_ENTRIES) {
-#ifdef DEBUG
-      if (config->debug >= 2)
-        fprintf(stderr, "DEBUG - Final hash table grow from %d to larger size (%d unique entries)\n", 
-                hash->size, hash->totalRecords);
-#endif
-      
-      /* Acquire write lock for final hash growth */
-      pthread_rwlock_wrlock(&ctx->hash_rwlock);
-      hash = dyGrowHash(hash);
-      ctx->global_hash = hash;
-      pthread_rwlock_unlock(&ctx->hash_rwlock);
-    }
-  }
-  
-#ifdef DEBUG
-  if (config->debug >= 2)
-    fprintf(stderr, "DEBUG - Hash management thread finished: %u total processed (%u new, %u updates), %u unique entries\n",
-            addresses_processed, new_addresses, updated_addresses, hash->totalRecords);
-#endif
-  
-  return NULL;
+static void fail_pool(thread_pool_t *pool) {
+  pthread_mutex_lock(&pool->pool_mutex);
+  pool->failed = 1;
+  pthread_mutex_unlock(&pool->pool_mutex);
+
+  pthread_mutex_lock(&pool->chunk_queue->queue_mutex);
+  pool->chunk_queue->finished = 1;
+  pthread_cond_broadcast(&pool->chunk_queue->not_empty);
+  pthread_cond_broadcast(&pool->chunk_queue->not_full);
+  pthread_mutex_unlock(&pool->chunk_queue->queue_mutex);
 }
 
 /****
@@ -1652,51 +1126,53 @@ void *worker_thread(void *arg) {
       break;
     }
     
-    /* Copy chunk data to worker's pre-allocated buffer */
-    if (chunk->buffer_size <= worker->max_chunk_size) {
-      memcpy(worker->chunk_buffer, chunk->buffer, chunk->buffer_size);
-      worker->chunk_buffer[chunk->buffer_size] = '\0';
-      
-      /* Update worker's chunk metadata to point to local buffer */
-      worker->chunk->chunk_id = chunk->chunk_id;
-      worker->chunk->start_offset = chunk->start_offset;
-      worker->chunk->end_offset = chunk->end_offset;
-      worker->chunk->buffer_size = chunk->buffer_size;
-      worker->chunk->start_line_number = chunk->start_line_number;
-      worker->chunk->carry_forward_lines = chunk->carry_forward_lines;
-      worker->chunk->buffer = worker->chunk_buffer;
-      
-      /* Free the original chunk buffer (we copied the data) */
-      XFREE(chunk->buffer);
-      XFREE(chunk);
-      
-      /* Mark as active worker */
-      pthread_mutex_lock(&pool->pool_mutex);
-      worker->status = 1;  /* working */
-      pool->active_workers++;
-      pthread_mutex_unlock(&pool->pool_mutex);
-      
-      /* Process the chunk */
-      if (process_chunk(worker) == FAILED) {
-        worker->status = -1;  /* error */
-      } else {
-        worker->status = 2;  /* done */
-        chunks_processed++;
-      }
-      
-      /* Mark completion */
-      pthread_mutex_lock(&pool->pool_mutex);
-      pool->active_workers--;
-      pthread_cond_signal(&pool->work_done);
+    /* Another worker failed, the index will not be written */
+    pthread_mutex_lock(&pool->pool_mutex);
+    if (pool->failed) {
       pthread_mutex_unlock(&pool->pool_mutex);
-      
+      free_chunk(chunk);
+      break;
+    }
+    pthread_mutex_unlock(&pool->pool_mutex);
+    
+    /* Scan the I/O thread's buffer in place, it is already NUL terminated */
+    worker->chunk->chunk_id = chunk->chunk_id;
+    worker->chunk->start_offset = chunk->start_offset;
+    worker->chunk->end_offset = chunk->end_offset;
+    worker->chunk->buffer_size = chunk->buffer_size;
+    worker->chunk->start_line_number = chunk->start_line_number;
+    worker->chunk->carry_forward_lines = chunk->carry_forward_lines;
+    worker->chunk->buffer = chunk->buffer;
+    
+    /* Mark as active worker */
+    pthread_mutex_lock(&pool->pool_mutex);
+    worker->status = 1;  /* working */
+    pool->active_workers++;
+    pthread_mutex_unlock(&pool->pool_mutex);
+    
+    /* Process the chunk, a failure part way through loses the rest of it */
+    if (process_chunk(worker) == FAILED) {
+      fprintf(stderr, "ERR - Worker %d was unable to index chunk %d\n", worker->thread_id,
+              worker->chunk->chunk_id);
+      worker->status = -1;  /* error */
+      fail_pool(pool);
     } else {
-      /* Chunk too large - skip it */
-      fprintf(stderr, "WARN - Worker %d: Chunk %d too large (%zu bytes), skipping\n",
-              worker->thread_id, chunk->chunk_id, chunk->buffer_size);
-      XFREE(chunk->buffer);
-      XFREE(chunk);
+      worker->status = 2;  /* done */
+      chunks_processed++;
     }
+    
+    /* The buffer goes back to the budget before the next chunk is taken */
+    worker->chunk->buffer = NULL;
+    free_chunk(chunk);
+    
+    /* Mark completion */
+    pthread_mutex_lock(&pool->pool_mutex);
+    pool->active_workers--;
+    pthread_cond_signal(&pool->work_done);
+    pthread_mutex_unlock(&pool->pool_mutex);
+    
+    if (worker->status == -1)
+      break;
   }
   
 #ifdef DEBUG
@@ -1706,109 +1182,163 @@ void *worker_thread(void *arg) {
   }
 #endif
   
-  /* Decrement active producers count for address queue */
-  pthread_mutex_lock(&pool->address_queue->queue_mutex);
-  pool->address_queue->active_producers--;
-  /* Wake up hash thread if we were the last producer */
-  if (pool->address_queue->active_producers == 0) {
-    pthread_cond_signal(&pool->address_queue->not_empty);
-  }
-  pthread_mutex_unlock(&pool->address_queue->queue_mutex);
-  
   return NULL;
 }
 
 
 /****
  *
- * merge local hash table into global
+ * merge one partition of a worker's private table into global
+ *
+ * Only records whose hash falls in this partition are touched, so one
+ * merge thread per partition can walk every worker table at once.  The
+ * worker's location list is moved, not copied, into the worker's slot
+ * of the merged metadata.  Each worker takes chunks in file order, so
+ * every slot is already in line order for the output k-way merge.
  *
  ****/
 
-int merge_hash_tables(struct hash_s *global, struct hash_s *local) {
-  uint32_t i, thread_id;
-  struct hashRec_s *localRec, *globalRec, *nextLocalRec;
+int merge_hash_tables(struct hash_s **global, struct hash_s *local, int worker_id, int num_workers, int partition, int partitions) {
+  size_t cursor = 0;
+  struct hashRec_s *localRec, *globalRec;
   metaData_t *localMd, *globalMd;
-  location_array_t *local_array, *global_array;
+  posting_list_t *list;
   
-  if (global == NULL || local == NULL) {
+  if (global == NULL || *global == NULL || local == NULL ||
+      worker_id < 0 || worker_id >= num_workers) {
     return FAILED;
   }
   
-  /* Iterate through all buckets in local hash */
-  for (i = 0; i < local->size; i++) {
-    localRec = local->buckets[i];
+  while ((localRec = nextHashRecord(local, &cursor)) != NULL) {
+    if (localRec->data == NULL || (localRec->hashValue % (uint64_t)partitions) != (uint64_t)partition)
+      continue;
     
-    while (localRec != NULL) {
-      nextLocalRec = localRec->next;  /* Save next before we potentially modify the chain */
-      
-      if (localRec->data != NULL) {
-        localMd = (metaData_t *)localRec->data;
-        
-        /* Check if this address exists in global hash */
-        globalRec = getHashRecord(global, localRec->keyString);
-        
-        if (globalRec == NULL) {
-          /* New address - transfer entire per-thread metadata to global hash */
-          globalMd = localMd;  /* Transfer ownership */
-          localRec->data = NULL;  /* Clear local ownership */
-          
-          /* Add to global hash */
-          addUniqueHashRec(global, localRec->keyString, localRec->keyLen, globalMd);
-        } else {
-          /* Address exists in global - merge per-thread data */
-          if (globalRec->data != NULL) {
-            globalMd = (metaData_t *)globalRec->data;
-            
-            /* Update total count */
-            globalMd->total_count += localMd->total_count;
-            
-            /* Merge per-thread data: find threads that have data in local */
-            for (thread_id = 0; thread_id < localMd->max_threads; thread_id++) {
-              if (localMd->thread_data[thread_id].locations != NULL) {
-                /* This thread has data in local hash, merge into global */
-                
-                /* Ensure global has enough thread slots */
-                if (thread_id >= globalMd->max_threads) {
-                  /* Global needs to expand thread capacity - for now skip this case */
-                  free_location_array(localMd->thread_data[thread_id].locations);
-                  continue;
-                }
-                
-                local_array = localMd->thread_data[thread_id].locations;
-                global_array = globalMd->thread_data[thread_id].locations;
-                
-                if (global_array == NULL) {
-                  /* Global thread has no data yet - transfer local thread's array */
-                  globalMd->thread_data[thread_id].locations = local_array;
-                  globalMd->thread_data[thread_id].count += localMd->thread_data[thread_id].count;
-                  localMd->thread_data[thread_id].locations = NULL;  /* Clear local ownership */
-                } else {
-                  /* Both have data - for now, just keep the larger array */
-                  if (local_array->count > global_array->count) {
-                    free_location_array(global_array);
-                    globalMd->thread_data[thread_id].locations = local_array;
-                    globalMd->thread_data[thread_id].count = localMd->thread_data[thread_id].count;
-                    localMd->thread_data[thread_id].locations = NULL;  /* Clear local ownership */
-                  } else {
-                    free_location_array(local_array);
-                  }
-                }
-              }
-            }
-            
-            /* Free local metadata structure (thread arrays were transferred or freed) */
-            free_metadata(localMd);
-            localRec->data = NULL;  /* Clear pointer to prevent double free */
-          }
-        }
+    localMd = (metaData_t *)localRec->data;
+    
+    if ((globalRec = getHashRecord(*global, localRec->keyString)) == NULL) {
+      if ((globalMd = create_metadata((*global)->arena)) == NULL) {
+        fprintf(stderr, "ERR - Unable to create merged metadata, aborting\n");
+        abort();
       }
-      
-      localRec = nextLocalRec;
+      addUniqueHashRec(*global, localRec->keyString, localRec->keyLen, globalMd);
+    } else {
+      globalMd = (metaData_t *)globalRec->data;
     }
     
-    /* Clear the bucket to prevent hash cleanup from trying to free transferred data */
-    local->buckets[i] = NULL;
+    /* Transfer the worker's postings into its own slot, the blocks stay in the worker's slab */
+    if ((list = get_slot_postings(globalMd, worker_id, (*global)->arena)) == NULL) {
+      fprintf(stderr, "ERR - Unable to create merged postings, aborting\n");
+      abort();
+    }
+    posting_list_take(list, &localMd->lists);
+    globalMd->total_count += localMd->total_count;
+    localRec->data = NULL;
+  }
+  
+  return TRUE;
+}
+
+/****
+ *
+ * merge thread, builds one partition of the final table
+ *
+ ****/
+
+void *merge_thread(void *arg) {
+  merge_data_t *merge = (merge_data_t *)arg;
+  thread_pool_t *pool = merge->ctx->pool;
+  struct hash_s *global;
+  size_t estimate = 0;
+  int i;
+  
+  /* Size for the worst case (no overlap between workers) so we never grow */
+  for (i = 0; i < pool->num_workers; i++)
+    estimate += pool->workers[i].local_hash->totalRecords;
+  estimate = estimate / merge->ctx->merge_partitions + 1;
+  estimate += estimate / 7;  /* Tables hold at most 7/8 of their slots */
+  
+  if ((global = initHash(estimate)) == NULL) {
+    fprintf(stderr, "ERR - Unable to allocate merge table, aborting\n");
+    abort();
+  }
+  global->memLimit = merge->ctx->table_budget / merge->ctx->merge_partitions;
+  
+  for (i = 0; i < pool->num_workers; i++) {
+    merge_hash_tables(&global, pool->workers[i].local_hash, i, pool->num_workers,
+                      merge->partition, merge->ctx->merge_partitions);
+  }
+  
+  merge->ctx->merged[merge->partition] = global;
+  
+#ifdef DEBUG
+  if (config->debug >= 2)
+    fprintf(stderr, "DEBUG - Merge partition %d: %zu unique addresses\n",
+            merge->partition, global->totalRecords);
+#endif
+  
+  return NULL;
+}
+
+/****
+ *
+ * merge all private worker tables using one thread per partition
+ *
+ ****/
+
+int merge_private_tables(parallel_context_t *ctx) {
+  thread_pool_t *pool = ctx->pool;
+  merge_data_t *merges;
+  int i;
+  
+  ctx->merge_partitions = pool->num_workers;
+  
+  /* Merge threads walk the worker tables' buckets directly */
+  for (i = 0; i < pool->num_workers; i++)
+    finishHashMigration(pool->workers[i].local_hash);
+  ctx->merged = (struct hash_s **)XMALLOC(sizeof(struct hash_s *) * ctx->merge_partitions);
+  merges = (merge_data_t *)XMALLOC(sizeof(merge_data_t) * ctx->merge_partitions);
+  
+  for (i = 0; i < ctx->merge_partitions; i++) {
+    merges[i].ctx = ctx;
+    merges[i].partition = i;
+    if (pthread_create(&merges[i].thread, NULL, merge_thread, &merges[i]) != 0) {
+      /* Fall back to merging this partition inline */
+      merges[i].thread = 0;
+      merge_thread(&merges[i]);
+    }
+  }
+  
+  for (i = 0; i < ctx->merge_partitions; i++) {
+    if (merges[i].thread)
+      pthread_join(merges[i].thread, NULL);
+  }
+  XFREE(merges);
+  
+  /* Private tables now only hold keys, every list was moved */
+  for (i = 0; i < pool->num_workers; i++) {
+    freeHash(pool->workers[i].local_hash);
+    pool->workers[i].local_hash = NULL;
+    budget_publish(BUDGET_TABLES, &pool->workers[i].tables_reported, 0);
+  }
+  
+  return TRUE;
+}
+
+/****
+ *
+ * walk every address the parallel pass found
+ *
+ ****/
+
+int traverse_parallel_results(parallel_context_t *ctx, int (*fn)(const struct hashRec_s *hashRec)) {
+  int i;
+  
+  if (ctx->merged == NULL)
+    return traverseConcurrentHash(ctx->addr_hash, fn);
+  
+  for (i = 0; i < ctx->merge_partitions; i++) {
+    if (traverseHash(ctx->merged[i], fn) != TRUE)
+      return FAILED;
   }
   
   return TRUE;
@@ -1834,24 +1364,6 @@ int process_file_parallel(parallel_context_t *ctx) {
   }
   ctx->pool->io_thread_created = 1;
   
-  /* Start hash management thread */
-#ifdef DEBUG
-  if (config->debug >= 2)
-    fprintf(stderr, "DEBUG - Starting hash management thread...\n");
-#endif
-  if (pthread_create(&ctx->pool->hash_thread, NULL, hash_thread, ctx) != 0) {
-    fprintf(stderr, "ERR - Failed to create hash management thread\n");
-    result = FAILED;
-  } else {
-    ctx->pool->hash_thread_created = 1;
-  }
-  
-  
-  /* Set active producers count for address queue */
-  if (result == TRUE) {
-    ctx->pool->address_queue->active_producers = ctx->pool->num_workers;
-  }
-  
   /* Start worker threads - they will consume chunks from queue */
 #ifdef DEBUG
   if (config->debug >= 2)
@@ -1881,18 +1393,11 @@ int process_file_parallel(parallel_context_t *ctx) {
       pthread_cond_broadcast(&ctx->pool->chunk_queue->not_empty);
       pthread_mutex_unlock(&ctx->pool->chunk_queue->queue_mutex);
     }
-    if (ctx->pool->address_queue) {
-      pthread_mutex_lock(&ctx->pool->address_queue->queue_mutex);
-      ctx->pool->address_queue->finished = 1;
-      ctx->pool->address_queue->active_producers = 0;
-      pthread_cond_broadcast(&ctx->pool->address_queue->not_empty);
-      pthread_mutex_unlock(&ctx->pool->address_queue->queue_mutex);
-    }
     pthread_mutex_unlock(&ctx->pool->pool_mutex);
   } else {
 #ifdef DEBUG
     if (config->debug >= 2)
-      fprintf(stderr, "DEBUG - Processing file with producer-consumer pattern (1 I/O + %d workers + 1 hash)...\n", 
+      fprintf(stderr, "DEBUG - Processing file with producer-consumer pattern (1 I/O + %d workers)...\n", 
               ctx->pool->num_workers);
 #endif
   }
@@ -1934,18 +1439,50 @@ int process_file_parallel(parallel_context_t *ctx) {
     }
   }
   
+  /* A chunk a worker could not finish leaves the tables short */
+  for (int i = 0; i < ctx->pool->num_workers; i++) {
+    if (ctx->pool->workers[i].status == -1)
+      result = FAILED;
+  }
+  if (result == FAILED)
+    return FAILED;
+  
+  if (config->private_tables) {
 #ifdef DEBUG
-  if (config->debug >= 2)
-    fprintf(stderr, "DEBUG - All worker threads finished. Waiting for hash thread to complete...\n");
+    if (config->debug >= 2)
+      fprintf(stderr, "DEBUG - All worker threads finished, merging %d private tables\n",
+              ctx->pool->num_workers);
 #endif
-  
-  /* Wait for hash thread to finish processing all addresses */
-  if (ctx->pool->hash_thread_created) {
-    pthread_join(ctx->pool->hash_thread, NULL);
-    ctx->pool->hash_thread_created = 0;
-    ctx->pool->hash_thread = 0; /* Clear handle */
+    size_t keys = 0;
+    
+    for (int i = 0; i < ctx->pool->num_workers; i++) {
+      if (ctx->pool->workers[i].local_hash != NULL)
+        keys += ctx->pool->workers[i].local_hash->totalRecords;
+    }
+    if (spill_has_runs(ctx->spill) || !output_fits(keys)) {
+      /* Once anything spilled every table ends up in a run, merged on output once they are let go */
+      for (int i = 0; i < ctx->pool->num_workers; i++) {
+        worker_data_t *worker = &ctx->pool->workers[i];
+        
+        if (worker->local_hash != NULL && spill_write_run(ctx->spill, worker->local_hash) != TRUE)
+          result = FAILED;
+        freeHash(worker->local_hash);
+        worker->local_hash = NULL;
+        mempool_destroy(worker->arena);
+        worker->arena = NULL;
+        budget_publish(BUDGET_TABLES, &worker->tables_reported, 0);
+        budget_publish(BUDGET_POSTINGS, &worker->postings_reported, 0);
+      }
+      budget_trim();
+    } else {
+      merge_private_tables(ctx);
+    }
   }
-  
+#ifdef DEBUG
+  else if (config->debug >= 2)
+    fprintf(stderr, "DEBUG - All worker threads finished, %zu unique addresses\n",
+            ctx->addr_hash->totalRecords);
+#endif
   
 #ifdef DEBUG
   if (config->debug >= 2)
@@ -74,8 +74,6 @@ extern Config_t *config;
 
 void initParser(void)
 {
-  int i;
-  
   /* Skip if already initialized for this thread */
   if (fields_initialized) {
     return;
@@ -84,17 +82,14 @@ void initParser(void)
   /* make sure the field list of clean */
   XMEMSET(fields, 0, sizeof(char *) * MAX_FIELD_POS);
 
-  /* Pre-allocate all field memory for better performance */
-  for (i = 0; i < MAX_FIELD_POS; i++) {
-    fields[i] = (char *)XMALLOC(MAX_FIELD_LEN);
-    if (fields[i] == NULL) {
-      fprintf(stderr, "ERR - Unable to allocate parser field memory\n");
-      /* Clean up already allocated fields */
-      while (--i >= 0) {
-        XFREE(fields[i]);
-      }
-      return;
-    }
+  /*
+   * Only the template is allocated up front, fields are allocated the
+   * first time a line has that many and kept for the thread's next
+   * line.  Allocating all of them cost 16MB per thread.
+   */
+  if ((fields[0] = (char *)XMALLOC(MAX_FIELD_LEN)) == NULL) {
+    fprintf(stderr, "ERR - Unable to allocate parser field memory\n");
+    return;
   }
   
   fields_initialized = 1;
@@ -184,6 +179,10 @@ int parseLine(char *line)
     }
     
     /* Store in field format */
+    if (fields[i + 1] == NULL && (fields[i + 1] = (char *)XMALLOC(MAX_FIELD_LEN)) == NULL) {
+      fprintf(stderr, "ERR - Unable to allocate parser field memory\n");
+      return i + 1;
+    }
     fields[i + 1][0] = type_char;
     strcpy(fields[i + 1] + 1, addr->str);
     
@@ -244,7 +243,7 @@ int parseLine(char *line)
   
   curChar = line[0];
 
-  /* Field memory is now pre-allocated in initParser() */
+  /* The template is allocated in initParser() */
   if (fields[fieldPos] EQ NULL)
   {
     fprintf(stderr, "ERR - Parser not properly initialized\n");
@@ -269,10 +268,11 @@ int parseLine(char *line)
     else if (curFieldType EQ FIELD_TYPE_EXTRACT)
     {
 
-      /* Field memory is pre-allocated, just verify it exists */
-      if (fields[fieldPos] EQ NULL)
+      /* Field memory is allocated on first use */
+      if (fields[fieldPos] EQ NULL &&
+          (fields[fieldPos] = (char *)XMALLOC(MAX_FIELD_LEN)) EQ NULL)
       {
-        fprintf(stderr, "ERR - Parser field not initialized\n");
+        fprintf(stderr, "ERR - Unable to allocate parser field memory\n");
         return (fieldPos - 1);
       }
       /* Ensure we don't overflow the field buffer */
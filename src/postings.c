@@ -0,0 +1,227 @@
+/*****
+ *
+ * Description: Compressed Posting List Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "postings.h"
+#include "mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Map signed deltas to small unsigned values */
+static inline uint64_t zigzag_encode(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/* LEB128 style varint, seven bits per byte */
+static inline uint8_t *put_varint(uint8_t *p, uint64_t value) {
+  while (value >= 0x80) {
+    *p++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *p++ = (uint8_t)value;
+  return p;
+}
+
+static inline const uint8_t *get_varint(const uint8_t *p, uint64_t *value) {
+  uint64_t result = 0;
+  int shift = 0;
+
+  while (*p & 0x80) {
+    result |= (uint64_t)(*p++ & 0x7F) << shift;
+    shift += 7;
+  }
+  *value = result | ((uint64_t)*p++ << shift);
+  return p;
+}
+
+/* Order decoded entries by line, then field */
+static int compare_entries(const void *a, const void *b) {
+  const location_entry_t *loc_a = (const location_entry_t *)a;
+  const location_entry_t *loc_b = (const location_entry_t *)b;
+
+  if (loc_a->line < loc_b->line) return -1;
+  if (loc_a->line > loc_b->line) return 1;
+  if (loc_a->offset < loc_b->offset) return -1;
+  if (loc_a->offset > loc_b->offset) return 1;
+  return 0;
+}
+
+/* Decode the entry under the cursor in storage order */
+static void decode_entry(posting_cursor_t *cursor) {
+  const uint8_t *p;
+  uint64_t value;
+
+  if (cursor->pos >= cursor->block->used) {
+    cursor->block = cursor->block->next;
+    cursor->pos = 0;
+  }
+
+  p = cursor->block->data + cursor->pos;
+  p = get_varint(p, &value);
+  cursor->line += (size_t)zigzag_decode(value);
+  p = get_varint(p, &value);
+  cursor->offset = (uint16_t)value;
+  cursor->pos = (uint32_t)(p - cursor->block->data);
+  cursor->remaining--;
+}
+
+/* Initialize an empty posting list owned by slot */
+void posting_list_init(posting_list_t *list, int slot) {
+  list->next = NULL;
+  list->head = list->tail = NULL;
+  list->count = 0;
+  list->last_line = 0;
+  list->last_offset = 0;
+  list->sorted = TRUE;
+  list->slot = slot;
+}
+
+/* Move the entries of src into an empty dst, keeping dst's link and owner */
+void posting_list_take(posting_list_t *dst, posting_list_t *src) {
+  dst->head = src->head;
+  dst->tail = src->tail;
+  dst->count = src->count;
+  dst->last_line = src->last_line;
+  dst->last_offset = src->last_offset;
+  dst->sorted = src->sorted;
+
+  src->head = src->tail = NULL;
+  src->count = 0;
+}
+
+/*
+ * Append one location, starting a new block when the tail is full.
+ * Blocks start small so an address seen once stays cheap, each new
+ * block doubles up to POSTING_BLOCK_SIZE.
+ */
+int posting_append(posting_list_t *list, mempool_t *slab, size_t line, uint16_t offset) {
+  posting_block_t *block = list->tail;
+  uint8_t *p;
+
+  if (block == NULL || block->used + POSTING_MAX_ENTRY > block->size) {
+    size_t bytes = POSTING_FIRST_BLOCK;
+
+    if (block != NULL) {
+      bytes = (sizeof(posting_block_t) + block->size) * 2;
+      if (bytes > POSTING_BLOCK_SIZE)
+        bytes = POSTING_BLOCK_SIZE;
+    }
+    block = (posting_block_t *)mempool_alloc_fast(slab, bytes);
+    if (UNLIKELY(!block)) {
+      fprintf(stderr, "ERR - Unable to allocate posting block\n");
+      return FALSE;
+    }
+    block->next = NULL;
+    block->used = 0;
+    block->size = (uint16_t)(bytes - sizeof(posting_block_t));
+    if (list->tail != NULL)
+      list->tail->next = block;
+    else
+      list->head = block;
+    list->tail = block;
+  }
+
+  if (list->count > 0 &&
+      (line < list->last_line || (line == list->last_line && offset < list->last_offset)))
+    list->sorted = FALSE;
+
+  p = block->data + block->used;
+  p = put_varint(p, zigzag_encode((int64_t)(line - list->last_line)));
+  p = put_varint(p, offset);
+  block->used = (uint16_t)(p - block->data);
+
+  list->last_line = line;
+  list->last_offset = offset;
+  list->count++;
+
+  return TRUE;
+}
+
+/* Bytes held by a posting list */
+size_t posting_list_bytes(const posting_list_t *list) {
+  const posting_block_t *block;
+  size_t bytes;
+
+  if (list == NULL) return 0;
+
+  bytes = sizeof(posting_list_t);
+  for (block = list->head; block != NULL; block = block->next)
+    bytes += sizeof(posting_block_t) + block->size;
+  return bytes;
+}
+
+/*
+ * Position a cursor on the first entry.  Lists appended in order are
+ * decoded as they are read, anything else is decoded once and sorted.
+ */
+int posting_cursor_init(posting_cursor_t *cursor, const posting_list_t *list) {
+  size_t i;
+
+  cursor->block = list->head;
+  cursor->pos = 0;
+  cursor->remaining = list->count;
+  cursor->line = 0;
+  cursor->offset = 0;
+  cursor->entries = NULL;
+  cursor->index = 0;
+
+  if (list->sorted || list->count == 0)
+    return TRUE;
+
+  cursor->entries = (location_entry_t *)XMALLOC(sizeof(location_entry_t) * list->count);
+  if (UNLIKELY(!cursor->entries)) {
+    fprintf(stderr, "ERR - Unable to allocate %zu posting entries for sorting\n", list->count);
+    return FALSE;
+  }
+  for (i = 0; i < list->count; i++) {
+    decode_entry(cursor);
+    cursor->entries[i].line = cursor->line;
+    cursor->entries[i].offset = cursor->offset;
+  }
+  qsort(cursor->entries, list->count, sizeof(location_entry_t), compare_entries);
+  cursor->remaining = list->count;
+
+  return TRUE;
+}
+
+/* Fetch the next location in (line, offset) order, FALSE when done */
+int posting_cursor_next(posting_cursor_t *cursor, size_t *line, uint16_t *offset) {
+  if (cursor->remaining == 0)
+    return FALSE;
+
+  if (cursor->entries != NULL) {
+    *line = cursor->entries[cursor->index].line;
+    *offset = cursor->entries[cursor->index].offset;
+    cursor->index++;
+    cursor->remaining--;
+    return TRUE;
+  }
+
+  decode_entry(cursor);
+  *line = cursor->line;
+  *offset = cursor->offset;
+  return TRUE;
+}
+
+/* Release anything the cursor decoded */
+void posting_cursor_free(posting_cursor_t *cursor) {
+  if (cursor->entries != NULL) {
+    XFREE(cursor->entries);
+    cursor->entries = NULL;
+  }
+}
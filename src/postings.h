@@ -0,0 +1,88 @@
+/*****
+ *
+ * Description: Compressed Posting List Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef POSTINGS_H
+#define POSTINGS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/common.h"
+#include "mempool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Posting list configuration */
+#define POSTING_FIRST_BLOCK 32        /* Bytes in a list's first block, header included */
+#define POSTING_BLOCK_SIZE 256        /* Blocks double up to this size */
+#define POSTING_MAX_ENTRY 13          /* 64-bit varint line delta + 16-bit varint offset */
+
+/* One decoded location */
+typedef struct {
+  size_t line;          /* Line number (8 bytes on 64-bit) */
+  uint16_t offset;      /* Field position (2 bytes, supports up to 65535 fields) */
+} location_entry_t;
+
+/* Slab-allocated block of varint encoded entries, an entry never spans blocks */
+typedef struct posting_block_s {
+  struct posting_block_s *next;
+  uint16_t used;
+  uint16_t size;                /* Usable bytes in data */
+  uint8_t data[];
+} posting_block_t;
+
+/*
+ * Locations of one address seen by one writer.  Each entry is the
+ * zigzag varint line delta from the previous entry followed by the
+ * varint field offset, so in-order lines cost two or three bytes.
+ * Lists and blocks come from the writer's slab and are released with
+ * it, there is no per-list lock because only the owner appends.
+ */
+typedef struct posting_list_s {
+  struct posting_list_s *next;  /* Next writer's list for the same address */
+  posting_block_t *head;
+  posting_block_t *tail;
+  size_t count;
+  size_t last_line;
+  uint16_t last_offset;
+  uint8_t sorted;               /* Entries were appended in (line, offset) order */
+  int slot;                     /* Owning writer, -1 until claimed */
+} posting_list_t;
+
+/* Ordered reader over a posting list */
+typedef struct posting_cursor_s {
+  const posting_block_t *block;
+  uint32_t pos;
+  size_t remaining;
+  size_t line;
+  uint16_t offset;
+  location_entry_t *entries;    /* Decoded and sorted copy of an unsorted list */
+  size_t index;
+} posting_cursor_t;
+
+/* Function prototypes */
+void posting_list_init(posting_list_t *list, int slot);
+void posting_list_take(posting_list_t *dst, posting_list_t *src);
+int posting_append(posting_list_t *list, mempool_t *slab, size_t line, uint16_t offset);
+size_t posting_list_bytes(const posting_list_t *list);
+int posting_cursor_init(posting_cursor_t *cursor, const posting_list_t *list);
+int posting_cursor_next(posting_cursor_t *cursor, size_t *line, uint16_t *offset);
+void posting_cursor_free(posting_cursor_t *cursor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* POSTINGS_H */
@@ -71,7 +71,7 @@ extern int reload;
 int searchFile(const char *fName)
 {
   FILE *inFile = NULL, *outFile = NULL;
-  gzFile gzInFile;
+  gzFile gzInFile = NULL;
   char inBuf[65536];  /* Increased buffer size for better I/O performance */
   char indexFileName[PATH_MAX];
   PRIVATE int c = 0, i;
@@ -81,7 +81,12 @@ int searchFile(const char *fName)
   struct Address_s *tmpAddr;
   struct Fields_s **curFieldPtr;
   size_t offMatchPos = 0;
-  size_t curMatchLine = 1;
+  size_t curMatchLine = 1, seekLine;
+  linemap_t *lines = NULL;
+  gzcheck_t *gzPoints = NULL;
+  gzreader_t *gzReader = NULL;
+  size_t seekPoint;
+  off_t seekOffset;
   int done = FALSE, isGz = FALSE;
   char *foundPtr;
   char indexBaseFileName[PATH_MAX];
@@ -121,8 +126,16 @@ int searchFile(const char *fName)
   /* XXX switch to multiple compression types */
   if (isGz)
   {
+    /* Gzip checkpoints let the read resume inflating near each match */
+    if ((gzPoints = gzcheck_load(indexFileName, fName)) != NULL &&
+        (gzReader = gzreader_open(fName, NULL)) EQ NULL)
+    {
+      gzcheck_free(gzPoints);
+      gzPoints = NULL;
+    }
+
     /* gzip compressed */
-    if ((gzInFile = gzopen(fName, "rb")) EQ NULL)
+    if (gzReader EQ NULL && (gzInFile = gzopen(fName, "rb")) EQ NULL)
     {
       fprintf(stderr, "ERR - Unable to open file [%s] %d (%s)\n", fName, errno,
               strerror(errno));
@@ -142,12 +155,54 @@ int searchFile(const char *fName)
               strerror(errno));
       return (EXIT_FAILURE);
     }
+
+    /* Line checkpoints let the read skip ahead to each match */
+    lines = linemap_load(indexFileName, fName);
   }
 
   do
   {
+    /* Seek to the checkpoint before the next match when it is far enough ahead */
+    if (lines != NULL && config->match_offsets[offMatchPos] >= curMatchLine + lines->interval &&
+        linemap_seek(lines, config->match_offsets[offMatchPos], &seekLine, &seekOffset) &&
+        seekLine > curMatchLine)
+    {
+#ifdef DEBUG
+      if (config->debug >= 2)
+        fprintf(stderr, "DEBUG - Seeking to line %zu at %lld\n", seekLine, (long long)seekOffset);
+#endif
+      if (fseeko(inFile, seekOffset, SEEK_SET) != 0)
+      {
+        fprintf(stderr, "ERR - Unable to seek in [%s]\n", fName);
+        linemap_free(lines);
+        fclose(inFile);
+        return (EXIT_FAILURE);
+      }
+      curMatchLine = seekLine;
+    }
+    if (gzPoints != NULL && gzcheck_find(gzPoints, config->match_offsets[offMatchPos], &seekPoint) &&
+        gzPoints->points[seekPoint].line > curMatchLine)
+    {
+#ifdef DEBUG
+      if (config->debug >= 2)
+        fprintf(stderr, "DEBUG - Inflating from line %llu at %llu\n",
+                (unsigned long long)gzPoints->points[seekPoint].line,
+                (unsigned long long)gzPoints->points[seekPoint].in);
+#endif
+      if (gzreader_seek(gzReader, gzPoints, seekPoint) != TRUE)
+      {
+        fprintf(stderr, "ERR - Unable to seek in [%s]\n", fName);
+        gzreader_close(gzReader);
+        gzcheck_free(gzPoints);
+        return (EXIT_FAILURE);
+      }
+      curMatchLine = gzPoints->points[seekPoint].line;
+    }
+
     /* XXX switch to multiple compression types */
-    if (isGz)
+    if (gzReader != NULL)
+      retPtr = gzreader_gets(gzReader, inBuf, sizeof(inBuf));
+    else if (isGz)
       retPtr = gzgets(gzInFile, inBuf, sizeof(inBuf));
     else
       retPtr = fgets(inBuf, sizeof(inBuf), inFile);
@@ -184,10 +239,16 @@ int searchFile(const char *fName)
   } while ((retPtr != NULL) && !done);
 
   /* XXX switch to multiple compression types */
-  if (isGz)
+  if (gzReader != NULL)
+  {
+    gzreader_close(gzReader);
+    gzcheck_free(gzPoints);
+  }
+  else if (isGz)
     gzclose(gzInFile);
   else
     fclose(inFile);
+  linemap_free(lines);
 
   if ( config->out_filename != NULL )
     fclose( outFile );
@@ -202,6 +263,107 @@ int searchFile(const char *fName)
   return (EXIT_SUCCESS);
 }
 
+/****
+ *
+ * can an index hold a term, TRUE when it has no filter
+ *
+ ****/
+
+static int termInFilter(const filter_t *filter, const struct searchTerm_s *searchPtr)
+{
+  if (filter EQ NULL)
+    return (TRUE);
+  return filter_contains(filter, filter_hash(searchPtr->term, searchPtr->len));
+}
+
+/****
+ *
+ * search the files an address catalog lists for the terms
+ *
+ * Each term is one lookup in the catalog, and only the files it names
+ * are searched.  In quick mode the counts come from the catalog and no
+ * index is read.
+ *
+ ****/
+
+int searchCatalog(const char *fName)
+{
+  catalog_t *catalog;
+  lpi2_cursor_t cursor;
+  const lpi2_key_t *key;
+  const char *text;
+  char text_buf[LPI2_TEXT_BUF];
+  struct searchTerm_s *searchPtr;
+  uint64_t first, found, k, file, count;
+  size_t *hits, i, files = 0;
+
+  if ((catalog = catalog_open(fName)) EQ NULL)
+    return (EXIT_FAILURE);
+  if (catalog->file_count EQ 0)
+  {
+    catalog_close(catalog);
+    return (EXIT_FAILURE);
+  }
+  if ((hits = XMALLOC(sizeof(size_t) * catalog->file_count)) EQ NULL)
+  {
+    fprintf(stderr, "ERR - Unable to allocate memory for catalog matches\n");
+    exit(EXIT_FAILURE);
+  }
+  XMEMSET(hits, 0, sizeof(size_t) * catalog->file_count);
+
+  for (searchPtr = config->searchHead; searchPtr != NULL; searchPtr = searchPtr->next)
+  {
+    found = lpi2_find(catalog->index, searchPtr->term, &first);
+    for (k = first; k < first + found; k++)
+    {
+      key = &catalog->index->keys[k];
+      if ((text = lpi2_key_text(catalog->index, key, text_buf)) EQ NULL ||
+          lpi2_cursor_init(catalog->index, key, &cursor) != TRUE)
+      {
+        fprintf(stderr, "ERR - Catalog is corrupt [%s]\n", fName);
+        exit(EXIT_FAILURE);
+      }
+      while (lpi2_cursor_next(&cursor, &file, &count) EQ TRUE)
+      {
+        if (file EQ 0 || file > catalog->file_count)
+        {
+          fprintf(stderr, "ERR - Catalog is corrupt [%s]\n", fName);
+          exit(EXIT_FAILURE);
+        }
+        fprintf(stderr, "MATCH [%.*s] in [%s] with %llu lines\n", (int)key->text_len, text,
+                catalog->files[file - 1], (unsigned long long)count);
+        if (hits[file - 1]++ EQ 0)
+          files++;
+      }
+    }
+  }
+
+#ifdef DEBUG
+  if (config->debug >= 1)
+    fprintf(stderr, "DEBUG - Catalog lists %zu of %zu files\n", files, catalog->file_count);
+#endif
+
+  for (i = 0; i < catalog->file_count && !config->quick; i++)
+  {
+    if (hits[i] EQ 0)
+      continue;
+    if (!is_path_safe(catalog->files[i]))
+    {
+      display(LOG_ERR, "Unsafe file path rejected: %s", catalog->files[i]);
+      continue;
+    }
+    searchFile(catalog->files[i]);
+  }
+
+  XFREE(hits);
+  catalog_close(catalog);
+
+  if (files)
+    return (EXIT_SUCCESS);
+  else
+    return (EXIT_FAILURE);
+}
+
 /****
  *
  * load index file associated with input file
@@ -210,6 +372,42 @@ int searchFile(const char *fName)
 
 int loadIndexFile(const char *fName)
 {
+  keydir_t *kd;
+  filter_t *filter;
+  struct searchTerm_s *termPtr;
+
+  /* Binary indexes are searched in place whatever their size */
+  if (lpi2_is_index(fName))
+    return loadIndexFile_binary(fName);
+
+  /* Skip a text index whose filter rules out every term */
+  if ((filter = filter_load(fName)) != NULL)
+  {
+    termPtr = config->searchHead;
+    while (termPtr != NULL && !termInFilter(filter, termPtr))
+      termPtr = termPtr->next;
+    filter_free(filter);
+    if (termPtr EQ NULL)
+    {
+#ifdef DEBUG
+      if (config->debug >= 1)
+        fprintf(stderr, "DEBUG - Filter rules out [%s]\n", fName);
+#endif
+      return (EXIT_FAILURE);
+    }
+  }
+
+  /* Address ordered text indexes are searched through their key directory */
+  if ((kd = keydir_load(fName)) != NULL)
+    return loadIndexFile_keydir(fName, kd);
+
+  /* Compressed blocks can only be found through theirs */
+  if (zblock_is_compressed(fName))
+  {
+    fprintf(stderr, "WARN - Compressed index [%s] has no key directory, reindex with -z -w\n", fName);
+    return (EXIT_FAILURE);
+  }
+
   /* Check if file is too large for regular processing, use streaming instead */
   struct stat file_stat;
   if (stat(fName, &file_stat) == 0 && file_stat.st_size > 10 * 1024 * 1024) {
@@ -514,6 +712,348 @@ int loadIndexFile(const char *fName)
     return (EXIT_FAILURE);
 }
 
+/****
+ *
+ * load index matches from a binary index
+ *
+ * The index is mapped and each term found with two binary searches
+ * over its sorted keys, so a lookup only faults in the pages it lands
+ * on and the postings of the keys that match.  A term its filter rules
+ * out costs one block of the filter.
+ *
+ ****/
+
+typedef struct indexMatch_s {
+  size_t line;
+  size_t field;
+} indexMatch_t;
+
+static int compareMatches(const void *a, const void *b)
+{
+  const indexMatch_t *match_a = (const indexMatch_t *)a;
+  const indexMatch_t *match_b = (const indexMatch_t *)b;
+
+  if (match_a->line != match_b->line)
+    return (match_a->line > match_b->line) ? 1 : -1;
+  return (match_a->field > match_b->field) - (match_a->field < match_b->field);
+}
+
+/* Put the matches of several keys in (line, field) order */
+static void sortIndexMatches(void)
+{
+  indexMatch_t *matches;
+  size_t a;
+
+  if (config->match_count < 2)
+    return;
+
+  if ((matches = XMALLOC(config->match_count * sizeof(indexMatch_t))) EQ NULL)
+  {
+    fprintf(stderr, "ERR - Unable to allocate memory for index matches\n");
+    exit(EXIT_FAILURE);
+  }
+  for (a = 0; a < config->match_count; a++)
+  {
+    matches[a].line = config->match_offsets[a];
+    matches[a].field = config->field_offsets[a];
+  }
+  qsort(matches, config->match_count, sizeof(indexMatch_t), compareMatches);
+  for (a = 0; a < config->match_count; a++)
+  {
+    config->match_offsets[a] = matches[a].line;
+    config->field_offsets[a] = matches[a].field;
+  }
+  XFREE(matches);
+}
+
+/****
+ *
+ * report a key of a binary index from its summary
+ *
+ * Keys too short for a summary entry have their postings read.
+ *
+ ****/
+
+static void reportBinaryKey(const lpi2_index_t *index, const lpi2_key_t *key, const char *text)
+{
+  uint64_t first, last;
+
+  if (lpi2_key_lines(index, key, &first, &last) != TRUE)
+  {
+    fprintf(stderr, "ERR - Index is corrupt [%.*s]\n", (int)key->text_len, text);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(stderr, "MATCH [%.*s] with %llu lines, first line %llu, last line %llu\n", (int)key->text_len, text,
+          (unsigned long long)key->count, (unsigned long long)first, (unsigned long long)last);
+}
+
+int loadIndexFile_binary(const char *fName)
+{
+  lpi2_index_t *index;
+  lpi2_cursor_t cursor;
+  const lpi2_section_t *section;
+  filter_t filter, *filterPtr = NULL;
+  const lpi2_key_t *key;
+  const char *text;
+  char text_buf[LPI2_TEXT_BUF];
+  struct searchTerm_s *searchPtr;
+  uint64_t first, found, k, line, field;
+  size_t a, count, keys = 0;
+
+#ifdef DEBUG
+  if (config->debug >= 1)
+    fprintf(stderr, "Opening binary index [%s]\n", fName);
+#endif
+
+  if ((index = lpi2_open(fName)) EQ NULL)
+    return (EXIT_FAILURE);
+  if ((section = lpi2_find_section(index, LPI2_SECTION_FILTER)) != NULL &&
+      filter_view(&filter, index->map + section->offset, section->length))
+    filterPtr = &filter;
+
+  for (searchPtr = config->searchHead; searchPtr != NULL; searchPtr = searchPtr->next)
+  {
+    /* A term the filter rules out needs no key search */
+    if (!termInFilter(filterPtr, searchPtr))
+      continue;
+    found = lpi2_find(index, searchPtr->term, &first);
+
+#ifdef DEBUG
+    if (config->debug >= 2)
+      fprintf(stderr, "DEBUG - [%s] matched %llu keys\n", searchPtr->term, (unsigned long long)found);
+#endif
+
+    for (k = first; k < first + found; k++)
+    {
+      key = &index->keys[k];
+      if ((text = lpi2_key_text(index, key, text_buf)) EQ NULL ||
+          lpi2_cursor_init(index, key, &cursor) != TRUE)
+      {
+        fprintf(stderr, "ERR - Index is corrupt [%s]\n", fName);
+        exit(EXIT_FAILURE);
+      }
+      count = (size_t)key->count;
+
+      /* Quick mode reports the key without reading its postings */
+      if (config->quick)
+      {
+        reportBinaryKey(index, key, text);
+        keys++;
+        continue;
+      }
+
+      if ((config->match_offsets = XREALLOC(config->match_offsets,
+                                            (config->match_count + count + 1) * sizeof(size_t))) EQ NULL ||
+          (config->field_offsets = XREALLOC(config->field_offsets,
+                                            (config->match_count + count + 1) * sizeof(size_t))) EQ NULL)
+      {
+        fprintf(stderr, "ERR - Unable to allocate memory for index matches\n");
+        exit(EXIT_FAILURE);
+      }
+      fprintf(stderr, "MATCH [%.*s] with %zu lines\n", (int)key->text_len, text, count);
+
+      for (a = config->match_count; a < config->match_count + count; a++)
+      {
+        if (lpi2_cursor_next(&cursor, &line, &field) != TRUE)
+        {
+          fprintf(stderr, "ERR - Index is corrupt [%.*s]\n", (int)key->text_len, text);
+          exit(EXIT_FAILURE);
+        }
+        config->match_offsets[a] = (size_t)line;
+        config->field_offsets[a] = (size_t)field;
+      }
+      config->match_count += count;
+      keys++;
+    }
+  }
+
+  lpi2_close(index);
+
+  /* Each key is in line order, several have to be merged */
+  if (keys > 1)
+    sortIndexMatches();
+
+  if (keys)
+    return (EXIT_SUCCESS);
+  else
+    return (EXIT_FAILURE);
+}
+
+/****
+ *
+ * load index matches through a key directory
+ *
+ * The .lpx sidecar of an address ordered text index lists a key every
+ * block or so.  A binary search over it gives the one block that can
+ * hold a term, which is read until the term is found or passed.
+ *
+ ****/
+
+static int readIndexNumber(FILE *inFile, size_t *value)
+{
+  size_t result = 0;
+  int c;
+
+  while ((c = getc(inFile)) >= '0' && c <= '9')
+    result = result * 10 + (c - '0');
+  *value = result;
+  return c;
+}
+
+/****
+ *
+ * inflate the compressed block at [start,end) and open it for reading
+ *
+ ****/
+
+static FILE *openIndexBlock(const char *fName, FILE *inFile, off_t start, off_t end,
+                            char **block, off_t *block_len)
+{
+  char *packed;
+  size_t len;
+  FILE *fp = NULL;
+
+  if ((packed = (char *)XMALLOC(end - start)) EQ NULL)
+  {
+    fprintf(stderr, "ERR - Unable to allocate memory for index block\n");
+    exit(EXIT_FAILURE);
+  }
+  if (fread(packed, 1, end - start, inFile) EQ (size_t)(end - start) &&
+      (*block = zblock_inflate(packed, end - start, &len)) != NULL &&
+      (fp = fmemopen(*block, len, "r")) EQ NULL)
+    XFREE(*block);
+  XFREE(packed);
+
+  if (fp EQ NULL)
+  {
+    fprintf(stderr, "ERR - Index is corrupt [%s]\n", fName);
+    exit(EXIT_FAILURE);
+  }
+  *block_len = (off_t)len;
+  return fp;
+}
+
+int loadIndexFile_keydir(const char *fName, keydir_t *kd)
+{
+  FILE *inFile = NULL, *in, *blockFile = NULL;
+  char key[LPI2_MAX_TEXT + 1];
+  char *block = NULL;
+  struct searchTerm_s *searchPtr;
+  off_t start, end;
+  size_t a, count, len, keys = 0;
+  int c, cmp;
+
+#ifdef DEBUG
+  if (config->debug >= 1)
+    fprintf(stderr, "Opening [%s] with %zu directory keys\n", fName, kd->count);
+#endif
+
+#ifdef HAVE_FOPEN64
+  if ((inFile = fopen64(fName, "r")) EQ NULL)
+#else
+  if ((inFile = fopen(fName, "r")) EQ NULL)
+#endif
+  {
+    fprintf(stderr, "ERR - Unable to open file [%s] %d (%s)\n", fName, errno,
+            strerror(errno));
+    keydir_free(kd);
+    return (EXIT_FAILURE);
+  }
+  setvbuf(inFile, NULL, _IOFBF, KEYDIR_BLOCK_SIZE);
+
+  for (searchPtr = config->searchHead; searchPtr != NULL; searchPtr = searchPtr->next)
+  {
+    if (!keydir_find(kd, searchPtr->term, &start, &end))
+      continue;
+    if (fseeko(inFile, start, SEEK_SET) != 0)
+    {
+      fprintf(stderr, "ERR - Unable to seek in [%s]\n", fName);
+      exit(EXIT_FAILURE);
+    }
+
+#ifdef DEBUG
+    if (config->debug >= 2)
+      fprintf(stderr, "DEBUG - [%s] in block %lld-%lld\n", searchPtr->term, (long long)start, (long long)end);
+#endif
+
+    /* A compressed block is read whole from its inflated copy */
+    in = inFile;
+    if (kd->compressed)
+    {
+      in = blockFile = openIndexBlock(fName, inFile, start, end, &block, &end);
+      start = 0;
+    }
+
+    while (start < end)
+    {
+      len = 0;
+      while ((c = getc(in)) != EOF && c != ',' && c != '\n' && len < sizeof(key) - 1)
+        key[len++] = (char)c;
+      key[len] = '\0';
+      if (c != ',')
+      {
+        fprintf(stderr, "ERR - Index is corrupt [%s]\n", fName);
+        exit(EXIT_FAILURE);
+      }
+
+      /* Records are in address order, stop once past the term */
+      if ((cmp = strcmp(key, searchPtr->term)) > 0)
+        break;
+
+      if (cmp EQ 0)
+      {
+        c = readIndexNumber(in, &count);
+        if ((config->match_offsets = XREALLOC(config->match_offsets,
+                                              (config->match_count + count + 1) * sizeof(size_t))) EQ NULL ||
+            (config->field_offsets = XREALLOC(config->field_offsets,
+                                              (config->match_count + count + 1) * sizeof(size_t))) EQ NULL)
+        {
+          fprintf(stderr, "ERR - Unable to allocate memory for index matches\n");
+          exit(EXIT_FAILURE);
+        }
+        fprintf(stderr, "MATCH [%s] with %zu lines\n", key, count);
+
+        for (a = config->match_count; a < config->match_count + count; a++)
+        {
+          if (c != ',' || readIndexNumber(in, &config->match_offsets[a]) != ':')
+          {
+            fprintf(stderr, "ERR - Index is corrupt [%s]\n", key);
+            exit(EXIT_FAILURE);
+          }
+          c = readIndexNumber(in, &config->field_offsets[a]);
+        }
+        config->match_count += count;
+        keys++;
+        break;
+      }
+
+      /* Skip the rest of this record */
+      while ((c = getc(in)) != EOF && c != '\n')
+        ;
+      start = ftello(in);
+    }
+
+    if (blockFile != NULL)
+    {
+      fclose(blockFile);
+      XFREE(block);
+      blockFile = NULL;
+    }
+  }
+
+  fclose(inFile);
+  keydir_free(kd);
+
+  if (keys > 1)
+    sortIndexMatches();
+
+  if (keys)
+    return (EXIT_SUCCESS);
+  else
+    return (EXIT_FAILURE);
+}
+
 /****
  *
  * bubble sort the offset array
@@ -53,6 +53,13 @@
 #include "mem.h"
 #include "parser.h"
 #include "util.h"
+#include "lpi2.h"
+#include "keydir.h"
+#include "filter.h"
+#include "catalog.h"
+#include "zblock.h"
+#include "linemap.h"
+#include "gzcheck.h"
 #include "../include/common.h"
 
 /****
@@ -90,7 +97,10 @@ int searchFile(const char *fName);
 int searchFile_stream(const char *fName);  /* Streaming version for large files */
 int loadIndexFile(const char *fName);
 int loadIndexFile_stream(const char *fName);  /* Streaming version for large index files */
+int loadIndexFile_binary(const char *fName);  /* Mapped binary index */
+int loadIndexFile_keydir(const char *fName, keydir_t *kd);  /* Address ordered text index */
 int loadSearchFile(const char *fName);
+int searchCatalog(const char *fName);  /* Search the files a catalog lists */
 void quickSort(size_t *number, size_t first, size_t last);
 void bubbleSort(size_t list[], size_t n);
 int showAddresses(void);
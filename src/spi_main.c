@@ -61,6 +61,7 @@ extern char **environ;
 
 extern int searchFile(const char *fName);
 extern int loadSearchFile(const char *fName);
+extern int searchCatalog(const char *fName);
 
 /****
  *
@@ -109,10 +110,11 @@ int main(int argc, char *argv[])
                                            {"help", no_argument, 0, 'h'},
                                            {"write", required_argument, 0, 'w'},
                                            {"quick", no_argument, 0, 'q'},
+                                           {"catalog", required_argument, 0, 'c'},
                                            {0, no_argument, 0, 0}};
-    c = getopt_long(argc, argv, "vd:f:w:hq", long_options, &option_index);
+    c = getopt_long(argc, argv, "vd:f:w:hqc:", long_options, &option_index);
 #else
-    c = getopt(argc, argv, "vd:f:w:hq");
+    c = getopt(argc, argv, "vd:f:w:hqc:");
 #endif
 
     if (c EQ - 1)
@@ -178,6 +180,21 @@ int main(int argc, char *argv[])
       XSTRNCPY(config->out_filename, optarg, PATH_MAX);
       break;
 
+    case 'c':
+      /* look the terms up in an address catalog */
+      if (!optarg || strlen(optarg) == 0) {
+        fprintf(stderr, "ERR - Catalog filename required\n");
+        return (EXIT_FAILURE);
+      }
+      if (!is_path_safe(optarg)) {
+        fprintf(stderr, "ERR - Unsafe catalog path [%s]\n", optarg);
+        return (EXIT_FAILURE);
+      }
+      if (config->catalog_filename != NULL)
+        XFREE(config->catalog_filename);
+      config->catalog_filename = XSTRDUP(optarg);
+      break;
+
     case 'h':
       /* show help info */
       print_help();
@@ -272,6 +289,10 @@ int main(int argc, char *argv[])
   }
   fprintf(stderr, "\n");
 
+  /* the catalog names the files worth searching */
+  if (config->catalog_filename != NULL)
+    searchCatalog(config->catalog_filename);
+
   /* process all the files */
   while (optind < argc)
   {
@@ -336,8 +357,11 @@ PRIVATE void print_help(void)
   fprintf(
       stderr,
       "syntax: spi [options] searchterm[,searchterm] filename [filename ...]\n");
+  fprintf(stderr,
+          "        spi [options] -c catalog searchterm[,searchterm] [filename ...]\n");
 
 #ifdef HAVE_GETOPT_LONG
+  fprintf(stderr, " -c|--catalog {fname}   search the files an address catalog lists for the terms\n");
   fprintf(stderr, " -d|--debug (0-9)       enable debugging info\n");
   fprintf(stderr,
           " -f|--file {fname}      use search terms stored in a file\n");
@@ -350,6 +374,7 @@ PRIVATE void print_help(void)
   fprintf(stderr, " filename               one or more files to process, use "
                   "'-' to read from stdin\n");
 #else
+  fprintf(stderr, " -c {fname}    search the files an address catalog lists for the terms\n");
   fprintf(stderr, " -d {lvl}      enable debugging info\n");
   fprintf(stderr, " -f {fname}    use search terms stored in a file\n");
   fprintf(stderr, " -h            this info\n");
@@ -386,6 +411,8 @@ PRIVATE void cleanup(void)
 
   if (config->outFile_st != NULL)
     fclose(config->outFile_st);
+  if (config->catalog_filename != NULL)
+    XFREE(config->catalog_filename);
   XFREE(config->hostname);
 #ifdef MEM_DEBUG
   XFREE_ALL();
@@ -0,0 +1,1160 @@
+/*****
+ *
+ * Description: Spill-to-Disk Index Run Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "spill.h"
+#include "logpi.h"
+#include "mem.h"
+#include "budget.h"
+#include "writer.h"
+#include "lpi2_build.h"
+#include "keydir.h"
+#include "zblock.h"
+#include "filter.h"
+#include "merge.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern Config_t *config;
+
+#define SPILL_ORDER_RECORDS 1048576   /* Merged records sorted in memory at once, 24MB */
+#define SPILL_ORDER_MIN 16384         /* Fewest, however small the budget */
+
+/* One run being read back, positioned on a record and an entry */
+typedef struct run_reader_s {
+  FILE *fp;
+  merge_source_t *source;       /* An index being merged instead of a run, fp is unused */
+  char key[ADDRESS_BATCH_KEY_LEN];
+  size_t count;
+  size_t left;
+  size_t line;
+  uint16_t offset;
+  int has_key;
+  int has_entry;
+  int error;
+} run_reader_t;
+
+/* Where merged records go, another run, the final .lpi text or a binary index */
+typedef struct merge_sink_s {
+  FILE *fp;
+  int text;
+  size_t last_line;
+  lpi2_builder_t *index;        /* Binary output, fp is unused */
+  out_buffer_t postings;        /* The current address, binary output */
+} merge_sink_t;
+
+/* A record of the merged text awaiting the (count, address) output order */
+typedef struct merged_record_s {
+  uint64_t count;
+  uint64_t offset;              /* The merged text is in address order, so is this */
+  uint64_t length;
+} merged_record_t;
+
+/* An order run being read back */
+typedef struct order_reader_s {
+  FILE *fp;
+  merged_record_t record;
+} order_reader_t;
+
+/*
+ * Merged records put in output order a bounded chunk at a time.  A
+ * full chunk is sorted and written out as an order run, the runs are
+ * merged as they are read back.  Records that fit in one chunk never
+ * leave memory.
+ */
+typedef struct record_order_s {
+  spill_set_t *runs;
+  merged_record_t *records;
+  size_t count;
+  size_t capacity;
+  size_t next;                  /* Reading back a chunk that stayed in memory */
+  uint64_t total;
+  order_reader_t *readers;
+  order_reader_t **heap;
+  int num_readers;
+  int num_heap;
+} record_order_t;
+
+/****
+ *
+ * varint helpers
+ *
+ ****/
+
+static int put_varint_file(FILE *fp, uint64_t value) {
+  uint8_t buf[10];
+  int len = 0;
+
+  while (value >= 0x80) {
+    buf[len++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  buf[len++] = (uint8_t)value;
+  return fwrite(buf, 1, len, fp) == (size_t)len;
+}
+
+static int get_varint_file(FILE *fp, uint64_t *value) {
+  uint64_t result = 0;
+  int shift = 0;
+  int c;
+
+  while ((c = getc(fp)) != EOF && shift < 64) {
+    result |= (uint64_t)(c & 0x7F) << shift;
+    if (!(c & 0x80)) {
+      *value = result;
+      return TRUE;
+    }
+    shift += 7;
+  }
+  return FALSE;
+}
+
+/****
+ *
+ * temporary files
+ *
+ ****/
+
+FILE *spill_open_temp(spill_set_t *set, const char *tag, char *path, size_t path_len) {
+  FILE *fp;
+  int fd;
+
+  if (snprintf(path, path_len, "%s/logpi-%s-XXXXXX", set->dir, tag) >= (int)path_len) {
+    fprintf(stderr, "ERR - Temporary directory path too long [%s]\n", set->dir);
+    return NULL;
+  }
+  if ((fd = mkstemp(path)) < 0) {
+    fprintf(stderr, "ERR - Unable to create temporary file [%s] %d (%s)\n", path, errno,
+            strerror(errno));
+    return NULL;
+  }
+  if ((fp = fdopen(fd, "w+b")) == NULL) {
+    fprintf(stderr, "ERR - Unable to open temporary file [%s] %d (%s)\n", path, errno,
+            strerror(errno));
+    close(fd);
+    unlink(path);
+    return NULL;
+  }
+  setvbuf(fp, NULL, _IOFBF, SPILL_IO_BUFFER);
+
+  return fp;
+}
+
+/* Remove the first count runs, once merged into another */
+void spill_drop_runs(spill_set_t *set, int count) {
+  int i;
+
+  for (i = 0; i < count; i++) {
+    unlink(set->paths[i]);
+    XFREE(set->paths[i]);
+  }
+  memmove(set->paths, set->paths + count, sizeof(char *) * (set->count - count));
+  set->count -= count;
+}
+
+/* Keep a finished run, workers add theirs concurrently */
+int spill_add_run(spill_set_t *set, const char *path) {
+  char *copy;
+
+  if ((copy = XSTRDUP(path)) == NULL)
+    return FALSE;
+
+  pthread_mutex_lock(&set->lock);
+  if (set->count == set->capacity) {
+    int capacity = (set->capacity == 0) ? 16 : set->capacity * 2;
+    char **paths = (char **)XREALLOC(set->paths, sizeof(char *) * capacity);
+    if (paths == NULL) {
+      pthread_mutex_unlock(&set->lock);
+      XFREE(copy);
+      return FALSE;
+    }
+    set->paths = paths;
+    set->capacity = capacity;
+  }
+  set->paths[set->count++] = copy;
+  pthread_mutex_unlock(&set->lock);
+
+  return TRUE;
+}
+
+/****
+ *
+ * create a run set, runs go to dir, $TMPDIR or /tmp
+ *
+ ****/
+
+spill_set_t *spill_create(const char *dir) {
+  spill_set_t *set;
+
+  if (dir == NULL || dir[0] == '\0') {
+    dir = getenv("TMPDIR");
+    if (dir == NULL || dir[0] == '\0')
+      dir = SPILL_DEFAULT_DIR;
+  }
+
+  if ((set = (spill_set_t *)XMALLOC(sizeof(spill_set_t))) == NULL) {
+    fprintf(stderr, "ERR - Unable to allocate spill set\n");
+    return NULL;
+  }
+  XMEMSET(set, 0, sizeof(spill_set_t));
+
+  if (snprintf(set->dir, sizeof(set->dir), "%s", dir) >= (int)sizeof(set->dir)) {
+    fprintf(stderr, "ERR - Temporary directory path too long [%s]\n", dir);
+    XFREE(set);
+    return NULL;
+  }
+  pthread_mutex_init(&set->lock, NULL);
+
+  return set;
+}
+
+/****
+ *
+ * remove every run and free the set
+ *
+ ****/
+
+void spill_destroy(spill_set_t *set) {
+  int i;
+
+  if (set == NULL)
+    return;
+
+  for (i = 0; i < set->count; i++) {
+    unlink(set->paths[i]);
+    XFREE(set->paths[i]);
+  }
+  if (set->paths != NULL)
+    XFREE(set->paths);
+  pthread_mutex_destroy(&set->lock);
+  XFREE(set);
+}
+
+int spill_has_runs(spill_set_t *set) {
+  return set != NULL && set->count > 0;
+}
+
+/****
+ *
+ * write a table out as one sorted run
+ *
+ * The table and its postings are left alone, the caller frees them.
+ *
+ ****/
+
+static int compare_records(const void *a, const void *b) {
+  return strcmp((*(const struct hashRec_s **)a)->keyString,
+                (*(const struct hashRec_s **)b)->keyString);
+}
+
+static int write_run_location(void *arg, size_t line, uint16_t offset) {
+  merge_sink_t *sink = (merge_sink_t *)arg;
+
+  if (!put_varint_file(sink->fp, line - sink->last_line) || !put_varint_file(sink->fp, offset))
+    return FALSE;
+  sink->last_line = line;
+  return TRUE;
+}
+
+int spill_write_run(spill_set_t *set, struct hash_s *hash) {
+  struct hashRec_s **records;
+  struct hashRec_s *rec;
+  merge_sink_t sink;
+  char path[PATH_MAX];
+  size_t cursor = 0, count = 0, i;
+  off_t runBytes;
+  int ok = TRUE;
+
+  finishHashMigration(hash);
+  if (hash->totalRecords == 0)
+    return TRUE;
+
+  if ((records = (struct hashRec_s **)XMALLOC(sizeof(struct hashRec_s *) * hash->totalRecords)) == NULL) {
+    fprintf(stderr, "ERR - Unable to allocate spill run index\n");
+    return FAILED;
+  }
+  while ((rec = nextHashRecord(hash, &cursor)) != NULL && count < hash->totalRecords) {
+    if (rec->data != NULL)
+      records[count++] = rec;
+  }
+  qsort(records, count, sizeof(struct hashRec_s *), compare_records);
+
+  if ((sink.fp = spill_open_temp(set, "run", path, sizeof(path))) == NULL) {
+    XFREE(records);
+    return FAILED;
+  }
+  sink.text = FALSE;
+
+  for (i = 0; i < count && ok; i++) {
+    metaData_t *tmpMd = (metaData_t *)records[i]->data;
+    posting_list_t *list;
+    size_t total = 0;
+
+    for (list = &tmpMd->lists; list != NULL; list = list->next)
+      total += list->count;
+
+    sink.last_line = 0;
+    ok = fwrite(records[i]->keyString, 1, records[i]->keyLen, sink.fp) == (size_t)records[i]->keyLen &&
+         put_varint_file(sink.fp, total) &&
+         visit_sorted_locations(tmpMd, write_run_location, &sink);
+  }
+  XFREE(records);
+
+  runBytes = ftello(sink.fp);
+  if (fclose(sink.fp) != 0)
+    ok = FALSE;
+  if (!ok) {
+    fprintf(stderr, "ERR - Unable to write spill run [%s] %d (%s)\n", path, errno, strerror(errno));
+    unlink(path);
+    return FAILED;
+  }
+
+#ifdef DEBUG
+  if (config->debug >= 2)
+    fprintf(stderr, "DEBUG - Spilled %zu addresses to [%s]\n", count, path);
+#endif
+
+  if (!spill_add_run(set, path)) {
+    unlink(path);
+    return FAILED;
+  }
+  if (runBytes > 0)
+    budget_add(BUDGET_SPILLED, runBytes);
+  return TRUE;
+}
+
+/****
+ *
+ * run readers
+ *
+ ****/
+
+static int next_entry(run_reader_t *reader) {
+  uint64_t delta, offset;
+
+  if (reader->left == 0)
+    return reader->has_entry = FALSE;
+
+  if (reader->source != NULL) {
+    if (merge_source_entry(reader->source, &delta, &offset) != TRUE) {
+      reader->error = TRUE;
+      reader->left = 0;
+      return reader->has_entry = FALSE;
+    }
+    reader->line = delta;
+  } else if (!get_varint_file(reader->fp, &delta) || !get_varint_file(reader->fp, &offset)) {
+    reader->error = TRUE;
+    reader->left = 0;
+    return reader->has_entry = FALSE;
+  } else
+    reader->line += delta;
+  reader->offset = (uint16_t)offset;
+  reader->left--;
+  return reader->has_entry = TRUE;
+}
+
+static int next_record(run_reader_t *reader) {
+  uint64_t count;
+  size_t len = 0;
+  int c;
+
+  reader->has_key = reader->has_entry = FALSE;
+
+  if (reader->source != NULL) {
+    if ((c = merge_source_record(reader->source, reader->key, sizeof(reader->key), &count)) != TRUE) {
+      if (c != FALSE)
+        reader->error = TRUE;
+      return FALSE;
+    }
+    reader->count = reader->left = (size_t)count;
+    reader->line = 0;
+    reader->has_key = TRUE;
+    next_entry(reader);
+    return TRUE;
+  }
+
+  while ((c = getc(reader->fp)) != EOF && c != '\0') {
+    if (len == sizeof(reader->key) - 1) {
+      reader->error = TRUE;
+      return FALSE;
+    }
+    reader->key[len++] = (char)c;
+  }
+  if (c == EOF) {
+    if (len > 0 || ferror(reader->fp))
+      reader->error = TRUE;
+    return FALSE;
+  }
+  reader->key[len] = '\0';
+
+  if (!get_varint_file(reader->fp, &count)) {
+    reader->error = TRUE;
+    return FALSE;
+  }
+  reader->count = reader->left = (size_t)count;
+  reader->line = 0;
+  reader->has_key = TRUE;
+  next_entry(reader);
+
+  return TRUE;
+}
+
+/****
+ *
+ * reader heaps
+ *
+ * Binary min-heaps of reader pointers, one ordered by key for picking
+ * the next address and one ordered by (line, field) for merging that
+ * address's locations.  Each step costs log k instead of a scan over
+ * every open run.
+ *
+ ****/
+
+static ALWAYS_INLINE int key_before(const run_reader_t *a, const run_reader_t *b) {
+  return strcmp(a->key, b->key) < 0;
+}
+
+static ALWAYS_INLINE int entry_before(const run_reader_t *a, const run_reader_t *b) {
+  return a->line < b->line || (a->line == b->line && a->offset < b->offset);
+}
+
+static void heap_sift_down(run_reader_t **heap, int count, int i,
+                           int (*before)(const run_reader_t *, const run_reader_t *)) {
+  run_reader_t *item = heap[i];
+  int child;
+
+  while ((child = 2 * i + 1) < count) {
+    if (child + 1 < count && before(heap[child + 1], heap[child]))
+      child++;
+    if (!before(heap[child], item))
+      break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = item;
+}
+
+static void heap_push(run_reader_t **heap, int *count, run_reader_t *item,
+                      int (*before)(const run_reader_t *, const run_reader_t *)) {
+  int i = (*count)++, parent;
+
+  while (i > 0 && before(item, heap[parent = (i - 1) / 2])) {
+    heap[i] = heap[parent];
+    i = parent;
+  }
+  heap[i] = item;
+}
+
+static run_reader_t *heap_pop(run_reader_t **heap, int *count,
+                              int (*before)(const run_reader_t *, const run_reader_t *)) {
+  run_reader_t *top = heap[0];
+
+  if (--(*count) > 0) {
+    heap[0] = heap[*count];
+    heap_sift_down(heap, *count, 0, before);
+  }
+  return top;
+}
+
+/****
+ *
+ * output order of the merged records
+ *
+ * Count descending then address, as the in-memory output, which is
+ * count then place in the merged text.  With -k just the place.
+ *
+ ****/
+
+static ALWAYS_INLINE int record_before(const merged_record_t *a, const merged_record_t *b) {
+  if (!config->key_order && a->count != b->count)
+    return a->count > b->count;
+  return a->offset < b->offset;
+}
+
+static int compare_merged(const void *a, const void *b) {
+  const merged_record_t *record_a = (const merged_record_t *)a;
+  const merged_record_t *record_b = (const merged_record_t *)b;
+
+  if (record_before(record_a, record_b))
+    return -1;
+  return record_before(record_b, record_a);
+}
+
+static void order_sift_down(order_reader_t **heap, int count, int i) {
+  order_reader_t *item = heap[i];
+  int child;
+
+  while ((child = 2 * i + 1) < count) {
+    if (child + 1 < count && record_before(&heap[child + 1]->record, &heap[child]->record))
+      child++;
+    if (!record_before(&heap[child]->record, &item->record))
+      break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = item;
+}
+
+/* A chunk is the output's share of the budget, when there is one */
+static int order_init(record_order_t *order, const char *dir) {
+  XMEMSET(order, 0, sizeof(record_order_t));
+  order->capacity = SPILL_ORDER_RECORDS;
+  if (budget_limit()) {
+    order->capacity = budget_limit() / BUDGET_OUTPUT_SHARE / sizeof(merged_record_t);
+    if (order->capacity > SPILL_ORDER_RECORDS)
+      order->capacity = SPILL_ORDER_RECORDS;
+    if (order->capacity < SPILL_ORDER_MIN)
+      order->capacity = SPILL_ORDER_MIN;
+  }
+  if ((order->runs = spill_create(dir)) == NULL)
+    return FAILED;
+  if ((order->records = (merged_record_t *)XMALLOC(sizeof(merged_record_t) * order->capacity)) == NULL) {
+    fprintf(stderr, "ERR - Unable to allocate merged record order\n");
+    spill_destroy(order->runs);
+    order->runs = NULL;
+    return FAILED;
+  }
+  budget_add(BUDGET_OUTPUT, (int64_t)(sizeof(merged_record_t) * order->capacity));
+  return TRUE;
+}
+
+static void order_release(record_order_t *order) {
+  if (order->records != NULL) {
+    XFREE(order->records);
+    budget_add(BUDGET_OUTPUT, -(int64_t)(sizeof(merged_record_t) * order->capacity));
+  }
+  order->records = NULL;
+}
+
+static void order_close_readers(record_order_t *order) {
+  int i;
+
+  for (i = 0; i < order->num_readers; i++) {
+    if (order->readers[i].fp != NULL) {
+      fclose(order->readers[i].fp);
+      budget_add(BUDGET_OUTPUT, -SPILL_READ_BUFFER);
+    }
+  }
+  if (order->readers != NULL)
+    XFREE(order->readers);
+  if (order->heap != NULL)
+    XFREE(order->heap);
+  order->readers = NULL;
+  order->heap = NULL;
+  order->num_readers = order->num_heap = 0;
+}
+
+static void order_free(record_order_t *order) {
+  order_close_readers(order);
+  order_release(order);
+  spill_destroy(order->runs);
+  order->runs = NULL;
+}
+
+/* Sort the chunk in memory and write it out as an order run */
+static int order_flush(record_order_t *order) {
+  char path[PATH_MAX];
+  FILE *fp;
+  int ok;
+
+  if (!config->key_order)
+    qsort(order->records, order->count, sizeof(merged_record_t), compare_merged);
+  if ((fp = spill_open_temp(order->runs, "order", path, sizeof(path))) == NULL)
+    return FAILED;
+  ok = fwrite(order->records, sizeof(merged_record_t), order->count, fp) == order->count;
+  if (fclose(fp) != 0 || !ok || !spill_add_run(order->runs, path)) {
+    fprintf(stderr, "ERR - Unable to write order run [%s] %d (%s)\n", path, errno, strerror(errno));
+    unlink(path);
+    return FAILED;
+  }
+  budget_add(BUDGET_SPILLED, (int64_t)(order->count * sizeof(merged_record_t)));
+  order->count = 0;
+  return TRUE;
+}
+
+static int order_add(record_order_t *order, uint64_t count, off_t offset, off_t length) {
+  merged_record_t *record;
+
+  if (order->count == order->capacity && order_flush(order) != TRUE)
+    return FAILED;
+  record = &order->records[order->count++];
+  record->count = count;
+  record->offset = (uint64_t)offset;
+  record->length = (uint64_t)length;
+  order->total++;
+  return TRUE;
+}
+
+/* Start reading back the first count order runs */
+static int order_open_readers(record_order_t *order, int count) {
+  int i;
+
+  if ((order->readers = (order_reader_t *)XMALLOC(sizeof(order_reader_t) * count)) == NULL ||
+      (order->heap = (order_reader_t **)XMALLOC(sizeof(order_reader_t *) * count)) == NULL) {
+    order_close_readers(order);
+    return FAILED;
+  }
+  XMEMSET(order->readers, 0, sizeof(order_reader_t) * count);
+  order->num_readers = count;
+
+  for (i = 0; i < count; i++) {
+    order_reader_t *reader = &order->readers[i];
+
+    if ((reader->fp = fopen(order->runs->paths[i], "rb")) == NULL) {
+      fprintf(stderr, "ERR - Unable to open order run [%s] %d (%s)\n", order->runs->paths[i], errno,
+              strerror(errno));
+      order_close_readers(order);
+      return FAILED;
+    }
+    setvbuf(reader->fp, NULL, _IOFBF, SPILL_READ_BUFFER);
+    budget_add(BUDGET_OUTPUT, SPILL_READ_BUFFER);
+    if (fread(&reader->record, sizeof(merged_record_t), 1, reader->fp) == 1)
+      order->heap[order->num_heap++] = reader;
+  }
+  for (i = order->num_heap / 2 - 1; i >= 0; i--)
+    order_sift_down(order->heap, order->num_heap, i);
+
+  return TRUE;
+}
+
+/****
+ *
+ * next merged record in output order
+ *
+ * Returns TRUE with record set, FALSE after the last one and FAILED
+ * if an order run could not be read.
+ *
+ ****/
+
+static int order_next(record_order_t *order, merged_record_t *record) {
+  order_reader_t *top;
+
+  if (order->readers == NULL) {
+    if (order->next == order->count)
+      return FALSE;
+    *record = order->records[order->next++];
+    return TRUE;
+  }
+
+  if (order->num_heap == 0)
+    return FALSE;
+  top = order->heap[0];
+  *record = top->record;
+  if (fread(&top->record, sizeof(merged_record_t), 1, top->fp) == 1)
+    order_sift_down(order->heap, order->num_heap, 0);
+  else if (ferror(top->fp))
+    return FAILED;
+  else if (--order->num_heap > 0) {
+    order->heap[0] = order->heap[order->num_heap];
+    order_sift_down(order->heap, order->num_heap, 0);
+  }
+  return TRUE;
+}
+
+/* Merge the oldest SPILL_MAX_FANIN order runs into one */
+static int order_pass(record_order_t *order) {
+  merged_record_t record;
+  char path[PATH_MAX];
+  FILE *fp;
+  int ret, ok = TRUE;
+
+  if (order_open_readers(order, SPILL_MAX_FANIN) != TRUE)
+    return FAILED;
+  if ((fp = spill_open_temp(order->runs, "order", path, sizeof(path))) == NULL) {
+    order_close_readers(order);
+    return FAILED;
+  }
+  while ((ret = order_next(order, &record)) == TRUE && ok)
+    ok = fwrite(&record, sizeof(record), 1, fp) == 1;
+  order_close_readers(order);
+  if (fclose(fp) != 0 || !ok || ret == FAILED) {
+    fprintf(stderr, "ERR - Unable to merge order runs into [%s]\n", path);
+    unlink(path);
+    return FAILED;
+  }
+
+  spill_drop_runs(order->runs, SPILL_MAX_FANIN);
+  return spill_add_run(order->runs, path) ? TRUE : FAILED;
+}
+
+/* Every record is in, get ready to read them back in output order */
+static int order_finish(record_order_t *order) {
+  if (order->runs->count == 0) {
+    if (!config->key_order)
+      qsort(order->records, order->count, sizeof(merged_record_t), compare_merged);
+    order->next = 0;
+    return TRUE;
+  }
+
+  if (order->count > 0 && order_flush(order) != TRUE)
+    return FAILED;
+  order_release(order);
+  while (order->runs->count > SPILL_MAX_FANIN) {
+    if (order_pass(order) != TRUE)
+      return FAILED;
+  }
+  return order_open_readers(order, order->runs->count);
+}
+
+/****
+ *
+ * merge readers into a sink, one record per address
+ *
+ * Addresses come out in strcmp order, the locations of an address are
+ * merged across every run holding it in (line, field) order.  In text
+ * mode each record's place in the file is noted for the final sort, a
+ * binary index takes each address as soon as it is merged.
+ *
+ ****/
+
+static int merge_readers(run_reader_t *readers, int num_readers, merge_sink_t *sink, record_order_t *order) {
+  char key[ADDRESS_BATCH_KEY_LEN];
+  char line[ADDRESS_BATCH_KEY_LEN + WRITER_MAX_DECIMAL + 8];  /* One text field */
+  run_reader_t **keys, **group, **live;
+  lpi2_postings_t postings;
+  int num_keys = 0, num_group, num_live, i;
+  int ret = TRUE;
+
+  if ((keys = (run_reader_t **)XMALLOC(sizeof(run_reader_t *) * num_readers * 3)) == NULL)
+    return FAILED;
+  group = keys + num_readers;
+  live = group + num_readers;
+
+  for (i = 0; i < num_readers; i++) {
+    if (next_record(&readers[i]))
+      heap_push(keys, &num_keys, &readers[i], key_before);
+    else if (readers[i].error)
+      ret = FAILED;
+  }
+
+  while (num_keys > 0 && ret == TRUE) {
+    size_t total = 0;
+    off_t start = 0;
+
+    /* Every run holding the smallest key */
+    num_group = 0;
+    group[num_group++] = heap_pop(keys, &num_keys, key_before);
+    memcpy(key, group[0]->key, sizeof(key));
+    while (num_keys > 0 && strcmp(keys[0]->key, key) == 0)
+      group[num_group++] = heap_pop(keys, &num_keys, key_before);
+    for (i = 0; i < num_group; i++)
+      total += group[i]->count;
+
+    if (sink->index != NULL) {
+      sink->postings.len = 0;
+      if (lpi2_postings_begin(&postings, &sink->postings, total) != TRUE) {
+        ret = FAILED;
+        break;
+      }
+    } else if (sink->text) {
+      char *p = line;
+      size_t len = strlen(key);
+
+      start = ftello(sink->fp);
+      memcpy(p, key, len);
+      p += len;
+      *p++ = ',';
+      p = writer_decimal(p, total);
+      fwrite(line, 1, p - line, sink->fp);
+    } else {
+      fwrite(key, 1, strlen(key) + 1, sink->fp);
+      put_varint_file(sink->fp, total);
+      sink->last_line = 0;
+    }
+
+    /* K-way merge of this address's locations */
+    num_live = 0;
+    for (i = 0; i < num_group; i++) {
+      if (group[i]->has_entry)
+        live[num_live++] = group[i];
+    }
+    for (i = num_live / 2 - 1; i >= 0; i--)
+      heap_sift_down(live, num_live, i, entry_before);
+
+    while (num_live > 0) {
+      run_reader_t *next = live[0];
+
+      if (sink->index != NULL) {
+        if (lpi2_postings_add(&postings, next->line + 1, next->offset) != TRUE)
+          ret = FAILED;
+      } else if (sink->text) {
+        char *p = line;
+
+        *p++ = ',';
+        p = writer_decimal(p, next->line + 1);
+        *p++ = ':';
+        p = writer_decimal(p, next->offset);
+        fwrite(line, 1, p - line, sink->fp);
+      } else
+        write_run_location(sink, next->line, next->offset);
+
+      if (next_entry(next))
+        heap_sift_down(live, num_live, 0, entry_before);
+      else
+        heap_pop(live, &num_live, entry_before);
+    }
+
+    if (sink->index != NULL) {
+      if (ret != TRUE || lpi2_postings_end(&postings) != TRUE ||
+          lpi2_builder_add(sink->index, key, strlen(key), total, sink->postings.data, sink->postings.len) != TRUE) {
+        ret = FAILED;
+        break;
+      }
+    } else if (sink->text) {
+      fputc('\n', sink->fp);
+      if (order_add(order, total, start, ftello(sink->fp) - start) != TRUE) {
+        ret = FAILED;
+        break;
+      }
+    }
+
+    /* Move the group on to its next addresses */
+    for (i = 0; i < num_group; i++) {
+      if (group[i]->error)
+        ret = FAILED;
+      else if (next_record(group[i]))
+        heap_push(keys, &num_keys, group[i], key_before);
+      else if (group[i]->error)
+        ret = FAILED;
+    }
+  }
+
+  XFREE(keys);
+  if (ret != TRUE)
+    return FAILED;
+  return (sink->index == NULL && ferror(sink->fp)) ? FAILED : TRUE;
+}
+
+static void close_readers(run_reader_t *readers, int num_readers) {
+  int i;
+
+  for (i = 0; i < num_readers; i++) {
+    if (readers[i].fp != NULL) {
+      fclose(readers[i].fp);
+      budget_add(BUDGET_OUTPUT, -SPILL_READ_BUFFER);
+    }
+  }
+  XFREE(readers);
+}
+
+static run_reader_t *open_readers(spill_set_t *set, int first, int num_readers) {
+  run_reader_t *readers;
+  int i;
+
+  if ((readers = (run_reader_t *)XMALLOC(sizeof(run_reader_t) * num_readers)) == NULL)
+    return NULL;
+  XMEMSET(readers, 0, sizeof(run_reader_t) * num_readers);
+
+  for (i = 0; i < num_readers; i++) {
+    if ((readers[i].fp = fopen(set->paths[first + i], "rb")) == NULL) {
+      fprintf(stderr, "ERR - Unable to open spill run [%s] %d (%s)\n", set->paths[first + i], errno,
+              strerror(errno));
+      close_readers(readers, i);
+      return NULL;
+    }
+    setvbuf(readers[i].fp, NULL, _IOFBF, SPILL_READ_BUFFER);
+    budget_add(BUDGET_OUTPUT, SPILL_READ_BUFFER);
+  }
+
+  return readers;
+}
+
+
+/* Merge the oldest SPILL_MAX_FANIN runs into one, keeping the file count bounded */
+static int merge_pass(spill_set_t *set) {
+  run_reader_t *readers;
+  merge_sink_t sink;
+  char path[PATH_MAX];
+  int ret;
+
+  if ((readers = open_readers(set, 0, SPILL_MAX_FANIN)) == NULL)
+    return FAILED;
+  if ((sink.fp = spill_open_temp(set, "run", path, sizeof(path))) == NULL) {
+    close_readers(readers, SPILL_MAX_FANIN);
+    return FAILED;
+  }
+  sink.text = FALSE;
+  sink.index = NULL;
+
+  ret = merge_readers(readers, SPILL_MAX_FANIN, &sink, NULL);
+  close_readers(readers, SPILL_MAX_FANIN);
+  if (fclose(sink.fp) != 0)
+    ret = FAILED;
+  if (ret != TRUE) {
+    fprintf(stderr, "ERR - Unable to merge spill runs into [%s]\n", path);
+    unlink(path);
+    return FAILED;
+  }
+
+  spill_drop_runs(set, SPILL_MAX_FANIN);
+  return spill_add_run(set, path) ? TRUE : FAILED;
+}
+
+/****
+ *
+ * merge every reader straight into a binary index
+ *
+ * The index sorts its own keys, so addresses go to it in merge order
+ * without the temporary file the text output is reordered through.
+ *
+ ****/
+
+static int merge_binary(spill_set_t *set, run_reader_t *readers, int num_readers, FILE *out) {
+  merge_sink_t sink;
+  writer_t *writer;
+  int ret = FAILED;
+
+  XMEMSET(&sink, 0, sizeof(sink));
+
+  if ((writer = writer_create(out, !config->force_serial)) != NULL) {
+    if ((sink.index = lpi2_builder_create(writer, 0)) != NULL) {
+      /* Its keys are held to the output's share of the budget */
+      if (!budget_limit() || lpi2_builder_spill(sink.index, set->dir, budget_limit() / BUDGET_OUTPUT_SHARE) == TRUE)
+        ret = merge_readers(readers, num_readers, &sink, NULL);
+      if (ret == TRUE)
+        ret = lpi2_builder_finish(sink.index);
+      lpi2_builder_destroy(sink.index);
+    }
+    if (writer_close(writer) != TRUE)
+      ret = FAILED;
+  }
+  if (sink.postings.data != NULL)
+    XFREE(sink.postings.data);
+
+  if (ret != TRUE)
+    fprintf(stderr, "ERR - Unable to merge into a binary index\n");
+  return ret;
+}
+
+/* Copy the address a merged record starts with, up to its comma */
+static int record_key(const char *text, size_t len, char *key) {
+  size_t i;
+
+  for (i = 0; i < len && i < ADDRESS_BATCH_KEY_LEN; i++) {
+    if (text[i] == ',') {
+      memcpy(key, text, i);
+      key[i] = '\0';
+      return TRUE;
+    }
+  }
+  return FAILED;
+}
+
+/****
+ *
+ * merge every reader and write the final index to out
+ *
+ * Records are merged into an unlinked temporary file, then copied to
+ * out in output order, with -k noting them in the key directory.
+ * With -z they are compressed a block at a time as they are copied.
+ * The output order is sorted externally, only a bounded chunk of
+ * (count, offset, length) records is held in memory, and addresses
+ * are read back from the merged text as they are copied.
+ *
+ ****/
+
+static int merge_text(spill_set_t *set, run_reader_t *readers, int num_readers, FILE *out) {
+  record_order_t order;
+  merged_record_t record;
+  merge_sink_t sink;
+  writer_t *writer;
+  keydir_writer_t *keys = NULL;
+  filter_t *filter = NULL;
+  out_buffer_t block, zbuf;
+  off_t written = 0;
+  char path[PATH_MAX];
+  char key[ADDRESS_BATCH_KEY_LEN], first[ADDRESS_BATCH_KEY_LEN];
+  char *buf;
+  int ret, more;
+
+  if ((sink.fp = spill_open_temp(set, "merged", path, sizeof(path))) == NULL)
+    return FAILED;
+  unlink(path);
+  sink.text = TRUE;
+  sink.index = NULL;
+
+  if (order_init(&order, set->dir) != TRUE) {
+    fclose(sink.fp);
+    return FAILED;
+  }
+
+  ret = merge_readers(readers, num_readers, &sink, &order);
+  if (ret != TRUE || fflush(sink.fp) != 0) {
+    fprintf(stderr, "ERR - Unable to merge into the index\n");
+    ret = FAILED;
+  }
+  if (ret == TRUE && order_finish(&order) != TRUE) {
+    fprintf(stderr, "ERR - Unable to order the merged index\n");
+    ret = FAILED;
+  }
+
+  if (ret == TRUE && (buf = (char *)XMALLOC(SPILL_READ_BUFFER)) == NULL)
+    ret = FAILED;
+  if (ret == TRUE && (writer = writer_create(out, !config->force_serial)) == NULL) {
+    XFREE(buf);
+    ret = FAILED;
+  }
+
+  if (ret == TRUE) {
+    /* The merge is already in address order, as -k wants */
+    if (config->key_order && config->index_filename != NULL)
+      keys = keydir_create(config->index_filename, config->compress_index);
+    if (config->index_filename != NULL && (filter = filter_create(order.total)) != NULL)
+      budget_add(BUDGET_OUTPUT, (int64_t)filter->blocks * FILTER_BLOCK_SIZE);
+    XMEMSET(&block, 0, sizeof(block));
+    XMEMSET(&zbuf, 0, sizeof(zbuf));
+    first[0] = '\0';
+
+    more = order_next(&order, &record);
+    while (more == TRUE && ret == TRUE) {
+      size_t left = (size_t)record.length;
+      char *text;
+
+      if (fseeko(sink.fp, (off_t)record.offset, SEEK_SET) != 0) {
+        ret = FAILED;
+        break;
+      }
+
+      /* -z gathers whole records into a block, compressed once it is full */
+      if (config->compress_index) {
+        if (!out_reserve(&block, left) || fread(block.data + block.len, 1, left, sink.fp) != left) {
+          ret = FAILED;
+          break;
+        }
+        text = block.data + block.len;
+        if (record_key(text, left, key) != TRUE) {
+          ret = FAILED;
+          break;
+        }
+        if (block.len == 0)
+          strcpy(first, key);
+        block.len += left;
+        if (filter != NULL)
+          filter_add(filter, filter_hash(key, strlen(key)));
+        if ((more = order_next(&order, &record)) == TRUE && block.len < ZBLOCK_SIZE)
+          continue;
+
+        zbuf.len = 0;
+        if (keydir_mark(keys, first, written) != TRUE ||
+            zblock_compress(&zbuf, block.data, block.len) != TRUE ||
+            writer_write(writer, zbuf.data, zbuf.len) != TRUE)
+          ret = FAILED;
+        written += zbuf.len;
+        block.len = 0;
+        continue;
+      }
+
+      while (left > 0 && ret == TRUE) {
+        size_t chunk = (left < SPILL_READ_BUFFER) ? left : SPILL_READ_BUFFER;
+        if (fread(buf, 1, chunk, sink.fp) != chunk)
+          ret = FAILED;
+        else if (left == (size_t)record.length) {
+          if (record_key(buf, chunk, key) != TRUE || keydir_add(keys, key, written, (size_t)record.length) != TRUE)
+            ret = FAILED;
+          else if (filter != NULL)
+            filter_add(filter, filter_hash(key, strlen(key)));
+        }
+        if (ret == TRUE && writer_write(writer, buf, chunk) != TRUE)
+          ret = FAILED;
+        left -= chunk;
+      }
+      written += (off_t)record.length;
+      more = order_next(&order, &record);
+    }
+    if (more == FAILED)
+      ret = FAILED;
+    XFREE(buf);
+    if (block.data != NULL)
+      XFREE(block.data);
+    if (zbuf.data != NULL)
+      XFREE(zbuf.data);
+    if (writer_close(writer) != TRUE)
+      ret = FAILED;
+    if (ret != TRUE)
+      fprintf(stderr, "ERR - Unable to copy merged index\n");
+    if (keys != NULL && (keydir_close(keys, written) != TRUE || ret != TRUE))
+      keydir_remove(config->index_filename);
+    if (filter != NULL) {
+      if (ret != TRUE || filter_save(filter, config->index_filename, written) != TRUE)
+        filter_remove(config->index_filename);
+      budget_add(BUDGET_OUTPUT, -(int64_t)filter->blocks * FILTER_BLOCK_SIZE);
+      filter_free(filter);
+    }
+  }
+
+  fclose(sink.fp);
+  order_free(&order);
+
+  return ret;
+}
+
+/****
+ *
+ * merge every run and write the final index to out
+ *
+ ****/
+
+int spill_merge_runs(spill_set_t *set, FILE *out) {
+  run_reader_t *readers;
+  int ret;
+
+  while (set->count > SPILL_MAX_FANIN) {
+    if (merge_pass(set) != TRUE)
+      return FAILED;
+  }
+
+#ifdef DEBUG
+  if (config->debug >= 1)
+    fprintf(stderr, "DEBUG - Merging %d spill runs\n", set->count);
+#endif
+
+  if ((readers = open_readers(set, 0, set->count)) == NULL)
+    return FAILED;
+  if (config->binary_index)
+    ret = merge_binary(set, readers, set->count, out);
+  else
+    ret = merge_text(set, readers, set->count, out);
+  close_readers(readers, set->count);
+
+  return ret;
+}
+
+/****
+ *
+ * merge indexes opened by logpi -M and write the merged index to out
+ *
+ * Each source is read in place of a run, so the sources are merged
+ * in one pass whatever their number.
+ *
+ ****/
+
+int spill_merge_sources(spill_set_t *set, merge_source_t *sources, int count, FILE *out) {
+  run_reader_t *readers;
+  int i, ret;
+
+  if ((readers = (run_reader_t *)XMALLOC(sizeof(run_reader_t) * count)) == NULL)
+    return FAILED;
+  XMEMSET(readers, 0, sizeof(run_reader_t) * count);
+  for (i = 0; i < count; i++)
+    readers[i].source = &sources[i];
+
+  if (config->binary_index)
+    ret = merge_binary(set, readers, count, out);
+  else
+    ret = merge_text(set, readers, count, out);
+  XFREE(readers);
+
+  return ret;
+}
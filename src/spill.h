@@ -0,0 +1,64 @@
+/*****
+ *
+ * Description: Spill-to-Disk Index Run Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "../include/common.h"
+#include "hash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Spill configuration */
+#define SPILL_IO_BUFFER 1048576       /* stdio buffer for each run and the merged file */
+#define SPILL_DEFAULT_DIR "/tmp"
+#define SPILL_MAX_FANIN 128           /* Runs merged at once, wider sets are merged in passes */
+#define SPILL_READ_BUFFER 65536       /* stdio buffer for each run being merged */
+
+/*
+ * Sorted runs written when an address table reaches its memory budget.
+ * A run holds each address in strcmp order as the key with its NUL,
+ * a varint count, then count (varint line delta, varint field) pairs
+ * in line order.
+ */
+typedef struct spill_set_s {
+  char dir[PATH_MAX];
+  char **paths;
+  int count;
+  int capacity;
+  pthread_mutex_t lock;         /* Workers add runs concurrently */
+} spill_set_t;
+
+struct merge_source_s;
+
+/* Function prototypes */
+spill_set_t *spill_create(const char *dir);
+void spill_destroy(spill_set_t *set);
+FILE *spill_open_temp(spill_set_t *set, const char *tag, char *path, size_t path_len);
+int spill_add_run(spill_set_t *set, const char *path);
+void spill_drop_runs(spill_set_t *set, int count);
+int spill_has_runs(spill_set_t *set);
+int spill_write_run(spill_set_t *set, struct hash_s *hash);
+int spill_merge_runs(spill_set_t *set, FILE *out);
+int spill_merge_sources(spill_set_t *set, struct merge_source_s *sources, int count, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPILL_H */
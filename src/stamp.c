@@ -0,0 +1,191 @@
+/*****
+ *
+ * Description: Indexed Log Stamp Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "stamp.h"
+#include "lpi2.h"
+#include "mem.h"
+#include "xxhash.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+extern Config_t *config;
+
+static int stamp_path(char *path, size_t len, const char *index_path) {
+  if (snprintf(path, len, "%s%s", index_path, STAMP_SUFFIX) >= (int)len) {
+    fprintf(stderr, "ERR - Log stamp path too long for [%s]\n", index_path);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* The switches that change what an index looks like */
+uint32_t stamp_flags(void) {
+  uint32_t flags = 0;
+
+  if (config->binary_index)
+    flags |= STAMP_FLAG_BINARY | ((uint32_t)LPI2_VERSION << STAMP_BINARY_VERSION_SHIFT);
+  if (config->key_order)
+    flags |= STAMP_FLAG_KEY_ORDER;
+  if (config->compress_index)
+    flags |= STAMP_FLAG_COMPRESS;
+  return flags;
+}
+
+/****
+ *
+ * hash both ends of the first size bytes of a log
+ *
+ * last is set to the final byte, -1 for an empty log.
+ *
+ ****/
+
+static int fingerprint(int fd, uint64_t size, uint32_t *head, uint32_t *tail, int *last) {
+  char *buf;
+  size_t len = (size < STAMP_SAMPLE) ? (size_t)size : STAMP_SAMPLE;
+  int ret = TRUE;
+
+  *head = *tail = 0;
+  *last = -1;
+  if (len == 0)
+    return TRUE;
+  if ((buf = (char *)XMALLOC(STAMP_SAMPLE)) == NULL)
+    return FAILED;
+
+  if (pread(fd, buf, len, 0) != (ssize_t)len)
+    ret = FAILED;
+  else
+    *head = xxhash32(buf, len, 0);
+  if (ret == TRUE && pread(fd, buf, len, (off_t)(size - len)) != (ssize_t)len)
+    ret = FAILED;
+  else if (ret == TRUE) {
+    *tail = xxhash32(buf, len, 1);
+    *last = (unsigned char)buf[len - 1];
+  }
+
+  XFREE(buf);
+  return ret;
+}
+
+/****
+ *
+ * stamp an index written from the first size bytes and lines of a log
+ *
+ ****/
+
+int stamp_save(const char *index_path, const char *log_path, off_t size, uint64_t lines) {
+  char path[PATH_MAX];
+  struct stat log_st, index_st;
+  stamp_t stamp;
+  FILE *fp;
+  int fd, last;
+
+  if (!stamp_path(path, sizeof(path), index_path))
+    return FAILED;
+
+  XMEMSET(&stamp, 0, sizeof(stamp));
+  memcpy(stamp.magic, STAMP_MAGIC, sizeof(stamp.magic));
+  stamp.flags = stamp_flags();
+  stamp.size = (uint64_t)size;
+  stamp.lines = lines;
+
+  if ((fd = open(log_path, O_RDONLY)) < 0) {
+    fprintf(stderr, "ERR - Unable to open file [%s] %d (%s)\n", log_path, errno, strerror(errno));
+    return FAILED;
+  }
+  if (fstat(fd, &log_st) != 0 || stat(index_path, &index_st) != 0 ||
+      fingerprint(fd, stamp.size, &stamp.head, &stamp.tail, &last) != TRUE) {
+    fprintf(stderr, "ERR - Unable to stamp [%s]\n", index_path);
+    close(fd);
+    return FAILED;
+  }
+  close(fd);
+  stamp.device = (uint64_t)log_st.st_dev;
+  stamp.inode = (uint64_t)log_st.st_ino;
+  stamp.mtime = (int64_t)log_st.st_mtime;
+  stamp.index_size = (uint64_t)index_st.st_size;
+
+  if ((fp = fopen(path, "w")) == NULL) {
+    fprintf(stderr, "ERR - Unable to open log stamp [%s] %d (%s)\n", path, errno, strerror(errno));
+    return FAILED;
+  }
+  fwrite(&stamp, sizeof(stamp), 1, fp);
+  if (ferror(fp) || fclose(fp) != 0) {
+    fprintf(stderr, "ERR - Unable to write log stamp [%s]\n", path);
+    unlink(path);
+    return FAILED;
+  }
+
+  return TRUE;
+}
+
+/* Drop the stamp of an index that is being written again */
+void stamp_remove(const char *index_path) {
+  char path[PATH_MAX];
+
+  if (stamp_path(path, sizeof(path), index_path))
+    unlink(path);
+}
+
+int stamp_load(stamp_t *stamp, const char *index_path) {
+  char path[PATH_MAX];
+  FILE *fp;
+  int ret;
+
+  if (!stamp_path(path, sizeof(path), index_path) || (fp = fopen(path, "r")) == NULL)
+    return FALSE;
+  ret = fread(stamp, sizeof(stamp_t), 1, fp) == 1 && memcmp(stamp->magic, STAMP_MAGIC, sizeof(stamp->magic)) == 0;
+  fclose(fp);
+
+  return ret ? TRUE : FALSE;
+}
+
+/****
+ *
+ * compare a log with the stamp of its index
+ *
+ * The log must be the same file with the same first stamp->size bytes
+ * as far as the hashes tell.  It is current if it is no longer and
+ * not modified since, and has grown if lines were added after the
+ * last one indexed, which must have been whole.
+ *
+ ****/
+
+int stamp_check(const stamp_t *stamp, const char *index_path, const char *log_path) {
+  struct stat log_st, index_st;
+  uint32_t head, tail;
+  int fd, last, ret;
+
+  if (stamp->flags != stamp_flags() || stat(index_path, &index_st) != 0 ||
+      (uint64_t)index_st.st_size != stamp->index_size)
+    return STAMP_CHANGED;
+
+  if ((fd = open(log_path, O_RDONLY)) < 0)
+    return STAMP_CHANGED;
+  if (fstat(fd, &log_st) != 0 || (uint64_t)log_st.st_dev != stamp->device ||
+      (uint64_t)log_st.st_ino != stamp->inode || (uint64_t)log_st.st_size < stamp->size ||
+      fingerprint(fd, stamp->size, &head, &tail, &last) != TRUE || head != stamp->head ||
+      tail != stamp->tail)
+    ret = STAMP_CHANGED;
+  else if ((uint64_t)log_st.st_size == stamp->size)
+    ret = ((int64_t)log_st.st_mtime == stamp->mtime) ? STAMP_CURRENT : STAMP_CHANGED;
+  else
+    ret = (last == -1 || last == '\n') ? STAMP_GROWN : STAMP_CHANGED;
+  close(fd);
+
+  return ret;
+}
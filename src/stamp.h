@@ -0,0 +1,76 @@
+/*****
+ *
+ * Description: Indexed Log Stamp Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef STAMP_H
+#define STAMP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "../include/common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A .lps sidecar records the log an index was written from: its
+ * device, inode, modification time, how many bytes and lines of it
+ * were indexed, and a hash of the first and of the last STAMP_SAMPLE
+ * bytes of those.  logpi -w skips a log that still matches it, and
+ * reads only the lines added to a log that has grown, merging them
+ * into the index.  The stamp also records the size of the index and
+ * the switches it was written with, any other index is rebuilt.
+ */
+
+#define STAMP_SUFFIX ".lps"
+#define STAMP_MAGIC "LPS1"
+#define STAMP_SAMPLE 65536              /* Bytes hashed at each end of what was indexed */
+
+/* Index formats, a stamp only matches a run writing the same one */
+#define STAMP_FLAG_BINARY 0x1
+#define STAMP_FLAG_KEY_ORDER 0x2
+#define STAMP_FLAG_COMPRESS 0x4
+#define STAMP_BINARY_VERSION_SHIFT 16 /* Binary format version, an older index is rebuilt */
+
+/* What a log is now, against the stamp of its index */
+#define STAMP_CHANGED 0                 /* Index it again */
+#define STAMP_CURRENT 1                 /* Nothing to do */
+#define STAMP_GROWN 2                   /* Only lines were added */
+
+typedef struct stamp_s {                /* 64 bytes */
+  char magic[4];
+  uint32_t flags;
+  uint64_t device;
+  uint64_t inode;
+  int64_t mtime;
+  uint64_t size;                        /* Bytes of the log indexed */
+  uint64_t lines;                       /* Lines of the log indexed */
+  uint64_t index_size;
+  uint32_t head;                        /* Hash of the first STAMP_SAMPLE bytes */
+  uint32_t tail;                        /* Hash of the STAMP_SAMPLE bytes before size */
+} stamp_t;
+
+/* Function prototypes */
+uint32_t stamp_flags(void);
+int stamp_save(const char *index_path, const char *log_path, off_t size, uint64_t lines);
+void stamp_remove(const char *index_path);
+int stamp_load(stamp_t *stamp, const char *index_path);
+int stamp_check(const stamp_t *stamp, const char *index_path, const char *log_path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STAMP_H */
@@ -0,0 +1,301 @@
+/*****
+ *
+ * Description: Buffered Index Writer Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "writer.h"
+#include "mem.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+const char writer_digit_pairs[200] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+/****
+ *
+ * write every byte of an iovec array, retrying short writes
+ *
+ ****/
+
+static int write_all(int fd, struct iovec *iov, int count) {
+  ssize_t ret;
+
+  while (count > 0) {
+    if ((ret = writev(fd, iov, count)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno;
+    }
+    while (count > 0 && (size_t)ret >= iov->iov_len) {
+      ret -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (char *)iov->iov_base + ret;
+      iov->iov_len -= ret;
+    }
+  }
+
+  return 0;
+}
+
+static void note_error(writer_t *w, int err) {
+  if (err != 0 && w->error == 0) {
+    w->error = err;
+    fprintf(stderr, "ERR - Unable to write index %d (%s)\n", err, strerror(err));
+  }
+}
+
+/****
+ *
+ * I/O thread, writes filled buffers in ring order
+ *
+ ****/
+
+static void *writer_thread(void *arg) {
+  writer_t *w = (writer_t *)arg;
+  struct iovec iov;
+  int err, failed;
+
+  pthread_mutex_lock(&w->lock);
+  while (TRUE) {
+    while (w->pending == 0 && !w->closing)
+      pthread_cond_wait(&w->filled, &w->lock);
+    if (w->pending == 0)
+      break;
+
+    iov.iov_base = w->buffers[w->drain];
+    iov.iov_len = w->lengths[w->drain];
+    failed = (w->error != 0);
+    pthread_mutex_unlock(&w->lock);
+
+    /* After a failure the rest is dropped, the error is reported on close */
+    err = failed ? 0 : write_all(w->fd, &iov, 1);
+
+    pthread_mutex_lock(&w->lock);
+    note_error(w, err);
+    w->drain = (w->drain + 1) % WRITER_BUFFERS;
+    w->pending--;
+    pthread_cond_signal(&w->drained);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  return NULL;
+}
+
+/****
+ *
+ * create a writer on fp's descriptor
+ *
+ * Anything already buffered in fp is flushed first so it stays ahead
+ * of the writer's output.  With background set a dedicated thread does
+ * the writes and formatting overlaps them.
+ *
+ ****/
+
+writer_t *writer_create(FILE *fp, int background) {
+  writer_t *w;
+  int i;
+
+  if (fflush(fp) != 0) {
+    fprintf(stderr, "ERR - Unable to flush output %d (%s)\n", errno, strerror(errno));
+    return NULL;
+  }
+
+  if ((w = (writer_t *)XMALLOC(sizeof(writer_t))) == NULL) {
+    fprintf(stderr, "ERR - Unable to allocate index writer\n");
+    return NULL;
+  }
+  XMEMSET(w, 0, sizeof(writer_t));
+  w->fd = fileno(fp);
+
+  /* XMALLOC can't align, the buffers are released with free() */
+  for (i = 0; i < WRITER_BUFFERS; i++) {
+    if (posix_memalign((void **)&w->buffers[i], WRITER_ALIGN, WRITER_BUFFER_SIZE) != 0) {
+      fprintf(stderr, "ERR - Unable to allocate index writer buffer\n");
+      while (--i >= 0)
+        free(w->buffers[i]);
+      XFREE(w);
+      return NULL;
+    }
+  }
+  w->cur = w->buffers[0];
+
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->filled, NULL);
+  pthread_cond_init(&w->drained, NULL);
+
+  /* Fall back to writing inline if the thread can't start */
+  if (background && pthread_create(&w->thread, NULL, writer_thread, w) == 0)
+    w->background = TRUE;
+
+  return w;
+}
+
+/****
+ *
+ * hand the current buffer to the I/O thread, or write it
+ *
+ ****/
+
+int writer_flush_buffer(writer_t *w) {
+  struct iovec iov;
+  int ret;
+
+  if (!w->background) {
+    if (w->len == 0)
+      return (w->error == 0) ? TRUE : FAILED;
+    iov.iov_base = w->cur;
+    iov.iov_len = w->len;
+    note_error(w, write_all(w->fd, &iov, 1));
+    w->len = 0;
+    return (w->error == 0) ? TRUE : FAILED;
+  }
+
+  pthread_mutex_lock(&w->lock);
+  if (w->len > 0) {
+    w->lengths[w->fill] = w->len;
+    w->pending++;
+    pthread_cond_signal(&w->filled);
+    w->fill = (w->fill + 1) % WRITER_BUFFERS;
+    while (w->pending == WRITER_BUFFERS)
+      pthread_cond_wait(&w->drained, &w->lock);
+  }
+  ret = (w->error == 0) ? TRUE : FAILED;
+  pthread_mutex_unlock(&w->lock);
+
+  w->cur = w->buffers[w->fill];
+  w->len = 0;
+  return ret;
+}
+
+/****
+ *
+ * append bytes to the output
+ *
+ * Small writes are copied into the current buffer.  A block at least a
+ * buffer long goes out with the buffered bytes in one writev, after
+ * the I/O thread has caught up so the order is kept.
+ *
+ ****/
+
+int writer_write(writer_t *w, const char *data, size_t len) {
+  struct iovec iov[2];
+  size_t room;
+
+  if (len < WRITER_BUFFER_SIZE) {
+    room = WRITER_BUFFER_SIZE - w->len;
+    if (len > room) {
+      memcpy(w->cur + w->len, data, room);
+      w->len += room;
+      data += room;
+      len -= room;
+      if (writer_flush_buffer(w) != TRUE)
+        return FAILED;
+    }
+    memcpy(w->cur + w->len, data, len);
+    w->len += len;
+    return TRUE;
+  }
+
+  /* Nothing else is writing once the I/O thread is idle */
+  if (w->background) {
+    pthread_mutex_lock(&w->lock);
+    while (w->pending > 0)
+      pthread_cond_wait(&w->drained, &w->lock);
+    pthread_mutex_unlock(&w->lock);
+  }
+
+  iov[0].iov_base = w->cur;
+  iov[0].iov_len = w->len;
+  iov[1].iov_base = (void *)data;
+  iov[1].iov_len = len;
+  if (w->error == 0)
+    note_error(w, (w->len > 0) ? write_all(w->fd, iov, 2) : write_all(w->fd, &iov[1], 1));
+  w->len = 0;
+
+  return (w->error == 0) ? TRUE : FAILED;
+}
+
+/****
+ *
+ * write what is left, stop the I/O thread and free the writer
+ *
+ * Returns FAILED if any write failed.
+ *
+ ****/
+
+int writer_close(writer_t *w) {
+  int ret;
+  int i;
+
+  if (w == NULL)
+    return TRUE;
+
+  writer_flush_buffer(w);
+
+  if (w->background) {
+    pthread_mutex_lock(&w->lock);
+    w->closing = TRUE;
+    pthread_cond_signal(&w->filled);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+  }
+
+  ret = (w->error == 0) ? TRUE : FAILED;
+
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->filled);
+  pthread_cond_destroy(&w->drained);
+  for (i = 0; i < WRITER_BUFFERS; i++)
+    free(w->buffers[i]);
+  XFREE(w);
+
+  return ret;
+}
+
+/****
+ *
+ * grow an output buffer to hold need more bytes
+ *
+ ****/
+
+int out_reserve(out_buffer_t *buf, size_t need) {
+  char *data;
+  size_t size;
+  
+  if (buf->len + need <= buf->size)
+    return TRUE;
+  
+  size = (buf->size == 0) ? OUTPUT_BUFFER_SIZE : buf->size;
+  while (size < buf->len + need)
+    size *= 2;
+  if ((data = (char *)XREALLOC(buf->data, size)) == NULL) {
+    fprintf(stderr, "ERR - Unable to grow output buffer\n");
+    return FALSE;
+  }
+  buf->data = data;
+  buf->size = size;
+  return TRUE;
+}
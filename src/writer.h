@@ -0,0 +1,131 @@
+/*****
+ *
+ * Description: Buffered Index Writer Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "../include/common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Writer configuration */
+#define WRITER_BUFFER_SIZE 4194304      /* 4MB per buffer */
+#define WRITER_BUFFERS 3                /* One filling, the rest queued for the I/O thread */
+#define WRITER_ALIGN 4096               /* Buffers start on a page */
+#define WRITER_MAX_DECIMAL 20           /* Digits in the largest 64 bit value */
+#define OUTPUT_BUFFER_SIZE 65536        /* Initial size of a growable output buffer */
+
+/*
+ * Buffers are filled in ring order.  pending counts the filled buffers
+ * the I/O thread has not written yet, the producer only waits when
+ * every buffer is pending.  Without an I/O thread a filled buffer is
+ * written before the call that filled it returns.
+ */
+typedef struct writer_s {
+  int fd;
+  char *buffers[WRITER_BUFFERS];
+  size_t lengths[WRITER_BUFFERS];
+  int fill;                     /* Buffer being filled */
+  int drain;                    /* Next buffer the I/O thread writes */
+  int pending;
+  char *cur;                    /* buffers[fill] */
+  size_t len;                   /* Bytes used in cur */
+  int background;
+  int closing;
+  int error;                    /* errno of the first failed write, 0 if none */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t filled;
+  pthread_cond_t drained;
+} writer_t;
+
+/* Records formatted ahead of the writer, one per formatting thread */
+typedef struct out_buffer_s {
+  char *data;
+  size_t len;
+  size_t size;
+} out_buffer_t;
+
+/* Function prototypes */
+writer_t *writer_create(FILE *fp, int background);
+int writer_close(writer_t *w);
+int writer_write(writer_t *w, const char *data, size_t len);
+int writer_flush_buffer(writer_t *w);
+int out_reserve(out_buffer_t *buf, size_t need);
+
+/* Two digit pairs, "00" through "99" */
+extern const char writer_digit_pairs[200];
+
+/****
+ *
+ * base 10 formatting
+ *
+ * The length is found up front from the bit length, then digits are
+ * written two at a time from the end.  Returns the end of the digits.
+ *
+ ****/
+
+static ALWAYS_INLINE int writer_decimal_len(uint64_t value) {
+  static const uint64_t powers[WRITER_MAX_DECIMAL] = {
+    0ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+  };
+  /* log10(2) ~= 1233/4096, exact after the one comparison */
+  int len = ((64 - __builtin_clzll(value | 1)) * 1233) >> 12;
+  
+  return len + 1 - (value < powers[len]);
+}
+
+static ALWAYS_INLINE char *writer_decimal(char *p, uint64_t value) {
+  int len = writer_decimal_len(value);
+  char *end = p + len;
+  
+  while (value >= 100) {
+    end -= 2;
+    memcpy(end, &writer_digit_pairs[(value % 100) * 2], 2);
+    value /= 100;
+  }
+  if (value >= 10)
+    memcpy(end - 2, &writer_digit_pairs[value * 2], 2);
+  else
+    end[-1] = (char)('0' + value);
+  
+  return p + len;
+}
+
+/* Room for need bytes in the current buffer, need must fit one buffer */
+static ALWAYS_INLINE char *writer_reserve(writer_t *w, size_t need) {
+  if (UNLIKELY(w->len + need > WRITER_BUFFER_SIZE) && writer_flush_buffer(w) != TRUE)
+    return NULL;
+  return w->cur + w->len;
+}
+
+static ALWAYS_INLINE void writer_commit(writer_t *w, char *end) {
+  w->len = end - w->cur;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WRITER_H */
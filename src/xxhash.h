@@ -17,6 +17,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -65,6 +66,52 @@ static inline uint32_t xxhash32_small(const void* input, size_t len, uint32_t se
     return h32;
 }
 
+#define XXH_PRIME64_1   0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2   0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3   0x165667B19E3779F9ULL
+#define XXH_PRIME64_4   0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5   0x27D4EB2F165667C5ULL
+
+#define XXH_ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* 64-bit xxHash tail loop, used for table keys (no 32-byte stripes) */
+static inline uint64_t xxhash64_small(const void* input, size_t len, uint64_t seed) {
+    const uint8_t* p = (const uint8_t*)input;
+    const uint8_t* end = p + len;
+    uint64_t h64 = seed + XXH_PRIME64_5 + (uint64_t)len;
+    uint64_t k64;
+    uint32_t k32;
+    
+    while (p + 8 <= end) {
+        memcpy(&k64, p, sizeof(k64));
+        k64 *= XXH_PRIME64_2;
+        k64 = XXH_ROTL64(k64, 31) * XXH_PRIME64_1;
+        h64 ^= k64;
+        h64 = XXH_ROTL64(h64, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+    
+    if (p + 4 <= end) {
+        memcpy(&k32, p, sizeof(k32));
+        h64 ^= (uint64_t)k32 * XXH_PRIME64_1;
+        h64 = XXH_ROTL64(h64, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    
+    while (p < end) {
+        h64 ^= (*p++) * XXH_PRIME64_5;
+        h64 = XXH_ROTL64(h64, 11) * XXH_PRIME64_1;
+    }
+    
+    h64 ^= h64 >> 33;
+    h64 *= XXH_PRIME64_2;
+    h64 ^= h64 >> 29;
+    h64 *= XXH_PRIME64_3;
+    h64 ^= h64 >> 32;
+    
+    return h64;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,139 @@
+/*****
+ *
+ * Description: Compressed Index Block Implementation
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#include "zblock.h"
+#include "mem.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+/****
+ *
+ * append a block of records as one gzip member
+ *
+ ****/
+
+int zblock_compress(out_buffer_t *out, const char *data, size_t len) {
+  z_stream zs;
+  size_t bound, size;
+  char *grown;
+  int ret;
+
+  if (len > UINT_MAX) {
+    fprintf(stderr, "ERR - Index block of %zu bytes is too large to compress\n", len);
+    return FAILED;
+  }
+
+  XMEMSET(&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, ZBLOCK_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    fprintf(stderr, "ERR - Unable to start index block compression\n");
+    return FAILED;
+  }
+
+  bound = deflateBound(&zs, (uLong)len);
+  if (out->len + bound > out->size) {
+    size = (out->size == 0) ? bound : out->size;
+    while (size < out->len + bound)
+      size *= 2;
+    if ((grown = (char *)XREALLOC(out->data, size)) == NULL) {
+      deflateEnd(&zs);
+      return FAILED;
+    }
+    out->data = grown;
+    out->size = size;
+  }
+
+  zs.next_in = (Bytef *)data;
+  zs.avail_in = (uInt)len;
+  zs.next_out = (Bytef *)out->data + out->len;
+  zs.avail_out = (uInt)bound;
+  ret = deflate(&zs, Z_FINISH);
+  out->len += bound - zs.avail_out;
+  deflateEnd(&zs);
+
+  if (ret != Z_STREAM_END) {
+    fprintf(stderr, "ERR - Unable to compress index block\n");
+    return FAILED;
+  }
+  return TRUE;
+}
+
+/****
+ *
+ * inflate one block, NULL if it is not a whole gzip member
+ *
+ * The member trailer holds its size, so the buffer is normally
+ * allocated once.  It is NUL terminated past out_len.
+ *
+ ****/
+
+char *zblock_inflate(const char *data, size_t len, size_t *out_len) {
+  const unsigned char *trailer = (const unsigned char *)data + len - 4;
+  size_t size, used = 0;
+  z_stream zs;
+  char *buf, *grown;
+  int ret = Z_OK;
+
+  if (len < 18 || len > UINT_MAX)
+    return NULL;
+  size = (size_t)trailer[0] | (size_t)trailer[1] << 8 | (size_t)trailer[2] << 16 | (size_t)trailer[3] << 24;
+  size++;
+
+  XMEMSET(&zs, 0, sizeof(zs));
+  if ((buf = (char *)XMALLOC(size)) == NULL)
+    return NULL;
+  if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+    XFREE(buf);
+    return NULL;
+  }
+
+  zs.next_in = (Bytef *)data;
+  zs.avail_in = (uInt)len;
+  while (ret == Z_OK) {
+    if (used + 1 >= size) {
+      if ((grown = (char *)XREALLOC(buf, size * 2)) == NULL)
+        break;
+      buf = grown;
+      size *= 2;
+    }
+    zs.next_out = (Bytef *)buf + used;
+    zs.avail_out = (uInt)(size - used - 1);
+    ret = inflate(&zs, Z_NO_FLUSH);
+    used = size - 1 - zs.avail_out;
+  }
+  inflateEnd(&zs);
+
+  /* A block is exactly one member */
+  if (ret != Z_STREAM_END || zs.avail_in != 0) {
+    XFREE(buf);
+    return NULL;
+  }
+
+  buf[used] = '\0';
+  *out_len = used;
+  return buf;
+}
+
+int zblock_is_compressed(const char *path) {
+  unsigned char magic[2];
+  FILE *fp;
+  int ret;
+
+  if ((fp = fopen(path, "r")) == NULL)
+    return FALSE;
+  ret = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && magic[0] == 0x1f && magic[1] == 0x8b;
+  fclose(fp);
+  return ret;
+}
@@ -0,0 +1,49 @@
+/*****
+ *
+ * Description: Compressed Index Block Headers
+ *
+ * Copyright (c) 2025, Ron Dilley
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ ****/
+
+#ifndef ZBLOCK_H
+#define ZBLOCK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "../include/common.h"
+#include "keydir.h"
+#include "writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A compressed text index is the address ordered records of -k cut
+ * into blocks of whole records, each block its own gzip member.  The
+ * members run back to back, so zcat still reads the index, and the
+ * .lpx key directory lists the first key of every block at the offset
+ * its member starts, so spi inflates only the blocks its terms are in.
+ */
+
+#define ZBLOCK_SIZE KEYDIR_BLOCK_SIZE   /* Record bytes gathered before a block is closed */
+#define ZBLOCK_LEVEL 1                  /* Index digits compress well even at the fastest level */
+
+/* Function prototypes */
+int zblock_compress(out_buffer_t *out, const char *data, size_t len);
+char *zblock_inflate(const char *data, size_t len, size_t *out_len);
+int zblock_is_compressed(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZBLOCK_H */